@@ -108,6 +108,11 @@ void RawImageSource::CA_correct_RT(double cared, double cablue) {
 	//temporary array to store simple interpolation of G
 	float (*Gtmp);
 	Gtmp = (float (*)) calloc ((height)*(width), sizeof *Gtmp);
+	//CA corrected R/B values of the correction pass, rawData has to stay unchanged
+	//until all tiles have read their borders. R/B sites of a row share one column parity
+	const int rbwidth=(width+1)/2;
+	float (*RawDataTmp);
+	RawDataTmp = (float (*)) malloc ((height)*rbwidth*sizeof *RawDataTmp);
 	
 	const int border=8;
 	const int border2=16;
@@ -116,16 +121,8 @@ void RawImageSource::CA_correct_RT(double cared, double cablue) {
 	//number of blocks used in the fit
 	int numblox[3]={0,0,0};
 	
-	int rrmin, rrmax, ccmin, ccmax;
 	int top, left, row, col;
-	int rr, cc, c, indx, indx1, i, j, k, m, n, dir;
-	//number of pixels in a tile contributing to the CA shift diagnostic
-	int areawt[2][3];
-	//direction of the CA shift in a tile
-	int GRBdir[2][3];
-	//offset data of the plaquette where the optical R/B data are sampled
-	int offset[2][3];
-	int	shifthfloor[3], shiftvfloor[3], shifthceil[3], shiftvceil[3];
+	int c, i, j, m, n, dir;
 	//number of tiles in the image
 	int vblsz, hblsz, vblock, hblock, vz1, hz1;
 	//int verbose=1;
@@ -134,30 +131,14 @@ void RawImageSource::CA_correct_RT(double cared, double cablue) {
 	//shifts to location of vertical and diagonal neighbors
 	const int v1=TS, v2=2*TS, /* v3=3*TS,*/ v4=4*TS;//, p1=-TS+1, p2=-2*TS+2, p3=-3*TS+3, m1=TS+1, m2=2*TS+2, m3=3*TS+3;
 	
-	float eps=1e-5, eps2=1e-10;	//tolerance to avoid dividing by zero
+	const float eps=1e-5, eps2=1e-10;	//tolerance to avoid dividing by zero
 	
-	//adaptive weights for green interpolation
-	float	wtu, wtd, wtl, wtr;
-	//local quadratic fit to shift data within a tile
-	float	coeff[2][3][3];
-	//measured CA shift parameters for a tile
-	float	CAshift[2][3];
 	//polynomial fit coefficients
 	float	polymat[3][2][256], shiftmat[3][2][16], fitparams[3][2][16];
-	//residual CA shift amount within a plaquette
-	float	shifthfrac[3], shiftvfrac[3];
 	//temporary storage for median filter
 	float	temp, p[9];
-	//temporary parameters for tile CA evaluation
-	float	gdiff, deltgrb;
-	//interpolated G at edge of plaquette
-	float	Ginthfloor, Ginthceil, Gint, RBint, gradwt;
-	//interpolated color difference at edge of plaquette
-	float	grbdiffinthfloor, grbdiffinthceil, grbdiffint, grbdiffold;
 	//data for evaluation of block CA shift variance
 	float	blockave[2][3]={{0,0,0},{0,0,0}}, blocksqave[2][3]={{0,0,0},{0,0,0}}, blockdenom[2][3]={{0,0,0},{0,0,0}}, blockvar[2][3];
-	//low and high pass 1D filters of G in vertical/horizontal directions
-	float	glpfh, glpfv;
 	
 	//max allowed CA shift
 	const float bslim = 3.99;
@@ -165,15 +146,62 @@ void RawImageSource::CA_correct_RT(double cared, double cablue) {
 	//static const float gaussg[5] = {0.171582, 0.15839, 0.124594, 0.083518, 0.0477063};//sig=2.5
 	//static const float gaussrb[3] = {0.332406, 0.241376, 0.0924212};//sig=1.25
 	
+	if((height+border2)%(TS-border2)==0) vz1=1; else vz1=0;
+    if((width+border2)%(TS-border2)==0) hz1=1; else hz1=0;
+    
+    vblsz=ceil((float)(height+border2)/(TS-border2)+2+vz1);
+    hblsz=ceil((float)(width+border2)/(TS-border2)+2+hz1);
+
+	//tiles per tile loop, and how many of them are done. The tiles finish in any order,
+	//the progress counts them and is reported by the first thread only
+	const int tileCount=((height+border+TS-border2-1)/(TS-border2))*((width+border+TS-border2-1)/(TS-border2));
+	int tilesDone=0;
+	
 	//block CA shift values and weight assigned to block
+	char		*buffer1;				// vblsz*hblsz*(3*2+1)
+	float		(*blockwt);				// vblsz*hblsz
+	float		(*blockshifts)[3][2];	// vblsz*hblsz*3*2 
+	//float blockshifts[1000][3][2]; //fixed memory allocation
+	//float blockwt[1000]; //fixed memory allocation
 	
+	buffer1 = (char *) malloc(vblsz*hblsz*(3*2+1)*sizeof(float));
+	//merror(buffer1,"CA_correct()");
+	memset(buffer1,0,vblsz*hblsz*(3*2+1)*sizeof(float));
+	// block CA shifts
+	blockwt		= (float (*))			(buffer1);
+	blockshifts	= (float (*)[3][2])		(buffer1+(vblsz*hblsz*sizeof(float)));
+	
+	const bool autoCA = (cared==0 && cablue==0);
+	
+	// The tiles run in parallel, every thread has its own tile buffers. A tile only
+	// writes its own entries of blockwt/blockshifts and the pixels of its core (the tile
+	// without the border, the cores do not overlap), so the results do not depend on the
+	// number of threads or the order of the tiles.
+	
+	// Main algorithm: Tile loop. G at the R/B sites for all of the image, and the CA
+	// diagnostic of each tile if the shifts are not set manually
+#pragma omp parallel
+{
+	int rrmin, rrmax, ccmin, ccmax;
+	int row, col;
+	int rr, cc, c, indx, indx1, j, k;
+	//number of pixels in a tile contributing to the CA shift diagnostic
+	int areawt[2][3];
+	//adaptive weights for green interpolation
+	float	wtu, wtd, wtl, wtr;
+	//local quadratic fit to shift data within a tile
+	float	coeff[2][3][3];
+	//measured CA shift parameters for a tile
+	float	CAshift[2][3];
+	//temporary parameters for tile CA evaluation
+	float	gdiff, deltgrb;
+	float	gradwt;
+	//low and high pass 1D filters of G in vertical/horizontal directions
+	float	glpfh, glpfv;
+
 	char		*buffer;			// TS*TS*16
 	//rgb data in a tile
 	float         (*rgb)[3];		// TS*TS*12
-	//color differences
-	float         (*grbdiff);		// TS*TS*4
-	//green interpolated to optical sample points for R/B
-	float         (*gshift);		// TS*TS*4
 	//high pass filter for R/B in vertical direction
 	float         (*rbhpfh);		// TS*TS*4
 	//high pass filter for R/B in horizontal direction
@@ -187,7 +215,6 @@ void RawImageSource::CA_correct_RT(double cared, double cablue) {
 	//low pass filter for color differences in vertical direction
 	float         (*grblpfv);		// TS*TS*4
 
-	
 	/* assign working space; this would not be necessary
 	 if the algorithm is part of the larger pre-interpolation processing */
 	buffer = (char *) malloc(11*sizeof(float)*TS*TS);
@@ -196,8 +223,6 @@ void RawImageSource::CA_correct_RT(double cared, double cablue) {
 	
 	// rgb array
 	rgb         = (float (*)[3])		buffer;
-	grbdiff		= (float (*))			(buffer +	3*sizeof(float)*TS*TS);
-	gshift		= (float (*))			(buffer +	4*sizeof(float)*TS*TS);
 	rbhpfh		= (float (*))			(buffer +	5*sizeof(float)*TS*TS);
 	rbhpfv		= (float (*))			(buffer +	6*sizeof(float)*TS*TS);
 	rblpfh		= (float (*))			(buffer +	7*sizeof(float)*TS*TS);
@@ -205,41 +230,19 @@ void RawImageSource::CA_correct_RT(double cared, double cablue) {
 	grblpfh		= (float (*))			(buffer +	9*sizeof(float)*TS*TS);
 	grblpfv		= (float (*))			(buffer +	10*sizeof(float)*TS*TS);
 
-	
-	if((height+border2)%(TS-border2)==0) vz1=1; else vz1=0;
-    if((width+border2)%(TS-border2)==0) hz1=1; else hz1=0;
-    
-    vblsz=ceil((float)(height+border2)/(TS-border2)+2+vz1);
-    hblsz=ceil((float)(width+border2)/(TS-border2)+2+hz1);
-	
-	//block CA shift values and weight assigned to block
-	char		*buffer1;				// vblsz*hblsz*(3*2+1)
-	float		(*blockwt);				// vblsz*hblsz
-	float		(*blockshifts)[3][2];	// vblsz*hblsz*3*2 
-	//float blockshifts[1000][3][2]; //fixed memory allocation
-	//float blockwt[1000]; //fixed memory allocation
-	
-	buffer1 = (char *) malloc(vblsz*hblsz*(3*2+1)*sizeof(float));
-	//merror(buffer1,"CA_correct()");
-	memset(buffer1,0,vblsz*hblsz*(3*2+1)*sizeof(float));
-	// block CA shifts
-	blockwt		= (float (*))			(buffer1);
-	blockshifts	= (float (*)[3][2])		(buffer1+(vblsz*hblsz*sizeof(float)));
-		
-	int vctr=0, hctr=0;
-	
-	if (cared==0 && cablue==0) {
-	// Main algorithm: Tile loop
-	//#pragma omp parallel for shared(image,height,width) private(top,left,indx,indx1) schedule(dynamic)
-	for (top=-border, vblock=1; top < height; top += TS-border2, vblock++) {
-		hctr=0;
-		vctr++;
-		for (left=-border, hblock=1; left < width; left += TS-border2, hblock++) {
-			hctr++;
+	// both tile loops together give enough tiles for many cores
+	#pragma omp for schedule(dynamic) collapse(2)
+	for (int top=-border; top < height; top += TS-border2)
+		for (int left=-border; left < width; left += TS-border2) {
+			int vblock = (top+border)/(TS-border2)+1;
+			int hblock = (left+border)/(TS-border2)+1;
 			int bottom = MIN( top+TS,height+border);
 			int right  = MIN(left+TS, width+border);
 			int rr1 = bottom - top;
 			int cc1 = right - left;
+			// the edges of a tile read a few values the tile does not fill, these must
+			// not depend on the tile the thread did before
+			memset(rgb,0,3*sizeof(float)*TS*TS);
 			//t1_init = clock();
 			// rgb from input CFA data
 			// rgb values should be floating point number between 0 and 1 
@@ -353,10 +356,14 @@ void RawImageSource::CA_correct_RT(double cared, double cablue) {
 						//store in rgb array the interpolated G value at R/B grid points using directional weighted average
 						rgb[indx][1]=(wtu*rgb[indx-v1][1]+wtd*rgb[indx+v1][1]+wtl*rgb[indx-1][1]+wtr*rgb[indx+1][1])/(wtu+wtd+wtl+wtr);
 					}
-					if (row>-1 && row<height && col>-1 && col<width)
+					//the core of the tile only, the cores of the tiles do not overlap
+					if (rr>=border && rr<rr1-border && cc>=border && cc<cc1-border && row<height && col<width)
 						Gtmp[row*width + col] = rgb[indx][1];
 				}
 			
+			if (autoCA==false)
+				continue;
+			
 			//%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
 			
 			for (rr=4; rr < rr1-4; rr++)
@@ -387,6 +394,8 @@ void RawImageSource::CA_correct_RT(double cared, double cablue) {
 					grblpfh[indx] = glpfh + 0.25*(2*rgb[indx][c]+rgb[indx+2][c]+rgb[indx-2][c]);
 				}
 			
+			for (c=0; c<3; c+=2) {areawt[0][c]=areawt[1][c]=0;}
+			
 			// along line segments, find the point along each segment that minimizes the color variance
 			// averaged over the tile; evaluate for up/down and left/right away from R/B grid point 
 			for (rr=8; rr < rr1-8; rr++)
@@ -428,72 +437,9 @@ void RawImageSource::CA_correct_RT(double cared, double cablue) {
 				}			
 			
 			//%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
-			/*
-			for (rr=4; rr < rr1-4; rr++)
-				for (cc=4+(FC(rr,2)&1), indx=rr*TS+cc, c = FC(rr,cc); cc < cc1-4; cc+=2, indx+=2) {
-					
-
-					rbhpfv[indx] = SQR(fabs((rgb[indx][1]-rgb[indx][c])-(rgb[indx+v4][1]-rgb[indx+v4][c])) +
-										fabs((rgb[indx-v4][1]-rgb[indx-v4][c])-(rgb[indx][1]-rgb[indx][c])) -
-										fabs((rgb[indx-v4][1]-rgb[indx-v4][c])-(rgb[indx+v4][1]-rgb[indx+v4][c])));
-					rbhpfh[indx] = SQR(fabs((rgb[indx][1]-rgb[indx][c])-(rgb[indx+4][1]-rgb[indx+4][c])) +
-										fabs((rgb[indx-4][1]-rgb[indx-4][c])-(rgb[indx][1]-rgb[indx][c])) -
-										fabs((rgb[indx-4][1]-rgb[indx-4][c])-(rgb[indx+4][1]-rgb[indx+4][c])));
-					
-					
-					glpfv = 0.25*(2*rgb[indx][1]+rgb[indx+v2][1]+rgb[indx-v2][1]);
-					glpfh = 0.25*(2*rgb[indx][1]+rgb[indx+2][1]+rgb[indx-2][1]);
-					rblpfv[indx] = eps+fabs(glpfv - 0.25*(2*rgb[indx][c]+rgb[indx+v2][c]+rgb[indx-v2][c]));
-					rblpfh[indx] = eps+fabs(glpfh - 0.25*(2*rgb[indx][c]+rgb[indx+2][c]+rgb[indx-2][c]));
-					grblpfv[indx] = glpfv + 0.25*(2*rgb[indx][c]+rgb[indx+v2][c]+rgb[indx-v2][c]);
-					grblpfh[indx] = glpfh + 0.25*(2*rgb[indx][c]+rgb[indx+2][c]+rgb[indx-2][c]);
-				}
-			
-			for (c=0;c<3;c++) {areawt[0][c]=areawt[1][c]=0;}
-			
-			// along line segments, find the point along each segment that minimizes the color variance
-			// averaged over the tile; evaluate for up/down and left/right away from R/B grid point 
-			for (rr=rrmin+8; rr < rrmax-8; rr++)
-				for (cc=ccmin+8+(FC(rr,2)&1), indx=rr*TS+cc, c = FC(rr,cc); cc < ccmax-8; cc+=2, indx+=2) {
-					
-					if (rgb[indx][c]>0.8*clip_pt || Gtmp[indx]>0.8*clip_pt) continue;
-
-					//in linear interpolation, color differences are a quadratic function of interpolation position;
-					//solve for the interpolation position that minimizes color difference variance over the tile
-					
-					//vertical
-					gdiff=0.3125*(rgb[indx+TS][1]-rgb[indx-TS][1])+0.09375*(rgb[indx+TS+1][1]-rgb[indx-TS+1][1]+rgb[indx+TS-1][1]-rgb[indx-TS-1][1]);
-					deltgrb=(rgb[indx][c]-rgb[indx][1])-0.5*((rgb[indx-v4][c]-rgb[indx-v4][1])+(rgb[indx+v4][c]-rgb[indx+v4][1]));
-					
-					gradwt=fabs(0.25*rbhpfv[indx]+0.125*(rbhpfv[indx+2]+rbhpfv[indx-2]) );// *(grblpfv[indx-v2]+grblpfv[indx+v2])/(eps+0.1*grblpfv[indx-v2]+rblpfv[indx-v2]+0.1*grblpfv[indx+v2]+rblpfv[indx+v2]);
-					if (gradwt>eps) {
-					coeff[0][0][c] += gradwt*deltgrb*deltgrb;
-					coeff[0][1][c] += gradwt*gdiff*deltgrb;
-					coeff[0][2][c] += gradwt*gdiff*gdiff;
-					areawt[0][c]++;
-					}
-					
-					//horizontal
-					gdiff=0.3125*(rgb[indx+1][1]-rgb[indx-1][1])+0.09375*(rgb[indx+1+TS][1]-rgb[indx-1+TS][1]+rgb[indx+1-TS][1]-rgb[indx-1-TS][1]);
-					deltgrb=(rgb[indx][c]-rgb[indx][1])-0.5*((rgb[indx-4][c]-rgb[indx-4][1])+(rgb[indx+4][c]-rgb[indx+4][1]));
-					
-					gradwt=fabs(0.25*rbhpfh[indx]+0.125*(rbhpfh[indx+v2]+rbhpfh[indx-v2]) );// *(grblpfh[indx-2]+grblpfh[indx+2])/(eps+0.1*grblpfh[indx-2]+rblpfh[indx-2]+0.1*grblpfh[indx+2]+rblpfh[indx+2]);
-					if (gradwt>eps) {
-					coeff[1][0][c] += gradwt*deltgrb*deltgrb;
-					coeff[1][1][c] += gradwt*gdiff*deltgrb;
-					coeff[1][2][c] += gradwt*gdiff*gdiff;
-					areawt[1][c]++;
-					}
-					
-					//	In Mathematica,
-					//  f[x_]=Expand[Total[Flatten[
-					//  ((1-x) RotateLeft[Gint,shift1]+x RotateLeft[Gint,shift2]-cfapad)^2[[dv;;-1;;2,dh;;-1;;2]]]]];
-					//  extremum = -.5Coefficient[f[x],x]/Coefficient[f[x],x^2]	
-				}*/
 			for (c=0; c<3; c+=2){
 				for (j=0; j<2; j++) {// vert/hor
 					//printf("hblock %d vblock %d j %d c %d areawt %d \n",hblock,vblock,j,c,areawt[j][c]);
-					//printf("hblock %d vblock %d j %d c %d areawt %d ",hblock,vblock,j,c,areawt[j][c]);
 
 					if (areawt[j][c]>0 && coeff[j][2][c]>eps2) {
 						CAshift[j][c]=coeff[j][1][c]/coeff[j][2][c];
@@ -504,20 +450,8 @@ void RawImageSource::CA_correct_RT(double cared, double cablue) {
 					}
 					//if (c==0 && j==0) printf("vblock= %d hblock= %d denom= %f areawt= %d \n",vblock,hblock,coeff[j][2][c],areawt[j][c]);
 
-					//printf("%f  \n",CAshift[j][c]);
-
 					//data structure = CAshift[vert/hor][color]
 					//j=0=vert, 1=hor
-					
-						
-					offset[j][c]=floor(CAshift[j][c]);
-					//offset gives NW corner of square containing the min; j=0=vert, 1=hor
-					
-					if (fabs(CAshift[j][c])<2.0) {
-						blockave[j][c] += CAshift[j][c];
-						blocksqave[j][c] += SQR(CAshift[j][c]);
-						blockdenom[j][c] += 1;
-					}
 				}//vert/hor
 			}//color
 			
@@ -535,19 +469,45 @@ void RawImageSource::CA_correct_RT(double cared, double cablue) {
 				//if (c==0) printf("vblock= %d hblock= %d blockshiftsmedian= %f \n",vblock,hblock,blockshifts[(vblock)*hblsz+hblock][c][0]);
 			}
 
-			if(plistener) plistener->setProgress(0.5*fabs((float)top/height));
+			int done;
+			#pragma omp atomic capture
+			done=++tilesDone;
+#ifdef _OPENMP
+			if(plistener && omp_get_thread_num()==0)
+#else
+			if(plistener)
+#endif
+				plistener->setProgress(0.5*done/tileCount);
 
 		}
-	}
+	
+	free(buffer);
+}
 	//end of diagnostic pass
 	
+	if (autoCA) {
+	// the spread of the tile shifts, summed up in tile order
+	for (top=-border, vblock=1; top < height; top += TS-border2, vblock++)
+		for (left=-border, hblock=1; left < width; left += TS-border2, hblock++)
+			for (c=0; c<3; c+=2)
+				for (j=0; j<2; j++) {// vert/hor
+					float CAshift = blockshifts[(vblock)*hblsz+hblock][c][j];
+					if (fabs(CAshift)<2.0) {
+						blockave[j][c] += CAshift;
+						blocksqave[j][c] += SQR(CAshift);
+						blockdenom[j][c] += 1;
+					}
+				}
+	
 	for (j=0; j<2; j++)
 		for (c=0; c<3; c+=2) {
 			if (blockdenom[j][c]) {
 				blockvar[j][c] = blocksqave[j][c]/blockdenom[j][c]-SQR(blockave[j][c]/blockdenom[j][c]);
 			} else {
 				printf ("blockdenom vanishes \n");
-                                free(buffer1);
+				free(Gtmp);
+				free(RawDataTmp);
+				free(buffer1);
 				return;
 			}
 		}
@@ -635,7 +595,9 @@ void RawImageSource::CA_correct_RT(double cared, double cablue) {
 		polyord=2; numpar=4;
 		if (numblox[1]< 10) {
 			printf ("numblox = %d \n",numblox[1]);
-                        free(buffer1);
+			free(Gtmp);
+			free(RawDataTmp);
+			free(buffer1);
 			return;
 		}
 	}
@@ -646,7 +608,9 @@ void RawImageSource::CA_correct_RT(double cared, double cablue) {
 			res = LinEqSolve(numpar, polymat[c][dir], shiftmat[c][dir], fitparams[c][dir]);
 			if (res) {
 				printf ("CA correction pass failed -- can't solve linear equations for color %d direction %d...\n",c,dir);
-                                free(buffer1);
+				free(Gtmp);
+				free(RawDataTmp);
+				free(buffer1);
 				return;
 			}
 		}
@@ -655,14 +619,53 @@ void RawImageSource::CA_correct_RT(double cared, double cablue) {
 	//end of initialization for CA correction pass
 	//only executed if cared and cablue are zero
 	
-	// Main algorithm: Tile loop
-	//#pragma omp parallel for shared(image,height,width) private(top,left,indx,indx1) schedule(dynamic)
-	for (top=-border, vblock=1; top < height; top += TS-border2, vblock++)
-		for (left=-border, hblock=1; left < width; left += TS-border2, hblock++) {
+	// Main algorithm: Tile loop. The tiles read rawData and Gtmp only, the corrected
+	// R/B values go to RawDataTmp and are copied back after the loop
+	tilesDone=0;
+#pragma omp parallel
+{
+	int rrmin, rrmax, ccmin, ccmax;
+	int row, col;
+	int rr, cc, c, indx, i, j;
+	//direction of the CA shift in a tile
+	int GRBdir[2][3];
+	int	shifthfloor[3], shiftvfloor[3], shifthceil[3], shiftvceil[3];
+	//residual CA shift amount within a plaquette
+	float	shifthfrac[3], shiftvfrac[3];
+	//gradient weights
+	float	p[4];
+	//interpolated G at edge of plaquette
+	float	Ginthfloor, Ginthceil, Gint, RBint;
+	//interpolated color difference at edge of plaquette
+	float	grbdiffinthfloor, grbdiffinthceil, grbdiffint, grbdiffold;
+
+	char		*buffer;			// TS*TS*20
+	//rgb data in a tile
+	float         (*rgb)[3];		// TS*TS*12
+	//color differences
+	float         (*grbdiff);		// TS*TS*4
+	//green interpolated to optical sample points for R/B
+	float         (*gshift);		// TS*TS*4
+
+	buffer = (char *) malloc(5*sizeof(float)*TS*TS);
+	memset(buffer,0,5*sizeof(float)*TS*TS);
+
+	rgb         = (float (*)[3])		buffer;
+	grbdiff		= (float (*))			(buffer +	3*sizeof(float)*TS*TS);
+	gshift		= (float (*))			(buffer +	4*sizeof(float)*TS*TS);
+
+	#pragma omp for schedule(dynamic) collapse(2)
+	for (int top=-border; top < height; top += TS-border2)
+		for (int left=-border; left < width; left += TS-border2) {
+			int vblock = (top+border)/(TS-border2)+1;
+			int hblock = (left+border)/(TS-border2)+1;
 			int bottom = MIN( top+TS,height+border);
 			int right  = MIN(left+TS, width+border);
 			int rr1 = bottom - top;
 			int cc1 = right - left;
+			// the edges of a tile read a few values the tile does not fill, these must
+			// not depend on the tile the thread did before
+			memset(rgb,0,3*sizeof(float)*TS*TS);
 			//t1_init = clock();
 			// rgb from input CFA data
 			// rgb values should be floating point number between 0 and 1 
@@ -678,12 +681,11 @@ void RawImageSource::CA_correct_RT(double cared, double cablue) {
 					col = cc+left;
 					c = FC(rr,cc);
 					indx=row*width+col;
-					indx1=rr*TS+cc;	
-					//rgb[indx1][c] = image[indx][c]/65535.0f;
-					rgb[indx1][c] = (rawData[row][col])/65535.0f;
-					//rgb[indx1][c] = image[indx][c]/65535.0f;//for dcraw implementation
+					//rgb[rr*TS+cc][c] = image[indx][c]/65535.0f;
+					rgb[rr*TS+cc][c] = (rawData[row][col])/65535.0f;
+					//rgb[rr*TS+cc][c] = image[indx][c]/65535.0f;//for dcraw implementation
 
-					if ((c&1)==0) rgb[indx1][1] = Gtmp[indx];
+					if ((c&1)==0) rgb[rr*TS+cc][1] = Gtmp[indx];
 				}
 			// %%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
 			//fill borders
@@ -771,24 +773,7 @@ void RawImageSource::CA_correct_RT(double cared, double cablue) {
 			
 			if (cared || cablue) {
 				//manual CA correction; use red/blue slider values to set CA shift parameters
-				for (rr=3; rr < rr1-3; rr++)
-					for (row=rr+top, cc=3, indx=rr*TS+cc; cc < cc1-3; cc++, indx++) {
-						col = cc+left;
-						c = FC(rr,cc);
-						
-						if (c!=1) {
-							//compute directional weights using image gradients
-							wtu=1/SQR(eps+fabs(rgb[(rr+1)*TS+cc][1]-rgb[(rr-1)*TS+cc][1])+fabs(rgb[(rr)*TS+cc][c]-rgb[(rr-2)*TS+cc][c])+fabs(rgb[(rr-1)*TS+cc][1]-rgb[(rr-3)*TS+cc][1]));
-							wtd=1/SQR(eps+fabs(rgb[(rr-1)*TS+cc][1]-rgb[(rr+1)*TS+cc][1])+fabs(rgb[(rr)*TS+cc][c]-rgb[(rr+2)*TS+cc][c])+fabs(rgb[(rr+1)*TS+cc][1]-rgb[(rr+3)*TS+cc][1]));
-							wtl=1/SQR(eps+fabs(rgb[(rr)*TS+cc+1][1]-rgb[(rr)*TS+cc-1][1])+fabs(rgb[(rr)*TS+cc][c]-rgb[(rr)*TS+cc-2][c])+fabs(rgb[(rr)*TS+cc-1][1]-rgb[(rr)*TS+cc-3][1]));
-							wtr=1/SQR(eps+fabs(rgb[(rr)*TS+cc-1][1]-rgb[(rr)*TS+cc+1][1])+fabs(rgb[(rr)*TS+cc][c]-rgb[(rr)*TS+cc+2][c])+fabs(rgb[(rr)*TS+cc+1][1]-rgb[(rr)*TS+cc+3][1]));
-							
-							//store in rgb array the interpolated G value at R/B grid points using directional weighted average
-							rgb[indx][1]=(wtu*rgb[indx-v1][1]+wtd*rgb[indx+v1][1]+wtl*rgb[indx-1][1]+wtr*rgb[indx+1][1])/(wtu+wtd+wtl+wtr);
-						}
-						if (row>-1 && row<height && col>-1 && col<width)
-							Gtmp[row*width + col] = rgb[indx][1];
-					}
+				//(G at the R/B sites comes from Gtmp, it is filled by the first tile loop)
 				float hfrac = -((float)(hblock-0.5)/(hblsz-2) - 0.5);
 				float vfrac = -((float)(vblock-0.5)/(vblsz-2) - 0.5)*height/width;
 				blockshifts[(vblock)*hblsz+hblock][0][0] = 2*vfrac*cared;
@@ -899,25 +884,41 @@ void RawImageSource::CA_correct_RT(double cared, double cablue) {
 					}
 				}
 			
-			// copy CA corrected results back to image matrix
+			// copy CA corrected results to the temporary R/B plane
 			for (rr=border; rr < rr1-border; rr++)
 				for (row=rr+top, cc=border+(FC(rr,2)&1); cc < cc1-border; cc+=2) {
 					col = cc + left;
-					indx = row*width + col;
 					c = FC(row,col);
 					 
-					rawData[row][col] = 65535.0f*rgb[(rr)*TS+cc][c] + 0.5f;
+					RawDataTmp[row*rbwidth+(col>>1)] = 65535.0f*rgb[(rr)*TS+cc][c] + 0.5f;
 					//image[indx][c] = CLIP((int)(65535.0*rgb[(rr)*TS+cc][c] + 0.5));//for dcraw implementation
 
 				} 
 			
-			if(plistener) plistener->setProgress(0.5+0.5*fabs((float)top/height));
+			int done;
+			#pragma omp atomic capture
+			done=++tilesDone;
+#ifdef _OPENMP
+			if(plistener && omp_get_thread_num()==0)
+#else
+			if(plistener)
+#endif
+				plistener->setProgress(0.5+0.5*done/tileCount);
 
 		}
+
+	free(buffer);
+
+	// all tiles have read their borders (barrier of the tile loop), now rawData can take the results
+	#pragma omp for
+	for (row=0; row < height; row++)
+		for (col=(FC(row,2)&1); col < width; col+=2)
+			rawData[row][col] = RawDataTmp[row*rbwidth+(col>>1)];
+}
 	
 	// clean up
-	free(buffer);
 	free(Gtmp);
+	free(RawDataTmp);
 	free(buffer1);
 	
 
@@ -34,7 +34,8 @@ float *SparseConjugateGradient(void Ax(float *Product, float *x, void *Pass), fl
 		s = new float[n];
 		Preconditioner(s, r, Pass);
 	}
-	for(i = 0; i != n; i++) rs += r[i]*s[i];
+	#pragma omp parallel for reduction(+:rs)
+	for(i = 0; i < n; i++) rs += r[i]*s[i];
 
 	//Search direction d.
 	float *d = new float[n];
@@ -50,14 +51,16 @@ float *SparseConjugateGradient(void Ax(float *Product, float *x, void *Pass), fl
 		//Get step size alpha, store ax while at it.
 		float ab = 0.0f;
 		Ax(ax, d, Pass);
-		for(i = 0; i != n; i++) ab += d[i]*ax[i];
+		#pragma omp parallel for reduction(+:ab)
+		for(i = 0; i < n; i++) ab += d[i]*ax[i];
 
 		if(ab == 0.0f) break;	//So unlikely. It means perfectly converged or singular, stop either way.
 		ab = rs/ab;
 
 		//Update x and r with this step size.
 		float rms = 0.0;
-		for(i = 0; i != n; i++){
+		#pragma omp parallel for reduction(+:rms)
+		for(i = 0; i < n; i++){
 			x[i] += ab*d[i];
 			r[i] -= ab*ax[i];	//"Fast recursive formula", use explicit r = b - Ax occasionally?
 			rms += r[i]*r[i];
@@ -72,11 +75,13 @@ float *SparseConjugateGradient(void Ax(float *Product, float *x, void *Pass), fl
 		//Get beta.
 		ab = rs;
 		rs = 0.0f;
-		for(i = 0; i != n; i++) rs += r[i]*s[i];
+		#pragma omp parallel for reduction(+:rs)
+		for(i = 0; i < n; i++) rs += r[i]*s[i];
 		ab = rs/ab;
 
 		//Update search direction p.
-		for(i = 0; i != n; i++) d[i] = s[i] + ab*d[i];
+		#pragma omp parallel for
+		for(i = 0; i < n; i++) d[i] = s[i] + ab*d[i];
 	}
 	if(iterate == MaximumIterates)
 		if(iterate != n && RMSResidual != 0.0f)
@@ -157,22 +162,31 @@ bool MultiDiagonalSymmetricMatrix::LazySetEntry(float value, unsigned int row, u
 }
 
 void MultiDiagonalSymmetricMatrix::VectorProduct(float *Product, float *x){
-	//Initialize to zero.
-	memset(Product, 0, n*sizeof(float));
-
-	//Loop over the stored diagonals.
-	for(unsigned int i = 0; i != m; i++){
-		unsigned int sr = StartRows[i];
-		float *a = Diagonals[i];	//One fewer dereference.
-		unsigned int j, l = DiagonalLength(sr);
-
-		if(sr == 0)
-			for(j = 0; j != l; j++)
-				Product[j] += a[j]*x[j];		//Separate, fairly simple treatment for the main diagonal.
-		else
-			for(j = 0; j != l; j++)
-				Product[j + sr] += a[j]*x[j],	//Contribution from lower...
-				Product[j] += a[j]*x[j + sr];	//...and upper triangle.
+	//Blocks of the product are independent: each gathers its contributions from all diagonals while it's in the cache, and the blocks
+	//go to the threads. The inner loops are plain enough for the compiler to vectorize. Same sums in the same order as a row at a time.
+	const int BlockSize = 4096;
+	#pragma omp parallel for
+	for(int b = 0; b < (int)n; b += BlockSize){
+		int e = min(b + BlockSize, (int)n), j;
+
+		//Initialize to zero.
+		memset(&Product[b], 0, (e - b)*sizeof(float));
+
+		//Loop over the stored diagonals.
+		for(unsigned int i = 0; i != m; i++){
+			int sr = StartRows[i];
+			float *a = Diagonals[i];	//One fewer dereference.
+
+			if(sr == 0)
+				for(j = b; j < e; j++)
+					Product[j] += a[j]*x[j];		//Separate, fairly simple treatment for the main diagonal.
+			else{
+				for(j = b > sr ? b : sr; j < e; j++)
+					Product[j] += a[j - sr]*x[j - sr];	//Contribution from lower...
+				for(j = b; j < min(e, (int)n - sr); j++)
+					Product[j] += a[j]*x[j + sr];		//...and upper triangle.
+			}
+		}
 	}
 }
 
@@ -312,19 +326,262 @@ void MultiDiagonalSymmetricMatrix::CholeskyBackSolve(float *x, float *b){
 
 
 
-EdgePreservingDecomposition::EdgePreservingDecomposition(unsigned int width, unsigned int height){
+MultigridPreconditioner::MultigridPreconditioner(unsigned int width, unsigned int height){
+	//Count the levels. Coarsen while both sides are longer than 16, no point in going further.
+	unsigned int w = width, h = height;
+	for(NumberOfLevels = 1; NumberOfLevels != 16 && w > 16 && h > 16; NumberOfLevels++)
+		w = (w + 1)/2,
+		h = (h + 1)/2;
+
+	Levels = new Level[NumberOfLevels];
+	memset(Levels, 0, sizeof(Level)*NumberOfLevels);
+	w = width, h = height;
+	for(unsigned int i = 0; i != NumberOfLevels; i++){
+		Level &l = Levels[i];
+		l.w = w;
+		l.h = h;
+		l.n = w*h;
+		l.r = new float[l.n];
+		if(i > 0){
+			//Coarse nodes are the fine nodes of even x and y.
+			l.A = new MultiDiagonalSymmetricMatrix(l.n, 5);
+			l.A->CreateDiagonal(0, 0);
+			l.A->CreateDiagonal(1, 1);
+			l.A->CreateDiagonal(2, w - 1);
+			l.A->CreateDiagonal(3, w);
+			l.A->CreateDiagonal(4, w + 1);
+			l.x = new float[l.n];
+			l.b = new float[l.n];
+			l.t = new float[Levels[i - 1].h*w];
+		}
+		w = (w + 1)/2;
+		h = (h + 1)/2;
+	}
+}
+
+MultigridPreconditioner::~MultigridPreconditioner(){
+	for(unsigned int i = 0; i != NumberOfLevels; i++){
+		if(i > 0){
+			delete Levels[i].A;
+			delete[] Levels[i].x;
+			delete[] Levels[i].b;
+			delete[] Levels[i].t;
+		}
+		delete[] Levels[i].r;
+	}
+	delete[] Levels;
+}
+
+/* One Gauss-Seidel update of x at pixel i, that is x[i] = (b[i] - sum of the off diagonal row i times x)/diagonal. Checked
+is for pixels on the border of the grid, where some of the neighbors are outside of the vectors. Their entries are zero (the matrices
+leave the couplings across the edge of the grid empty), so it's enough to keep the indices in range. */
+static inline void GaussSeidelPixel(float **d, float *x, float *b, int i, int w, int n, bool Checked){
+	float s = b[i];
+	if(!Checked)
+		s -= d[1][i - 1]*x[i - 1] + d[1][i]*x[i + 1] +
+			d[2][i - w + 1]*x[i - w + 1] + d[2][i]*x[i + w - 1] +
+			d[3][i - w]*x[i - w] + d[3][i]*x[i + w] +
+			d[4][i - w - 1]*x[i - w - 1] + d[4][i]*x[i + w + 1];
+	else{
+		int sr[4] = {1, w - 1, w, w + 1};
+		for(int k = 0; k != 4; k++){
+			if(i >= sr[k]) s -= d[k + 1][i - sr[k]]*x[i - sr[k]];
+			if(i + sr[k] < n) s -= d[k + 1][i]*x[i + sr[k]];
+		}
+	}
+	x[i] = s/d[0][i];
+}
+
+void MultigridPreconditioner::Smooth(Level &l, bool Forward){
+	float **d = l.A->Diagonals;
+	int w = l.w, h = l.h, n = l.n;
+
+	//Four colors, by parity of x and y. Within a color no pixel touches another, so its rows can go to the threads.
+	for(int k = 0; k != 4; k++){
+		int Color = Forward ? k : 3 - k;
+		int cx = Color & 1, cy = Color >> 1;
+
+		#pragma omp parallel for
+		for(int y = cy; y < h; y += 2){
+			int i = w*y;
+			bool Border = y == 0 || y == h - 1;
+			for(int x = cx; x < w; x += 2)
+				GaussSeidelPixel(d, l.x, l.b, i + x, w, n, Border || x == 0 || x == w - 1);
+		}
+	}
+}
+
+/* Bilinear interpolation from the coarse to the fine grid, along one axis: the fine node 2X is coarse node X, odd fine nodes are
+the mean of the coarse nodes to both sides. If the fine grid has an even number of nodes, the last one only has a coarse node to
+its left and takes it as it is. Restriction is the transpose, so that the V-cycle is symmetric. */
+static inline float Interpolate(float *Coarse, int Stride, int f, int CoarseLength){
+	if((f & 1) == 0) return Coarse[Stride*(f >> 1)];
+	int c = f >> 1;
+	if(c + 1 == CoarseLength) return Coarse[Stride*c];
+	return 0.5f*(Coarse[Stride*c] + Coarse[Stride*(c + 1)]);
+}
+
+static inline float Restrict(float *Fine, int Stride, int c, int FineLength, int CoarseLength){
+	float s = Fine[Stride*2*c];
+	if(c > 0) s += 0.5f*Fine[Stride*(2*c - 1)];
+	if(2*c + 1 < FineLength) s += (c + 1 == CoarseLength ? 1.0f : 0.5f)*Fine[Stride*(2*c + 1)];
+	return s;
+}
+
+//Weight of coarse node c in the interpolation to fine node f, along one axis. Same as Interpolate.
+static inline float InterpolationWeight(int f, int c, int FineLength, int CoarseLength){
+	int d = f - 2*c;
+	if(d == 0) return 1.0f;
+	if(d == -1) return 0.5f;
+	if(d == 1 && f < FineLength) return c + 1 == CoarseLength ? 1.0f : 0.5f;
+	return 0.0f;
+}
+
+//Row i of a 9 point matrix as a 3 x 3 stencil, [1 + oy][1 + ox] is the entry of column i + ox + w*oy. Outside of the vectors it's zero.
+static inline void Stencil(float **d, int w, int n, int i, float s[3][3]){
+	s[1][1] = d[0][i];
+	s[1][0] = i >= 1         ? d[1][i - 1]     : 0.0f;
+	s[0][2] = i >= w - 1     ? d[2][i - w + 1] : 0.0f;
+	s[0][1] = i >= w         ? d[3][i - w]     : 0.0f;
+	s[0][0] = i >= w + 1     ? d[4][i - w - 1] : 0.0f;
+	s[1][2] = i + 1 < n      ? d[1][i]         : 0.0f;
+	s[2][0] = i + w - 1 < n  ? d[2][i]         : 0.0f;
+	s[2][1] = i + w < n      ? d[3][i]         : 0.0f;
+	s[2][2] = i + w + 1 < n  ? d[4][i]         : 0.0f;
+}
+
+void MultigridPreconditioner::Setup(MultiDiagonalSymmetricMatrix *A){
+	Levels[0].A = A;
+
+	for(unsigned int Depth = 1; Depth != NumberOfLevels; Depth++){
+		Level &f = Levels[Depth - 1], &c = Levels[Depth];
+		float **fd = f.A->Diagonals, **cd = c.A->Diagonals;
+		int fw = f.w, fh = f.h, fn = f.n, cw = c.w, ch = c.h;
+
+		//Row I of R A P, one coarse pixel at a time: q = A P e_I on the 5 x 5 fine pixels around it, then the lower triangle entries of
+		//row I are the interpolation weights of the coarse neighbors J dotted with q. Every entry belongs to one row, so rows go parallel.
+		//Couplings across the edge of the grid are zero in the matrices, so the stencils need no care there.
+		#pragma omp parallel for
+		for(int Y = 0; Y < ch; Y++){
+			//Interpolation weights of coarse rows Y - 1, Y (and columns X - 1, X, X + 1) at fine offsets -2 to 2 from 2Y (2X).
+			float wy[2][5], wx[3][5];
+			for(int k = 0; k != 2; k++)
+				for(int d = 0; d != 5; d++)
+					wy[k][d] = Y + k - 1 >= 0 && 2*Y + d - 2 >= 0 && 2*Y + d - 2 < fh ? InterpolationWeight(2*Y + d - 2, Y + k - 1, fh, ch) : 0.0f;
+
+			for(int X = 0; X < cw; X++){
+				for(int k = 0; k != 3; k++)
+					for(int d = 0; d != 5; d++)
+						wx[k][d] = X + k - 1 >= 0 && X + k - 1 < cw && 2*X + d - 2 >= 0 && 2*X + d - 2 < fw ? InterpolationWeight(2*X + d - 2, X + k - 1, fw, cw) : 0.0f;
+
+				float q[5][5];
+				memset(q, 0, sizeof(q));
+				for(int dy = 1; dy != 4; dy++){
+					if(wy[1][dy] == 0.0f) continue;
+					for(int dx = 1; dx != 4; dx++){
+						float p = wy[1][dy]*wx[1][dx];
+						if(p == 0.0f) continue;
+
+						float s[3][3];
+						Stencil(fd, fw, fn, 2*X + dx - 2 + fw*(2*Y + dy - 2), s);
+						for(int oy = 0; oy != 3; oy++)
+							for(int ox = 0; ox != 3; ox++)
+								q[dy + oy - 1][dx + ox - 1] += p*s[oy][ox];
+					}
+				}
+
+				//Neighbors on the lower triangle, in the order of the diagonals: itself, left, above right, above, above left.
+				static const int Neighbors[5][2] = {{0, 0}, {-1, 0}, {1, -1}, {0, -1}, {-1, -1}};
+				int I = X + cw*Y;
+				for(int k = 0; k != 5; k++){
+					int JX = X + Neighbors[k][0], JY = Y + Neighbors[k][1];
+					if(JX < 0 || JX >= cw || JY < 0) continue;
+
+					float *py = wy[Neighbors[k][1] + 1], *px = wx[Neighbors[k][0] + 1], v = 0.0f;
+					for(int dy = 0; dy != 5; dy++)
+						for(int dx = 0; dx != 5; dx++)
+							v += py[dy]*px[dx]*q[dy][dx];
+					cd[k][k == 0 ? I : JX + cw*JY] = v;
+				}
+			}
+		}
+	}
+}
+
+void MultigridPreconditioner::Cycle(unsigned int Depth){
+	Level &l = Levels[Depth];
+	memset(l.x, 0, l.n*sizeof(float));
+
+	//Coarsest level, a few symmetric sweeps. It's small, exactness wouldn't pay.
+	if(Depth == NumberOfLevels - 1){
+		for(unsigned int i = 0; i != 4; i++)
+			Smooth(l, true),
+			Smooth(l, false);
+		return;
+	}
+
+	//Presmooth, and restrict the residual to the coarser level.
+	Smooth(l, true);
+	l.A->VectorProduct(l.r, l.x);
+
+	Level &c = Levels[Depth + 1];
+	int fw = l.w, fh = l.h, cw = c.w, ch = c.h;
+	#pragma omp parallel for
+	for(int y = 0; y < fh; y++){
+		float *r = &l.r[fw*y], *b = &l.b[fw*y];
+		for(int x = 0; x < fw; x++) r[x] = b[x] - r[x];
+		for(int x = 0; x < cw; x++) c.t[cw*y + x] = Restrict(r, 1, x, fw, cw);
+	}
+	#pragma omp parallel for
+	for(int y = 0; y < ch; y++)
+		for(int x = 0; x < cw; x++)
+			c.b[cw*y + x] = Restrict(&c.t[x], cw, y, fh, ch);
+
+	Cycle(Depth + 1);
+
+	//Interpolate the correction back and postsmooth in reverse.
+	#pragma omp parallel for
+	for(int y = 0; y < fh; y++){
+		float *t = &c.t[cw*y], *x = &l.x[fw*y];
+		for(int i = 0; i < cw; i++) t[i] = Interpolate(&c.x[i], cw, y, ch);
+		for(int i = 0; i < fw; i++) x[i] += Interpolate(t, 1, i, cw);
+	}
+	Smooth(l, false);
+}
+
+void MultigridPreconditioner::VCycle(float *x, float *b){
+	Levels[0].x = x;
+	Levels[0].b = b;
+	Cycle(0);
+}
+
+
+
+
+EdgePreservingDecomposition::EdgePreservingDecomposition(unsigned int width, unsigned int height, unsigned int Solver, unsigned int Reduction){
 	w = width;
 	h = height;
 	n = w*h;
 
+	//The grid the blurs are solved on. Partial boxes at the right and bottom.
+	if(Reduction < 1 || w/Reduction < 3 || h/Reduction < 3) Reduction = 1;
+	this->Reduction = Reduction;
+	rw = (w + Reduction - 1)/Reduction;
+	rh = (h + Reduction - 1)/Reduction;
+	rn = rw*rh;
+	rSource = rBlur = NULL;
+	if(Reduction > 1)
+		rSource = new float[rn],
+		rBlur = new float[rn];
+
 	//Initialize the matrix just once at construction.
-	A = new MultiDiagonalSymmetricMatrix(n, 5);
+	A = new MultiDiagonalSymmetricMatrix(rn, 5);
 	if(!(
 		A->CreateDiagonal(0, 0) &&
 		A->CreateDiagonal(1, 1) &&
-		A->CreateDiagonal(2, w - 1) &&
-		A->CreateDiagonal(3, w) &&
-		A->CreateDiagonal(4, w + 1))){
+		A->CreateDiagonal(2, rw - 1) &&
+		A->CreateDiagonal(3, rw) &&
+		A->CreateDiagonal(4, rw + 1))){
 		delete A;
 		A = NULL;
 		printf("Error in EdgePreservingDecomposition construction: out of memory.\n");
@@ -335,38 +592,59 @@ EdgePreservingDecomposition::EdgePreservingDecomposition(unsigned int width, uns
 		a_w   = A->Diagonals[3];
 		a_w_1 = A->Diagonals[4];
 	}
+
+	Multigrid = NULL;
+	if(Solver == SolverMultigrid) Multigrid = new MultigridPreconditioner(rw, rh);
 }
 
 EdgePreservingDecomposition::~EdgePreservingDecomposition(){
 	delete A;
+	delete Multigrid;
+	delete[] rSource;
+	delete[] rBlur;
 }
 
 float *EdgePreservingDecomposition::CreateBlur(float *Source, float Scale, float EdgeStopping, unsigned int Iterates, float *Blur, bool UseBlurForEdgeStop){
+	if(Reduction == 1) return SolveBlur(Source, Scale, EdgeStopping, Iterates, Blur, UseBlurForEdgeStop);
+
 	if(Blur == NULL)
-		UseBlurForEdgeStop = false,	//Use source if there's no supplied Blur.
+		UseBlurForEdgeStop = false,
 		Blur = new float[n];
+
+	//Scale is in pixels of the full size, so it shrinks with them.
+	Reduce(rSource, Source);
+	if(UseBlurForEdgeStop) Reduce(rBlur, Blur);
+	SolveBlur(rSource, Scale/Reduction, EdgeStopping, Iterates, rBlur, UseBlurForEdgeStop);
+	GuidedUpsample(Blur, Source);
+	return Blur;
+}
+
+float *EdgePreservingDecomposition::SolveBlur(float *Source, float Scale, float EdgeStopping, unsigned int Iterates, float *Blur, bool UseBlurForEdgeStop){
+	if(Blur == NULL)
+		UseBlurForEdgeStop = false,	//Use source if there's no supplied Blur.
+		Blur = new float[rn];
 	if(Scale == 0.0f){
-		memcpy(Blur, Source, n*sizeof(float));
+		memcpy(Blur, Source, rn*sizeof(float));
 		return Blur;
 	}
 
 	//Create the edge stopping function a, rotationally symmetric and just one instead of (ax, ay). Maybe don't need Blur yet, so use its memory.
 	float *a, *g;
-	if(UseBlurForEdgeStop) a = new float[n], g = Blur;
+	if(UseBlurForEdgeStop) a = new float[rn], g = Blur;
 	else a = Blur, g = Source;
 
-	unsigned int x, y, i;
-	unsigned int w1 = w - 1, h1 = h - 1;
+	unsigned int w1 = rw - 1, h1 = rh - 1;
 	float eps = 0.02f;
-	for(y = 0; y != h1; y++){
-		float *rg = &g[w*y];
-		for(x = 0; x != w1; x++){
+	#pragma omp parallel for
+	for(int y = 0; y < (int)h1; y++){
+		float *rg = &g[rw*y];
+		for(unsigned int x = 0; x != w1; x++){
 			//Estimate the central difference gradient in the center of a four pixel square. (gx, gy) is actually 2*gradient.
-			float gx = (rg[x + 1] - rg[x]) + (rg[x + w + 1] - rg[x + w]);
-			float gy = (rg[x + w] - rg[x]) + (rg[x + w + 1] - rg[x + 1]);
+			float gx = (rg[x + 1] - rg[x]) + (rg[x + rw + 1] - rg[x + rw]);
+			float gy = (rg[x + rw] - rg[x]) + (rg[x + rw + 1] - rg[x + 1]);
 
 			//Apply power to the magnitude of the gradient to get the edge stopping function.
-			a[x + w*y] = Scale*powf(0.5f*sqrtf(gx*gx + gy*gy + eps*eps), -EdgeStopping);
+			a[x + rw*y] = Scale*powf(0.5f*sqrtf(gx*gx + gy*gy + eps*eps), -EdgeStopping);
 		}
 	}
 
@@ -381,23 +659,24 @@ float *EdgePreservingDecomposition::CreateBlur(float *Source, float Scale, float
 		Integrate(diff(P(u, v - 1), x)*diff(p(x, 1 - y), x) + diff(P(u, v - 1), y)*diff(p(x, 1 - y), y));
 	So yeah. Use the numeric results of that to fill the matrix A.*/
 	memset(a_1, 0, A->DiagonalLength(1)*sizeof(float));
-	memset(a_w1, 0, A->DiagonalLength(w - 1)*sizeof(float));
-	memset(a_w, 0, A->DiagonalLength(w)*sizeof(float));
-	memset(a_w_1, 0, A->DiagonalLength(w + 1)*sizeof(float));
-	for(i = y = 0; y != h; y++){
-		for(x = 0; x != w; x++, i++){
+	memset(a_w1, 0, A->DiagonalLength(rw - 1)*sizeof(float));
+	memset(a_w, 0, A->DiagonalLength(rw)*sizeof(float));
+	memset(a_w_1, 0, A->DiagonalLength(rw + 1)*sizeof(float));
+	unsigned int x, y, i;
+	for(i = y = 0; y != rh; y++){
+		for(x = 0; x != rw; x++, i++){
 			float ac;
 			a0[i] = 1.0;
 
 			//Remember, only fill the lower triangle. Memory for upper is never made. It's symmetric. Trust.
 			if(x > 0 && y > 0)
-				ac = a[i - w - 1]/6.0f,
-				a_w_1[i - w - 1] -= 2.0f*ac, a_w[i - w] -= ac,
-				a_1[i - 1]       -=      ac, a0[i] += 4.0f*ac;
+				ac = a[i - rw - 1]/6.0f,
+				a_w_1[i - rw - 1] -= 2.0f*ac, a_w[i - rw] -= ac,
+				a_1[i - 1]        -=      ac, a0[i] += 4.0f*ac;
 
 			if(x < w1 && y > 0)
-				ac = a[i - w]/6.0f,
-				a_w[i - w] -= ac, a_w1[i - w + 1] -= 2.0f*ac,
+				ac = a[i - rw]/6.0f,
+				a_w[i - rw] -= ac, a_w1[i - rw + 1] -= 2.0f*ac,
 				a0[i] += 4.0f*ac;
 
 			if(x > 0 && y < h1)
@@ -411,13 +690,120 @@ float *EdgePreservingDecomposition::CreateBlur(float *Source, float Scale, float
 	if(UseBlurForEdgeStop) delete[] a;
 
 	//Solve & return.
+	if(Multigrid != NULL){
+		//A V-cycle does a lot more than a Cholesky back solve, about a third of the iterates reach the same residual.
+		Multigrid->Setup(A);
+		if(!UseBlurForEdgeStop) memcpy(Blur, Source, rn*sizeof(float));
+		SparseConjugateGradient(Multigrid->PassThroughVectorProduct, Source, rn, false, Blur, 0.0f, (void *)Multigrid, (Iterates + 2)/3, Multigrid->PassThroughVCycle);
+		return Blur;
+	}
+
 	A->CreateIncompleteCholeskyFactorization(1);	//Fill-in of 1 seems to work really good. More doesn't really help and less hurts (slightly).
-	if(!UseBlurForEdgeStop) memcpy(Blur, Source, n*sizeof(float));
-	SparseConjugateGradient(A->PassThroughVectorProduct, Source, n, false, Blur, 0.0f, (void *)A, Iterates, A->PassThroughCholeskyBackSolve);
+	if(!UseBlurForEdgeStop) memcpy(Blur, Source, rn*sizeof(float));
+	SparseConjugateGradient(A->PassThroughVectorProduct, Source, rn, false, Blur, 0.0f, (void *)A, Iterates, A->PassThroughCholeskyBackSolve);
 	A->KillIncompleteCholeskyFactorization();
 	return Blur;
 }
 
+void EdgePreservingDecomposition::Reduce(float *Reduced, float *Full){
+	int R = Reduction;
+
+	#pragma omp parallel for
+	for(int y = 0; y < (int)rh; y++){
+		int y1 = min((y + 1)*R, (int)h);
+		for(int x = 0; x < (int)rw; x++){
+			int x1 = min((x + 1)*R, (int)w);
+			float s = 0.0f;
+			for(int yy = y*R; yy < y1; yy++)
+				for(int xx = x*R; xx < x1; xx++)
+					s += Full[xx + w*yy];
+			Reduced[x + rw*y] = s/((y1 - y*R)*(x1 - x*R));
+		}
+	}
+}
+
+//Mean of a radius r box around each pixel of a w x h image, the box clipped to the image.
+static void BoxMean(float *Mean, float *Image, int w, int h, int r, float *Temp){
+	#pragma omp parallel for
+	for(int y = 0; y < h; y++){
+		float *s = &Image[w*y], *t = &Temp[w*y];
+		for(int x = 0; x < w; x++){
+			int x0 = x - r > 0 ? x - r : 0, x1 = min(x + r, w - 1);
+			float a = 0.0f;
+			for(int i = x0; i <= x1; i++) a += s[i];
+			t[x] = a/(x1 - x0 + 1);
+		}
+	}
+	#pragma omp parallel for
+	for(int y = 0; y < h; y++){
+		int y0 = y - r > 0 ? y - r : 0, y1 = min(y + r, h - 1);
+		float *m = &Mean[w*y], ir = 1.0f/(y1 - y0 + 1);
+		for(int x = 0; x < w; x++) m[x] = 0.0f;
+		for(int i = y0; i <= y1; i++){
+			float *t = &Temp[w*i];
+			for(int x = 0; x < w; x++) m[x] += t[x];
+		}
+		for(int x = 0; x < w; x++) m[x] *= ir;
+	}
+}
+
+void EdgePreservingDecomposition::GuidedUpsample(float *Blur, float *Source){
+	/* The guided filter (He, Sun, Tang) fits Blur = ga*Source + gb in every box. Where the blur kept an edge of the source, ga is about
+	one and the edge comes back at full sharpness; where it smoothed the source out, ga is about zero. The fit is made on the reduced
+	grid (Fast Guided Filter, He and Sun), the mean coefficients are interpolated bilinearly. Source is logarithmic here, GuidedEps
+	is a variance: contrasts of a few percent count as edge. */
+	const int Radius = 2;
+	const float GuidedEps = 0.001f;
+	float *mI = new float[rn], *mP = new float[rn], *mII = new float[rn], *mIP = new float[rn], *t = new float[rn];
+
+	int i;
+	#pragma omp parallel for
+	for(i = 0; i < (int)rn; i++)
+		mII[i] = rSource[i]*rSource[i],
+		mIP[i] = rSource[i]*rBlur[i];
+	BoxMean(mI, rSource, rw, rh, Radius, t);
+	BoxMean(mP, rBlur, rw, rh, Radius, t);
+	BoxMean(mII, mII, rw, rh, Radius, t);
+	BoxMean(mIP, mIP, rw, rh, Radius, t);
+
+	//ga into mII, gb into mIP, then their means.
+	#pragma omp parallel for
+	for(i = 0; i < (int)rn; i++){
+		float ga = (mIP[i] - mI[i]*mP[i])/(mII[i] - mI[i]*mI[i] + GuidedEps);
+		mII[i] = ga;
+		mIP[i] = mP[i] - ga*mI[i];
+	}
+	BoxMean(mII, mII, rw, rh, Radius, t);
+	BoxMean(mIP, mIP, rw, rh, Radius, t);
+
+	//Reduced pixel x is centered on full size pixel x*Reduction + (Reduction - 1)/2.
+	float ir = 1.0f/Reduction;
+	#pragma omp parallel for
+	for(int y = 0; y < (int)h; y++){
+		float fy = (y + 0.5f)*ir - 0.5f;
+		fy = fy < 0.0f ? 0.0f : (fy > rh - 1 ? rh - 1 : fy);
+		int y0 = min((int)fy, (int)rh - 2 > 0 ? (int)rh - 2 : 0), y1 = min(y0 + 1, (int)rh - 1);
+		float wy = fy - y0;
+		for(int x = 0; x < (int)w; x++){
+			float fx = (x + 0.5f)*ir - 0.5f;
+			fx = fx < 0.0f ? 0.0f : (fx > rw - 1 ? rw - 1 : fx);
+			int x0 = min((int)fx, (int)rw - 2 > 0 ? (int)rw - 2 : 0), x1 = min(x0 + 1, (int)rw - 1);
+			float wx = fx - x0;
+
+			int i00 = x0 + rw*y0, i01 = x1 + rw*y0, i10 = x0 + rw*y1, i11 = x1 + rw*y1;
+			float ga = (1.0f - wy)*((1.0f - wx)*mII[i00] + wx*mII[i01]) + wy*((1.0f - wx)*mII[i10] + wx*mII[i11]);
+			float gb = (1.0f - wy)*((1.0f - wx)*mIP[i00] + wx*mIP[i01]) + wy*((1.0f - wx)*mIP[i10] + wx*mIP[i11]);
+			Blur[x + w*y] = ga*Source[x + w*y] + gb;
+		}
+	}
+
+	delete[] mI;
+	delete[] mP;
+	delete[] mII;
+	delete[] mIP;
+	delete[] t;
+}
+
 float *EdgePreservingDecomposition::CreateIteratedBlur(float *Source, float Scale, float EdgeStopping, unsigned int Iterates, unsigned int Reweightings, float *Blur){
 	//Simpler outcome?
 	if(Reweightings == 0) return CreateBlur(Source, Scale, EdgeStopping, Iterates, Blur);
@@ -440,7 +826,8 @@ float *EdgePreservingDecomposition::CompressDynamicRange(float *Source, float Sc
 
 	//We're working with luminance, which does better logarithmic.
 	unsigned int i;
-	for(i = 0; i != n; i++)
+	#pragma omp parallel for
+	for(i = 0; i < n; i++)
 		Source[i] = logf(Source[i] + eps);
 
 	//Blur. Also setup memory for Compressed (we can just use u since each element of u is used in one calculation).
@@ -448,7 +835,8 @@ float *EdgePreservingDecomposition::CompressDynamicRange(float *Source, float Sc
 	if(Compressed == NULL) Compressed = u;
 
 	//Apply compression, detail boost, unlogging. Compression is done on the logged data and detail boost on unlogged.
-	for(i = 0; i != n; i++){
+	#pragma omp parallel for
+	for(i = 0; i < n; i++){
 		float ce = expf(Source[i] + u[i]*(CompressionExponent - 1.0f)) - eps;
 		float ue = expf(u[i]) - eps;
 		Source[i] = expf(Source[i]) - eps;
@@ -107,9 +107,58 @@ public:
 
 };
 
+/* Multigrid preconditioner for 9 point matrices on a w x h grid, as EdgePreservingDecomposition makes them (diagonals with start
+rows 0, 1, w - 1, w, w + 1). Each coarser level has half the width and height, and its matrix is the Galerkin product R A P of the
+finer one, P bilinear interpolation and R its transpose. That's a 9 point matrix again, and unlike simply averaging the edge
+stopping function it keeps track of the edges, where the coefficients jump by orders of magnitude.
+
+One application is a symmetric V-cycle: Gauss-Seidel in four colors (pixels of the same parity in x and y don't touch each
+other in the 9 point stencil, so each color is updated in parallel), restriction, recursion, interpolation, and the same sweeps
+in reverse color order. That's symmetric positive definite, so it can precondition SparseConjugateGradient. Unlike the incomplete
+Cholesky factorization every step of it runs on all threads, and the number of iterates needed doesn't grow with the image size. */
+class MultigridPreconditioner{
+public:
+	MultigridPreconditioner(unsigned int width, unsigned int height);
+	~MultigridPreconditioner();
+
+	//A is the finest level matrix, the coarse levels are made from it. Call again whenever A changes.
+	void Setup(MultiDiagonalSymmetricMatrix *A);
+
+	//x = approximately A^-1 b by one V-cycle.
+	void VCycle(float *x, float *b);
+
+	//Pass through functions for SparseConjugateGradient, Pass is the preconditioner. Multiplies with the finest level matrix.
+	static void PassThroughVectorProduct(float *Product, float *x, void *Pass){
+		(static_cast<MultigridPreconditioner *>(Pass))->Levels[0].A->VectorProduct(Product, x);
+	};
+	static void PassThroughVCycle(float *Product, float *x, void *Pass){
+		(static_cast<MultigridPreconditioner *>(Pass))->VCycle(Product, x);
+	};
+
+private:
+	struct Level{
+		unsigned int w, h, n;
+		MultiDiagonalSymmetricMatrix *A;	//NULL for the finest level until Setup, which doesn't own it.
+		float *x, *b, *r;					//Solution, right hand side, residual. The finest level only owns r.
+		float *t;							//Rows of the finer level times columns of this one, for the separable transfers.
+	};
+	Level *Levels;
+	unsigned int NumberOfLevels;
+
+	void Smooth(Level &l, bool Forward);
+	void Cycle(unsigned int Depth);
+};
+
 class EdgePreservingDecomposition{
 public:
-	EdgePreservingDecomposition(unsigned int width, unsigned int height);
+	//The blurs (and everything using them) are solved by the Solver below. With Reduction > 1 they're solved on a grid Reduction times
+	//smaller in each direction and brought back to width x height by guided upsampling with the source as guide: meant for results
+	//that get downscaled by about that factor anyway. Edges stay sharp, but the blur's finest details are lost.
+	enum {
+		SolverIncompleteCholesky = 0,	//Conjugate gradient preconditioned by an incomplete Cholesky factorization, serial. The original.
+		SolverMultigrid = 1				//Conjugate gradient preconditioned by MultigridPreconditioner, parallel.
+	};
+	EdgePreservingDecomposition(unsigned int width, unsigned int height, unsigned int Solver = SolverIncompleteCholesky, unsigned int Reduction = 1);
 	~EdgePreservingDecomposition();
 
 	//Create an edge preserving blur of Source. Will create and return, or fill into Blur if not NULL. In place not ok.
@@ -127,7 +176,20 @@ public:
 
 private:
 	MultiDiagonalSymmetricMatrix *A;	//The equations are simple enough to not mandate a matrix class, but fast solution NEEDS a complicated preconditioner.
-	unsigned int w, h, n;
+	MultigridPreconditioner *Multigrid;	//Only with SolverMultigrid.
+	unsigned int w, h, n;				//Size of the images going in and out.
+	unsigned int Reduction, rw, rh, rn;	//Size of the grid the blurs are solved on, w x h without reduction.
+	float *rSource, *rBlur;				//Reduced source and blur, only with Reduction > 1.
+
+	//CreateBlur on the solver grid.
+	float *SolveBlur(float *Source, float Scale, float EdgeStopping, unsigned int Iterates, float *Blur, bool UseBlurForEdgeStop);
+
+	//Box average of Reduction x Reduction pixels of a full size image.
+	void Reduce(float *Reduced, float *Full);
+
+	//Upsamples the reduced blur to Blur with the full size Source as guide: a guided filter fitted on the reduced grid, its linear
+	//coefficients interpolated to full size and applied there.
+	void GuidedUpsample(float *Blur, float *Source);
 
 	//Convenient access to the data in A.
 	float *a0, *a_1, *a_w, *a_w_1, *a_w1;
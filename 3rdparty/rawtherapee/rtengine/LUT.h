@@ -47,11 +47,26 @@
  *
  *          LUT<float> my_lut (10,0); // this will extrapolate on either side
  *
+ *      four lookups at once, and whole rows (SSE2, the scalar code otherwise):
+ *
+ *      	vfloat values = my_lut[LVFU(index[j])];  // same as four float lookups
+ *      	my_lut.interpolate (index, values, n);   // values[k] = my_lut[index[k]]
+ *
+ *      these are for LUTf, they return the interpolated value without the
+ *      conversion to an integer T.
+ *
+ *      compact tables of 16 bit values with 16 bit indices, half the size of a
+ *      LUTf of 65536 entries:
+ *
+ *      	LUTus my_lut (65536);
+ *      	my_lut.lookup (index, values, n);         // values[k] = my_lut[(int)index[k]]
+ *
  *      shotcuts:
  *
  *      	LUTf stands for LUT<float>
  *          LUTi stands for LUT<int>
  *          LUTu stands for LUT<unsigned int>
+ *          LUTus stands for LUT<unsigned short>
  */
 
 #ifndef LUT_H_
@@ -64,8 +79,11 @@
 #define LUTf LUT<float>
 #define LUTi LUT<int>
 #define LUTu LUT<unsigned int>
+#define LUTus LUT<unsigned short>
 
 #include <cstring>
+#include <stdint.h>
+#include "helpersse2.h"
 
 template<typename T>
 class LUT {
@@ -74,26 +92,38 @@ private:
 	unsigned int maxs; 
 	T * data;
 	unsigned int clip, size, owner;
+	char * storage;
+
+	// data starts on a cache line, so a lookup and its neighbour rarely touch two lines
+	void allocate (int s) {
+		storage = new char[s*sizeof(T) + 63];
+		data = (T*)(((uintptr_t)storage + 63) & ~(uintptr_t)63);
+	}
+	void release () {
+		delete [] storage;
+		storage = NULL;
+		data = NULL;
+	}
 public:
 	LUT(int s, int flags = 0xfffffff) {
 		clip = flags;
-		data = new T[s];
+		allocate (s);
 		owner = 1;
 		size = s;
 		maxs=size-2;
 	}
 	void operator ()(int s, int flags = 0xfffffff) {
 		if (owner&&data)
-			delete[] data;
+			release ();
 		clip = flags;
-		data = new T[s];
+		allocate (s);
 		owner = 1;
 		size = s;
 		maxs=size-2;
 	}
 
 	LUT(int s, T * source) {
-		data = new T[s];
+		allocate (s);
 		owner = 1;
 		size = s;
 		maxs=size-2;
@@ -104,6 +134,7 @@ public:
 
 	LUT(void) {
 		data = NULL;
+		storage = NULL;
 		owner = 1;
 		size = 0;
 		maxs=0;
@@ -111,17 +142,16 @@ public:
 
 	~LUT() {
 		if (owner)
-			delete[] data;
+			release ();
 	}
 
 	LUT<T> & operator=(const LUT<T> &rhs) {
 	    if (this != &rhs) {
 	      if (rhs.size>this->size)
 	      {
-	    	delete [] this->data;
-	    	this->data=NULL;
+	    	this->release();
 	      }
-	      if (this->data==NULL) this->data=new T[rhs.size];
+	      if (this->data==NULL) this->allocate(rhs.size);
 	      this->clip=rhs.clip;
 	      this->owner=1;
 	      memcpy(this->data,rhs.data,rhs.size*sizeof(T));
@@ -162,8 +192,65 @@ public:
 		}
 		float diff = index - (float) idx;
 		T p1 = data[idx];
-		T p2 = data[idx + 1]-p1;
-		return (p1 + p2*diff);
+		// no T for the difference, it would wrap for a falling LUTus
+		return (p1 + (data[idx + 1]-p1)*diff);
+	}
+
+#ifdef __SSE2__
+	// four float indices, the same as four calls of operator[](float). There is no
+	// gather in SSE2, so the neighbours are loaded lane by lane from the clamped indices
+	vfloat operator[](vfloat index) {
+		vint idx = _mm_cvttps_epi32(index);
+		vint below = _mm_cmplt_epi32(idx, _mm_setzero_si128());
+		vint above = _mm_cmpgt_epi32(idx, _mm_set1_epi32(maxs));
+		idx = _mm_or_si128(_mm_andnot_si128(above, idx), _mm_and_si128(above, _mm_set1_epi32(maxs)));
+		idx = _mm_andnot_si128(below, idx);
+		vfloat diff = _mm_sub_ps(index, _mm_cvtepi32_ps(idx));
+		int i[4];
+		_mm_storeu_si128((vint*)i, idx);
+		vfloat p1 = _mm_setr_ps(data[i[0]], data[i[1]], data[i[2]], data[i[3]]);
+		vfloat p2 = _mm_sub_ps(_mm_setr_ps(data[i[0]+1], data[i[1]+1], data[i[2]+1], data[i[3]+1]), p1);
+		vfloat result = _mm_add_ps(p1, _mm_mul_ps(p2, diff));
+		if (clip & LUT_CLIP_BELOW)
+			result = vself(_mm_castsi128_ps(below), F2V(data[0]), result);
+		if (clip & LUT_CLIP_ABOVE)
+			result = vself(_mm_castsi128_ps(above), F2V(data[size - 1]), result);
+		return result;
+	}
+
+	// four integer indices, the same as four calls of operator[](int)
+	vfloat operator[](vint index) {
+		vint above = _mm_cmpgt_epi32(index, _mm_set1_epi32(size - 1));
+		index = _mm_or_si128(_mm_andnot_si128(above, index), _mm_and_si128(above, _mm_set1_epi32(size - 1)));
+		index = _mm_andnot_si128(_mm_cmplt_epi32(index, _mm_setzero_si128()), index);
+		int i[4];
+		_mm_storeu_si128((vint*)i, index);
+		return _mm_setr_ps(data[i[0]], data[i[1]], data[i[2]], data[i[3]]);
+	}
+#endif
+
+	// result[k] = (*this)[index[k]] for n float indices, result may be index
+	void interpolate (const float* index, float* result, int n) {
+		int k = 0;
+#ifdef __SSE2__
+		for (; k<n-3; k+=4)
+			STVFU(result[k], (*this)[LVFU(index[k])]);
+#endif
+		for (; k<n; k++)
+			result[k] = (*this)[index[k]];
+	}
+
+	// result[k] = (*this)[(int)index[k]] for n 16 bit indices. A table of 65536
+	// entries has no index to clip, the loop is a plain load
+	void lookup (const unsigned short* index, T* result, int n) {
+		if (size >= 65536) {
+			for (int k = 0; k<n; k++)
+				result[k] = data[index[k]];
+		}
+		else {
+			for (int k = 0; k<n; k++)
+				result[k] = (*this)[(int)index[k]];
+		}
 	}
 
 	operator bool (void)
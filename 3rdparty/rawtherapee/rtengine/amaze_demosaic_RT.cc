@@ -71,6 +71,8 @@ void RawImageSource::amaze_demosaic_RT(int winx, int winy, int winw, int winh) {
 	static const float gquinc[4] = {0.169917f, 0.108947f, 0.069855f, 0.0287182f};
 
 	volatile double progress = 0.0;
+
+	const DemosaicKernels* kernels = demosaicKernels();
 	// %%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
 #pragma omp parallel
 {
@@ -392,8 +394,11 @@ void RawImageSource::amaze_demosaic_RT(int winx, int winy, int winw, int winh) {
 			//end of border fill
 			// %%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
 
-			for (rr=1; rr < rr1-1; rr++)
-				for (cc=1, indx=(rr)*TS+cc; cc < cc1-1; cc++, indx++) {
+			for (rr=1; rr < rr1-1; rr++) {
+				indx=rr*TS+1;
+				if (kernels)
+					indx = kernels->amazeGradients(cfa, delh, delv, delhsq, delvsq, delp, delm, indx, rr*TS+cc1-1, TS);
+				for (; indx < rr*TS+cc1-1; indx++) {
 					
 					delh[indx] = fabs(cfa[indx+1]-cfa[indx-1]);
 					delv[indx] = fabs(cfa[indx+v1]-cfa[indx-v1]);
@@ -403,9 +408,16 @@ void RawImageSource::amaze_demosaic_RT(int winx, int winy, int winw, int winh) {
 					delm[indx] = fabs(cfa[indx+m1]-cfa[indx-m1]);
 					
 				}
+			}
 
-			for (rr=2; rr < rr1-2; rr++)
-				for (cc=2,indx=(rr)*TS+cc; cc < cc1-2; cc++, indx++) {
+			for (rr=2; rr < rr1-2; rr++) {
+				cc=2;
+				indx=rr*TS+cc;
+				if (kernels) {
+					indx = kernels->amazeDirectionalWeights(cfa, delh, delv, dirwts[0], Dgrbpsq1, Dgrbmsq1, indx, rr*TS+cc1-2, TS, eps);
+					cc = indx-rr*TS;
+				}
+				for (; cc < cc1-2; cc++, indx++) {
 					
 					dirwts[indx][0] = eps+delv[indx+v1]+delv[indx-v1]+delv[indx];//+fabs(cfa[indx+v2]-cfa[indx-v2]);
 					//vert directional averaging weights
@@ -420,6 +432,7 @@ void RawImageSource::amaze_demosaic_RT(int winx, int winy, int winw, int winh) {
 						Dgrbmsq1[indx]=(SQR(cfa[indx]-cfa[indx-m1])+SQR(cfa[indx]-cfa[indx+m1]));
 					} 
 				}
+			}
 
 			//t2_init += clock()-t1_init;
 			// end of tile initialization
@@ -428,9 +441,17 @@ void RawImageSource::amaze_demosaic_RT(int winx, int winy, int winw, int winh) {
 			//interpolate vertical and horizontal color differences
 			//t1_vcdhcd = clock();
 
-			for (rr=4; rr<rr1-4; rr++)
+			for (rr=4; rr<rr1-4; rr++) {
 				//for (cc=4+(FC(rr,2)&1),indx=rr*TS+cc,c=FC(rr,cc); cc<cc1-4; cc+=2,indx+=2) {
-				for (cc=4,indx=rr*TS+cc; cc<cc1-4; cc++,indx++) {
+				cc=4;
+				indx=rr*TS+cc;
+				if (kernels) {
+					// indx and cc have the same parity, TS is even
+					indx = kernels->amazeColorDifferences(cfa, dirwts[0], vcd, hcd, vcdalt, hcdalt, dgintv, dginth, rbint, nyquist,
+														  indx, rr*TS+cc1-4, FC(rr,0)&1 ? 0 : 1, TS, eps, arthresh, clip_pt);
+					cc = indx-rr*TS;
+				}
+				for (; cc<cc1-4; cc++,indx++) {
 					c=FC(rr,cc);
 					if (c&1) {sgn=-1;} else {sgn=1;}
 
@@ -480,6 +501,7 @@ void RawImageSource::amaze_demosaic_RT(int winx, int winy, int winw, int winh) {
 					dginth[indx]=MIN(SQR(glha-grha),SQR(glar-grar));
 					
 				}
+			}
 			//t2_vcdhcd += clock() - t1_vcdhcd;
 
 			//t1_cdvar = clock();
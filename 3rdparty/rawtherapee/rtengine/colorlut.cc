@@ -0,0 +1,234 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "colorlut.h"
+#include "helpersse2.h"
+#include "rtengine.h"
+#include <math.h>
+#include <algorithm>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace rtengine {
+
+// the input value of node i, lcms gets 16 bit
+static inline unsigned short lutNode (double i, int grid) {
+    return (unsigned short)(i * 65535.0 / (grid-1) + 0.5);
+}
+
+ColorLUT::ColorLUT (cmsHPROFILE in, cmsHPROFILE out, int intent, cmsUInt32Number flags, int grid)
+    : grid(grid), channels(0), maxError(0.0), buffer(NULL), table(NULL) {
+
+    if (grid<2 || grid>256 || in==NULL || out==NULL || cmsChannelsOf (cmsGetColorSpace (in))!=3)
+        return;
+
+    cmsColorSpaceSignature outSpace = cmsGetColorSpace (out);
+    if (outSpace==cmsSigCmykData)
+        channels = 4;
+    else if (outSpace==cmsSigRgbData)
+        channels = 3;
+    else
+        return;
+
+    // the formats carry no colorspace, lcms then takes the profiles as they are. The lcms
+    // optimizations would interpolate on their own grid, the nodes have to be exact.
+    // The profiles are shared, they are only read under lcmsMutex; the transform has its
+    // own copy of the pipeline, the sampling below needs no lock
+    cmsHTRANSFORM transform;
+    {
+        Glib::Mutex::Lock lock(*lcmsMutex);
+        transform = cmsCreateTransform (in, CHANNELS_SH(3)|BYTES_SH(2), out, CHANNELS_SH(channels)|BYTES_SH(2),
+            intent, flags | cmsFLAGS_NOOPTIMIZE | cmsFLAGS_NOCACHE);
+    }
+    if (transform==NULL)
+        return;
+
+    buffer = new AlignedBuffer<float> ((size_t)grid*grid*grid*4);
+    table = buffer->data;
+
+    unsigned short* src = new unsigned short[grid*grid*3];
+    unsigned short* dst = new unsigned short[grid*grid*4];
+
+    // one plane of constant red at a time, the nodes are padded to four values
+    for (int i=0; i<grid; i++) {
+        int n = 0;
+        for (int j=0; j<grid; j++)
+            for (int k=0; k<grid; k++) {
+                src[n++] = lutNode (i, grid);
+                src[n++] = lutNode (j, grid);
+                src[n++] = lutNode (k, grid);
+            }
+        cmsDoTransform (transform, src, dst, grid*grid);
+
+        float* plane = table + (size_t)i*grid*grid*4;
+        for (int p=0; p<grid*grid; p++)
+            for (int c=0; c<4; c++)
+                plane[4*p+c] = c<channels ? dst[channels*p+c] / 65535.f : 0.f;
+    }
+
+    // the error bound, measured at the centers of the cells (of every step-th cell on
+    // the large grids, the build would take twice as long otherwise)
+    int step = grid>25 ? (grid-1)/24 : 1;
+    for (int i=0; i<grid-1; i+=step) {
+        int n = 0;
+        for (int j=0; j<grid-1; j+=step)
+            for (int k=0; k<grid-1; k+=step) {
+                src[n++] = lutNode (i+0.5, grid);
+                src[n++] = lutNode (j+0.5, grid);
+                src[n++] = lutNode (k+0.5, grid);
+            }
+        cmsDoTransform (transform, src, dst, n/3);
+
+        float res[4];
+        for (int p=0; p<n/3; p++) {
+            lookup (src[3*p] / 65535.f, src[3*p+1] / 65535.f, src[3*p+2] / 65535.f, res);
+            for (int c=0; c<channels; c++)
+                maxError = std::max(maxError, fabs (res[c] - dst[channels*p+c] / 65535.0));
+        }
+    }
+
+    delete [] src;
+    delete [] dst;
+    cmsDeleteTransform (transform);
+}
+
+ColorLUT::~ColorLUT () {
+
+    delete buffer;
+}
+
+inline void ColorLUT::lookup (float r, float g, float b, float* out) const {
+
+    const int sr = grid*grid*4, sg = grid*4, sb = 4;
+    const float top = grid-1;
+
+    // the cell and the position inside of it, the last cell also takes the upper edge.
+    // Written so that NaN ends up at 0
+    float fr = r>0.f ? (r<1.f ? r*top : top) : 0.f;
+    float fg = g>0.f ? (g<1.f ? g*top : top) : 0.f;
+    float fb = b>0.f ? (b<1.f ? b*top : top) : 0.f;
+    int ir = std::min((int)fr, grid-2);
+    int ig = std::min((int)fg, grid-2);
+    int ib = std::min((int)fb, grid-2);
+    fr -= ir;
+    fg -= ig;
+    fb -= ib;
+
+    // the tetrahedron that holds the point: from the lower corner of the cell along the
+    // axis with the largest fraction first, then along the second one, to the upper corner
+    int o1, o2;
+    float t1, t2, t3;
+    if (fr>=fg) {
+        if (fg>=fb)      { o1 = sr; o2 = sr+sg; t1 = fr; t2 = fg; t3 = fb; }
+        else if (fr>=fb) { o1 = sr; o2 = sr+sb; t1 = fr; t2 = fb; t3 = fg; }
+        else             { o1 = sb; o2 = sr+sb; t1 = fb; t2 = fr; t3 = fg; }
+    }
+    else {
+        if (fb>fg)       { o1 = sb; o2 = sg+sb; t1 = fb; t2 = fg; t3 = fr; }
+        else if (fb>fr)  { o1 = sg; o2 = sg+sb; t1 = fg; t2 = fb; t3 = fr; }
+        else             { o1 = sg; o2 = sr+sg; t1 = fg; t2 = fr; t3 = fb; }
+    }
+
+    const float* c0 = table + ir*sr + ig*sg + ib*sb;
+    const float* c3 = c0 + sr + sg + sb;
+
+#ifdef __SSE2__
+    // a node is one vector, all channels are interpolated at once
+    vfloat v0 = LVF(c0[0]);
+    vfloat v1 = LVF(c0[o1]);
+    vfloat v2 = LVF(c0[o2]);
+    vfloat v3 = LVF(c3[0]);
+    vfloat res = _mm_add_ps(v0, _mm_mul_ps(_mm_sub_ps(v1, v0), F2V(t1)));
+    res = _mm_add_ps(res, _mm_mul_ps(_mm_sub_ps(v2, v1), F2V(t2)));
+    res = _mm_add_ps(res, _mm_mul_ps(_mm_sub_ps(v3, v2), F2V(t3)));
+    STVFU(out[0], res);
+#else
+    const float* c1 = c0 + o1;
+    const float* c2 = c0 + o2;
+    for (int c=0; c<4; c++)
+        out[c] = c0[c] + (c1[c]-c0[c])*t1 + (c2[c]-c1[c])*t2 + (c3[c]-c2[c])*t3;
+#endif
+}
+
+template<typename T> void ColorLUT::applyInterleaved (const T* src, T* dst, int width, int height, float range, bool multiThread) const {
+
+    if (table==NULL)
+        return;
+
+    const float scale = 1.f / range;
+    const int ch = channels;
+
+    #pragma omp parallel for if (multiThread)
+    for (int i=0; i<height; i++) {
+        const T* s = src + (size_t)i*width*3;
+        T* d = dst + (size_t)i*width*ch;
+        float res[4];
+        for (int j=0; j<width; j++) {
+            lookup (s[3*j] * scale, s[3*j+1] * scale, s[3*j+2] * scale, res);
+            for (int c=0; c<ch; c++)
+                d[ch*j+c] = (T)std::min(res[c]*range + 0.5f, range);
+        }
+    }
+}
+
+void ColorLUT::apply (const unsigned char* src, unsigned char* dst, int width, int height, bool multiThread) const {
+
+    applyInterleaved (src, dst, width, height, 255.f, multiThread);
+}
+
+void ColorLUT::apply (const unsigned short* src, unsigned short* dst, int width, int height, bool multiThread) const {
+
+    applyInterleaved (src, dst, width, height, 65535.f, multiThread);
+}
+
+void ColorLUT::apply (float** r, float** g, float** b, int width, int height, bool multiThread) const {
+
+    if (table==NULL || channels!=3)
+        return;
+
+    #pragma omp parallel for if (multiThread)
+    for (int i=0; i<height; i++) {
+        float res[4];
+        for (int j=0; j<width; j++) {
+            lookup (r[i][j] / 65535.f, g[i][j] / 65535.f, b[i][j] / 65535.f, res);
+            r[i][j] = res[0] * 65535.f;
+            g[i][j] = res[1] * 65535.f;
+            b[i][j] = res[2] * 65535.f;
+        }
+    }
+}
+
+void ColorLUT::apply (float** r, float** g, float** b, unsigned char* dst, int width, int height, bool multiThread) const {
+
+    if (table==NULL)
+        return;
+
+    const int ch = channels;
+
+    #pragma omp parallel for if (multiThread)
+    for (int i=0; i<height; i++) {
+        unsigned char* d = dst + (size_t)i*width*ch;
+        float res[4];
+        for (int j=0; j<width; j++) {
+            lookup (r[i][j] / 65535.f, g[i][j] / 65535.f, b[i][j] / 65535.f, res);
+            for (int c=0; c<ch; c++)
+                d[ch*j+c] = (unsigned char)std::min(res[c]*255.f + 0.5f, 255.f);
+        }
+    }
+}
+
+}
@@ -0,0 +1,68 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _COLORLUT_H_
+#define _COLORLUT_H_
+
+#include <lcms2.h>
+#include "alignedbuffer.h"
+
+namespace rtengine {
+
+/** A color transform from a three channel profile (RGB, or the XYZ of RT) to an RGB or CMYK
+  * profile, baked into a 3D LUT of grid^3 nodes and applied with tetrahedral interpolation.
+  * The nodes are sampled from lcms without its own optimizations, so the LUT is the only
+  * approximation. Use ICCStore::getLUT to share them between images and threads, a
+  * ColorLUT is never modified after it is built. */
+class ColorLUT {
+
+        int grid;
+        int channels;       // 3 or 4 output channels
+        double maxError;
+        AlignedBuffer<float>* buffer;
+        float* table;       // grid^3 nodes of four floats in [0,1], red major
+
+        void lookup (float r, float g, float b, float* out) const;
+        template<typename T> void applyInterleaved (const T* src, T* dst, int width, int height, float range, bool multiThread) const;
+
+    public:
+        /** Samples the transform from in to out. isValid() is false if lcms cannot create it
+          * or the profiles are not supported. */
+        ColorLUT (cmsHPROFILE in, cmsHPROFILE out, int intent, cmsUInt32Number flags, int grid);
+        ~ColorLUT ();
+
+        bool    isValid ()     const { return table!=NULL; }
+        int     getGrid ()     const { return grid; }
+        int     getChannels () const { return channels; }
+        /** The largest difference to lcms at the centers of the cells, where the interpolation
+          * is the least accurate, as a fraction of the output range (1/65535 is one 16 bit step). */
+        double  getMaxError () const { return maxError; }
+
+        /** Interleaved RGB to interleaved RGB or CMYK (getChannels() values per pixel), the rows
+          * follow each other without padding. src and dst must not overlap. */
+        void apply (const unsigned char* src, unsigned char* dst, int width, int height, bool multiThread=true) const;
+        void apply (const unsigned short* src, unsigned short* dst, int width, int height, bool multiThread=true) const;
+        /** Planar RGB in the 0..65535 range of Imagefloat, in place. Only for RGB output,
+          * values outside the range are clipped. */
+        void apply (float** r, float** g, float** b, int width, int height, bool multiThread=true) const;
+        /** Planar RGB in the 0..65535 range to interleaved 8 bit RGB or CMYK, the rows of dst
+          * follow each other without padding. Converts and quantizes in one pass. */
+        void apply (float** r, float** g, float** b, unsigned char* dst, int width, int height, bool multiThread=true) const;
+};
+
+}
+
+#endif
@@ -8,6 +8,7 @@
 /*RT*/#define NO_JASPER
 /*RT*/#define LOCALTIME
 /*RT*/#define DJGPP
+/*RT*/#include <vector>
 
 /*
    dcraw.c -- Dave Coffin's raw photo decoder
@@ -235,6 +236,13 @@ struct ph1 {
 #define BAYER2(row,col) \
 	image[((row) >> shrink)*iwidth + ((col) >> shrink)][fc(row,col)]
 
+/*RT*/ // one plane CFA buffer if the caller provided one, see RawImage::loadRaw
+#define CFA(row,col) \
+	(cfa_image ? cfa_image[((row) >> shrink)*iwidth + ((col) >> shrink)] : BAYER(row,col))
+
+#define CFA2(row,col) \
+	(cfa_image ? cfa_image[((row) >> shrink)*iwidth + ((col) >> shrink)] : BAYER2(row,col))
+
 int CLASS fc (int row, int col)
 {
   static const char filter[16][16] =
@@ -775,7 +783,7 @@ void CLASS canon_compressed_load_raw()
 	icol = col - left_margin;
 	c = FC(irow,icol);
 	if (icol < width)
-	  BAYER(irow,icol) = pixel[r*raw_width+col];
+	  CFA(irow,icol) = pixel[r*raw_width+col];
 	else if (col > 1 && (unsigned) (col-left_margin+2) > width+3)
 	  cblack[c] += (cblack[4+c]++,pixel[r*raw_width+col]);
       }
@@ -904,30 +912,132 @@ ushort * CLASS ljpeg_row (int jrow, struct jhead *jh)
   return row[2];
 }
 
-void CLASS lossless_jpeg_load_raw()
+/*RT*/
+/*
+   Reentrant bit reader for the lossless JPEG decoders below. It works on
+   the memory of the IMFILE and stops at a marker like getbithuff does;
+   instead of calling derror it sets the error flag, which the caller
+   checks once the segment is done.
+ */
+void CLASS ljpeg_bits_t::fill()
 {
-  int jwide, jrow, jcol, val, jidx, c, i, j, row=0, col=0;
-  struct jhead jh;
-  int min=INT_MAX;
+  unsigned c;
+
+  while (vbits <= 56) {
+    c = 0;
+    if (marker || dp >= end)
+      padded += 8;
+    else if ((c = *dp) != 0xff)
+      dp++;
+    else if (dp+1 < end && !dp[1])
+      dp += 2;
+    else {
+      marker = true;		// keep dp on the marker for restart()
+      padded += 8;
+      c = 0;
+    }
+    bitbuf = (bitbuf << 8) + c;
+    vbits += 8;
+  }
+}
+
+unsigned CLASS ljpeg_bits_t::read (int nbits)
+{
+  unsigned c;
+
+  if (nbits <= 0) return 0;
+  if (vbits < nbits) fill();
+  c = (unsigned) (bitbuf >> (vbits - nbits)) & ((1U << nbits) - 1);
+  if ((vbits -= nbits) < padded) error = true;
+  return c;
+}
+
+unsigned CLASS ljpeg_bits_t::decode (const ushort *huff)
+{
+  unsigned c;
+  int max = huff[0];
+
+  if (vbits < max) fill();
+  // huff has one entry for each value of the next max bits, see make_decoder_ref
+  c = (unsigned) (bitbuf >> (vbits - max)) & ((1U << max) - 1);
+  if ((vbits -= huff[c+1] >> 8) < padded) error = true;
+  return (uchar) huff[c+1];
+}
+
+void CLASS ljpeg_bits_t::restart()
+{
+  while (dp+1 < end && !(dp[0] == 0xff && dp[1] >> 4 == 0xd)) dp++;
+  dp = dp+2 < end ? dp+2 : end;
+  bitbuf = vbits = padded = 0;
+  marker = false;
+}
+
+/*RT*/ // ljpeg_row on a reentrant bit reader
+ushort * CLASS ljpeg_row_mem (int jrow, struct jhead *jh, ljpeg_bits_t &bits)
+{
+  int col, c, len, diff, pred, spred=0;
+  ushort *row[3];
+
+  if (jrow * jh->wide % jh->restart == 0) {
+    FORC(6) jh->vpred[c] = 1 << (jh->bits-1);
+    if (jrow) bits.restart();
+  }
+  FORC3 row[c] = jh->row + jh->wide*jh->clrs*((jrow+c) & 1);
+  for (col=0; col < jh->wide; col++)
+    FORC(jh->clrs) {
+      len = bits.decode (jh->huff[c]);
+      if (len == 16 && (!dng_version || dng_version >= 0x1010000))
+	diff = -32768;
+      else {
+	diff = bits.read (len);
+	if ((diff & (1 << (len-1))) == 0)
+	  diff -= (1 << len) - 1;
+      }
+      if (jh->sraw && c <= jh->sraw && (col | c))
+		    pred = spred;
+      else if (col) pred = row[0][-jh->clrs];
+      else	    pred = (jh->vpred[c] += diff) - diff;
+      if (jrow && col) switch (jh->psv) {
+	case 1:	break;
+	case 2: pred = row[1][0];					break;
+	case 3: pred = row[1][-jh->clrs];				break;
+	case 4: pred = pred +   row[1][0] - row[1][-jh->clrs];		break;
+	case 5: pred = pred + ((row[1][0] - row[1][-jh->clrs]) >> 1);	break;
+	case 6: pred = row[1][0] + ((pred - row[1][-jh->clrs]) >> 1);	break;
+	case 7: pred = (pred + row[1][0]) >> 1;				break;
+	default: pred = 0;
+      }
+      if ((**row = pred + diff) >> jh->bits) bits.error = true;
+      if (c <= jh->sraw) spred = **row;
+      row[0]++; row[1]++;
+    }
+  return row[2];
+}
+
+/*RT*/ // rows jrow0 to jrow1 of lossless_jpeg_load_raw, the masked pixels go to sum instead of cblack
+void CLASS lossless_jpeg_rows (struct jhead *jh, ljpeg_bits_t &bits, int jrow0, int jrow1, unsigned sum[8], int &min)
+{
+  int jwide, jrow, jcol, val, jidx, c, i, j, row, col;
   ushort *rp;
 
-  if (!ljpeg_start (&jh, 0)) return;
-  jwide = jh.wide * jh.clrs;
+  jwide = jh->wide * jh->clrs;
+  row = (INT64) jrow0 * jwide / raw_width;
+  col = (INT64) jrow0 * jwide % raw_width;
 
-  for (jrow=0; jrow < jh.high; jrow++) {
-    rp = ljpeg_row (jrow, &jh);
+  for (jrow=jrow0; jrow < jrow1 && !bits.error; jrow++) {
+    rp = ljpeg_row_mem (jrow, jh, bits);
     if (load_flags & 1)
       row = jrow & 1 ? height-1-jrow/2 : jrow/2;
     for (jcol=0; jcol < jwide; jcol++) {
       val = *rp++;
-      if (jh.bits <= 12)
+      if (jh->bits <= 12)
 	val = curve[val & 0xfff];
       if (cr2_slice[0]) {
 	jidx = jrow*jwide + jcol;
-	i = jidx / (cr2_slice[1]*jh.high);
+	i = jidx / (cr2_slice[1]*jh->high);
 	if ((j = i >= cr2_slice[0]))
 		 i  = cr2_slice[0];
-	jidx -= i * (cr2_slice[1]*jh.high);
+	jidx -= i * (cr2_slice[1]*jh->high);
 	row = jidx / cr2_slice[1+j];
 	col = jidx % cr2_slice[1+j] + i*cr2_slice[1];
       }
@@ -936,16 +1046,66 @@ void CLASS lossless_jpeg_load_raw()
       if ((unsigned) (row-top_margin) < height) {
 	c = FC(row-top_margin,col-left_margin);
 	if ((unsigned) (col-left_margin) < width) {
-	  BAYER(row-top_margin,col-left_margin) = val;
+	  CFA(row-top_margin,col-left_margin) = val;
 	  if (min > val) min = val;
 	} else if (col > 1 && (unsigned) (col-left_margin+2) > width+3)
-	  cblack[c] += (cblack[4+c]++,val);
+	  sum[c] += (sum[4+c]++,val);
       }
       if (++col >= raw_width)
 	col = (row++,0);
     }
   }
+}
+
+void CLASS lossless_jpeg_load_raw()
+{
+  int c, s, nseg=1, rows=0, error=0;
+  struct jhead jh;
+  int min=INT_MAX;
+  const uchar *dp, *data, *end;
+  std::vector<const uchar *> start;
+
+  if (!ljpeg_start (&jh, 0)) return;
+  data = (const uchar *) ifp->data + ftell(ifp);
+  end = (const uchar *) ifp->data + ifp->size;
+  start.push_back (data);
+
+  /*RT*/ // restart intervals of whole rows are independent if no row above is used for prediction,
+  /*RT*/ // and if the position of a pixel only depends on its jrow and jcol
+  if (jh.restart < INT_MAX && jh.restart % jh.wide == 0 && jh.psv == 1 &&
+      !(load_flags & 1) && (cr2_slice[0] || raw_width != 3984)) {
+    rows = jh.restart / jh.wide;
+    for (dp = data; dp+1 < end && (int) start.size() * rows < jh.high; dp++)
+      if (dp[0] == 0xff && dp[1]) {
+	if ((dp[1] & 0xf8) != 0xd0) break;
+	start.push_back (dp);
+      }
+    nseg = start.size();
+  }
+
+  std::vector<unsigned> sum (8*nseg, 0);
+  std::vector<int> smin (nseg, INT_MAX);
+
+#pragma omp parallel for schedule(dynamic) reduction(+:error) if (nseg > 1)
+  for (s=0; s < nseg; s++) {
+    struct jhead sj = jh;
+    sj.row = (ushort *) calloc (jh.wide*jh.clrs, 4);
+    if (!sj.row) {
+      error++;
+      continue;
+    }
+    ljpeg_bits_t bits (start[s], end);
+    lossless_jpeg_rows (&sj, bits, s*rows, s+1 < nseg ? (s+1)*rows : jh.high, &sum[8*s], smin[s]);
+    if (bits.error) error++;
+    free (sj.row);
+  }
+
   ljpeg_end (&jh);
+  if (error) derror();
+  for (s=0; s < nseg; s++) {
+    FORC(8) cblack[c] += sum[8*s+c];
+    if (min > smin[s]) min = smin[s];
+  }
   FORC4 if (cblack[4+c]) cblack[c] /= cblack[4+c];
   if (!strcasecmp(make,"KODAK"))
     black = min;
@@ -1031,7 +1191,7 @@ void CLASS adobe_copy_pixel (int row, int col, ushort **rp)
       c = row + ((col+1) >> 1);
     }
     if (r < height && c < width)
-      BAYER(r,c) = **rp < 0x1000 ? curve[**rp] : **rp;
+      CFA(r,c) = **rp < 0x1000 ? curve[**rp] : **rp;
     *rp += is_raw;
   } else {
     if (r < height && c < width)
@@ -1044,31 +1204,54 @@ void CLASS adobe_copy_pixel (int row, int col, ushort **rp)
 
 void CLASS adobe_dng_load_raw_lj()
 {
-  unsigned save, trow=0, tcol=0, jwide, jrow, jcol, row, col;
-  struct jhead jh;
-  ushort *rp;
+  unsigned save, trow=0, tcol=0;
+  int t, error=0;
+  const uchar *end;
+  std::vector<unsigned> offset, tilerow, tilecol;
 
+  /*RT*/ // the tiles are separate JPEG streams: find them first, then decode them in parallel
   while (trow < raw_height) {
     save = ftell(ifp);
-    if (tile_length < INT_MAX)
-      fseek (ifp, get4(), SEEK_SET);
-    if (!ljpeg_start (&jh, 0)) break;
+    offset.push_back (tile_length < INT_MAX ? get4() : save);
+    tilerow.push_back (trow);
+    tilecol.push_back (tcol);
+    fseek (ifp, save+4, SEEK_SET);
+    if ((tcol += tile_width) >= raw_width)
+      trow += tile_length + (tcol = 0);
+  }
+  end = (const uchar *) ifp->data + ifp->size;
+
+#pragma omp parallel for schedule(dynamic) reduction(+:error) if (offset.size() > 1)
+  for (t=0; t < (int) offset.size(); t++) {
+    unsigned jwide, jrow, jcol, row, col;
+    struct jhead jh;
+    const uchar *data;
+    ushort *rp;
+    int ok;
+
+#pragma omp critical(adobe_dng_ljpeg_start)
+    {
+      fseek (ifp, offset[t], SEEK_SET);
+      ok = ljpeg_start (&jh, 0);
+      data = (const uchar *) ifp->data + ftell(ifp);
+    }
+    if (!ok) continue;
+    ljpeg_bits_t bits (data, end);
     jwide = jh.wide;
     if (filters) jwide *= jh.clrs;
     jwide /= is_raw;
-    for (row=col=jrow=0; jrow < jh.high; jrow++) {
-      rp = ljpeg_row (jrow, &jh);
+    for (row=col=jrow=0; jrow < jh.high && !bits.error; jrow++) {
+      rp = ljpeg_row_mem (jrow, &jh, bits);
       for (jcol=0; jcol < jwide; jcol++) {
-	adobe_copy_pixel (trow+row, tcol+col, &rp);
+	adobe_copy_pixel (tilerow[t]+row, tilecol[t]+col, &rp);
 	if (++col >= tile_width || col >= raw_width)
 	  row += 1 + (col = 0);
       }
     }
-    fseek (ifp, save+4, SEEK_SET);
-    if ((tcol += tile_width) >= raw_width)
-      trow += tile_length + (tcol = 0);
+    if (bits.error) error++;
     ljpeg_end (&jh);
   }
+  if (error) derror();
 }
 
 void CLASS adobe_dng_load_raw_nc()
@@ -1181,7 +1364,7 @@ void CLASS nikon_compressed_load_raw()
       else	   hpred[col & 1] += diff;
       if ((ushort)(hpred[col & 1] + min) >= max) derror();
       if ((unsigned) (col-left_margin) < width)
-	BAYER(row,col-left_margin) = curve[LIM((short)hpred[col & 1],0,0x3fff)];
+	CFA(row,col-left_margin) = curve[LIM((short)hpred[col & 1],0,0x3fff)];
     }
   }
   free (huff);
@@ -1793,7 +1976,7 @@ void CLASS packed_load_raw()
       val = bitbuf << (64-tiff_bps-vbits) >> (64-tiff_bps);
       i = (col ^ (load_flags >> 6)) - left_margin;
       if ((unsigned) i < width)
-	BAYER(row,i) = val;
+	CFA(row,i) = val;
       else if (load_flags & 32) {
 	black += val;
 	zero += !val;
@@ -1822,7 +2005,7 @@ void CLASS unpacked_load_raw()
     read_shorts (pixel, width);
     fseek (ifp, 2*(raw_width - width), SEEK_CUR);
     for (col=0; col < width; col++)
-      if ((BAYER2(row,col) = pixel[col] >> load_flags) >> bits) derror();
+      if ((CFA2(row,col) = pixel[col] >> load_flags) >> bits) derror();
   }
   free (pixel);
 }
@@ -2519,7 +2702,7 @@ void CLASS sony_arw2_load_raw()
 	  bit += 7;
 	}
       for (i=0; i < 16; i++, col+=2)
-	if (col < width) BAYER(row,col) = curve[pix[i] << 1] >> 2;
+	if (col < width) CFA(row,col) = curve[pix[i] << 1] >> 2;
       col -= col & 1 ? 1:31;
     }
   }
@@ -49,6 +49,7 @@ public:
     ,meta_data(NULL)
     ,shot_select(0),multi_out(0)
     ,image(NULL)
+    ,cfa_image(NULL)
     ,bright(1.),threshold(0.)
     ,half_size(0),four_color_rgb(0),document_mode(0),highlight(0)
     ,verbose(0)
@@ -91,6 +92,7 @@ protected:
     double aber[4];
     double gamm[6];
     dcrawImage_t image;
+    ushort *cfa_image; // if set, the Bayer loaders using CFA() store one value per pixel here instead of image
     ushort white[8][8], curve[0x10000], cr2_slice[3], sraw_mul[4];
     float bright, threshold, user_mul[4];
     
@@ -200,6 +202,25 @@ int ljpeg_start (struct jhead *jh, int info_only);
 void ljpeg_end (struct jhead *jh);
 int ljpeg_diff (ushort *huff);
 ushort * ljpeg_row (int jrow, struct jhead *jh);
+// reentrant counterpart of getbithuff over the memory of ifp, the tiles and
+// restart intervals of lossless JPEG data each get one and decode in parallel
+class ljpeg_bits_t
+{
+public:
+   ljpeg_bits_t(const uchar *d, const uchar *e):error(false),dp(d),end(e),bitbuf(0),vbits(0),padded(0),marker(false){}
+   unsigned read(int nbits);
+   unsigned decode(const ushort *huff);
+   void restart(); // continue after the next RSTn marker
+   bool error;     // read past the data of the segment, or corrupt data
+private:
+   void fill();
+   const uchar *dp, *end;
+   UINT64 bitbuf;
+   int vbits, padded;
+   bool marker;
+};
+ushort * ljpeg_row_mem (int jrow, struct jhead *jh, ljpeg_bits_t &bits);
+void lossless_jpeg_rows (struct jhead *jh, ljpeg_bits_t &bits, int jrow0, int jrow1, unsigned sum[8], int &min);
 void lossless_jpeg_load_raw();
 
 void canon_sraw_load_raw();
@@ -28,6 +28,7 @@
 #include "curves.h"
 #include "dfmanager.h"
 #include "slicer.h"
+#include "demosaic_simd.h"
 #include <cassert>
 
 #ifdef _OPENMP
@@ -869,30 +870,49 @@ void RawImageSource::border_interpolate(int border, float (*image)[4], int start
     }
 }
 
+// border_interpolate straight from rawData into the output planes, with
+// the same integer averages, for the methods that do not need image[][4]
+void RawImageSource::border_interpolate2(int border)
+{
+  unsigned row, col, y, x, f, c, sum[8];
+  int width=W, height=H;
+  int colors = 3;
+  float** dst[3] = { red, green, blue };
+
+  for (row=0; row < height; row++)
+    for (col=0; col < width; col++) {
+      if (col==border && row >= border && row < height-border)
+	col = width-border;
+      memset (sum, 0, sizeof sum);
+      for (y=row-1; y != row+2; y++)
+	for (x=col-1; x != col+2; x++)
+	  if (y < height && x < width) {
+	    f = fc(y,x);
+	    sum[f] += rawData[y][x];
+	    sum[f+4]++;
+	  }
+      f = fc(row,col);
+      FORCC
+	dst[c][row][col] = c == f ? rawData[row][col] : (sum[c+4] ? sum[c] / sum[c+4] : 0);
+    }
+}
+
 /*
    Adaptive Homogeneity-Directed interpolation is based on
    the work of Keigo Hirakawa, Thomas Parks, and Paul Lee.
  */
-#define TS 256		/* Tile Size */
+#define TS 128		/* Tile Size, the scratch of a tile (13*TS*TS floats) stays in L2 */
 #define FORC(cnt) for (c=0; c < cnt; c++)
 #define FORC3 FORC(3)
 #define SQR(x) ((x)*(x))
 
 void RawImageSource::ahd_demosaic(int winx, int winy, int winw, int winh)
 {
-    int i, j, k, top, left, row, col, tr, tc, c, d, val, hm[2];
-    float (*pix)[4], (*rix)[3];
     static const int dir[4] = { -1, 1, -TS, TS };
-    float ldiff[2][4], abdiff[2][4], leps, abeps;
-    float r, xyz[3], xyz_cam[3][4];
+    float xyz_cam[3][4];
 	float (*cbrt);
-    float (*rgb)[TS][TS][3];
-    float (*lab)[TS][TS][3];
-	float (*lix)[3];
-    char (*homo)[TS][TS], *buffer;
 
     int width=W, height=H;
-    float (*image)[4];
     int colors = 3;
 
     const double xyz_rgb[3][3] = {			/* XYZ from RGB */
@@ -908,46 +928,58 @@ void RawImageSource::ahd_demosaic(int winx, int winy, int winw, int winh)
         plistener->setProgress (0.0);
     }
 
-    image = (float (*)[4]) calloc (H*W, sizeof *image);
-    for (int ii=0; ii<H; ii++)
-        for (int jj=0; jj<W; jj++)
-            image[ii*W+jj][fc(ii,jj)] = rawData[ii][jj];
-
 	cbrt = (float (*)) calloc (0x10000, sizeof *cbrt);
-    for (i=0; i < 0x10000; i++) {
-        r = (double)i / 65535.0;
+    for (int i=0; i < 0x10000; i++) {
+        float r = (double)i / 65535.0;
         cbrt[i] = r > 0.008856 ? pow(r,1/3.0) : 7.787*r + 16/116.0;
     }
 
-    for (i=0; i < 3; i++)
-        for (j=0; j < colors; j++)
-            for (xyz_cam[i][j] = k=0; k < 3; k++)
+    for (int i=0; i < 3; i++)
+        for (int j=0; j < colors; j++) {
+            xyz_cam[i][j] = 0;
+            for (int k=0; k < 3; k++)
 	            xyz_cam[i][j] += xyz_rgb[i][k] * rgb_cam[k][j] / d65_white[i];
+        }
 
-    border_interpolate(5, image);
-    buffer = (char *) malloc (13*TS*TS*sizeof(float));		/* 1664 kB */
-    //merror (buffer, "ahd_interpolate()");
-    rgb  = (float(*)[TS][TS][3]) buffer;
-    lab  = (float(*)[TS][TS][3])(buffer + 6*TS*TS*sizeof(float));
-    homo = (char (*)[TS][TS])   (buffer + 12*TS*TS*sizeof(float));
+    // the tiles write the inner part of red/green/blue, the 5 pixel frame is
+    // filled here. The tiles only read raw values, so they take them from
+    // rawData instead of a full frame copy
+    border_interpolate2(5);
 
-    // helper variables for progress indication
-    int n_tiles = ((height-7 + (TS-7))/(TS-6)) * ((width-7 + (TS-7))/(TS-6));
-    int tile = 0;
+    const int tileRows = (height-7 + (TS-7))/(TS-6);
+    const int tileCols = (width-7 + (TS-7))/(TS-6);
+    const int n_tiles = tileRows * tileCols;
+    int tilesDone = 0;
+
+#pragma omp parallel
+{
+    // per thread scratch, reused for all tiles of the thread
+    char *buffer = (char *) malloc (13*TS*TS*sizeof(float));		/* 832 kB */
+    float (*rgb)[TS][TS][3] = (float(*)[TS][TS][3]) buffer;
+    float (*lab)[TS][TS][3] = (float(*)[TS][TS][3])(buffer + 6*TS*TS*sizeof(float));
+    char (*homo)[TS][TS]    = (char (*)[TS][TS])   (buffer + 12*TS*TS*sizeof(float));
+
+#pragma omp for schedule(dynamic)
+    for (int tile=0; tile < n_tiles; tile++) {
+        int i, j, row, col, tr, tc, c, d, val, hm[2];
+        float (*rix)[3], (*lix)[3];
+        float ldiff[2][4], abdiff[2][4], leps, abeps;
+        float xyz[3];
+
+        const int top  = 2 + (tile / tileCols) * (TS-6);
+        const int left = 2 + (tile % tileCols) * (TS-6);
 
-    for (top=2; top < height-5; top += TS-6)
-        for (left=2; left < width-5; left += TS-6) {
             /*  Interpolate green horizontally and vertically:		*/
             for (row = top; row < top+TS && row < height-2; row++) {
 	            col = left + (FC(row,left) & 1);
 	            for (c = FC(row,col); col < left+TS && col < width-2; col+=2) {
-	                pix = image + (row*width+col);
-	                val = 0.25*((pix[-1][1] + pix[0][c] + pix[1][1]) * 2
-		                  - pix[-2][c] - pix[2][c]) ;
-	                rgb[0][row-top][col-left][1] = ULIM(val,pix[-1][1],pix[1][1]);
-	                val = 0.25*((pix[-width][1] + pix[0][c] + pix[width][1]) * 2
-		                  - pix[-2*width][c] - pix[2*width][c]) ;
-	                rgb[1][row-top][col-left][1] = ULIM(val,pix[-width][1],pix[width][1]);
+	                const float *pix = &rawData[row][col];
+	                val = 0.25*((pix[-1] + pix[0] + pix[1]) * 2
+		                  - pix[-2] - pix[2]) ;
+	                rgb[0][row-top][col-left][1] = ULIM(val,pix[-1],pix[1]);
+	                val = 0.25*((rawData[row-1][col] + pix[0] + rawData[row+1][col]) * 2
+		                  - rawData[row-2][col] - rawData[row+2][col]) ;
+	                rgb[1][row-top][col-left][1] = ULIM(val,rawData[row-1][col],rawData[row+1][col]);
 	            }
             }
 
@@ -955,24 +987,24 @@ void RawImageSource::ahd_demosaic(int winx, int winy, int winw, int winh)
             for (d=0; d < 2; d++)
 	            for (row=top+1; row < top+TS-1 && row < height-3; row++)
 	                for (col=left+1; col < left+TS-1 && col < width-3; col++) {
-	                    pix = image + (row*width+col);
+	                    const float *pix = &rawData[row][col], *pixup = &rawData[row-1][col], *pixdn = &rawData[row+1][col];
 	                    rix = &rgb[d][row-top][col-left];
 	                    lix = &lab[d][row-top][col-left];
 	                    if ((c = 2 - FC(row,col)) == 1) {
 	                        c = FC(row+1,col);
-	                        val = pix[0][1] + (0.5*( pix[-1][2-c] + pix[1][2-c]
+	                        val = pix[0] + (0.5*( pix[-1] + pix[1]
 				                  - rix[-1][1] - rix[1][1] ) );
 	                        rix[0][2-c] = CLIP(val);
-	                        val = pix[0][1] + (0.5*( pix[-width][c] + pix[width][c]
+	                        val = pix[0] + (0.5*( pixup[0] + pixdn[0]
 				                  - rix[-TS][1] - rix[TS][1] ) );
 	                    } else
-	                        val = rix[0][1] + (0.25*( pix[-width-1][c] + pix[-width+1][c]
-				                  + pix[+width-1][c] + pix[+width+1][c]
+	                        val = rix[0][1] + (0.25*( pixup[-1] + pixup[1]
+				                  + pixdn[-1] + pixdn[1]
 				                  - rix[-TS-1][1] - rix[-TS+1][1]
 				                  - rix[+TS-1][1] - rix[+TS+1][1] + 1) );
 	                    rix[0][c] = CLIP(val);
 	                    c = FC(row,col);
-	                    rix[0][c] = pix[0][c];
+	                    rix[0][c] = pix[0];
 	                    xyz[0] = xyz[1] = xyz[2] = 0.0;
 	                    FORCC {
 	                        xyz[0] += xyz_cam[0][c] * rix[0][c];
@@ -1019,6 +1051,7 @@ void RawImageSource::ahd_demosaic(int winx, int winy, int winw, int winh)
             }
 
             /*  Combine the most homogenous pixels for the final result:	*/
+            float** dst[3] = { red, green, blue };
             for (row=top+3; row < top+TS-3 && row < height-5; row++) {
                 tr = row-top;
                 for (col=left+3; col < left+TS-3 && col < width-5; col++) {
@@ -1028,30 +1061,30 @@ void RawImageSource::ahd_demosaic(int winx, int winy, int winw, int winh)
                             for (j=tc-1; j <= tc+1; j++)
                                 hm[d] += homo[d][i][j];
                     if (hm[0] != hm[1])
-                        FORC3 image[row*width+col][c] = rgb[hm[1] > hm[0]][tr][tc][c];
+                        FORC3 dst[c][row][col] = rgb[hm[1] > hm[0]][tr][tc][c];
                     else
-                        FORC3 image[row*width+col][c] =
+                        FORC3 dst[c][row][col] =
                             0.5*(rgb[0][tr][tc][c] + rgb[1][tr][tc][c]) ;
                 }
             }
 
-            tile++;
+#ifdef _OPENMP
+        if(omp_get_thread_num()==0)
+#endif
+        {
             if(plistener) {
-                plistener->setProgress((double)tile / n_tiles);
+                plistener->setProgress((double)tilesDone / n_tiles);
             }
         }
+#pragma omp atomic
+        tilesDone++;
+    }
 
-    if(plistener) plistener->setProgress (1.0);
     free (buffer);
-    for (int i=0; i<H; i++) {
-        for (int j=0; j<W; j++){
-            red[i][j] = image[i*W+j][0];
-            green[i][j] = image[i*W+j][1];
-            blue[i][j] = image[i*W+j][2];
-        }
-    }
+}
+
+    if(plistener) plistener->setProgress (1.0);
 
-    free (image);
 	free (cbrt);
 }
 #undef TS
@@ -1078,6 +1111,44 @@ void RawImageSource::nodemosaic()
     }
 }
 
+// Every 2x2 quad of the CFA holds one red, two green and one blue sample, they
+// become the colour of all four pixels. Only good for output at half size or
+// less: getImage with skip >= 2 averages the quads, which bins the raw data
+// without interpolating it.
+void RawImageSource::superpixel_demosaic()
+{
+    if (plistener) {
+        plistener->setProgressStr ("Superpixel...");
+        plistener->setProgress (0.0);
+    }
+
+#pragma omp parallel for
+    for (int i=0; i<H; i+=2) {
+        // an odd last row or column takes the samples of the one before
+        int i0 = i+1<H ? i : i-1;
+        for (int j=0; j<W; j+=2) {
+            int j0 = j+1<W ? j : j-1;
+            float sum[3] = {0.f, 0.f, 0.f};
+            int n[3] = {0, 0, 0};
+            for (int m=i0; m<i0+2; m++)
+                for (int k=j0; k<j0+2; k++) {
+                    int c = FC(m,k);
+                    sum[c] += rawData[m][k];
+                    n[c]++;
+                }
+            float r = sum[0]/n[0], g = sum[1]/n[1], b = sum[2]/n[2];
+            for (int m=i; m<i+2 && m<H; m++)
+                for (int k=j; k<j+2 && k<W; k++) {
+                    red[m][k] = r;
+                    green[m][k] = g;
+                    blue[m][k] = b;
+                }
+        }
+    }
+
+    if (plistener) plistener->setProgress (1.0);
+}
+
 // Refinement based on EECI demosaicing algorithm by L. Chang and Y.P. Tan
 // from "Lassus" : Luis Sanz, adapted by Jacques Desmis - JDC - and Oliver Duis for RawTherapee
 // increases the signal to noise ratio (PSNR) # +1 to +2 dB : tested with Dcraw : eg: Lighthouse + AMaZE : whitout refinement:39.96dB, with refinement:41.86 dB
@@ -1440,9 +1511,13 @@ void RawImageSource::dcb_map(float (*image)[4], int x0, int y0)
 	const int u=4*CACHESIZE;
 	int rowMin,colMin,rowMax,colMax;
 	dcb_initTileLimits(colMin,rowMin,colMax,rowMax,x0,y0,2);
+	const DemosaicKernels* kernels = demosaicKernels();
 
 	for (int row=rowMin; row < rowMax; row++) {
-		for (int col=colMin, indx=row*CACHESIZE+col; col < colMax; col++, indx++) {
+		int indx=row*CACHESIZE+colMin;
+		if (kernels)
+			indx = kernels->dcbMap(image[0], indx, row*CACHESIZE+colMax, CACHESIZE);
+		for (int col=indx-row*CACHESIZE; col < colMax; col++, indx++) {
 			float *pix = &(image[indx][1]);
 
             assert(indx>=0 && indx<u*u);
@@ -1460,9 +1535,13 @@ void RawImageSource::dcb_correction(float (*image)[4], int x0, int y0)
 	const int u=CACHESIZE, v=2*CACHESIZE;
 	int rowMin,colMin,rowMax,colMax;
 	dcb_initTileLimits(colMin,rowMin,colMax,rowMax,x0,y0,2);
+	const DemosaicKernels* kernels = demosaicKernels();
 
 	for (int row=rowMin; row < rowMax; row++) {
-		for (int col = colMin+(FC(y0-TILEBORDER+row,x0-TILEBORDER+colMin)&1),indx=row*CACHESIZE+col; col < colMax; col+=2, indx+=2) {
+		int indx=row*CACHESIZE+colMin+(FC(y0-TILEBORDER+row,x0-TILEBORDER+colMin)&1);
+		if (kernels)
+			indx = kernels->dcbCorrection(image[0], indx, row*CACHESIZE+colMax, CACHESIZE);
+		for (int col=indx-row*CACHESIZE; col < colMax; col+=2, indx+=2) {
 			float current = 4.f * image[indx][3] +
 						  2.f * (image[indx+u][3] + image[indx-u][3] + image[indx+1][3] + image[indx-1][3]) +
 							image[indx+v][3] + image[indx-v][3] + image[indx+2][3] + image[indx-2][3];
@@ -1536,9 +1615,15 @@ void RawImageSource::dcb_correction2(float (*image)[4], int x0, int y0)
 	const int u=CACHESIZE, v=2*CACHESIZE;
 	int rowMin,colMin,rowMax,colMax;
 	dcb_initTileLimits(colMin,rowMin,colMax,rowMax,x0,y0,4);
+	const DemosaicKernels* kernels = demosaicKernels();
 
 	for (int row=rowMin; row < rowMax; row++) {
-		for (int col = colMin+(FC(y0-TILEBORDER+row,x0-TILEBORDER+colMin)&1),indx=row*CACHESIZE+col,c=FC(y0-TILEBORDER+row,x0-TILEBORDER+col); col < colMax; col+=2, indx+=2) {
+		int col=colMin+(FC(y0-TILEBORDER+row,x0-TILEBORDER+colMin)&1), indx=row*CACHESIZE+col, c=FC(y0-TILEBORDER+row,x0-TILEBORDER+col);
+		if (kernels) {
+			indx = kernels->dcbCorrection2(image[0], indx, row*CACHESIZE+colMax, CACHESIZE, c);
+			col = indx-row*CACHESIZE;
+		}
+		for (; col < colMax; col+=2, indx+=2) {
 			float current = 4.f * image[indx][3] +
 						  2.f * (image[indx+u][3] + image[indx-u][3] + image[indx+1][3] + image[indx-1][3]) +
 							image[indx+v][3] + image[indx-v][3] + image[indx+2][3] + image[indx-2][3];
@@ -1661,46 +1746,24 @@ void RawImageSource::dcb_demosaic(int iterations, bool dcb_enhance)
     int hTiles = H/TILESIZE + (H%TILESIZE?1:0);
     int numTiles = wTiles * hTiles;
     int tilesDone=0;
-#ifdef _OPENMP
-	int nthreads = omp_get_max_threads();
- 	float (**image)[4]  =  (float(**)[4]) calloc( nthreads,sizeof( void*) );
-	float (**image2)[3] =	(float(**)[3]) calloc( nthreads,sizeof( void*) );
-	float (**image3)[3] =	(float(**)[3]) calloc( nthreads,sizeof( void*) );
-	float  (**chroma)[2] =  (float (**)[2]) calloc( nthreads,sizeof( void*) );
-	for(int i=0; i<nthreads; i++){
-		image[i] = (float(*)[4]) calloc( CACHESIZE*CACHESIZE, sizeof **image);
-		image2[i]= (float(*)[3]) calloc( CACHESIZE*CACHESIZE, sizeof **image2);
-		image3[i]= (float(*)[3]) calloc( CACHESIZE*CACHESIZE, sizeof **image3);
-		chroma[i]= (float (*)[2]) calloc( CACHESIZE*CACHESIZE, sizeof **chroma);
-	}
-#else
-	float (*image)[4]  = (float(*)[4]) calloc( CACHESIZE*CACHESIZE, sizeof *image);
-	float (*image2)[3] = (float(*)[3]) calloc( CACHESIZE*CACHESIZE, sizeof *image2);
-	float (*image3)[3] = (float(*)[3]) calloc( CACHESIZE*CACHESIZE, sizeof *image3);
-	float  (*chroma)[2] = (float (*)[2]) calloc( CACHESIZE*CACHESIZE, sizeof *chroma);
-#endif
-
-#pragma omp parallel for
+#pragma omp parallel
+{
+	// per thread scratch, allocated by the thread that works on it and reused
+	// for all its tiles
+	float (*tile)[4]   = (float(*)[4]) calloc( CACHESIZE*CACHESIZE, sizeof *tile);
+	float (*buffer)[3] = (float(*)[3]) calloc( CACHESIZE*CACHESIZE, sizeof *buffer);
+	float (*buffer2)[3]= (float(*)[3]) calloc( CACHESIZE*CACHESIZE, sizeof *buffer2);
+	float  (*chrm)[2]   = (float (*)[2]) calloc( CACHESIZE*CACHESIZE, sizeof *chrm);
+
+	// the tiles at the image border take longer (fill_border), so they are
+	// handed out one by one
+#pragma omp for schedule(dynamic)
     for( int iTile=0; iTile < numTiles; iTile++){
     	int xTile = iTile % wTiles;
     	int yTile = iTile / wTiles;
     	int x0 = xTile*TILESIZE;
     	int y0 = yTile*TILESIZE;
 
-#ifdef _OPENMP
-    	int tid = omp_get_thread_num();
-        assert(tid<nthreads);
-    	float (*tile)[4]   = image[tid];
-    	float (*buffer)[3] = image2[tid];
-    	float (*buffer2)[3]= image3[tid];
-    	float  (*chrm)[2]   = chroma[tid];
-#else
-    	float (*tile)[4]   = image;
-    	float (*buffer)[3] = image2;
-    	float (*buffer2)[3]= image3;
-    	float  (*chrm)[2]   = chroma;
-#endif
-
 		fill_raw( tile, x0,y0,rawData );
 		if( !xTile || !yTile || xTile==wTiles-1 || yTile==hTiles-1)
 		   fill_border(tile,6, x0, y0);
@@ -1753,18 +1816,11 @@ void RawImageSource::dcb_demosaic(int iterations, bool dcb_enhance)
         tilesDone++;
     }
 
-#ifdef _OPENMP
-	for(int i=0; i<nthreads; i++){
-		free(image[i]);
-		free(image2[i]);
-		free(image3[i]);
-		free(chroma[i]);
-	}
-#endif
-	free(image);
-    free(image2);
-    free(image3);
-    free(chroma);
+	free(tile);
+	free(buffer);
+	free(buffer2);
+	free(chrm);
+}
 
     if(plistener) plistener->setProgress (1.0);
 }
@@ -0,0 +1,51 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <http://www.gnu.org/licenses/>.
+ */
+// The AVX2 demosaic kernels. This file is compiled with -mavx2 (see CMakeLists.txt),
+// nothing from it may be called unless the CPU has AVX2.
+#include "demosaic_simd.h"
+#include <cstring>
+#include <cstddef>
+#include "helperavx2.h"
+
+namespace rtengine {
+
+#ifdef __AVX2__
+
+namespace avx2 {
+#include "demosaic_kernels.cc"
+}
+
+const DemosaicKernels* demosaicKernelsAVX2 () {
+
+	static const DemosaicKernels kernels = {
+		"AVX2",
+		avx2::fastGreen, avx2::fastRedBlue, avx2::fastRedBlueAtGreen,
+		avx2::amazeGradients, avx2::amazeDirectionalWeights, avx2::amazeColorDifferences,
+		avx2::dcbMap, avx2::dcbCorrection, avx2::dcbCorrection2
+	};
+	return &kernels;
+}
+
+#else
+
+const DemosaicKernels* demosaicKernelsAVX2 () {
+	return NULL;
+}
+
+#endif
+
+}
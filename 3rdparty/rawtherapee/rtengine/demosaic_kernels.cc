@@ -0,0 +1,276 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Vectorized inner loops of fast_demosaic, amaze_demosaic_RT and dcb_demosaic.
+// Not compiled on its own: demosaic_sse2.cc and demosaic_avx2.cc include it
+// inside their own namespace after the helper layer for their instruction set,
+// so everything here has to stay within the common subset of helpersse2.h and
+// helperavx2.h. See demosaic_simd.h for the contract of each kernel.
+
+#define SQRV(x) ((x)*(x))
+
+// fast_demosaic
+
+// 1/SQR(1+idx), the value RawImageSource::invGrad holds at the clipped index
+static inline vfloat invGradV (vfloat sum)
+{
+	vfloat t = F2V(1.f) + vminf(vtruncf(sum * F2V(0.25f)), F2V(65535.f));
+	return F2V(1.f) / (t * t);
+}
+
+// integer differences like the abs() of the scalar loop
+static inline vfloat idiff (vfloat a, vfloat b)
+{
+	return vtruncf(vabsf(a - b));
+}
+
+int fastGreen (float** rawData, float* green, int row, int col, int end, int greenParity)
+{
+	const float *rm3 = rawData[row-3], *rm2 = rawData[row-2], *rm1 = rawData[row-1], *r0 = rawData[row];
+	const float *rp1 = rawData[row+1], *rp2 = rawData[row+2], *rp3 = rawData[row+3];
+	const vfloat isGreen = vparitymask(greenParity - col);
+
+	for (; col <= end - VSIZE; col += VSIZE) {
+		vfloat c = LVFU(r0[col]);
+		vfloat u1 = LVFU(rm1[col]), d1 = LVFU(rp1[col]);
+		vfloat l1 = LVFU(r0[col-1]), r1 = LVFU(r0[col+1]);
+
+		vfloat wtu = invGradV(idiff(d1, u1) + idiff(c, LVFU(rm2[col])) + idiff(u1, LVFU(rm3[col])));
+		vfloat wtd = invGradV(idiff(u1, d1) + idiff(c, LVFU(rp2[col])) + idiff(d1, LVFU(rp3[col])));
+		vfloat wtl = invGradV(idiff(r1, l1) + idiff(c, LVFU(r0[col-2])) + idiff(l1, LVFU(r0[col-3])));
+		vfloat wtr = invGradV(idiff(l1, r1) + idiff(c, LVFU(r0[col+2])) + idiff(r1, LVFU(r0[col+3])));
+
+		vfloat g = (wtu*u1 + wtd*d1 + wtl*l1 + wtr*r1) / (wtu + wtd + wtl + wtr);
+		STVFU(green[col], vself(isGreen, c, g));
+	}
+	return col;
+}
+
+int fastRedBlue (float** rawData, float** green, float* red, float* blue, int row, int col, int end, bool redRow, float clip_pt)
+{
+	const float *rm1 = rawData[row-1], *r0 = rawData[row], *rp1 = rawData[row+1];
+	const float *gm1 = green[row-1], *g0 = green[row], *gp1 = green[row+1];
+	const vfloat clip = F2V(clip_pt), quarter = F2V(0.25f);
+
+	for (; col <= end - VSIZE; col += VSIZE) {
+		vfloat g = LVFU(gm1[col-1]) + LVFU(gm1[col+1]) + LVFU(gp1[col+1]) + LVFU(gp1[col-1]);
+		vfloat c = LVFU(rm1[col-1]) + LVFU(rm1[col+1]) + LVFU(rp1[col+1]) + LVFU(rp1[col-1]);
+		vfloat other = LVFU(g0[col]) - quarter * (g - vminf(clip, c));
+		vfloat raw = LVFU(r0[col]);
+		STVFU(red[col], redRow ? raw : other);
+		STVFU(blue[col], redRow ? other : raw);
+	}
+	return col;
+}
+
+// R and B at the even lanes only, the odd lanes belong to R/B sites read by other threads
+static inline vfloat colorAtGreen (const float* gm1, const float* g0, const float* gp1, const float* cm1, const float* c0, const float* cp1, int col)
+{
+	return LVFU(g0[col]) - F2V(0.25f) * ((LVFU(gm1[col]) - LVFU(cm1[col])) + (LVFU(gp1[col]) - LVFU(cp1[col])) +
+	                                     (LVFU(g0[col-1]) - LVFU(c0[col-1])) + (LVFU(g0[col+1]) - LVFU(c0[col+1])));
+}
+
+int fastRedBlueAtGreen (float** green, float** red, float** blue, int row, int col, int end)
+{
+	const float *gm1 = green[row-1], *g0 = green[row], *gp1 = green[row+1];
+
+	for (; col <= end - VSIZE; col += VSIZE) {
+		STVFALT(&red[row][col], colorAtGreen(gm1, g0, gp1, red[row-1], red[row], red[row+1], col), 0);
+		STVFALT(&blue[row][col], colorAtGreen(gm1, g0, gp1, blue[row-1], blue[row], blue[row+1], col), 0);
+	}
+	return col;
+}
+
+// amaze_demosaic_RT, tile buffers with a row stride of ts
+
+int amazeGradients (const float* cfa, float* delh, float* delv, float* delhsq, float* delvsq, float* delp, float* delm, int indx, int end, int ts)
+{
+	const int v1 = ts, p1 = -ts+1, m1 = ts+1;
+
+	for (; indx <= end - VSIZE; indx += VSIZE) {
+		vfloat h = vabsf(LVFU(cfa[indx+1]) - LVFU(cfa[indx-1]));
+		vfloat v = vabsf(LVFU(cfa[indx+v1]) - LVFU(cfa[indx-v1]));
+		STVFU(delh[indx], h);
+		STVFU(delv[indx], v);
+		STVFU(delhsq[indx], h * h);
+		STVFU(delvsq[indx], v * v);
+		STVFU(delp[indx], vabsf(LVFU(cfa[indx+p1]) - LVFU(cfa[indx-p1])));
+		STVFU(delm[indx], vabsf(LVFU(cfa[indx+m1]) - LVFU(cfa[indx-m1])));
+	}
+	return indx;
+}
+
+// Dgrbpsq1/Dgrbmsq1 are only read at G sites, the values written at R/B sites are never used
+int amazeDirectionalWeights (const float* cfa, const float* delh, const float* delv, float* dirwts, float* Dgrbpsq1, float* Dgrbmsq1, int indx, int end, int ts, float eps)
+{
+	const int v1 = ts, p1 = -ts+1, m1 = ts+1;
+	const vfloat epsv = F2V(eps);
+
+	for (; indx <= end - VSIZE; indx += VSIZE) {
+		vfloat vert = epsv + LVFU(delv[indx+v1]) + LVFU(delv[indx-v1]) + LVFU(delv[indx]);
+		vfloat hor = epsv + LVFU(delh[indx+1]) + LVFU(delh[indx-1]) + LVFU(delh[indx]);
+		STVF2U(&dirwts[2*indx], vert, hor);
+
+		vfloat c = LVFU(cfa[indx]);
+		STVFU(Dgrbpsq1[indx], SQRV(c - LVFU(cfa[indx-p1])) + SQRV(c - LVFU(cfa[indx+p1])));
+		STVFU(Dgrbmsq1[indx], SQRV(c - LVFU(cfa[indx-m1])) + SQRV(c - LVFU(cfa[indx+m1])));
+	}
+	return indx;
+}
+
+static inline vfloat dirwtsV (const float* dirwts, int indx)
+{
+	vfloat v, h;
+	LVF2U(&dirwts[2*indx], v, h);
+	return v;
+}
+
+static inline vfloat dirwtsH (const float* dirwts, int indx)
+{
+	vfloat v, h;
+	LVF2U(&dirwts[2*indx], v, h);
+	return h;
+}
+
+int amazeColorDifferences (const float* cfa, const float* dirwts, float* vcd, float* hcd, float* vcdalt, float* hcdalt,
+                           float* dgintv, float* dginth, float* rbint, int* nyquist, int indx, int end, int greenParity,
+                           int ts, float eps, float arthresh, float clip_pt)
+{
+	const int v1 = ts, v2 = 2*ts;
+	const vfloat isGreen = vparitymask(greenParity - indx);
+	const vfloat sgn = vself(isGreen, F2V(-1.f), F2V(1.f));
+	const vfloat epsv = F2V(eps), one = F2V(1.f), half = F2V(0.5f), arth = F2V(arthresh);
+	const vfloat clip = F2V((float)(0.8*clip_pt));
+
+	for (; indx <= end - VSIZE; indx += VSIZE) {
+		//initialization of nyquist test and diag interp
+		memset(&nyquist[indx], 0, VSIZE*sizeof(int));
+		STVFU(rbint[indx], ZEROV());
+
+		vfloat c = LVFU(cfa[indx]);
+		vfloat cu1 = LVFU(cfa[indx-v1]), cd1 = LVFU(cfa[indx+v1]), cl1 = LVFU(cfa[indx-1]), cr1 = LVFU(cfa[indx+1]);
+		vfloat cu2 = LVFU(cfa[indx-v2]), cd2 = LVFU(cfa[indx+v2]), cl2 = LVFU(cfa[indx-2]), cr2 = LVFU(cfa[indx+2]);
+		vfloat wv = dirwtsV(dirwts, indx), wh = dirwtsH(dirwts, indx);
+		vfloat wu2 = dirwtsV(dirwts, indx-v2), wd2 = dirwtsV(dirwts, indx+v2);
+		vfloat wl2 = dirwtsH(dirwts, indx-2), wr2 = dirwtsH(dirwts, indx+2);
+
+		//color ratios in each cardinal direction
+		vfloat cru = cu1*(wu2+wv)/(wu2*(epsv+c)+wv*(epsv+cu2));
+		vfloat crd = cd1*(wd2+wv)/(wd2*(epsv+c)+wv*(epsv+cd2));
+		vfloat crl = cl1*(wl2+wh)/(wl2*(epsv+c)+wh*(epsv+cl2));
+		vfloat crr = cr1*(wr2+wh)/(wr2*(epsv+c)+wh*(epsv+cr2));
+
+		vfloat guha = cu1+half*(c-cu2);
+		vfloat gdha = cd1+half*(c-cd2);
+		vfloat glha = cl1+half*(c-cl2);
+		vfloat grha = cr1+half*(c-cr2);
+
+		vfloat guar = vself(vmaskf_lt(vabsf(one-cru), arth), c*cru, guha);
+		vfloat gdar = vself(vmaskf_lt(vabsf(one-crd), arth), c*crd, gdha);
+		vfloat glar = vself(vmaskf_lt(vabsf(one-crl), arth), c*crl, glha);
+		vfloat grar = vself(vmaskf_lt(vabsf(one-crr), arth), c*crr, grha);
+
+		vfloat hwt = dirwtsH(dirwts, indx-1)/(dirwtsH(dirwts, indx-1)+dirwtsH(dirwts, indx+1));
+		vfloat vwt = dirwtsV(dirwts, indx-v1)/(dirwtsV(dirwts, indx+v1)+dirwtsV(dirwts, indx-v1));
+
+		//interpolated G via adaptive weights of cardinal evaluations
+		vfloat Gintvar = vwt*gdar+(one-vwt)*guar;
+		vfloat Ginthar = hwt*grar+(one-hwt)*glar;
+		vfloat Gintvha = vwt*gdha+(one-vwt)*guha;
+		vfloat Ginthha = hwt*grha+(one-hwt)*glha;
+
+		vfloat vcdaltv = sgn*(Gintvha-c);
+		vfloat hcdaltv = sgn*(Ginthha-c);
+		STVFU(vcdalt[indx], vcdaltv);
+		STVFU(hcdalt[indx], hcdaltv);
+
+		//use HA if highlights are (nearly) clipped
+		vfloat clipped = vmaskf_or(vmaskf_gt(c, clip), vmaskf_or(vmaskf_gt(Gintvha, clip), vmaskf_gt(Ginthha, clip)));
+		guar = vself(clipped, guha, guar);
+		gdar = vself(clipped, gdha, gdar);
+		glar = vself(clipped, glha, glar);
+		grar = vself(clipped, grha, grar);
+		STVFU(vcd[indx], vself(clipped, vcdaltv, sgn*(Gintvar-c)));
+		STVFU(hcd[indx], vself(clipped, hcdaltv, sgn*(Ginthar-c)));
+
+		//differences of interpolations in opposite directions
+		STVFU(dgintv[indx], vminf(SQRV(guha-gdha), SQRV(guar-gdar)));
+		STVFU(dginth[indx], vminf(SQRV(glha-grha), SQRV(glar-grar)));
+	}
+	return indx;
+}
+
+// dcb_demosaic, tiles of float[4] pixels with a row stride of u pixels
+
+int dcbMap (float* image, int indx, int end, int u)
+{
+	const vfloat one = F2V(1.f);
+
+	for (; indx <= end - VSIZE; indx += VSIZE) {
+		vfloat pix = LVFS(&image[4*indx+1], 4);
+		vfloat l = LVFS(&image[4*(indx-1)+1], 4), r = LVFS(&image[4*(indx+1)+1], 4);
+		vfloat up = LVFS(&image[4*(indx-u)+1], 4), dn = LVFS(&image[4*(indx+u)+1], 4);
+
+		vfloat above = vmaskf_gt(pix, (l + r + up + dn) * F2V(0.25f));
+		vfloat hor = vmaskf_lt(vminf(l, r) + l + r, vminf(up, dn) + up + dn);
+		vfloat vert = vmaskf_gt(vmaxf(l, r) + l + r, vmaxf(up, dn) + up + dn);
+		STVFS(&image[4*indx+3], 4, vandf(vself(above, hor, vert), one));
+	}
+	return indx;
+}
+
+// the weight of the vertical direction from the map around indx, 0..16
+static inline vfloat dcbCurrent (const float* image, int indx, int u)
+{
+	const int v = 2*u;
+	return F2V(4.f) * LVFS(&image[4*indx+3], 8) +
+	       F2V(2.f) * (LVFS(&image[4*(indx+u)+3], 8) + LVFS(&image[4*(indx-u)+3], 8) + LVFS(&image[4*(indx+1)+3], 8) + LVFS(&image[4*(indx-1)+3], 8)) +
+	       LVFS(&image[4*(indx+v)+3], 8) + LVFS(&image[4*(indx-v)+3], 8) + LVFS(&image[4*(indx+2)+3], 8) + LVFS(&image[4*(indx-2)+3], 8);
+}
+
+// R/B sites only: the lanes are every other pixel, indx, indx+2, ...
+int dcbCorrection (float* image, int indx, int end, int u)
+{
+	const vfloat sixteen = F2V(16.f), half = F2V(0.5f);
+
+	for (; indx + 2*(VSIZE-1) < end; indx += 2*VSIZE) {
+		vfloat current = dcbCurrent(image, indx, u);
+		vfloat h = (LVFS(&image[4*(indx-1)+1], 8) + LVFS(&image[4*(indx+1)+1], 8)) * half;
+		vfloat v = (LVFS(&image[4*(indx-u)+1], 8) + LVFS(&image[4*(indx+u)+1], 8)) * half;
+		STVFS(&image[4*indx+1], 8, ((sixteen-current)*h + current*v) * F2V(0.0625f));
+	}
+	return indx;
+}
+
+int dcbCorrection2 (float* image, int indx, int end, int u, int c)
+{
+	const int v = 2*u;
+	const vfloat sixteen = F2V(16.f), half = F2V(0.5f);
+
+	for (; indx + 2*(VSIZE-1) < end; indx += 2*VSIZE) {
+		vfloat current = dcbCurrent(image, indx, u);
+		vfloat pix = LVFS(&image[4*indx+c], 8);
+		vfloat h = (LVFS(&image[4*(indx-1)+1], 8) + LVFS(&image[4*(indx+1)+1], 8)) * half
+		           + pix - (LVFS(&image[4*(indx+2)+c], 8) + LVFS(&image[4*(indx-2)+c], 8)) * half;
+		vfloat vert = (LVFS(&image[4*(indx-u)+1], 8) + LVFS(&image[4*(indx+u)+1], 8)) * half
+		           + pix - (LVFS(&image[4*(indx+v)+c], 8) + LVFS(&image[4*(indx-v)+c], 8)) * half;
+		STVFS(&image[4*indx+1], 8, ((sixteen-current)*h + current*vert) * F2V(0.0625f));
+	}
+	return indx;
+}
+
+#undef SQRV
@@ -0,0 +1,53 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "demosaic_simd.h"
+#include <glibmm.h>
+#include "settings.h"
+#include <cstddef>
+
+namespace rtengine {
+
+extern const Settings* settings;
+
+// defined in demosaic_sse2.cc and demosaic_avx2.cc, NULL if the compiler could not build them
+const DemosaicKernels* demosaicKernelsSSE2 ();
+const DemosaicKernels* demosaicKernelsAVX2 ();
+
+static const DemosaicKernels* detectDemosaicKernels (bool avx2) {
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	__builtin_cpu_init ();
+	if (avx2 && __builtin_cpu_supports ("avx2") && demosaicKernelsAVX2 ())
+		return demosaicKernelsAVX2 ();
+	if (__builtin_cpu_supports ("sse2"))
+		return demosaicKernelsSSE2 ();
+#endif
+	return NULL;
+}
+
+const DemosaicKernels* demosaicKernels () {
+
+	// the CPU does not change while we run, detect once
+	static const DemosaicKernels* kernels = detectDemosaicKernels (true);
+	static const DemosaicKernels* kernelsSSE2 = detectDemosaicKernels (false);
+
+	if (!settings || !settings->simdDemosaic)
+		return NULL;
+	return settings->simdDemosaicNoAVX2 ? kernelsSSE2 : kernels;
+}
+
+}
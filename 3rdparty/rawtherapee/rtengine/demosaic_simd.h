@@ -0,0 +1,62 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _DEMOSAIC_SIMD_H_
+#define _DEMOSAIC_SIMD_H_
+
+namespace rtengine {
+
+/** Hand vectorized inner loops of the demosaic methods.
+  * Every kernel handles one row of the scalar loop it replaces, starting at
+  * col/indx and stopping before end. It returns the first position it did
+  * not process, the caller finishes the row from there with the scalar code.
+  * The results match the scalar loops up to float rounding (the scalar code
+  * computes a few constants in double). */
+struct DemosaicKernels {
+    const char* name;
+
+    // fast_demosaic: G at all sites of the row, greenParity is the column parity of the G sites
+    int (*fastGreen) (float** rawData, float* green, int row, int col, int end, int greenParity);
+    // fast_demosaic: R and B at the R/B sites, col has to be one. The G sites in between
+    // get scratch values, they are overwritten by fastRedBlueAtGreen
+    int (*fastRedBlue) (float** rawData, float** green, float* red, float* blue, int row, int col, int end, bool redRow, float clip_pt);
+    // fast_demosaic: R and B at the G sites, col has to be one. Only writes the G sites
+    int (*fastRedBlueAtGreen) (float** green, float** red, float** blue, int row, int col, int end);
+
+    // amaze_demosaic_RT: tile initialization, indices into the tile buffers
+    int (*amazeGradients) (const float* cfa, float* delh, float* delv, float* delhsq, float* delvsq, float* delp, float* delm, int indx, int end, int ts);
+    int (*amazeDirectionalWeights) (const float* cfa, const float* delh, const float* delv, float* dirwts, float* Dgrbpsq1, float* Dgrbmsq1, int indx, int end, int ts, float eps);
+    // amaze_demosaic_RT: vertical and horizontal color differences, greenParity is the index parity of the G sites
+    int (*amazeColorDifferences) (const float* cfa, const float* dirwts, float* vcd, float* hcd, float* vcdalt, float* hcdalt,
+                                  float* dgintv, float* dginth, float* rbint, int* nyquist, int indx, int end, int greenParity,
+                                  int ts, float eps, float arthresh, float clip_pt);
+
+    // dcb_demosaic: direction map, all sites
+    int (*dcbMap) (float* image, int indx, int end, int u);
+    // dcb_demosaic: green correction at the R/B sites, indx has to be one and the result
+    // is the next R/B site
+    int (*dcbCorrection) (float* image, int indx, int end, int u);
+    int (*dcbCorrection2) (float* image, int indx, int end, int u, int c);
+};
+
+/** Returns the kernels for the widest instruction set the CPU supports (AVX2 or SSE2),
+  * or NULL if there are none or settings->simdDemosaic is off. settings->simdDemosaicNoAVX2
+  * leaves out AVX2. */
+const DemosaicKernels* demosaicKernels ();
+
+}
+
+#endif
@@ -0,0 +1,50 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <http://www.gnu.org/licenses/>.
+ */
+// The SSE2 demosaic kernels, always available on x86-64.
+#include "demosaic_simd.h"
+#include <cstring>
+#include <cstddef>
+#include "helpersse2.h"
+
+namespace rtengine {
+
+#ifdef __SSE2__
+
+namespace sse2 {
+#include "demosaic_kernels.cc"
+}
+
+const DemosaicKernels* demosaicKernelsSSE2 () {
+
+	static const DemosaicKernels kernels = {
+		"SSE2",
+		sse2::fastGreen, sse2::fastRedBlue, sse2::fastRedBlueAtGreen,
+		sse2::amazeGradients, sse2::amazeDirectionalWeights, sse2::amazeColorDifferences,
+		sse2::dcbMap, sse2::dcbCorrection, sse2::dcbCorrection2
+	};
+	return &kernels;
+}
+
+#else
+
+const DemosaicKernels* demosaicKernelsSSE2 () {
+	return NULL;
+}
+
+#endif
+
+}
@@ -21,10 +21,12 @@
 //#include "rtengine.h"
 #include <cstddef>
 #include <cmath>
+#include <algorithm>
 #include "curves.h"
 #include "labimage.h"
 #include "improcfun.h"
 #include "array2D.h"
+#include "helpersse2.h"
 
 #ifdef _OPENMP
 #include <omp.h>
@@ -36,12 +38,6 @@
 #define CLIP(a) (CLIPTO(a,0,65535))
 
 
-#define DIRWT_L(i1,j1,i,j) (  rangefn_L[(data_fine->L[i1][j1]-data_fine->L[i][j]+32768)] )
-
-#define DIRWT_AB(i1,j1,i,j) (  rangefn_ab[(data_fine->a[i1][j1]-data_fine->a[i][j]+32768)] *  \
-rangefn_ab[(data_fine->L[i1][j1]-data_fine->L[i][j]+32768)] * \
-rangefn_ab[(data_fine->b[i1][j1]-data_fine->b[i][j]+32768)] )
-
 //#define NRWT_L(a) (nrwt_l[a] )
 
 #define NRWT_AB (nrwt_ab[(hipass[1]+32768)] * nrwt_ab[(hipass[2]+32768)])
@@ -96,10 +92,76 @@ namespace rtengine {
 	//example 2: subsampling by 2 every level -- pitch=2, scale=1 at each level
 	//example 3: no subsampling at first level, subsampling by 2 thereafter -- 
 	//	pitch =1, scale=1 at first level; pitch=2, scale=2 thereafter
-	
-	
-	
-	
+
+
+	//range weights of the directional averaging, exp(-|d|*k) * c/(d*d+c) for the difference d
+	//of L, and for chroma the product of that over the differences of L, a and b (with the
+	//chroma noise in k and c). They are computed rather than looked up: three LUT lookups per
+	//neighbour were most of the time of dirpyr, and the formula vectorizes. |d| is limited to
+	//32767 like the index of the LUTs was. The exponent is limited to -40 and the fraction of
+	//the chroma weight to 1e-18: weights that small are lost next to the weight 1 of the center,
+	//and below that they become denormals, which are slow
+	struct DirpyrRangeWeights {
+		float kL, cL;
+		float kab, cab, cab3;
+
+		DirpyrRangeWeights (float tonefactor, int luma, int chroma) {
+			float noise_L = 10.0*luma;
+			float noise_ab = 100.0*chroma;
+			kL = tonefactor / (1.0+noise_L);
+			cL = 1.0+SQR(noise_L);
+			kab = tonefactor / (1.0+3*noise_ab);
+			cab = 1.0+SQR(noise_ab);
+			cab3 = cab*cab*cab;
+		}
+
+		float L (float dL) const {
+			dL = std::min(fabsf(dL), 32767.f);
+			return expf(std::max(-dL*kL, -40.f)) * cL/(dL*dL+cL);
+		}
+
+		float ab (float dL, float da, float db) const {
+			dL = std::min(fabsf(dL), 32767.f);
+			da = std::min(fabsf(da), 32767.f);
+			db = std::min(fabsf(db), 32767.f);
+			return expf(std::max(-(dL+da+db)*kab, -40.f)) * std::max(cab3/((dL*dL+cab)*(da*da+cab)*(db*db+cab)), 1e-18f);
+		}
+
+#ifdef __SSE2__
+		vfloat L (vfloat dL) const {
+			dL = _mm_min_ps(vabsf(dL), F2V(32767.f));
+			vfloat e = vexpf(_mm_max_ps(_mm_mul_ps(dL, F2V(-kL)), F2V(-40.f)));
+			return _mm_div_ps(_mm_mul_ps(e, F2V(cL)), _mm_add_ps(_mm_mul_ps(dL, dL), F2V(cL)));
+		}
+
+		vfloat ab (vfloat dL, vfloat da, vfloat db) const {
+			dL = _mm_min_ps(vabsf(dL), F2V(32767.f));
+			da = _mm_min_ps(vabsf(da), F2V(32767.f));
+			db = _mm_min_ps(vabsf(db), F2V(32767.f));
+			vfloat c = F2V(cab);
+			vfloat den = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(dL, dL), c), _mm_add_ps(_mm_mul_ps(da, da), c));
+			den = _mm_mul_ps(den, _mm_add_ps(_mm_mul_ps(db, db), c));
+			vfloat e = vexpf(_mm_max_ps(_mm_mul_ps(_mm_add_ps(_mm_add_ps(dL, da), db), F2V(-kab)), F2V(-40.f)));
+			return _mm_mul_ps(e, _mm_max_ps(_mm_div_ps(F2V(cab3), den), F2V(1e-18f)));
+		}
+#endif
+	};
+
+#ifdef __SSE2__
+	//four values pitch apart
+	static inline vfloat LVFP (const float* p, int pitch) {
+		if (pitch==1)
+			return LVFU(p[0]);
+		if (pitch==2) {
+			vfloat even, odd;
+			LVF2U(p, even, odd);
+			return even;
+		}
+		return LVFS(p, pitch);
+	}
+#endif
+
+
 	void ImProcFunctions :: dirpyrLab_denoise(LabImage * src, LabImage * dst, const procparams::DirPyrDenoiseParams & dnparams )
 	{
 		float gam = dnparams.gamma/3.0;
@@ -113,6 +175,9 @@ namespace rtengine {
 		//DiagonalCurve* chromacurve = new DiagonalCurve (dnparams.chromcurve, CURVES_MIN_POLY_POINTS);
 		//LUTf Lcurve(65536);
 		//LUTf abcurve(65536);
+#ifdef _OPENMP
+#pragma omp parallel for if (multiThread)
+#endif
 		for (int i=0; i<65536; i++) {
 			int g = (int)(CurveFactory::gamma((double)i/65535.0, gam, gamthresh, gamslope, 1.0, 0.0) * 65535.0);
 			gamcurve[i] = CLIP(g);
@@ -129,7 +194,9 @@ namespace rtengine {
 		
 		
 		
-		//#pragma omp parallel for if (multiThread)
+#ifdef _OPENMP
+#pragma omp parallel for if (multiThread)
+#endif
 		for (int i=0; i<src->H; i++) {
 			for (int j=0; j<src->W; j++) {
 				//src->L[i][j] = CurveFactory::flinterp(gamcurve,src->L[i][j]);
@@ -141,10 +208,7 @@ namespace rtengine {
 		
 		
 		
-		LUTf rangefn_L(65536);
 		LUTf nrwt_l(65536);
-		
-		LUTf rangefn_ab(65536);
 		LUTf nrwt_ab(65536);
 		
 		//set up NR weight functions
@@ -152,6 +216,9 @@ namespace rtengine {
 		//gamma correction for chroma in shadows
 		float nrwtl_norm = ((CurveFactory::gamma((double)65535.0/65535.0, gam, gamthresh, gamslope, 1.0, 0.0)) -
 							(CurveFactory::gamma((double)75535.0/65535.0, gam, gamthresh, gamslope, 1.0, 0.0)));
+#ifdef _OPENMP
+#pragma omp parallel for if (multiThread)
+#endif
 		for (int i=0; i<65536; i++) {
 			nrwt_l[i] = ((CurveFactory::gamma((double)i/65535.0, gam, gamthresh, gamslope, 1.0, 0.0) -
 						  CurveFactory::gamma((double)(i+10000)/65535.0, gam, gamthresh, gamslope, 1.0, 0.0)) )/nrwtl_norm;
@@ -160,20 +227,14 @@ namespace rtengine {
 		
 		float tonefactor = nrwt_l[32768];
 		
-		float noise_L = 10.0*dnparams.luma;
-		float noisevar_L = SQR(noise_L);
-		
 		float noise_ab = 100.0*dnparams.chroma;
-		float noisevar_ab = SQR(noise_ab);
 		
 		
-		//set up range functions
-		for (int i=0; i<65536; i++) 
-			rangefn_L[i] = (( exp(-(double)fabs(i-32768) * tonefactor / (1.0+noise_L)) * (1.0+noisevar_L)/((double)(i-32768)*(double)(i-32768) + noisevar_L+1.0))); 
-		for (int i=0; i<65536; i++) 
-			rangefn_ab[i] = (( exp(-(double)fabs(i-32768) * tonefactor / (1.0+3*noise_ab)) * (1.0+noisevar_ab)/((double)(i-32768)*(double)(i-32768) + noisevar_ab+1.0))); 
-		
+		//the range functions are DirpyrRangeWeights
 		
+#ifdef _OPENMP
+#pragma omp parallel for if (multiThread)
+#endif
 		for (int i=0; i<65536; i++) 
 			nrwt_ab[i] = ((1.0+abs(i-32768)/(1.0+8*noise_ab)) * exp(-(double)fabs(i-32768)/ (1.0+8*noise_ab) ) );
 		
@@ -215,7 +276,7 @@ namespace rtengine {
 		//int thresh = 10 * c[8];
 		//impulse_nr (src, src, m_w1, m_h1, thresh, noisevar);
 		
-		dirpyr(src, dirpyrLablo[0], 0, rangefn_L, rangefn_ab, pitch, scale, dnparams.luma, dnparams.chroma );
+		dirpyr(src, dirpyrLablo[0], 0, tonefactor, pitch, scale, dnparams.luma, dnparams.chroma );
 		
 		level = 1;
 		
@@ -224,7 +285,7 @@ namespace rtengine {
 			scale = scales[level];
 			pitch = pitches[level];
 			
-			dirpyr(dirpyrLablo[level-1], dirpyrLablo[level], level, rangefn_L, rangefn_ab, pitch, scale, dnparams.luma, dnparams.chroma );
+			dirpyr(dirpyrLablo[level-1], dirpyrLablo[level], level, tonefactor, pitch, scale, dnparams.luma, dnparams.chroma );
 			
 			level ++;
 		}
@@ -239,7 +300,7 @@ namespace rtengine {
 			
 			int scale = scales[level];
 			int pitch = pitches[level];
-			idirpyr(dirpyrLablo[level], dirpyrLablo[level-1], level, rangefn_L, nrwt_l, nrwt_ab, pitch, scale, dnparams.luma, dnparams.chroma/*, Lcurve, abcurve*/ );
+			idirpyr(dirpyrLablo[level], dirpyrLablo[level-1], level, tonefactor, nrwt_l, nrwt_ab, pitch, scale, dnparams.luma, dnparams.chroma/*, Lcurve, abcurve*/ );
 		}
 		
 		
@@ -250,7 +311,7 @@ namespace rtengine {
 			delete dirpyrLablo[i];
 		}
 
-		idirpyr(dirpyrLablo[0], dst, 0, rangefn_L, nrwt_l, nrwt_ab, pitch, scale, dnparams.luma, dnparams.chroma/*, Lcurve, abcurve*/ );
+		idirpyr(dirpyrLablo[0], dst, 0, tonefactor, nrwt_l, nrwt_ab, pitch, scale, dnparams.luma, dnparams.chroma/*, Lcurve, abcurve*/ );
 
 		// freeing the last bunch of memory
 		delete dirpyrLablo[0];
@@ -261,17 +322,26 @@ namespace rtengine {
 		float igam = 1/gam;
 		float igamthresh = gamthresh*gamslope;
 		float igamslope = 1/gamslope;
+#ifdef _OPENMP
+#pragma omp parallel for if (multiThread)
+#endif
 		for (int i=0; i<65536; i++) {
 			gamcurve[i] = (CurveFactory::gamma((float)i/65535.0, igam, igamthresh, igamslope, 1.0, 0.0) * 65535.0);
 		}
 		
 		
 		if (dnparams.luma>0) {
+#ifdef _OPENMP
+#pragma omp parallel for if (multiThread)
+#endif
 			for (int i=0; i<dst->H; i++) 
 				for (int j=0; j<dst->W; j++) {
 					dst->L[i][j] = gamcurve[dst->L[i][j]];
 				}
 		} else {
+#ifdef _OPENMP
+#pragma omp parallel for if (multiThread)
+#endif
 			for (int i=0; i<dst->H; i++) 
 				for (int j=0; j<dst->W; j++) {
 					dst->L[i][j] = gamcurve[src->L[i][j]];
@@ -280,8 +350,42 @@ namespace rtengine {
 		
 	};
 	
+	//the directionally weighted average at (i,j), the neighbours outside of the image are left out
+	static inline void dirpyrPixel (LabImage* data_fine, LabImage* data_coarse, const DirpyrRangeWeights & wts,
+									int i, int j, int i1, int j1, int scale, int scalewin)
+	{
+		int width = data_fine->W;
+		int height = data_fine->H;
+		
+		float dirwt_l, dirwt_ab, norm_l, norm_ab;
+		float Lout, aout, bout;
+		norm_l = norm_ab = 0;//if we do want to include the input pixel in the sum
+		Lout = 0;
+		aout = 0;
+		bout = 0;
+		
+		for(int inbr=(i-scalewin); inbr<=(i+scalewin); inbr+=scale) {
+			if (inbr<0 || inbr>height-1) continue;
+			for (int jnbr=(j-scalewin); jnbr<=(j+scalewin); jnbr+=scale) {
+				if (jnbr<0 || jnbr>width-1) continue;
+				float dL = data_fine->L[inbr][jnbr]-data_fine->L[i][j];
+				dirwt_l = wts.L(dL);
+				dirwt_ab = wts.ab(dL, data_fine->a[inbr][jnbr]-data_fine->a[i][j], data_fine->b[inbr][jnbr]-data_fine->b[i][j]);
+				Lout += dirwt_l*data_fine->L[inbr][jnbr];
+				aout += dirwt_ab*data_fine->a[inbr][jnbr];
+				bout += dirwt_ab*data_fine->b[inbr][jnbr];
+				norm_l += dirwt_l;
+				norm_ab += dirwt_ab;
+			}
+		}
+		
+		data_coarse->L[i1][j1]=Lout/norm_l;//low pass filter
+		data_coarse->a[i1][j1]=aout/norm_ab;
+		data_coarse->b[i1][j1]=bout/norm_ab;
+	}
+	
 	void ImProcFunctions::dirpyr(LabImage* data_fine, LabImage* data_coarse, int level,
-								 LUTf & rangefn_L, LUTf & rangefn_ab, int pitch, int scale,
+								 float tonefactor, int pitch, int scale,
 								 const int luma, const int chroma )
 	{
 		
@@ -298,59 +402,74 @@ namespace rtengine {
 		
 		int width = data_fine->W;
 		int height = data_fine->H;
+		int width1 = data_coarse->W;
+		
+		DirpyrRangeWeights wts (tonefactor, luma, chroma);
 		
 		//generate domain kernel 
 		int halfwin = 3;//MIN(ceil(2*sig),3);
 		int scalewin = halfwin*scale;
 		
+#ifdef __SSE2__
+		//the columns j1 from jvstart on, up to jvend, have their whole window inside of the image
+		//(and the pitch-1 values past it that a strided load reads); they go four at a time
+		int jvstart = (scalewin+pitch-1)/pitch;
+		int jvend = width-scalewin-pitch >= 0 ? (width-scalewin-pitch)/pitch+1 : 0;
+#endif
+		
 #ifdef _OPENMP
-#pragma omp parallel for
+#pragma omp parallel for if (multiThread)
 #endif
  
 		for(int i = 0; i < height; i+=pitch ) { int i1=i/pitch;
-			for(int j = 0, j1=0; j < width; j+=pitch, j1++)
-			{	
-				float dirwt_l, dirwt_ab, norm_l, norm_ab;
-				//float lops,aops,bops;
-				float Lout, aout, bout;
-				norm_l = norm_ab = 0;//if we do want to include the input pixel in the sum
-				Lout = 0;
-				aout = 0;
-				bout = 0;
-				
-				for(int inbr=(i-scalewin); inbr<=(i+scalewin); inbr+=scale) {
-					if (inbr<0 || inbr>height-1) continue;
-					for (int jnbr=(j-scalewin); jnbr<=(j+scalewin); jnbr+=scale) {
-						if (jnbr<0 || jnbr>width-1) continue;
-						dirwt_l = DIRWT_L(inbr, jnbr, i, j);
-						dirwt_ab = DIRWT_AB(inbr, jnbr, i, j);
-						Lout += dirwt_l*data_fine->L[inbr][jnbr];
-						aout += dirwt_ab*data_fine->a[inbr][jnbr];
-						bout += dirwt_ab*data_fine->b[inbr][jnbr];
-						norm_l += dirwt_l;
-						norm_ab += dirwt_ab;
-					}
-				}
-				//lops = Lout/norm;//diagnostic
-				//aops = aout/normab;//diagnostic
-				//bops = bout/normab;//diagnostic
-				
-				data_coarse->L[i1][j1]=Lout/norm_l;//low pass filter
-				data_coarse->a[i1][j1]=aout/norm_ab;
-				data_coarse->b[i1][j1]=bout/norm_ab;
+			int j1 = 0;
+#ifdef __SSE2__
+			if (i>=scalewin && i+scalewin<height) {
+				for (; j1<jvstart && j1<width1; j1++)
+					dirpyrPixel(data_fine, data_coarse, wts, i, j1*pitch, i1, j1, scale, scalewin);
 				
-				
-				/*if (level<2 && i>0 && i<height-1 && j>0 && j<width-1) {
-					Lhmf = hmf(data_fine->L[i-1][j-1], data_fine->L[i-1][j], data_fine->L[i-1][j+1], \
-							   data_fine->L[i][j-1], data_fine->L[i][j], data_fine->L[i][j+1], \
-							   data_fine->L[i+1][j-1], data_fine->L[i+1][j], data_fine->L[i+1][j+1]);
-					//med3x3(data_fine->L[i-1][j-1], data_fine->L[i-1][j], data_fine->L[i-1][j+1], \
-					data_fine->L[i][j-1], data_fine->L[i][j], data_fine->L[i][j+1], \
-					data_fine->L[i+1][j-1], data_fine->L[i+1][j], data_fine->L[i+1][j+1],Lmed);
+				for (; j1+3<jvend; j1+=4) {
+					int j = j1*pitch;
+					vfloat Lc = LVFP(&data_fine->L[i][j], pitch);
+					vfloat ac = LVFP(&data_fine->a[i][j], pitch);
+					vfloat bc = LVFP(&data_fine->b[i][j], pitch);
+					vfloat norm_l = ZEROV(), norm_ab = ZEROV();
+					vfloat Lout = ZEROV(), aout = ZEROV(), bout = ZEROV();
+					
+					for(int inbr=(i-scalewin); inbr<=(i+scalewin); inbr+=scale)
+						for (int jnbr=(j-scalewin); jnbr<=(j+scalewin); jnbr+=scale) {
+							vfloat Ln = LVFP(&data_fine->L[inbr][jnbr], pitch);
+							vfloat an = LVFP(&data_fine->a[inbr][jnbr], pitch);
+							vfloat bn = LVFP(&data_fine->b[inbr][jnbr], pitch);
+							vfloat dL = _mm_sub_ps(Ln, Lc);
+							vfloat dirwt_l = wts.L(dL);
+							vfloat dirwt_ab = wts.ab(dL, _mm_sub_ps(an, ac), _mm_sub_ps(bn, bc));
+							Lout = _mm_add_ps(Lout, _mm_mul_ps(dirwt_l, Ln));
+							aout = _mm_add_ps(aout, _mm_mul_ps(dirwt_ab, an));
+							bout = _mm_add_ps(bout, _mm_mul_ps(dirwt_ab, bn));
+							norm_l = _mm_add_ps(norm_l, dirwt_l);
+							norm_ab = _mm_add_ps(norm_ab, dirwt_ab);
+						}
 					
-					data_coarse->L[i1][j1] = Lhmf;
-				}*/
+					STVFU(data_coarse->L[i1][j1], _mm_div_ps(Lout, norm_l));//low pass filter
+					STVFU(data_coarse->a[i1][j1], _mm_div_ps(aout, norm_ab));
+					STVFU(data_coarse->b[i1][j1], _mm_div_ps(bout, norm_ab));
+				}
 			}
+#endif
+			for(; j1 < width1; j1++)
+				dirpyrPixel(data_fine, data_coarse, wts, i, j1*pitch, i1, j1, scale, scalewin);
+			
+			/*if (level<2 && i>0 && i<height-1 && j>0 && j<width-1) {
+				Lhmf = hmf(data_fine->L[i-1][j-1], data_fine->L[i-1][j], data_fine->L[i-1][j+1], \
+						   data_fine->L[i][j-1], data_fine->L[i][j], data_fine->L[i][j+1], \
+						   data_fine->L[i+1][j-1], data_fine->L[i+1][j], data_fine->L[i+1][j+1]);
+				//med3x3(data_fine->L[i-1][j-1], data_fine->L[i-1][j], data_fine->L[i-1][j+1], \
+				data_fine->L[i][j-1], data_fine->L[i][j], data_fine->L[i][j+1], \
+				data_fine->L[i+1][j-1], data_fine->L[i+1][j], data_fine->L[i+1][j+1],Lmed);
+				
+				data_coarse->L[i1][j1] = Lhmf;
+			}*/
 		}
 		
 		
@@ -358,9 +477,64 @@ namespace rtengine {
 		
 	};
 	
+	//the Wiener factor of L at (i,j) averaged over the neighbours step apart, weighted by the range of L
+	static inline float smoothNRFactorPixel (float** L, float** nrfactorL, int width, int height, int i, int j, int step,
+											 const DirpyrRangeWeights & wts)
+	{
+		float dirwt_l, norm_l;
+		float nrfctrave=0;
+		norm_l = 0;//if we do want to include the input pixel in the sum
+		
+		for(int inbr=(i-step); inbr<=(i+step); inbr+=step) {
+			if (inbr<0 || inbr>height-1) continue;
+			for (int jnbr=(j-step); jnbr<=(j+step); jnbr+=step) {
+				if (jnbr<0 || jnbr>width-1) continue;
+				dirwt_l = wts.L(L[inbr][jnbr]-L[i][j]);
+				nrfctrave += dirwt_l*nrfactorL[inbr][jnbr];
+				norm_l += dirwt_l;
+			}
+		}
+		
+		return nrfctrave/norm_l;
+	}
+	
+	//smoothNRFactorPixel for the whole image into nrfactorAve, to be called inside of a parallel region.
+	//L is only changed afterwards: changed in place, the threads read the new values of their
+	//neighbours, and the result depended on the number of threads
+	static void smoothNRFactor (float** L, float** nrfactorL, float** nrfactorAve, int width, int height, int step,
+								const DirpyrRangeWeights & wts)
+	{
+#ifdef _OPENMP
+#pragma omp for
+#endif
+		for(int  i = 0; i < height; i++) {
+			int j = 0;
+#ifdef __SSE2__
+			if (i>=step && i+step<height) {
+				for (; j<step && j<width; j++)
+					nrfactorAve[i][j] = smoothNRFactorPixel(L, nrfactorL, width, height, i, j, step, wts);
+				
+				for (; j+3+step<width; j+=4) {
+					vfloat Lc = LVFU(L[i][j]);
+					vfloat norm_l = ZEROV(), nrfctrave = ZEROV();
+					for(int inbr=(i-step); inbr<=(i+step); inbr+=step)
+						for (int jnbr=(j-step); jnbr<=(j+step); jnbr+=step) {
+							vfloat dirwt_l = wts.L(_mm_sub_ps(LVFU(L[inbr][jnbr]), Lc));
+							nrfctrave = _mm_add_ps(nrfctrave, _mm_mul_ps(dirwt_l, LVFU(nrfactorL[inbr][jnbr])));
+							norm_l = _mm_add_ps(norm_l, dirwt_l);
+						}
+					STVFU(nrfactorAve[i][j], _mm_div_ps(nrfctrave, norm_l));
+				}
+			}
+#endif
+			for (; j<width; j++)
+				nrfactorAve[i][j] = smoothNRFactorPixel(L, nrfactorL, width, height, i, j, step, wts);
+		}
+	}
+	
 	//%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
 	
-	void ImProcFunctions::idirpyr(LabImage* data_coarse, LabImage* data_fine, int level, LUTf &rangefn_L, LUTf & nrwt_l, LUTf & nrwt_ab,
+	void ImProcFunctions::idirpyr(LabImage* data_coarse, LabImage* data_fine, int level, float tonefactor, LUTf & nrwt_l, LUTf & nrwt_ab,
 								  int pitch, int scale, const int luma, const int chroma/*, LUTf & Lcurve, LUTf & abcurve*/ )
 	{
 		
@@ -369,6 +543,8 @@ namespace rtengine {
 		
 		array2D<float> nrfactorL (width,height);
 		
+		DirpyrRangeWeights wts (tonefactor, luma, chroma);
+		
 		//float eps = 0.0;
 		
 		// c[0] noise_L
@@ -403,6 +579,8 @@ namespace rtengine {
 			
 			// step (1-2-3-4) 
 			
+			array2D<float> nrfactorAve (width,height);
+			
 #ifdef _OPENMP
 #pragma omp parallel
 #endif
@@ -445,54 +623,20 @@ namespace rtengine {
 				}
 			
 	if (level<2) {
+		smoothNRFactor(data_fine->L, nrfactorL, nrfactorAve, width, height, 1, wts);
+		
 #ifdef _OPENMP
 #pragma omp for
 #endif
 		for(int  i = 0; i < height; i++)
 			for(int  j = 0; j < width; j++) {
 				
-				float dirwt_l, norm_l;
-				float nrfctrave=0;
-				norm_l = 0;//if we do want to include the input pixel in the sum
-				
-				for(int inbr=MAX(0,i-1); inbr<=MIN(height-1,i+1); inbr++) {
-					for (int jnbr=MAX(0,j-1); jnbr<=MIN(width-1,j+1); jnbr++) {
-						dirwt_l = DIRWT_L(inbr, jnbr, i, j);
-						nrfctrave += dirwt_l*nrfactorL[inbr][jnbr];
-						norm_l += dirwt_l;
-					}
-				}
-				
-				nrfctrave /= norm_l;
-				//nrfctrave = nrfactorL[i][j];
-				//nrfctrave=1;
-				
 				float hipass[3];
 
 				//luma
 				
-				/*if (i>0 && i<height-1 && j>0 && j<width-1) {
-					med3x3(nrfactorL[i-1][j-1], nrfactorL[i-1][j], nrfactorL[i-1][j+1], \
-						   nrfactorL[i][j-1], nrfactorL[i][j], nrfactorL[i][j+1], \
-						   nrfactorL[i+1][j-1], nrfactorL[i+1][j], nrfactorL[i+1][j+1], median);
-					//median = hmf(nrfactorL[i-1][j-1], nrfactorL[i-1][j], nrfactorL[i-1][j+1], \
-								 nrfactorL[i][j-1], nrfactorL[i][j], nrfactorL[i][j+1], \
-								 nrfactorL[i+1][j-1], nrfactorL[i+1][j], nrfactorL[i+1][j+1]);
-					//median = nrfactorL[i][j];
-				} else {
-					median = nrfactorL[i][j];
-				}*/
-				hipass[0] = nrfctrave*(data_fine->L[i][j]-data_coarse->L[i][j]);
-				//hipass[0] = median*(data_fine->L[i][j]-data_coarse->L[i][j]);
-				//hipass[0] = nrfactorL[i][j]*(data_fine->L[i][j]-data_coarse->L[i][j]);
+				hipass[0] = nrfactorAve[i][j]*(data_fine->L[i][j]-data_coarse->L[i][j]);
 				data_fine->L[i][j] = CLIP(hipass[0]+data_coarse->L[i][j]);
-				
-				//chroma
-				//hipass[1] = nrfactorab[i][j]*(data_fine->a[i][j]-data_coarse->a[i][j]);
-				//hipass[2] = nrfactorab[i][j]*(data_fine->b[i][j]-data_coarse->b[i][j]);
-				
-				//data_fine->a[i][j] = hipass[1]+data_coarse->a[i][j];
-				//data_fine->b[i][j] = hipass[2]+data_coarse->b[i][j];
 			}
 	}//end of luminance correction
 	
@@ -636,57 +780,21 @@ namespace rtengine {
 	
 	
 	if (level<2) {
+		//smooth->a and b are not needed any more, a takes the averaged factors
+		smoothNRFactor(data_fine->L, nrfactorL, smooth->a, width, height, pitch, wts);
+		
 #ifdef _OPENMP
 #pragma omp for
 #endif
 		for(int  i = 0; i < height; i++)
 			for(int  j = 0; j < width; j++) {
 				
-				float dirwt_l, norm_l;
-				float nrfctrave=0;
-				norm_l = 0;//if we do want to include the input pixel in the sum
-				
-				for(int inbr=(i-pitch); inbr<=(i+pitch); inbr+=pitch) {
-					if (inbr<0 || inbr>height-1) continue;
-					for (int jnbr=(j-pitch); jnbr<=(j+pitch); jnbr+=pitch) {
-						if (jnbr<0 || jnbr>width-1) continue;
-						dirwt_l = DIRWT_L(inbr, jnbr, i, j);
-						nrfctrave += dirwt_l*nrfactorL[inbr][jnbr];
-						norm_l += dirwt_l;
-					}
-				}
-				
-				nrfctrave /= norm_l;
-				//nrfctrave = nrfactorL[i][j];
-				//nrfctrave=1;
-
-				
 				float hipass[3];
 				
 				//luma
 				
-				/*if (i>0 && i<height-1 && j>0 && j<width-1) {
-					//med3x3(nrfactorL[i-1][j-1], nrfactorL[i-1][j], nrfactorL[i-1][j+1], \
-						   nrfactorL[i][j-1], nrfactorL[i][j], nrfactorL[i][j+1], \
-						   nrfactorL[i+1][j-1], nrfactorL[i+1][j], nrfactorL[i+1][j+1], median);
-					median = hmf(nrfactorL[i-1][j-1], nrfactorL[i-1][j], nrfactorL[i-1][j+1], \
-								 nrfactorL[i][j-1], nrfactorL[i][j], nrfactorL[i][j+1], \
-								 nrfactorL[i+1][j-1], nrfactorL[i+1][j], nrfactorL[i+1][j+1]);
-				} else {
-					median = nrfactorL[i][j];
-				}*/
-				hipass[0] = nrfctrave*(data_fine->L[i][j]-smooth->L[i][j]);
-				//hipass[0] = median*(data_fine->L[i][j]-smooth->L[i][j]);
-				//hipass[0] = nrfactorL[i][j]*(data_fine->L[i][j]-data_coarse->L[i][j]);
+				hipass[0] = smooth->a[i][j]*(data_fine->L[i][j]-smooth->L[i][j]);
 				data_fine->L[i][j] = CLIP(hipass[0]+smooth->L[i][j]);
-				
-				
-				//chroma
-				//hipass[1] = nrfactorab[i][j]*(data_fine->a[i][j]-data_coarse->a[i][j]);
-				//hipass[2] = nrfactorab[i][j]*(data_fine->b[i][j]-data_coarse->b[i][j]);
-				
-				//data_fine->a[i][j] = hipass[1]+data_coarse->a[i][j];
-				//data_fine->b[i][j] = hipass[2]+data_coarse->b[i][j];
 			}
 	}//end of luminance correction
 	
@@ -698,9 +806,6 @@ namespace rtengine {
 	};
 	
 	
-#undef DIRWT_L
-#undef DIRWT_AB
-	
 //#undef NRWT_L	
 #undef NRWT_AB	
 	
@@ -54,6 +54,8 @@ void RawImageSource::fast_demosaic(int winx, int winy, int winw, int winh) {
     const int bord=4;
 		
 	int clip_pt = 4*65535*initialGain;
+
+	const DemosaicKernels* kernels = demosaicKernels();
 	
 	//%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
 #pragma omp parallel
@@ -189,7 +191,10 @@ void RawImageSource::fast_demosaic(int winx, int winy, int winw, int winh) {
 		// interpolate G using gradient weights
 		for (int i=bord; i< H-bord; i++) {
 			float	wtu, wtd, wtl, wtr;
-			for (int j=bord; j < W-bord; j++) {
+			int j=bord;
+			if (kernels)
+				j = kernels->fastGreen(rawData, green[i], i, j, W-bord, FC(i,0)==1 ? 0 : 1);
+			for (; j < W-bord; j++) {
 				
 				if (FC(i,j)==1) {
 					green[i][j] = rawData[i][j];
@@ -218,7 +223,10 @@ void RawImageSource::fast_demosaic(int winx, int winy, int winw, int winh) {
 		
 #pragma omp for 		
 		for (int i=bord; i< H-bord; i++) {
-			for (int j=bord+(FC(i,2)&1); j < W-bord; j+=2) {
+			int j=bord+(FC(i,2)&1);
+			if (kernels)
+				j = kernels->fastRedBlue(rawData, green, red[i], blue[i], i, j, W-bord, FC(i,j)==0, clip_pt);
+			for (; j < W-bord; j+=2) {
 				
 				int c=FC(i,j);
 				//interpolate B/R colors at R/B sites
@@ -244,7 +252,10 @@ void RawImageSource::fast_demosaic(int winx, int winy, int winw, int winh) {
 
 	// interpolate R/B using color differences
 	for (int i=bord; i< H-bord; i++) {
-		for (int j=bord+1-(FC(i,2)&1); j < W-bord; j+=2) {
+		int j=bord+1-(FC(i,2)&1);
+		if (kernels)
+			j = kernels->fastRedBlueAtGreen(green, red, blue, i, j, W-bord);
+		for (; j < W-bord; j+=2) {
 			
 			//interpolate R and B colors at G sites
 			red[i][j] = green[i][j] - 0.25f*((green[i-1][j]-red[i-1][j])+(green[i+1][j]-red[i+1][j])+
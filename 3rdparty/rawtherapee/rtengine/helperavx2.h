@@ -0,0 +1,111 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _HELPERAVX2_H_
+#define _HELPERAVX2_H_
+
+// The helpersse2.h layer on eight lanes. Only usable in translation units
+// compiled with -mavx2, which must not be entered unless the CPU has AVX2
+// (see demosaicKernels()). Never include it together with helpersse2.h.
+
+#ifdef __AVX2__
+#include <immintrin.h>
+
+typedef __m256  vfloat;
+typedef __m256i vint;
+
+#define LVF(x)      _mm256_load_ps(&(x))
+#define LVFU(x)     _mm256_loadu_ps(&(x))
+#define STVF(x,y)   _mm256_store_ps(&(x),(y))
+#define STVFU(x,y)  _mm256_storeu_ps(&(x),(y))
+
+#define VSIZE 8
+
+static inline vfloat F2V (float a) { return _mm256_set1_ps(a); }
+static inline vfloat ZEROV () { return _mm256_setzero_ps(); }
+
+// horizontal sum of the eight lanes
+static inline float vhadd (vfloat a) {
+    __m128 t = _mm_add_ps(_mm256_castps256_ps128(a), _mm256_extractf128_ps(a, 1));
+    t = _mm_add_ps(t, _mm_movehl_ps(t, t));
+    t = _mm_add_ss(t, _mm_shuffle_ps(t, t, 1));
+    return _mm_cvtss_f32(t);
+}
+
+static inline vfloat vmaxf (vfloat a, vfloat b) { return _mm256_max_ps(a, b); }
+static inline vfloat vminf (vfloat a, vfloat b) { return _mm256_min_ps(a, b); }
+
+// clamps to [lo,hi]
+static inline vfloat vclampf (vfloat a, vfloat lo, vfloat hi) { return _mm256_min_ps(_mm256_max_ps(a, lo), hi); }
+
+// eight unsigned shorts to eight floats
+static inline vfloat LVUS (const unsigned short* p) {
+    return _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)p)));
+}
+
+static inline vfloat vabsf (vfloat a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a); }
+
+// rounds towards zero, like a cast to int
+static inline vfloat vtruncf (vfloat a) { return _mm256_round_ps(a, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC); }
+
+// comparisons give a mask with all bits set in the lanes where they hold
+static inline vfloat vmaskf_gt (vfloat a, vfloat b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+static inline vfloat vmaskf_lt (vfloat a, vfloat b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+static inline vfloat vmaskf_or (vfloat a, vfloat b) { return _mm256_or_ps(a, b); }
+
+// a where mask is set, else b
+static inline vfloat vself (vfloat mask, vfloat a, vfloat b) { return _mm256_blendv_ps(b, a, mask); }
+// a where mask is set, else 0
+static inline vfloat vandf (vfloat mask, vfloat a) { return _mm256_and_ps(mask, a); }
+
+// mask of the lanes with (lane & 1) == parity
+static inline vfloat vparitymask (int parity) {
+    return _mm256_castsi256_ps(parity & 1 ? _mm256_setr_epi32(0, -1, 0, -1, 0, -1, 0, -1)
+                                          : _mm256_setr_epi32(-1, 0, -1, 0, -1, 0, -1, 0));
+}
+
+// lanes from memory with a stride of n floats, and back
+static inline vfloat LVFS (const float* p, int n) {
+    return _mm256_i32gather_ps(p, _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(n)), 4);
+}
+static inline void STVFS (float* p, int n, vfloat a) {
+    float t[8];
+    _mm256_storeu_ps(t, a);
+    for (int k = 0; k < 8; k++)
+        p[k*n] = t[k];
+}
+
+// stores only the lanes with (lane & 1) == parity, the others stay untouched
+static inline void STVFALT (float* p, vfloat a, int parity) {
+    _mm256_maskstore_ps(p, _mm256_castps_si256(vparitymask(parity)), a);
+}
+
+// interleaved pairs as in float (*)[2]: loads a0 b0 a1 b1 .. as a and b, and back
+static inline void LVF2U (const float* p, vfloat& a, vfloat& b) {
+    vfloat x = _mm256_loadu_ps(p), y = _mm256_loadu_ps(p + 8);
+    // a0 a1 a4 a5 a2 a3 a6 a7, restored by swapping the middle quarters
+    a = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(_mm256_shuffle_ps(x, y, _MM_SHUFFLE(2,0,2,0))), _MM_SHUFFLE(3,1,2,0)));
+    b = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(_mm256_shuffle_ps(x, y, _MM_SHUFFLE(3,1,3,1))), _MM_SHUFFLE(3,1,2,0)));
+}
+static inline void STVF2U (float* p, vfloat a, vfloat b) {
+    vfloat lo = _mm256_unpacklo_ps(a, b), hi = _mm256_unpackhi_ps(a, b);
+    _mm256_storeu_ps(p, _mm256_permute2f128_ps(lo, hi, 0x20));
+    _mm256_storeu_ps(p + 8, _mm256_permute2f128_ps(lo, hi, 0x31));
+}
+
+#endif
+
+#endif
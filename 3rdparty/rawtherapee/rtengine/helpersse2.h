@@ -0,0 +1,134 @@
+/*
+ *  This file is part of RawTherapee.
+ *
+ *  RawTherapee is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  RawTherapee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with RawTherapee.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _HELPERSSE2_H_
+#define _HELPERSSE2_H_
+
+// Thin layer over the SSE2 intrinsics used by the vectorized code paths.
+// Everything is only defined when the compiler targets SSE2 (always the case
+// on x86-64), code using it has to provide a scalar path for the other cases.
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+
+typedef __m128  vfloat;
+typedef __m128i vint;
+
+#define LVF(x)      _mm_load_ps(&(x))
+#define LVFU(x)     _mm_loadu_ps(&(x))
+#define STVF(x,y)   _mm_store_ps(&(x),(y))
+#define STVFU(x,y)  _mm_storeu_ps(&(x),(y))
+
+static inline vfloat F2V (float a) { return _mm_set1_ps(a); }
+static inline vfloat ZEROV () { return _mm_setzero_ps(); }
+
+// horizontal sum of the four lanes
+static inline float vhadd (vfloat a) {
+    vfloat t = _mm_add_ps(a, _mm_movehl_ps(a, a));
+    t = _mm_add_ss(t, _mm_shuffle_ps(t, t, 1));
+    return _mm_cvtss_f32(t);
+}
+
+static inline vfloat vmaxf (vfloat a, vfloat b) { return _mm_max_ps(a, b); }
+static inline vfloat vminf (vfloat a, vfloat b) { return _mm_min_ps(a, b); }
+
+// clamps to [lo,hi]
+static inline vfloat vclampf (vfloat a, vfloat lo, vfloat hi) { return _mm_min_ps(_mm_max_ps(a, lo), hi); }
+
+// four unsigned shorts to four floats
+static inline vfloat LVUS (const unsigned short* p) {
+    return _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i*)p), _mm_setzero_si128()));
+}
+
+// e^x, the relative error stays below 3e-7. x = n*ln2 + r with |r| <= ln2/2 (ln2 in two parts),
+// a polynomial for e^r, and 2^n through the exponent bits. x is clamped to [-87,88]
+static inline vfloat vexpf (vfloat x) {
+    x = _mm_min_ps(_mm_max_ps(x, _mm_set1_ps(-87.f)), _mm_set1_ps(88.f));
+    vint n = _mm_cvtps_epi32(_mm_mul_ps(x, _mm_set1_ps(1.44269504f)));
+    vfloat fn = _mm_cvtepi32_ps(n);
+    vfloat r = _mm_sub_ps(x, _mm_mul_ps(fn, _mm_set1_ps(0.693359375f)));
+    r = _mm_add_ps(r, _mm_mul_ps(fn, _mm_set1_ps(2.12194440e-4f)));
+    vfloat p = _mm_set1_ps(1.9875691500e-4f);
+    p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(1.3981999507e-3f));
+    p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(8.3334519073e-3f));
+    p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(4.1665795894e-2f));
+    p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(1.6666665459e-1f));
+    p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(5.0000001201e-1f));
+    p = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_mul_ps(p, r), r), r), _mm_set1_ps(1.f));
+    return _mm_mul_ps(p, _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(n, _mm_set1_epi32(127)), 23)));
+}
+
+// Everything below is also provided by helperavx2.h with the same names, so
+// kernels written against it can be compiled for both (see demosaic_kernels.cc)
+
+#define VSIZE 4
+
+static inline vfloat vabsf (vfloat a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+
+// rounds towards zero, like a cast to int
+static inline vfloat vtruncf (vfloat a) { return _mm_cvtepi32_ps(_mm_cvttps_epi32(a)); }
+
+// comparisons give a mask with all bits set in the lanes where they hold
+static inline vfloat vmaskf_gt (vfloat a, vfloat b) { return _mm_cmpgt_ps(a, b); }
+static inline vfloat vmaskf_lt (vfloat a, vfloat b) { return _mm_cmplt_ps(a, b); }
+static inline vfloat vmaskf_or (vfloat a, vfloat b) { return _mm_or_ps(a, b); }
+
+// a where mask is set, else b
+static inline vfloat vself (vfloat mask, vfloat a, vfloat b) {
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+// a where mask is set, else 0
+static inline vfloat vandf (vfloat mask, vfloat a) { return _mm_and_ps(mask, a); }
+
+// mask of the lanes with (lane & 1) == parity
+static inline vfloat vparitymask (int parity) {
+    return _mm_castsi128_ps(parity & 1 ? _mm_setr_epi32(0, -1, 0, -1) : _mm_setr_epi32(-1, 0, -1, 0));
+}
+
+// lanes from memory with a stride of n floats, and back
+static inline vfloat LVFS (const float* p, int n) { return _mm_setr_ps(p[0], p[n], p[2*n], p[3*n]); }
+static inline void STVFS (float* p, int n, vfloat a) {
+    _mm_store_ss(p, a);
+    _mm_store_ss(p + n, _mm_shuffle_ps(a, a, 1));
+    _mm_store_ss(p + 2*n, _mm_shuffle_ps(a, a, 2));
+    _mm_store_ss(p + 3*n, _mm_shuffle_ps(a, a, 3));
+}
+
+// stores only the lanes with (lane & 1) == parity, the others stay untouched
+static inline void STVFALT (float* p, vfloat a, int parity) {
+    if (parity & 1) {
+        _mm_store_ss(p + 1, _mm_shuffle_ps(a, a, 1));
+        _mm_store_ss(p + 3, _mm_shuffle_ps(a, a, 3));
+    } else {
+        _mm_store_ss(p, a);
+        _mm_store_ss(p + 2, _mm_movehl_ps(a, a));
+    }
+}
+
+// interleaved pairs as in float (*)[2]: loads a0 b0 a1 b1 .. as a and b, and back
+static inline void LVF2U (const float* p, vfloat& a, vfloat& b) {
+    vfloat x = _mm_loadu_ps(p), y = _mm_loadu_ps(p + 4);
+    a = _mm_shuffle_ps(x, y, _MM_SHUFFLE(2,0,2,0));
+    b = _mm_shuffle_ps(x, y, _MM_SHUFFLE(3,1,3,1));
+}
+static inline void STVF2U (float* p, vfloat a, vfloat b) {
+    _mm_storeu_ps(p, _mm_unpacklo_ps(a, b));
+    _mm_storeu_ps(p + 4, _mm_unpackhi_ps(a, b));
+}
+
+#endif
+
+#endif
@@ -23,14 +23,19 @@
 #include <netinet/in.h>
 #endif
 #include "iccmatrices.h"
+#include "colorlut.h"
 #include <glib/gstdio.h>
 #include "safegtk.h"
 #include "options.h"
+#include "rtengine.h"
+#include "settings.h"
 
 #include <cstring>
 
 namespace rtengine {
 
+extern const Settings* settings;
+
 const double (*wprofiles[])[3]  = {xyz_sRGB, xyz_adobe, xyz_prophoto, xyz_widegamut, xyz_bruce, xyz_beta, xyz_best};
 const double (*iwprofiles[])[3] = {sRGB_xyz, adobe_xyz, prophoto_xyz, widegamut_xyz, bruce_xyz, beta_xyz, best_xyz};
 const char* wpnames[] = {"sRGB", "Adobe RGB", "ProPhoto", "WideGamut", "BruceRGB", "Beta RGB", "BestRGB"};         
@@ -192,6 +197,181 @@ ProfileContent ICCStore::getContent (Glib::ustring name) {
     return fileProfileContents[name];
 }
 
+// the MD5 of the profile, computed once per handle. cmsMD5computeID serializes the profile and
+// changes its header meanwhile, so it must not run again on a profile another thread may read.
+// A handle that was freed and reused shows another ID in its header and is computed anew.
+// lcmsMutex has to be locked
+bool ICCStore::profileID (cmsHPROFILE profile, cmsUInt8Number* id) {
+
+    std::map<cmsHPROFILE, std::string>::iterator r = profileIDs.find (profile);
+    cmsGetHeaderProfileID (profile, id);
+    if (r!=profileIDs.end() && memcmp (r->second.data(), id, 16)==0)
+        return true;
+
+    if (!cmsMD5computeID (profile))
+        return false;
+    cmsGetHeaderProfileID (profile, id);
+
+    // the per image profiles come and go, keep the map small
+    if (profileIDs.size()>=256)
+        profileIDs.clear ();
+    profileIDs[profile].assign ((const char*)id, 16);
+    return true;
+}
+
+// the profiles are often created per image (camera matrices, modified output profiles),
+// so the key is their content and not the handle. lcmsMutex has to be locked
+bool ICCStore::transformKey (cmsHPROFILE in, cmsUInt32Number inFormat, cmsHPROFILE out, cmsUInt32Number outFormat, int intent, cmsUInt32Number flags, std::string& key) {
+
+    if (in==NULL || out==NULL || settings->iccTransformCache<=0)
+        return false;
+
+    cmsUInt8Number id[2*16 + 4*sizeof(cmsUInt32Number)];
+    if (!profileID (in, id) || !profileID (out, id + 16))
+        return false;
+
+    cmsUInt32Number params[4] = { inFormat, outFormat, (cmsUInt32Number)intent, flags };
+    memcpy (id + 32, params, sizeof(params));
+    key.assign ((const char*)id, sizeof(id));
+    return true;
+}
+
+cmsHTRANSFORM ICCStore::getTransform (cmsHPROFILE in, cmsUInt32Number inFormat, cmsHPROFILE out, cmsUInt32Number outFormat, int intent, cmsUInt32Number flags) {
+
+    Glib::Mutex::Lock lock(*lcmsMutex);
+
+    std::string name;
+    if (!transformKey (in, inFormat, out, outFormat, intent, flags, name))
+        return cmsCreateTransform (in, inFormat, out, outFormat, intent, flags);
+
+    std::map<std::string, CachedTransform>::iterator r = transforms.find (name);
+    if (r!=transforms.end()) {
+        transformLRU.splice (transformLRU.end(), transformLRU, r->second.lru);
+        r->second.users++;
+        return r->second.transform;
+    }
+
+    cmsHTRANSFORM transform = cmsCreateTransform (in, inFormat, out, outFormat, intent, flags);
+    if (transform==NULL)
+        return NULL;
+
+    CachedTransform& ct = transforms[name];
+    ct.transform = transform;
+    ct.lut = NULL;
+    ct.users = 1;
+    ct.lru = transformLRU.insert (transformLRU.end(), name);
+    transformKeys[transform] = name;
+
+    evictTransforms (settings->iccTransformCache);
+    return transform;
+}
+
+void ICCStore::releaseTransform (cmsHTRANSFORM transform) {
+
+    if (transform==NULL)
+        return;
+
+    Glib::Mutex::Lock lock(*lcmsMutex);
+
+    if (transformKeys.find (transform)==transformKeys.end())
+        cmsDeleteTransform (transform);
+    else
+        releaseCached (transform);
+}
+
+const ColorLUT* ICCStore::getLUT (cmsHPROFILE in, cmsHPROFILE out, int intent, cmsUInt32Number flags, int grid) {
+
+    std::string name;
+    bool cache;
+    {
+        Glib::Mutex::Lock lock(*lcmsMutex);
+
+        cache = transformKey (in, 0, out, grid, intent, flags, name);
+        if (cache) {
+            std::map<std::string, CachedTransform>::iterator r = transforms.find (name);
+            if (r!=transforms.end()) {
+                transformLRU.splice (transformLRU.end(), transformLRU, r->second.lru);
+                r->second.users++;
+                return r->second.lut;
+            }
+        }
+    }
+
+    // building the nodes takes a while, the other jobs get their transforms meanwhile
+    ColorLUT* lut = new ColorLUT (in, out, intent, flags, grid);
+    if (!lut->isValid()) {
+        delete lut;
+        return NULL;
+    }
+    if (!cache)
+        return lut;
+
+    Glib::Mutex::Lock lock(*lcmsMutex);
+
+    // another thread may have built the same LUT in the meantime
+    std::map<std::string, CachedTransform>::iterator r = transforms.find (name);
+    if (r!=transforms.end()) {
+        delete lut;
+        transformLRU.splice (transformLRU.end(), transformLRU, r->second.lru);
+        r->second.users++;
+        return r->second.lut;
+    }
+
+    CachedTransform& ct = transforms[name];
+    ct.transform = NULL;
+    ct.lut = lut;
+    ct.users = 1;
+    ct.lru = transformLRU.insert (transformLRU.end(), name);
+    transformKeys[lut] = name;
+
+    evictTransforms (settings->iccTransformCache);
+    return lut;
+}
+
+void ICCStore::releaseLUT (const ColorLUT* lut) {
+
+    if (lut==NULL)
+        return;
+
+    Glib::Mutex::Lock lock(*lcmsMutex);
+
+    if (transformKeys.find (lut)==transformKeys.end())
+        delete lut;
+    else
+        releaseCached (lut);
+}
+
+// lcmsMutex has to be locked
+void ICCStore::releaseCached (const void* compiled) {
+
+    transforms[transformKeys[compiled]].users--;
+    evictTransforms (settings->iccTransformCache);
+}
+
+// drops unused transforms, least recently used first, until at most maxTransforms are left.
+// Transforms in use stay even if that leaves more. lcmsMutex has to be locked
+void ICCStore::evictTransforms (int maxTransforms) {
+
+    std::list<std::string>::iterator i = transformLRU.begin();
+    while ((int)transforms.size()>maxTransforms && i!=transformLRU.end()) {
+        std::map<std::string, CachedTransform>::iterator r = transforms.find (*i);
+        if (r->second.users>0) {
+            ++i;
+            continue;
+        }
+        if (r->second.transform) {
+            transformKeys.erase (r->second.transform);
+            cmsDeleteTransform (r->second.transform);
+        }
+        else {
+            transformKeys.erase (r->second.lut);
+            delete r->second.lut;
+        }
+        transforms.erase (r);
+        i = transformLRU.erase (i);
+    }
+}
+
 // Reads all profiles from the given profiles dir
 void ICCStore::init (Glib::ustring usrICCDir, Glib::ustring rtICCDir) {
 
@@ -21,11 +21,14 @@
 
 #include <lcms2.h>
 #include <glibmm.h>
+#include <list>
 #include <map>
 #include <string>
 
 namespace rtengine {
 
+class ColorLUT;
+
 typedef const double (*TMatrix)[3];
 
 class ProfileContent {
@@ -63,8 +66,26 @@ class ICCStore {
 
         Glib::Mutex mutex_;
 
+        // compiled transforms and LUTs, keyed by the MD5 of both profiles, the formats (0 and the
+        // grid for LUTs), the intent and the flags. Guarded by lcmsMutex, like the creation of
+        // transforms everywhere else
+        struct CachedTransform {
+            cmsHTRANSFORM transform;
+            ColorLUT* lut;
+            int users;
+            std::list<std::string>::iterator lru;
+        };
+        std::map<std::string, CachedTransform> transforms;
+        std::map<const void*, std::string> transformKeys;
+        std::list<std::string> transformLRU;    // least recently used first
+        std::map<cmsHPROFILE, std::string> profileIDs;  // MD5 of the profiles, see profileID
+
         ICCStore (); 
         void loadICCs(Glib::ustring rootDirName, bool nameUpper, std::map<std::string, cmsHPROFILE>& resultProfiles, std::map<std::string, ProfileContent> &resultProfileContents);
+        void evictTransforms (int maxTransforms);
+        bool profileID (cmsHPROFILE profile, cmsUInt8Number* id);
+        bool transformKey (cmsHPROFILE in, cmsUInt32Number inFormat, cmsHPROFILE out, cmsUInt32Number outFormat, int intent, cmsUInt32Number flags, std::string& key);
+        void releaseCached (const void* compiled);
         
     public:
 
@@ -89,6 +110,21 @@ class ICCStore {
         cmsHPROFILE getXYZProfile ()  { return xyz;  }
         cmsHPROFILE getsRGBProfile () { return srgb; }
         std::vector<std::string> getOutputProfiles ();
+
+        /** Returns the transform between two profiles, like cmsCreateTransform. Transforms are kept
+          * for later calls with profiles of the same content and shared by all threads, up to
+          * settings->iccTransformCache of them; the least recently used unused one is dropped first.
+          * The transform has to be given back with releaseTransform, never with cmsDeleteTransform.
+          * @return the transform, or NULL if lcms cannot create it */
+        cmsHTRANSFORM getTransform (cmsHPROFILE in, cmsUInt32Number inFormat, cmsHPROFILE out, cmsUInt32Number outFormat, int intent, cmsUInt32Number flags);
+        /** Gives back a transform of getTransform. NULL is ignored. */
+        void releaseTransform (cmsHTRANSFORM transform);
+        /** Returns the transform baked into a 3D LUT with grid nodes per axis, cached like the
+          * transforms of getTransform. Building one takes a few ten ms.
+          * @return the LUT, or NULL if the profiles are not supported (see ColorLUT) */
+        const ColorLUT* getLUT (cmsHPROFILE in, cmsHPROFILE out, int intent, cmsUInt32Number flags, int grid);
+        /** Gives back a LUT of getLUT. NULL is ignored. */
+        void releaseLUT (const ColorLUT* lut);
 };
 
 #define iccStore ICCStore::getInstance()
@@ -90,6 +90,10 @@ namespace rtengine {
         /** Returns the "blue" plane data.
           * @return the two dimensional array of the blue plane */
             virtual unsigned short** getBPlane ()=0;
+        /** Returns the output ICC profile set by the processing, if any.
+          * @param length is set to the length of the profile data, 0 if there is none
+          * @param pdata is set to the profile data, it remains owned by the image */
+            virtual void getOutputProfileData (int& length, char*& pdata)=0;
     };
 	
 	/** This class represents an image having a float pixel planar representation. 
@@ -87,6 +87,7 @@ class Image16 : public ImageIO, public IImage16 {
         virtual unsigned short** getRPlane () { return r; }
         virtual unsigned short** getGPlane () { return g; }
         virtual unsigned short** getBPlane () { return b; }
+        virtual void getOutputProfileData (int& length, char*& pdata) { pdata = profileData; length = profileData ? profileLength : 0; }
 
         void ExecCMSTransform(cmsHTRANSFORM hTransform, bool safe);
     };
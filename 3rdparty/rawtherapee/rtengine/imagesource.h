@@ -70,6 +70,9 @@ class ImageSource : public InitialImage {
         virtual int         load        (Glib::ustring fname, bool batch = false) =0;
         virtual void        preprocess  (const RAWParams &raw){};
         virtual void        demosaic    (const RAWParams &raw){};
+        // replaces demosaic if the image is only read with getImage at skip >= 2,
+        // returns false if the source has no cheaper way than demosaic
+        virtual bool        demosaicSuperpixel (){ return false; };
         virtual void        flushRawData       (){};
         virtual void        flushRGB           (){};
         virtual void        HLRecovery_Global  (HRecParams hrp){};
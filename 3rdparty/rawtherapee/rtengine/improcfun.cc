@@ -208,7 +208,7 @@ void ImProcFunctions::firstAnalysis (Imagefloat* original, const ProcParams* par
 
 // Process RGB image and convert to LAB space
 void ImProcFunctions::rgbProc (Imagefloat* working, LabImage* lab, LUTf & hltonecurve, LUTf & shtonecurve, LUTf & tonecurve,
-							   SHMap* shmap, int sat, LUTf & rCurve, LUTf & gCurve, LUTf & bCurve) {
+							   SHMap* shmap, int sat, LUTf & rCurve, LUTf & gCurve, LUTf & bCurve, LUTu* histogram) {
 
     int h_th, s_th;
     if (shmap) {
@@ -272,8 +272,36 @@ void ImProcFunctions::rgbProc (Imagefloat* working, LabImage* lab, LUTf & hltone
 	const float shoulder = ((65536.0/MAX(1,exp_scale))*(params->toneCurve.hlcomprthresh/200.0))+0.1;
 	const float hlrange = 65536.0-shoulder;
 	
+	// the L histogram is added up per thread, rather than in a pass of its own afterwards
+#ifdef _OPENMP
+	int T = histogram ? omp_get_max_threads() : 0;
+#else
+	int T = histogram ? 1 : 0;
+#endif
+	unsigned int** hist = new unsigned int* [T];
+	for (int i=0; i<T; i++) {
+		hist[i] = new unsigned int[65536];
+		memset (hist[i], 0, 65536*sizeof(int));
+	}
 	
-#pragma omp parallel for if (multiThread)
+#pragma omp parallel if (multiThread)
+{
+#ifdef _OPENMP
+	unsigned int* rowHist = histogram ? hist[omp_get_thread_num()] : NULL;
+#else
+	unsigned int* rowHist = histogram ? hist[0] : NULL;
+#endif
+
+	// a row goes through in passes, so that the tone curves and cachef are
+	// looked up four pixels at a time (see LUT::interpolate)
+	float* rbuf = new float[tW];
+	float* gbuf = new float[tW];
+	float* bbuf = new float[tW];
+	float* fxbuf = new float[tW];
+	float* fybuf = new float[tW];
+	float* fzbuf = new float[tW];
+
+#pragma omp for
     for (int i=0; i<tH; i++) {
 
         for (int j=0; j<tW; j++) {
@@ -330,14 +358,24 @@ void ImProcFunctions::rgbProc (Imagefloat* working, LabImage* lab, LUTf & hltone
 			//shadow tone curve
 			float Y = (0.299*r + 0.587*g + 0.114*b);
 			tonefactor = shtonecurve[Y];
-			r *= tonefactor;
-			g *= tonefactor;
-			b *= tonefactor;
-			
-			//brightness/contrast and user tone curve
-			r = rCurve[tonecurve[r]];
-			g = gCurve[tonecurve[g]];
-			b = bCurve[tonecurve[b]];
+			rbuf[j] = r*tonefactor;
+			gbuf[j] = g*tonefactor;
+			bbuf[j] = b*tonefactor;
+		}
+
+		//brightness/contrast and user tone curve
+		tonecurve.interpolate (rbuf, rbuf, tW);
+		tonecurve.interpolate (gbuf, gbuf, tW);
+		tonecurve.interpolate (bbuf, bbuf, tW);
+		rCurve.interpolate (rbuf, rbuf, tW);
+		gCurve.interpolate (gbuf, gbuf, tW);
+		bCurve.interpolate (bbuf, bbuf, tW);
+
+        for (int j=0; j<tW; j++) {
+
+			float r = rbuf[j];
+			float g = gbuf[j];
+			float b = bbuf[j];
 			
 			//if (r<0 || g<0 || b<0) {
 			//	printf("negative values row=%d col=%d  r=%f  g=%f  b=%f  \n", i,j,r,g,b);
@@ -393,24 +431,36 @@ void ImProcFunctions::rgbProc (Imagefloat* working, LabImage* lab, LUTf & hltone
 			//g=FCLIP(g);
 			//b=FCLIP(b);
 			
-            float x = (toxyz[0][0] * r + toxyz[0][1] * g + toxyz[0][2] * b) ;
-            float y = (toxyz[1][0] * r + toxyz[1][1] * g + toxyz[1][2] * b) ;
-            float z = (toxyz[2][0] * r + toxyz[2][1] * g + toxyz[2][2] * b) ;
+            rbuf[j] = (toxyz[0][0] * r + toxyz[0][1] * g + toxyz[0][2] * b) ;
+            gbuf[j] = (toxyz[1][0] * r + toxyz[1][1] * g + toxyz[1][2] * b) ;
+            bbuf[j] = (toxyz[2][0] * r + toxyz[2][1] * g + toxyz[2][2] * b) ;
+		}
+
+		// above 65535 the lookups are not used
+		cachef.interpolate (rbuf, fxbuf, tW);
+		cachef.interpolate (gbuf, fybuf, tW);
+		cachef.interpolate (bbuf, fzbuf, tW);
+
+        for (int j=0; j<tW; j++) {
+
+			float x = rbuf[j];
+			float y = gbuf[j];
+			float z = bbuf[j];
 			
 			float fx,fy,fz;
 			
 			//if (x>0) {
-				fx = (x<65535.0 ? cachef[x] : (327.68*exp(log(x/MAXVAL)/3.0 )));
+				fx = (x<65535.0 ? fxbuf[j] : (327.68*exp(log(x/MAXVAL)/3.0 )));
 			//} else {
 			//	fx = (x>-65535.0 ? -cachef[-x] : (-327.68*exp(log(-x/MAXVAL)/3.0 )));
 			//}
 			//if (y>0) {
-				fy = (y<65535.0 ? cachef[y] : (327.68*exp(log(y/MAXVAL)/3.0 )));
+				fy = (y<65535.0 ? fybuf[j] : (327.68*exp(log(y/MAXVAL)/3.0 )));
 			//} else {
 			//	fy = (y>-65535.0 ? -cachef[-y] : (-327.68*exp(log(-y/MAXVAL)/3.0 )));
 			//}
 			//if (z>0) {
-				fz = (z<65535.0 ? cachef[z] : (327.68*exp(log(z/MAXVAL)/3.0 )));
+				fz = (z<65535.0 ? fzbuf[j] : (327.68*exp(log(z/MAXVAL)/3.0 )));
 			//} else {
 			//	fz = (z>-65535.0 ? -cachef[-z] : (-327.68*exp(log(-z/MAXVAL)/3.0 )));
 			//}
@@ -419,6 +469,8 @@ void ImProcFunctions::rgbProc (Imagefloat* working, LabImage* lab, LUTf & hltone
             lab->a[i][j] = (500.0 * (fx - fy) );
             lab->b[i][j] = (200.0 * (fy - fz) );
 			
+			if (rowHist)
+				rowHist[CLIP((int)lab->L[i][j])]++;
 
 			
 			//test for color accuracy
@@ -437,7 +489,22 @@ void ImProcFunctions::rgbProc (Imagefloat* working, LabImage* lab, LUTf & hltone
 
         }
     }
+
+	delete [] rbuf;
+	delete [] gbuf;
+	delete [] bbuf;
+	delete [] fxbuf;
+	delete [] fybuf;
+	delete [] fzbuf;
+}
 	
+	for (int i=0; i<T; i++) {
+		for (int j=0; j<65536; j++)
+			(*histogram)[j] += hist[i][j];
+		delete [] hist[i];
+	}
+	delete [] hist;
+
 	if (hCurveEnabled) delete hCurve;
 	if (sCurveEnabled) delete sCurve;
 	if (vCurveEnabled) delete vCurve;
@@ -505,6 +572,81 @@ void ImProcFunctions::chrominanceCurve (LabImage* lold, LabImage* lnew, LUTf & a
 
 	}
 	
+void ImProcFunctions::labCurvesRow (LabImage* lab, int row, LabCurves & curves) {
+
+	float* L = lab->L[row];
+	float* a = lab->a[row];
+	float* b = lab->b[row];
+	LUTf & curve = *curves.curve;
+	LUTf & acurve = *curves.acurve;
+	LUTf & bcurve = *curves.bcurve;
+	LUTf & satcurve = *curves.satcurve;
+
+	// first the three curves, four pixels at a time
+	int j = 0;
+#ifdef __SSE2__
+	vfloat offsetv = F2V(32768.0f);
+	for (; j<lab->W-3; j+=4) {
+		STVFU(L[j], curve[LVFU(L[j])]);
+		STVFU(a[j], _mm_sub_ps(acurve[_mm_add_ps(LVFU(a[j]), offsetv)], offsetv));
+		STVFU(b[j], _mm_sub_ps(bcurve[_mm_add_ps(LVFU(b[j]), offsetv)], offsetv));
+	}
+#endif
+	for (; j<lab->W; j++) {
+		L[j] = curve[L[j]];
+		a[j] = acurve[a[j]+32768.0f]-32768.0f;
+		b[j] = bcurve[b[j]+32768.0f]-32768.0f;
+	}
+
+	for (int j=0; j<lab->W; j++) {
+		float atmp = a[j];
+		float btmp = b[j];
+
+		if (params->labCurve.saturation) {
+			float chroma = sqrt(SQR(atmp)+SQR(btmp)+0.001);
+			float satfactor = (satcurve[chroma+32768.0f]-32768.0f)/chroma;
+			atmp *= satfactor;
+			btmp *= satfactor;
+		}
+
+		if (params->labCurve.avoidclip) {
+			//Luv limiter
+			float Y,u,v;
+			Lab2Yuv(L[j],atmp,btmp,Y,u,v);
+			//Yuv2Lab includes gamut restriction map
+			Yuv2Lab(Y,u,v,L[j],a[j],b[j], curves.wp);
+		} else {
+			a[j] = atmp;
+			b[j] = btmp;
+		}
+	}
+}
+
+// luminanceCurve, chrominanceCurve and vibrance are point operations, so a row gets all
+// three before the next one is read. With vibrance the curves run inside of its pass.
+void ImProcFunctions::labCurves (LabImage* lab, LUTf & curve, LUTf & acurve, LUTf & bcurve, LUTf & satcurve) {
+
+	LabCurves curves;
+	curves.curve = &curve;
+	curves.acurve = &acurve;
+	curves.bcurve = &bcurve;
+	curves.satcurve = &satcurve;
+
+	TMatrix wprof = iccStore->workingSpaceMatrix (params->icm.working);
+	for (int i=0; i<3; i++)
+		for (int j=0; j<3; j++)
+			curves.wp[i][j] = wprof[i][j];
+
+	if (params->vibrance.enabled && (params->vibrance.pastels || params->vibrance.saturated)) {
+		vibrance (lab, &curves);
+		return;
+	}
+
+#pragma omp parallel for if (multiThread)
+	for (int i=0; i<lab->H; i++)
+		labCurvesRow (lab, i, curves);
+}
+
 
 //#include "cubic.cc"
 
@@ -620,7 +762,7 @@ void ImProcFunctions::colorCurve (LabImage* lold, LabImage* lnew) {
 
 //Map tones by way of edge preserving decomposition. Is this the right way to include source?
 #include "EdgePreservingDecomposition.cc"
-void ImProcFunctions::EPDToneMap(LabImage *lab, unsigned int Iterates, int skip){
+void ImProcFunctions::EPDToneMap(LabImage *lab, unsigned int Iterates, int skip, double outputScale){
 	//Hasten access to the parameters.
 	EPDParams *p = (EPDParams *)(&params->edgePreservingDecompositionUI);
 
@@ -633,7 +775,12 @@ void ImProcFunctions::EPDToneMap(LabImage *lab, unsigned int Iterates, int skip)
 	float *b = lab->b[0];
 	unsigned int i, N = lab->W*lab->H;
 
-	EdgePreservingDecomposition epd = EdgePreservingDecomposition(lab->W, lab->H);
+	//If the result gets downscaled by 2 or more anyway, the blur can be solved at about the output size.
+	unsigned int Reduction = 1;
+	if(settings->epdDownscale && outputScale > 0.0 && outputScale <= 0.5)
+		Reduction = (unsigned int)(1.0/outputScale + 1e-5);
+
+	EdgePreservingDecomposition epd = EdgePreservingDecomposition(lab->W, lab->H, settings->epdSolver, Reduction);
 
 	//Due to the taking of logarithms, L must be nonnegative. Further, scale to 0 to 1 using nominal range of L, 0 to 15 bit.
 	float minL = FLT_MAX;
@@ -32,6 +32,16 @@ namespace rtengine {
 
 using namespace procparams;
 
+// the tables of luminanceCurve and chrominanceCurve, for applying them row by row
+// inside of the vibrance pass (see ImProcFunctions::labCurves)
+struct LabCurves {
+	LUTf* curve;
+	LUTf* acurve;
+	LUTf* bcurve;
+	LUTf* satcurve;
+	double wp[3][3];
+};
+
 class ImProcFunctions {
 
 		static LUTf gamma2curve;
@@ -50,6 +60,7 @@ class ImProcFunctions {
 		void sharpenHaloCtrl    (LabImage* lab, float** blurmap, float** base, int W, int H);
 		void firstAnalysisThread(Imagefloat* original, Glib::ustring wprofile, unsigned int* histogram, int row_from, int row_to);
 		void dcdamping          (float** aI, float** aO, float damping, int W, int H);
+		void labCurvesRow       (LabImage* lab, int row, LabCurves & curves);
 
 		bool needsCA            ();
 		bool needsDistortion    ();
@@ -112,10 +123,11 @@ class ImProcFunctions {
 
 		void firstAnalysis    (Imagefloat* working, const ProcParams* params, LUTu & vhist16, double gamma);
 		void rgbProc          (Imagefloat* working, LabImage* lab, LUTf & hltonecurve, LUTf & shtonecurve, LUTf & tonecurve,
-							   SHMap* shmap, int sat, LUTf & rCurve, LUTf & gCurve, LUTf & bCurve);
+							   SHMap* shmap, int sat, LUTf & rCurve, LUTf & gCurve, LUTf & bCurve, LUTu* histogram=NULL);
 		void luminanceCurve   (LabImage* lold, LabImage* lnew, LUTf &curve);
 		void chrominanceCurve (LabImage* lold, LabImage* lnew, LUTf &acurve, LUTf &bcurve, LUTf & satcurve);
-		void vibrance 		  (LabImage* lab);//Jacques' vibrance
+		void labCurves        (LabImage* lab, LUTf &curve, LUTf &acurve, LUTf &bcurve, LUTf & satcurve);// luminanceCurve, chrominanceCurve and vibrance in one pass
+		void vibrance 		  (LabImage* lab, LabCurves* curves=NULL);//Jacques' vibrance
 		void skinsat 		  (float lum, float hue, float chrom, float &satreduc);//jacques Skin color
 		void MunsellLch 	  (float lum, float hue, float chrom, float memChprov, float &correction, int zone);//jacques:  Munsell correction
 		void colorCurve       (LabImage* lold, LabImage* lnew);
@@ -123,6 +135,10 @@ class ImProcFunctions {
 		void transform        (Imagefloat* original, Imagefloat* transformed, int cx, int cy, int sx, int sy, int oW, int oH);
 		void lab2monitorRgb   (LabImage* lab, Image8* image);
 		void resize           (Image16* src, Image16* dst, float dScale);
+		void resize           (Imagefloat* src, Imagefloat* dst, float dScale); // Lanczos only
+		void resize           (LabImage* src, LabImage* dst, float dScale);     // Lanczos only
+		// the Lanczos resize of three float planes, for images outside of the pipeline
+		static void resizePlanes (const float** const src[3], int sw, int sh, float** const dst[3], int dw, int dh, float scale, bool multiThread);
 		void deconvsharpening (LabImage* lab, float** buffer);
 		void MLsharpen (LabImage* lab);// Manuel's clarity / sharpening
 		void MLmicrocontrast(LabImage* lab ); //Manuel's microcontrast
@@ -132,13 +148,13 @@ class ImProcFunctions {
 		void dirpyrdenoise    (LabImage* lab);//Emil's pyramid denoise
 		void dirpyrequalizer  (LabImage* lab);//Emil's equalizer
 
-		void EPDToneMap(LabImage *lab, unsigned int Iterates = 0, int skip = 1);
+		void EPDToneMap(LabImage *lab, unsigned int Iterates = 0, int skip = 1, double outputScale = 1.0);
 		
 		procparams::DirPyrDenoiseParams dnparams;
 		void dirpyrLab_denoise(LabImage * src, LabImage * dst, const procparams::DirPyrDenoiseParams & dnparams );//Emil's directional pyramid denoise
-		void dirpyr           (LabImage* data_fine, LabImage* data_coarse, int level, LUTf &rangefn_L, LUTf &rangefn_ab,
+		void dirpyr           (LabImage* data_fine, LabImage* data_coarse, int level, float tonefactor,
 							   int pitch, int scale, const int luma, int chroma );
-		void idirpyr          (LabImage* data_coarse, LabImage* data_fine, int level, LUTf &rangefn_L, LUTf & nrwt_l, LUTf & nrwt_ab,
+		void idirpyr          (LabImage* data_coarse, LabImage* data_fine, int level, float tonefactor, LUTf & nrwt_l, LUTf & nrwt_ab,
 							   int pitch, int scale, const int luma, const int chroma/*, LUTf & Lcurve, LUTf & abcurve*/ );
 
 		void dirpyrLab_equalizer (LabImage * src, LabImage * dst, const double * mult );//Emil's directional pyramid equalizer
@@ -73,7 +73,8 @@ void StagedImageProcessor::destroy (StagedImageProcessor* sip) {
 
 Settings* Settings::create  () {
     
-    return new Settings;
+    // value initialized, new members default to 0 / false
+    return new Settings ();
 }
 
 void Settings::destroy (Settings* s) {
@@ -149,10 +149,8 @@ Image8* ImProcFunctions::lab2rgb (LabImage* lab, int cx, int cy, int cw, int ch,
 
     if (oprof) {
         cmsHPROFILE iprof = iccStore->getXYZProfile ();
-        lcmsMutex->lock ();
-        cmsHTRANSFORM hTransform = cmsCreateTransform (iprof, TYPE_RGB_16, oprof, TYPE_RGB_8, settings->colorimetricIntent,
+        cmsHTRANSFORM hTransform = iccStore->getTransform (iprof, TYPE_RGB_16, oprof, TYPE_RGB_8, settings->colorimetricIntent,
             cmsFLAGS_NOOPTIMIZE | cmsFLAGS_NOCACHE );  // NOCACHE is important for thread safety
-        lcmsMutex->unlock ();
 
         // cmsDoTransform is relatively expensive
 		#pragma omp parallel for
@@ -184,7 +182,7 @@ Image8* ImProcFunctions::lab2rgb (LabImage* lab, int cx, int cy, int cw, int ch,
             cmsDoTransform (hTransform, buffer, image->data + ix, cw);
         }
 
-        cmsDeleteTransform(hTransform);
+        iccStore->releaseTransform (hTransform);
     } else {
 		
 		float rgb_xyz[3][3];
@@ -267,12 +265,10 @@ Image16* ImProcFunctions::lab2rgb16 (LabImage* lab, int cx, int cy, int cw, int
 		}
 
         cmsHPROFILE iprof = iccStore->getXYZProfile ();
-        lcmsMutex->lock ();
-		cmsHTRANSFORM hTransform = cmsCreateTransform (iprof, TYPE_RGB_16_PLANAR, oprof, TYPE_RGB_16_PLANAR, settings->colorimetricIntent, cmsFLAGS_NOOPTIMIZE);
-        lcmsMutex->unlock ();
+		cmsHTRANSFORM hTransform = iccStore->getTransform (iprof, TYPE_RGB_16_PLANAR, oprof, TYPE_RGB_16_PLANAR, settings->colorimetricIntent, cmsFLAGS_NOOPTIMIZE);
 
 		cmsDoTransform (hTransform, image->data, image->data, image->planestride);
-		cmsDeleteTransform(hTransform);
+		iccStore->releaseTransform (hTransform);
 	} else {
 		#pragma omp parallel for if (multiThread)
 		for (int i=cy; i<cy+ch; i++) {
@@ -406,12 +402,10 @@ Image16* ImProcFunctions::lab2rgb16b (LabImage* lab, int cx, int cy, int cw, int
 		}
 
         cmsHPROFILE iprof = iccStore->getXYZProfile ();
-        lcmsMutex->lock ();
-		cmsHTRANSFORM hTransform = cmsCreateTransform (iprof, TYPE_RGB_16_PLANAR, oprofdef, TYPE_RGB_16_PLANAR, settings->colorimetricIntent, cmsFLAGS_NOOPTIMIZE);
-        lcmsMutex->unlock ();
+		cmsHTRANSFORM hTransform = iccStore->getTransform (iprof, TYPE_RGB_16_PLANAR, oprofdef, TYPE_RGB_16_PLANAR, settings->colorimetricIntent, cmsFLAGS_NOOPTIMIZE);
 
 		cmsDoTransform (hTransform, image->data, image->data, image->planestride);
-		cmsDeleteTransform(hTransform);
+		iccStore->releaseTransform (hTransform);
 	} else {
 	// 
 		#pragma omp parallel for if (multiThread)
@@ -18,6 +18,7 @@
  */
 
 #include "improcfun.h"
+#include "helpersse2.h"
 
 #ifdef _OPENMP
 #include <omp.h>
@@ -51,127 +52,266 @@ static inline float Lanc(float x, float a)
     }
 }
 
-static void Lanczos(const Image16* src, Image16* dst, float scale)
-{
-    const float delta = 1.0f / scale;
-    const float a = 3.0f;
-    const float sc = std::min(scale, 1.0f);
-    const int support = static_cast<int>(2.0f * a / sc) + 1;
-    
-    // storage for precomputed parameters for horisontal interpolation
-    float * wwh = new float[support * dst->width];
-    int * jj0 = new int[dst->width];
-    int * jj1 = new int[dst->width];
-    
-    // temporal storage for vertically-interpolated row of pixels
-    float * lr = new float[src->width];
-    float * lg = new float[src->width];
-    float * lb = new float[src->width];
-
-    // Phase 1: precompute coefficients for horisontal interpolation
-    
-    for (int j = 0; j < dst->width; j++) {
-    
-        // x coord of the center of pixel on src image
-        float x0 = (static_cast<float>(j) + 0.5f) * delta - 0.5f;
-
-        // weights for interpolation in horisontal direction
-        float * w = wwh + j * support;
-        
-        // sum of weights used for normalization
-        float ws = 0.0f;
-
-        jj0[j] = std::max(0, static_cast<int>(floorf(x0 - a / sc)) + 1);
-        jj1[j] = std::min(src->width, static_cast<int>(floorf(x0 + a / sc)) + 1);
-
-        // calculate weights
-        for (int jj = jj0[j]; jj < jj1[j]; jj++) {
-            int k = jj - jj0[j];
-            float z = sc * (x0 - static_cast<float>(jj));
-            w[k] = Lanc(z, a);
-            ws += w[k];
-        }
-        
-        // normalize weights
-        for (int k = 0; k < support; k++) {
-            w[k] /= ws;
+// Lanczos coefficients of one axis. They only depend on (source size,
+// destination size, scale), so they are computed once per resize and shared
+// by all rows resp. columns and all threads.
+class LanczosKernel {
+
+    public:
+        int support;
+        float* w;   // support weights per destination sample, normalized
+        int* i0;    // first source sample used
+        int* n;     // number of source samples used
+
+        LanczosKernel (int srcSize, int dstSize, float scale) {
+
+            const float delta = 1.0f / scale;
+            const float a = 3.0f;
+            const float sc = std::min(scale, 1.0f);
+            support = static_cast<int>(2.0f * a / sc) + 1;
+
+            w = new float[support * dstSize];
+            i0 = new int[dstSize];
+            n = new int[dstSize];
+
+            for (int j = 0; j < dstSize; j++) {
+                // coord of the center of pixel on src image
+                float x0 = (static_cast<float>(j) + 0.5f) * delta - 0.5f;
+                float* wj = w + j * support;
+
+                int jj0 = std::max(0, static_cast<int>(floorf(x0 - a / sc)) + 1);
+                int jj1 = std::min(srcSize, static_cast<int>(floorf(x0 + a / sc)) + 1);
+                jj0 = std::min(jj0, srcSize - 1);
+                jj1 = std::max(jj1, jj0 + 1);
+
+                float ws = 0.0f;
+                for (int jj = jj0; jj < jj1; jj++) {
+                    wj[jj - jj0] = Lanc(sc * (x0 - static_cast<float>(jj)), a);
+                    ws += wj[jj - jj0];
+                }
+                if (ws == 0.0f) {
+                    // far outside of the kernel, happens only for degenerated sizes
+                    for (int k = 0; k < jj1 - jj0; k++)
+                        wj[k] = 1.0f / (jj1 - jj0);
+                    ws = 1.0f;
+                }
+                for (int k = 0; k < support; k++)
+                    wj[k] = (k < jj1 - jj0) ? wj[k] / ws : 0.0f;
+
+                i0[j] = jj0;
+                n[j] = jj1 - jj0;
+            }
         }
-    }
-    
-    // Phase 2: do actual interpolation
-    
-    for (int i = 0; i < dst->height; i++) {
-        
-        // y coord of the center of pixel on src image
-        float y0 = (static_cast<float>(i) + 0.5f) * delta - 0.5f;
-        
-        // weights for interpolation in y direction
-        float w[support];
-        
-        // sum of weights used for normalization
-        float ws= 0.0f;
-
-        int ii0 = std::max(0, static_cast<int>(floorf(y0 - a / sc)) + 1);
-        int ii1 = std::min(src->height, static_cast<int>(floorf(y0 + a / sc)) + 1);
-        
-        // calculate weights for vertical interpolation
-        for (int ii = ii0; ii < ii1; ii++) {
-            int k = ii - ii0;
-            float z = sc * (y0 - static_cast<float>(ii));
-            w[k] = Lanc(z, a);
-            ws += w[k];
+
+        ~LanczosKernel () {
+            delete [] w;
+            delete [] i0;
+            delete [] n;
         }
+};
+
+static inline void storeResized (float v, unsigned short& d) { d = CLIP(static_cast<int>(v)); }
+static inline void storeResized (float v, float& d) { d = v; }
 
-        // normalize weights
-        for (int k = 0; k < support; k++) {
-            w[k] /= ws;
+// source row as floats. 16 bit rows are converted into the buffer,
+// float rows are used in place.
+static inline const float* resizeRow (unsigned short* row, int width, float* buffer) {
+    for (int j = 0; j < width; j++)
+        buffer[j] = row[j];
+    return buffer;
+}
+static inline const float* resizeRow (const float* row, int width, float* buffer) {
+    return row;
+}
+
+// Averages f x f blocks. Used in front of the Lanczos filter for large
+// downscale factors, the Lanczos support then stays small.
+template<class T>
+static void boxShrink (T** const src[3], int sw, int sh, int f, float** dst[3], bool multiThread)
+{
+    const int bw = (sw + f - 1) / f;
+    const int bh = (sh + f - 1) / f;
+
+#pragma omp parallel for if (multiThread)
+    for (int i = 0; i < bh; i++) {
+        const int y0 = i * f;
+        const int y1 = std::min(sh, y0 + f);
+        for (int c = 0; c < 3; c++) {
+            float* out = dst[c][i];
+            for (int j = 0; j < bw; j++)
+                out[j] = 0.0f;
+            for (int y = y0; y < y1; y++) {
+                const T* in = src[c][y];
+                for (int j = 0; j < bw; j++) {
+                    const int x1 = std::min(sw, (j + 1) * f);
+                    float sum = 0.0f;
+                    for (int x = j * f; x < x1; x++)
+                        sum += in[x];
+                    out[j] += sum;
+                }
+            }
+            for (int j = 0; j < bw; j++)
+                out[j] /= static_cast<float>((y1 - y0) * (std::min(sw, (j + 1) * f) - j * f));
         }
-        
-        // Do vertical interpolation. Store results.
-        for (int j = 0; j < src->width; j++) {
-            
-            float r = 0.0f, g = 0.0f, b = 0.0f;
-            
-            for (int ii = ii0; ii < ii1; ii++) {
-                int k = ii - ii0;
-            
-                r += w[k] * src->r[ii][j];
-                g += w[k] * src->g[ii][j];
-                b += w[k] * src->b[ii][j];
+    }
+}
+
+// Separable two pass Lanczos resize of three planes. Rows are filtered
+// horizontally first into a strip buffer sized to stay in L2, the vertical
+// pass then runs over the narrow (destination width) strip. Strips of
+// destination rows are distributed over the threads, every thread owns its
+// buffers.
+template<class T, class U>
+static void LanczosPlanes (T** const src[3], int sw, int sh, U** const dst[3], int dw, int dh, float scale, bool multiThread)
+{
+    const LanczosKernel hk (sw, dw, scale);
+    const LanczosKernel vk (sh, dh, scale);
+
+    // destination rows per strip, the horizontally filtered source rows of a strip
+    // (3 planes of dw floats) should fit into ~512 KB
+    const int budgetRows = std::max(1, (512 * 1024) / (3 * dw * (int)sizeof(float)));
+    const int stripRows = std::max(1, static_cast<int>((budgetRows - vk.support) * scale));
+    const int strips = (dh + stripRows - 1) / stripRows;
+
+    // source rows of a strip: from the first row used by its first destination
+    // row up to the last row used by its last one
+    int maxSpan = 1;
+    for (int s = 0; s < strips; s++) {
+        const int r0 = s * stripRows;
+        const int r1 = std::min(dh, r0 + stripRows);
+        for (int i = r0; i < r1; i++)
+            maxSpan = std::max(maxSpan, vk.i0[i] + vk.n[i] - vk.i0[r0]);
+    }
+
+#pragma omp parallel if (multiThread)
+{
+    float* tmp = new float[3 * maxSpan * dw];
+    float* line = new float[sw];
+
+#pragma omp for schedule(dynamic)
+    for (int s = 0; s < strips; s++) {
+        const int r0 = s * stripRows;
+        const int r1 = std::min(dh, r0 + stripRows);
+        const int base = vk.i0[r0];
+        int last = base;
+        for (int i = r0; i < r1; i++)
+            last = std::max(last, vk.i0[i] + vk.n[i]);
+        const int span = last - base;
+
+        // horizontal pass for all source rows of the strip
+        for (int c = 0; c < 3; c++) {
+            for (int y = 0; y < span; y++) {
+                const float* in = resizeRow(src[c][base + y], sw, line);
+                float* out = tmp + (c * maxSpan + y) * dw;
+                for (int j = 0; j < dw; j++) {
+                    const float* wh = hk.w + j * hk.support;
+                    const float* px = in + hk.i0[j];
+                    const int cnt = hk.n[j];
+                    int k = 0;
+                    float sum = 0.0f;
+#ifdef __SSE2__
+                    vfloat vsum = ZEROV();
+                    for (; k < cnt - 3; k += 4)
+                        vsum = _mm_add_ps(vsum, _mm_mul_ps(LVFU(wh[k]), LVFU(px[k])));
+                    sum = vhadd(vsum);
+#endif
+                    for (; k < cnt; k++)
+                        sum += wh[k] * px[k];
+                    out[j] = sum;
+                }
             }
-            
-            lr[j] = r;
-            lg[j] = g;
-            lb[j] = b;
         }
-        
-        // Do horisontal interpolation
-        for(int j = 0; j < dst->width; j++) {
-
-            float * wh = wwh + support * j;
-            
-            float r = 0.0f, g = 0.0f, b = 0.0f;
-            
-            for (int jj = jj0[j]; jj < jj1[j]; jj++) {
-                int k = jj - jj0[j];
-            
-                r += wh[k] * lr[jj];
-                g += wh[k] * lg[jj];
-                b += wh[k] * lb[jj];
+
+        // vertical pass, vectorized along the rows
+        for (int i = r0; i < r1; i++) {
+            const float* wv = vk.w + i * vk.support;
+            const int cnt = vk.n[i];
+            const int first = vk.i0[i] - base;
+            for (int c = 0; c < 3; c++) {
+                const float* in = tmp + (c * maxSpan + first) * dw;
+                U* out = dst[c][i];
+                int j = 0;
+#ifdef __SSE2__
+                for (; j < dw - 3; j += 4) {
+                    vfloat vsum = ZEROV();
+                    for (int k = 0; k < cnt; k++)
+                        vsum = _mm_add_ps(vsum, _mm_mul_ps(F2V(wv[k]), LVFU(in[k * dw + j])));
+                    float res[4];
+                    _mm_storeu_ps(res, vsum);
+                    for (int q = 0; q < 4; q++)
+                        storeResized(res[q], out[j + q]);
+                }
+#endif
+                for (; j < dw; j++) {
+                    float sum = 0.0f;
+                    for (int k = 0; k < cnt; k++)
+                        sum += wv[k] * in[k * dw + j];
+                    storeResized(sum, out[j]);
+                }
             }
-            
-            dst->r[i][j] = CLIP(static_cast<int>(r));
-            dst->g[i][j] = CLIP(static_cast<int>(g));
-            dst->b[i][j] = CLIP(static_cast<int>(b));
         }
     }
-    
-    delete[] wwh;
-    delete[] jj0;
-    delete[] jj1;
-    delete[] lr;
-    delete[] lg;
-    delete[] lb;
+
+    delete [] tmp;
+    delete [] line;
+}
+}
+
+// Lanczos resize of three planes, optionally with a box prefilter for large
+// downscale factors: the image is first shrunk by an integer factor so that
+// the remaining Lanczos pass downscales by at most 2.
+template<class T, class U>
+static void Lanczos (T** const src[3], int sw, int sh, U** const dst[3], int dw, int dh, float scale, bool boxPrefilter, bool multiThread)
+{
+    const int f = boxPrefilter ? static_cast<int>(0.5f / scale) : 1;
+
+    if (f < 2) {
+        LanczosPlanes(src, sw, sh, dst, dw, dh, scale, multiThread);
+        return;
+    }
+
+    const int bw = (sw + f - 1) / f;
+    const int bh = (sh + f - 1) / f;
+    float* data = new float[3 * bw * bh];
+    float** rows = new float*[3 * bh];
+    float** box[3];
+    for (int c = 0; c < 3; c++) {
+        box[c] = rows + c * bh;
+        for (int i = 0; i < bh; i++)
+            box[c][i] = data + (c * bh + i) * bw;
+    }
+
+    boxShrink(src, sw, sh, f, box, multiThread);
+    LanczosPlanes(box, bw, bh, dst, dw, dh, scale * f, multiThread);
+
+    delete [] rows;
+    delete [] data;
+}
+
+static void Lanczos(const Image16* src, Image16* dst, float scale, bool boxPrefilter, bool multiThread)
+{
+    unsigned short** const s[3] = { src->r, src->g, src->b };
+    unsigned short** const d[3] = { dst->r, dst->g, dst->b };
+    Lanczos(s, src->width, src->height, d, dst->width, dst->height, scale, boxPrefilter, multiThread);
+}
+
+void ImProcFunctions::resize (Imagefloat* src, Imagefloat* dst, float dScale) {
+
+    float** const s[3] = { src->r, src->g, src->b };
+    float** const d[3] = { dst->r, dst->g, dst->b };
+    Lanczos(s, src->width, src->height, d, dst->width, dst->height, dScale, params->resize.method == "Downscale (Faster)", multiThread);
+}
+
+void ImProcFunctions::resize (LabImage* src, LabImage* dst, float dScale) {
+
+    float** const s[3] = { src->L, src->a, src->b };
+    float** const d[3] = { dst->L, dst->a, dst->b };
+    Lanczos(s, src->W, src->H, d, dst->W, dst->H, dScale, params->resize.method == "Downscale (Faster)", multiThread);
+}
+
+void ImProcFunctions::resizePlanes (const float** const src[3], int sw, int sh, float** const dst[3], int dw, int dh, float scale, bool multiThread) {
+
+    Lanczos(src, sw, sh, dst, dw, dh, scale, false, multiThread);
 }
 
 void ImProcFunctions::resize (Image16* src, Image16* dst, float dScale) {
@@ -184,7 +324,8 @@ void ImProcFunctions::resize (Image16* src, Image16* dst, float dScale) {
        params->resize.method == "Downscale (Better)" ||
        params->resize.method == "Downscale (Faster)"
       ) {
-        Lanczos(src, dst, dScale);
+        // the faster downscale uses a box prefilter for large factors
+        Lanczos(src, dst, dScale, params->resize.method == "Downscale (Faster)", multiThread);
     }
     else if (params->resize.method.substr(0,7)=="Bicubic") {
         float Av = -0.5f;
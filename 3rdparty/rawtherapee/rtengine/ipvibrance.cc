@@ -1981,7 +1981,7 @@ void ImProcFunctions::skinsat (float lum, float hue, float chrom, float &satredu
  * copyright (c)2011  Jacques Desmis <jdesmis@gmail.com> and Jean-Christophe Frisch <natureh@free.fr>
  *
  */
-void ImProcFunctions::vibrance (LabImage* lab) {
+void ImProcFunctions::vibrance (LabImage* lab, LabCurves* curves) {
 	if (!params->vibrance.enabled || (!params->vibrance.pastels && !params->vibrance.saturated))
 		return;
 
@@ -2049,7 +2049,11 @@ void ImProcFunctions::vibrance (LabImage* lab) {
 	if (settings->verbose) printf("vibrance:  pastel=%f   satur=%f   limit= %1.2f\n",1.0+chromaPastel,1.0+chromaSatur, limitpastelsatur);
 
 #pragma omp for schedule(dynamic, 10)
-	for (int i=0; i<height; i++)
+	for (int i=0; i<height; i++) {
+		// the Lab curves of labCurves, while the row is in the cache
+		if (curves)
+			labCurvesRow (lab, i, *curves);
+
 		for (int j=0; j<width; j++) {
 			//int pos = i*width+j;
 			LL=lab->L[i][j]/327.68f;
@@ -2314,6 +2318,7 @@ void ImProcFunctions::vibrance (LabImage* lab) {
 			lab->a[i][j]=aprovn*327.68;
 			lab->b[i][j]=bprovn*327.68;
 
+		}
 	}
 
 }
@@ -20,12 +20,17 @@
 #include <cstdarg>
 #include <glibmm.h>
 #include "safegtk.h"
+#include "settings.h"
 #ifdef BZIP_SUPPORT
 #include <bzlib.h>
 #endif
 
-// get mmap() sorted out
-#ifdef MYFILE_MMAP
+// get mmap() sorted out, posix systems always have it
+#if defined(MYFILE_MMAP) || !defined(WIN32)
+#define MYFILE_CAN_MMAP
+#endif
+
+#ifdef MYFILE_CAN_MMAP
 
 #ifdef WIN32
 
@@ -35,6 +40,7 @@
 // dummy values
 #define MAP_PRIVATE 1
 #define PROT_READ 1
+#define MAP_FAILED ((void*)-1)
 
 void* mmap(void *start, size_t length, int prot, int flags, int fd, off_t offset)
 {
@@ -57,76 +63,134 @@ int munmap(void *start, size_t length)
 #else // WIN32
 
 #include <fcntl.h>
+#include <unistd.h>
+#include <climits>
 #include <sys/mman.h>
+#include <sys/stat.h>
 
 #endif // WIN32
-#endif // MYFILE_MMAP
+#endif // MYFILE_CAN_MMAP
 
-#ifdef MYFILE_MMAP
+namespace rtengine {
+extern const Settings* settings;
+}
+
+namespace {
+
+IMFILE* readFile (const char* fname) {
+
+	FILE* f = g_fopen (fname, "rb");
+	if (!f)
+		return NULL;
+	IMFILE* mf = new IMFILE;
+	fseek (f, 0, SEEK_END);
+	mf->size = ftell (f);
+	mf->data = new char [mf->size];
+	fseek (f, 0, SEEK_SET);
+	fread (mf->data, 1, mf->size, f);
+	fclose (f);
+	mf->fd = -1;
+	mf->pos = 0;
+	mf->eof = false;
+	mf->mapped = false;
+	return mf;
+}
+
+#ifdef MYFILE_CAN_MMAP
+// returns NULL if the file can not be mapped, the caller falls back to reading it
+IMFILE* mapFile (const char* fname) {
 
-IMFILE* fopen (const char* fname)
-{
 	int fd = safe_open_ReadOnly(fname);
-	if ( fd < 0 )
-		return 0;
+	if (fd < 0)
+		return NULL;
 
 	struct stat stat_buffer;
-	if ( fstat(fd,&stat_buffer) < 0 )
-	{
-		printf("no stat\n");
+	if (fstat(fd, &stat_buffer) < 0 || stat_buffer.st_size <= 0 || stat_buffer.st_size > INT_MAX) {
 		close(fd);
-		return 0;
+		return NULL;
 	}
 
-	void* data = mmap(0,stat_buffer.st_size,PROT_READ,MAP_PRIVATE,fd,0);
-	if ( data == 0 )
-	{
-		printf("no mmap\n");
-		close(fd);
-		return 0;
-	}
+	void* data = mmap(0, stat_buffer.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	// the mapping keeps the file open
+	close(fd);
+	if (data == MAP_FAILED || data == NULL)
+		return NULL;
 
-	IMFILE* mf = new IMFILE;
+#ifdef MADV_WILLNEED
+	// start the read ahead of the whole file right away; the decoders mostly
+	// walk the data front to back, so pages behind them can be dropped early
+	madvise(data, stat_buffer.st_size, MADV_WILLNEED);
+	madvise(data, stat_buffer.st_size, MADV_SEQUENTIAL);
+#endif
 
-	mf->fd = fd;
+	IMFILE* mf = new IMFILE;
+	mf->fd = -1;
 	mf->pos = 0;
 	mf->size = stat_buffer.st_size;
 	mf->data = (char*)data;
 	mf->eof = false;
+	mf->mapped = true;
+	return mf;
+}
+#endif // MYFILE_CAN_MMAP
+
+IMFILE* openFile (const char* fname) {
+
+#ifdef MYFILE_CAN_MMAP
+	if (rtengine::settings && rtengine::settings->mmapFiles) {
+		IMFILE* mf = mapFile (fname);
+		if (mf)
+			return mf;
+	}
+#endif
+	return readFile (fname);
+}
+
+void freeData (IMFILE* f) {
+
+#ifdef MYFILE_CAN_MMAP
+	if (f->mapped) {
+		munmap((void*)f->data, f->size);
+		return;
+	}
+#endif
+	delete [] f->data;
+}
 
 #ifdef BZIP_SUPPORT
-	{
-	  bool bzip = false;
-	  Glib::ustring bname = Glib::path_get_basename(fname);
-	  int lastdot = bname.find_last_of ('.');
-	  if (lastdot!=bname.npos)
-	    bzip = bname.substr (lastdot).casefold() == Glib::ustring(".bz2").casefold();
-      
-	  if (bzip) {
-	    int ret;
-
-	    // initialize bzip stream structure
-	    bz_stream stream;
-	    stream.bzalloc = 0;
-	    stream.bzfree = 0;
-	    stream.opaque = 0;
-	    ret = BZ2_bzDecompressInit(&stream, 0, 0);
-
-	    if (ret != BZ_OK) {
-	      printf("bzip initialization failed with error %d\n", ret);
-	    }
-	    else {
-	      // allocate initial buffer for decompressed data
-	      unsigned int buffer_out_count = 0; // bytes of decompressed data
-	      unsigned int buffer_size = 10*1024*1024; // 10 MB, extended dynamically if needed
-	      char* buffer = 0;
-
-	      stream.next_in = mf->data; // input data address
-	      stream.avail_in = mf->size;
-
-	      while (ret == BZ_OK) {
-		buffer = static_cast<char*>( realloc(buffer, buffer_size)); // allocate/resize buffer
-		if (!buffer) free(buffer);
+// replaces the data of the file by its decompressed data, leaves the file
+// as it is if it is not a valid bzip2 stream
+void decompressBzip (IMFILE* mf) {
+
+	int ret;
+
+	// initialize bzip stream structure
+	bz_stream stream;
+	stream.bzalloc = 0;
+	stream.bzfree = 0;
+	stream.opaque = 0;
+	ret = BZ2_bzDecompressInit(&stream, 0, 0);
+
+	if (ret != BZ_OK) {
+		printf("bzip initialization failed with error %d\n", ret);
+		return;
+	}
+
+	// allocate initial buffer for decompressed data
+	unsigned int buffer_out_count = 0; // bytes of decompressed data
+	unsigned int buffer_size = 10*1024*1024; // 10 MB, extended dynamically if needed
+	char* buffer = 0;
+
+	stream.next_in = mf->data; // input data address
+	stream.avail_in = mf->size;
+
+	while (ret == BZ_OK) {
+		char* grown = static_cast<char*>( realloc(buffer, buffer_size)); // allocate/resize buffer
+		if (!grown) {
+			ret = BZ_MEM_ERROR;
+			break;
+		}
+		buffer = grown;
 
 		stream.next_out = buffer + buffer_out_count; // output data adress
 		stream.avail_out = buffer_size - buffer_out_count;
@@ -136,145 +200,51 @@ IMFILE* fopen (const char* fname)
 		buffer_size *= 2; // increase buffer size for next iteration
 		buffer_out_count = stream.total_out_lo32;
 		if (stream.total_out_hi32 > 0)
-		  printf("bzip decompressed data byte count high byte is nonzero: %d\n", stream.total_out_hi32);
-	      }
-
-	      if (ret == BZ_STREAM_END) {
-		//delete [] mf->data;
-		// close memory mapping, setting fd -1 will ensure deletion of mf->data upon fclose()
-		mf->fd = -1;
-		munmap((void*)mf->data,mf->size);
-		close(mf->fd);
+			printf("bzip decompressed data byte count high byte is nonzero: %d\n", stream.total_out_hi32);
+	}
 
+	if (ret == BZ_STREAM_END) {
 		char* realData = new char [buffer_out_count];
 		memcpy(realData, buffer, buffer_out_count);
 
+		freeData (mf);
 		mf->data = realData;
 		mf->size = buffer_out_count;
-	      }
-	      else
+		mf->mapped = false;
+	}
+	else
 		printf("bzip decompression failed with error %d\n", ret);
 
-	      // cleanup
-	      free(buffer);
-	      ret = BZ2_bzDecompressEnd(&stream);
-	      if (ret != BZ_OK)
+	// cleanup
+	free(buffer);
+	ret = BZ2_bzDecompressEnd(&stream);
+	if (ret != BZ_OK)
 		printf("bzip cleanup failed with error %d\n", ret);
-	    }
-	  }
-	}
-#endif // BZIP_SUPPORT
-
-	return mf;
 }
+#endif // BZIP_SUPPORT
 
-IMFILE* gfopen (const char* fname)
-{
-	return fopen(fname);
 }
-#else
 
 IMFILE* fopen (const char* fname) {
 
-	FILE* f = g_fopen (fname, "rb");
-    if (!f)
-        return NULL;
-    IMFILE* mf = new IMFILE;
-	fseek (f, 0, SEEK_END);
-	mf->size = ftell (f);
-	mf->data = new char [mf->size];
-	fseek (f, 0, SEEK_SET);
-	fread (mf->data, 1, mf->size, f);
-	fclose (f);
-	mf->pos = 0;
-	mf->eof = false;
-
-    return mf;
+	return openFile (fname);
 }
 
 IMFILE* gfopen (const char* fname) {
 
-	FILE* f = g_fopen (fname, "rb");
-    if (!f)
-        return NULL;
-    IMFILE* mf = new IMFILE;
-	fseek (f, 0, SEEK_END);
-	mf->size = ftell (f);
-	mf->data = new char [mf->size];
-	fseek (f, 0, SEEK_SET);
-	fread (mf->data, 1, mf->size, f);
-	fclose (f);
-	mf->pos = 0;
-	mf->eof = false;
+	IMFILE* mf = openFile (fname);
+	if (!mf)
+		return NULL;
 
 #ifdef BZIP_SUPPORT
-    {
-      bool bzip = false;
-      Glib::ustring bname = Glib::path_get_basename(fname);
-      int lastdot = bname.find_last_of ('.');
-      if (lastdot!=bname.npos)
-        bzip = bname.substr (lastdot).casefold() == Glib::ustring(".bz2").casefold();
-      
-      if (bzip) {
-	int ret;
-
-	// initialize bzip stream structure
-	bz_stream stream;
-	stream.bzalloc = 0;
-	stream.bzfree = 0;
-	stream.opaque = 0;
-	ret = BZ2_bzDecompressInit(&stream, 0, 0);
-
-	if (ret != BZ_OK) {
-	  printf("bzip initialization failed with error %d\n", ret);
-	}
-	else {
-	  // allocate initial buffer for decompressed data
-	  unsigned int buffer_out_count = 0; // bytes of decompressed data
-	  unsigned int buffer_size = 10*1024*1024; // 10 MB, extended dynamically if needed
-	  char* buffer = 0;
-
-	  stream.next_in = mf->data; // input data address
-	  stream.avail_in = mf->size;
-
-	  while (ret == BZ_OK) {
-	    buffer = static_cast<char*>( realloc(buffer, buffer_size)); // allocate/resize buffer
-	    if (!buffer) free(buffer);
-
-	    stream.next_out = buffer + buffer_out_count; // output data adress
-	    stream.avail_out = buffer_size - buffer_out_count;
-
-	    ret = BZ2_bzDecompress(&stream);
-
-	    buffer_size *= 2; // increase buffer size for next iteration
-	    buffer_out_count = stream.total_out_lo32;
-	    if (stream.total_out_hi32 > 0)
-	      printf("bzip decompressed data byte count high byte is nonzero: %d\n", stream.total_out_hi32);
-	  }
-
-	  if (ret == BZ_STREAM_END) {
-	    delete [] mf->data;
-	    char* realData = new char [buffer_out_count];
-	    memcpy(realData, buffer, buffer_out_count);
-
-	    mf->data = realData;
-	    mf->size = buffer_out_count;
-	  }
-	  else
-	    printf("bzip decompression failed with error %d\n", ret);
-
-	  // cleanup
-	  free(buffer);
-	  ret = BZ2_bzDecompressEnd(&stream);
-	  if (ret != BZ_OK)
-	    printf("bzip cleanup failed with error %d\n", ret);
-	}
-      }
-    }
+	Glib::ustring bname = Glib::path_get_basename(fname);
+	int lastdot = bname.find_last_of ('.');
+	if (lastdot!=bname.npos && bname.substr (lastdot).casefold() == Glib::ustring(".bz2").casefold())
+		decompressBzip (mf);
 #endif // BZIP_SUPPORT
-    return mf;
+
+	return mf;
 }
-#endif //MYFILE_MMAP
 
 IMFILE* fopen (unsigned* buf, int size) {
 
@@ -285,23 +255,13 @@ IMFILE* fopen (unsigned* buf, int size) {
 	memcpy ((void*)mf->data, buf, size);
 	mf->pos = 0;
 	mf->eof = false;
+	mf->mapped = false;
 	return mf;
 }
 
 void fclose (IMFILE* f) {
-#ifdef MYFILE_MMAP
-	if ( f->fd == -1 )
-	{
-		delete [] f->data;
-	}
-	else
-	{
-		munmap((void*)f->data,f->size);
-		close(f->fd);
-	}
-#else
-	delete [] f->data;
-#endif
+
+	freeData (f);
 	delete f;
 }
 
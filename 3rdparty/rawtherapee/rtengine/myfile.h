@@ -28,10 +28,15 @@ struct IMFILE {
 	int size;
 	char* data;
 	bool eof;
+	bool mapped;	// data is a read only mapping of the file, else it is owned (new[])
 };
 
+// The file name versions map the file into memory if settings->mmapFiles is set
+// and the platform supports it, else the whole file is read. gfopen also
+// decompresses .bz2 files.
 IMFILE* fopen (const char* fname);
-IMFILE* gfopen (const char* fname);IMFILE* fopen (unsigned* buf, int size);
+IMFILE* gfopen (const char* fname);
+IMFILE* fopen (unsigned* buf, int size);
 void fclose (IMFILE* f);
 inline int ftell (IMFILE* f) {
 
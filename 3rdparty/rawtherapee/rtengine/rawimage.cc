@@ -14,6 +14,7 @@
 #include <netinet/in.h>
 #endif
 #include "safegtk.h"
+#include <new>
 
 namespace rtengine{
 
@@ -125,7 +126,21 @@ skip_block: ;
 	}
 }
 
-int RawImage::loadRaw (bool loadData, bool closeFile)
+bool RawImage::decodesCompact() const
+{
+	// these loaders write Bayer pixels through the CFA macros only
+	return filters != 0 && shrink == 0 &&
+		   ( load_raw == &rtengine::RawImage::lossless_jpeg_load_raw ||
+			 load_raw == &rtengine::RawImage::canon_compressed_load_raw ||
+			 load_raw == &rtengine::RawImage::nikon_compressed_load_raw ||
+			 load_raw == &rtengine::RawImage::sony_arw2_load_raw ||
+			 load_raw == &rtengine::RawImage::adobe_dng_load_raw_lj ||
+			 load_raw == &rtengine::RawImage::adobe_dng_load_raw_nc ||
+			 load_raw == &rtengine::RawImage::packed_load_raw ||
+			 load_raw == &rtengine::RawImage::unpacked_load_raw );
+}
+
+int RawImage::loadRaw (bool loadData, bool closeFile, bool compact)
 {
   ifname = filename.c_str();
   image = NULL;
@@ -167,14 +182,34 @@ int RawImage::loadRaw (bool loadData, bool closeFile)
 	  iheight = height;
 	  iwidth  = width;
 
-	  // dcraw needs this global variable to hold pixel data
-	  image = (dcrawImage_t)calloc (height*width*sizeof *image + meta_length, 1);
-	  meta_data = (char *) (image + height*width);
-	  if(!image)
-		  return 200;
+	  if (compact && decodesCompact()) {
+		  // one value per pixel instead of four, compress_image has nothing left to do
+		  if (allocation) { delete [] allocation; allocation=NULL; }
+		  if (data) { delete [] data; data=NULL; }
+		  allocation = new (std::nothrow) unsigned short[height*width + (meta_length+1)/2];
+		  if(!allocation)
+			  return 200;
+		  memset (allocation, 0, (height*width + (meta_length+1)/2) * sizeof *allocation);
+		  meta_data = (char *) (allocation + height*width);
+		  cfa_image = allocation;
+		  data = new unsigned short*[height];
+		  for (int i = 0; i < height; i++)
+			  data[i] = allocation + i * width;
+	  } else {
+		  // dcraw needs this global variable to hold pixel data
+		  image = (dcrawImage_t)calloc (height*width*sizeof *image + meta_length, 1);
+		  meta_data = (char *) (image + height*width);
+		  if(!image)
+			  return 200;
+	  }
 
 	  if (setjmp (failure)) {
           if (image) { free (image); image=NULL; }
+          if (cfa_image) {
+              cfa_image=NULL;
+              delete [] allocation; allocation=NULL;
+              delete [] data; data=NULL;
+          }
 		  fclose(ifp); ifp=NULL;
 		  return 100;
 	  }
@@ -182,6 +217,7 @@ int RawImage::loadRaw (bool loadData, bool closeFile)
 	  // Load raw pixels data
 	  fseek (ifp, data_offset, SEEK_SET);
 	  (this->*load_raw)();
+	  cfa_image = NULL;
 
 	  // Load embedded profile
 	  if (profile_length) {
@@ -210,7 +246,7 @@ int RawImage::loadRaw (bool loadData, bool closeFile)
 unsigned short** RawImage::compress_image()
 {
 	if( !image )
-		return NULL;
+		return data; // decoded compact by loadRaw, or nothing loaded
 	if (filters) {
 		if (!allocation) {
 			allocation = new unsigned short[height * width];
@@ -89,7 +89,9 @@ public:
   RawImage(  const Glib::ustring name );
   ~RawImage();
 
-  int loadRaw (bool loadData=true, bool closeFile=true);
+  // compact: Bayer data is decoded straight into data[][] where the loader allows it,
+  // image stays NULL then; pass false if the four channel image is needed
+  int loadRaw (bool loadData=true, bool closeFile=true, bool compact=true);
   int get_colorsCoeff( float *pre_mul, float *scale_mul, float *cblack  );
   void set_prefilters(){
       if (isBayer() && get_colors() == 3) {
@@ -107,6 +109,8 @@ protected:
   char* profile_data; // Embedded ICC color profile
   unsigned short* allocation; // pointer to allocated memory
 
+  bool decodesCompact() const; // load_raw can write into cfa_image
+
 public:
 
   std::string get_filename() const { return filename;}
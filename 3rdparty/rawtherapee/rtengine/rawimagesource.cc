@@ -32,6 +32,7 @@
 #include <iostream>
 #include "options.h"
 #include "dcp.h"
+#include "demosaic_simd.h"
 
 
 
@@ -1138,6 +1139,25 @@ void RawImageSource::demosaic(const RAWParams &raw)
     }
 }
 
+bool RawImageSource::demosaicSuperpixel()
+{
+    // the skewed grids of Fuji and D1x do not bin into square quads
+    if (fuji || d1x)
+        return false;
+
+    if (ri->isBayer()) {
+        MyTime t1,t2;
+        t1.set();
+        superpixel_demosaic();
+        t2.set();
+        if( settings->verbose )
+           printf("Demosaicing: superpixel - %d usec\n", t2.etime(t1));
+
+        rgbSourceModified = false;
+    }
+    return true;
+}
+
 void RawImageSource::flushRawData() {
     if(cache) {
         delete [] cache;
@@ -1769,20 +1789,16 @@ void RawImageSource::colorSpaceConversion (Imagefloat* im, ColorManagementParams
 			( wprof[2][2])
         }
 		};
-        lcmsMutex->lock ();
-        cmsHTRANSFORM hTransform = cmsCreateTransform (in, (FLOAT_SH(1)|COLORSPACE_SH(PT_RGB)|CHANNELS_SH(3)|BYTES_SH(4)|PLANAR_SH(1)), out, (FLOAT_SH(1)|COLORSPACE_SH(PT_RGB)|CHANNELS_SH(3)|BYTES_SH(4)|PLANAR_SH(1)), 
+        cmsHTRANSFORM hTransform = iccStore->getTransform (in, (FLOAT_SH(1)|COLORSPACE_SH(PT_RGB)|CHANNELS_SH(3)|BYTES_SH(4)|PLANAR_SH(1)), out, (FLOAT_SH(1)|COLORSPACE_SH(PT_RGB)|CHANNELS_SH(3)|BYTES_SH(4)|PLANAR_SH(1)), 
             INTENT_RELATIVE_COLORIMETRIC,  // float is clipless, so don't trim it
             settings->LCMSSafeMode ? 0 : cmsFLAGS_NOCACHE );  // NOCACHE is important for thread safety
-        lcmsMutex->unlock ();
 		if (hTransform) {
             im->ExecCMSTransform(hTransform, settings->LCMSSafeMode);
 			}
 			else {
           // create the profile from camera
-          lcmsMutex->lock ();
-          hTransform = cmsCreateTransform (camprofile, (FLOAT_SH(1)|COLORSPACE_SH(PT_RGB)|CHANNELS_SH(3)|BYTES_SH(4)|PLANAR_SH(1)), out, (FLOAT_SH(1)|COLORSPACE_SH(PT_RGB)|CHANNELS_SH(3)|BYTES_SH(4)|PLANAR_SH(1)), settings->colorimetricIntent,
+          hTransform = iccStore->getTransform (camprofile, (FLOAT_SH(1)|COLORSPACE_SH(PT_RGB)|CHANNELS_SH(3)|BYTES_SH(4)|PLANAR_SH(1)), out, (FLOAT_SH(1)|COLORSPACE_SH(PT_RGB)|CHANNELS_SH(3)|BYTES_SH(4)|PLANAR_SH(1)), settings->colorimetricIntent,
               settings->LCMSSafeMode ? cmsFLAGS_NOOPTIMIZE : cmsFLAGS_NOOPTIMIZE | cmsFLAGS_NOCACHE );  // NOCACHE is important for thread safety    
-          lcmsMutex->unlock ();
 				
           im->ExecCMSTransform(hTransform, settings->LCMSSafeMode);
 				}
@@ -1802,7 +1818,7 @@ void RawImageSource::colorSpaceConversion (Imagefloat* im, ColorManagementParams
 			}	
 			}
 			
-		        cmsDeleteTransform(hTransform);
+		        iccStore->releaseTransform (hTransform);
 	
 	}
      else {	
@@ -1810,26 +1826,22 @@ void RawImageSource::colorSpaceConversion (Imagefloat* im, ColorManagementParams
 		cmsHPROFILE out = iccStore->workingSpace (cmp.working);	
 
 //        out = iccStore->workingSpaceGamma (wProfile);
-        lcmsMutex->lock ();
-        cmsHTRANSFORM hTransform = cmsCreateTransform (in, (FLOAT_SH(1)|COLORSPACE_SH(PT_RGB)|CHANNELS_SH(3)|BYTES_SH(4)|PLANAR_SH(1)), out, (FLOAT_SH(1)|COLORSPACE_SH(PT_RGB)|CHANNELS_SH(3)|BYTES_SH(4)|PLANAR_SH(1)), 
+        cmsHTRANSFORM hTransform = iccStore->getTransform (in, (FLOAT_SH(1)|COLORSPACE_SH(PT_RGB)|CHANNELS_SH(3)|BYTES_SH(4)|PLANAR_SH(1)), out, (FLOAT_SH(1)|COLORSPACE_SH(PT_RGB)|CHANNELS_SH(3)|BYTES_SH(4)|PLANAR_SH(1)), 
             INTENT_RELATIVE_COLORIMETRIC,  // float is clipless, so don't trim it
             settings->LCMSSafeMode ? 0 : cmsFLAGS_NOCACHE );  // NOCACHE is important for thread safety
-        lcmsMutex->unlock ();
 
         if (hTransform) {
             // there is an input profile
             im->ExecCMSTransform(hTransform, settings->LCMSSafeMode);
         } else {
           // create the profile from camera
-          lcmsMutex->lock ();
-          hTransform = cmsCreateTransform (camprofile, (FLOAT_SH(1)|COLORSPACE_SH(PT_RGB)|CHANNELS_SH(3)|BYTES_SH(4)|PLANAR_SH(1)), out, (FLOAT_SH(1)|COLORSPACE_SH(PT_RGB)|CHANNELS_SH(3)|BYTES_SH(4)|PLANAR_SH(1)), settings->colorimetricIntent,
+          hTransform = iccStore->getTransform (camprofile, (FLOAT_SH(1)|COLORSPACE_SH(PT_RGB)|CHANNELS_SH(3)|BYTES_SH(4)|PLANAR_SH(1)), out, (FLOAT_SH(1)|COLORSPACE_SH(PT_RGB)|CHANNELS_SH(3)|BYTES_SH(4)|PLANAR_SH(1)), settings->colorimetricIntent,
               settings->LCMSSafeMode ? cmsFLAGS_NOOPTIMIZE : cmsFLAGS_NOOPTIMIZE | cmsFLAGS_NOCACHE );  // NOCACHE is important for thread safety    
-          lcmsMutex->unlock ();
 
           im->ExecCMSTransform(hTransform, settings->LCMSSafeMode);
         }
 
-        cmsDeleteTransform(hTransform);
+        iccStore->releaseTransform (hTransform);
 		}
 		
 		// restore normalization to the range (0,65535) and blend matrix colors if LCMS is clipping
@@ -1952,10 +1964,8 @@ TMatrix work = iccStore->workingSpaceInverseMatrix (cmp.working);
 
 		cmsHPROFILE out = iccStore->workingSpace (cmp.working);
 		//        out = iccStore->workingSpaceGamma (wProfile);
-		lcmsMutex->lock ();
-		cmsHTRANSFORM hTransform = cmsCreateTransform (in, TYPE_RGB_16_PLANAR, out, TYPE_RGB_16_PLANAR, settings->colorimetricIntent,
+		cmsHTRANSFORM hTransform = iccStore->getTransform (in, TYPE_RGB_16_PLANAR, out, TYPE_RGB_16_PLANAR, settings->colorimetricIntent,
             settings->LCMSSafeMode ? 0 : cmsFLAGS_NOCACHE);  // NOCACHE is important for thread safety
-		lcmsMutex->unlock ();
 
 		if (hTransform) {
 			im->ExecCMSTransform(hTransform, settings->LCMSSafeMode);
@@ -1972,15 +1982,13 @@ TMatrix work = iccStore->workingSpaceInverseMatrix (cmp.working);
             }
 		}
 		else {
-			lcmsMutex->lock ();
-			hTransform = cmsCreateTransform (camprofile, TYPE_RGB_16_PLANAR, out, TYPE_RGB_16_PLANAR, settings->colorimetricIntent,
+			hTransform = iccStore->getTransform (camprofile, TYPE_RGB_16_PLANAR, out, TYPE_RGB_16_PLANAR, settings->colorimetricIntent,
                 settings->LCMSSafeMode ? 0 : cmsFLAGS_NOCACHE);   
-			lcmsMutex->unlock ();
 
 			im->ExecCMSTransform(hTransform, settings->LCMSSafeMode);
 		}
 
-		cmsDeleteTransform(hTransform);
+		iccStore->releaseTransform (hTransform);
 	}
     }
 	//t3.set ();
@@ -137,6 +137,7 @@ class RawImageSource : public ImageSource {
         int         load        (Glib::ustring fname, bool batch = false);
         void        preprocess  (const RAWParams &raw);
         void        demosaic    (const RAWParams &raw);
+        bool        demosaicSuperpixel ();
         void        flushRawData      ();
         void        flushRGB          ();
         void        HLRecovery_Global (HRecParams hrp);
@@ -206,6 +207,7 @@ class RawImageSource : public ImageSource {
         void green_equilibrate (float greenthresh);//Emil's green equilibration
 
         void nodemosaic();
+        void superpixel_demosaic();
         void eahd_demosaic();
         void hphd_demosaic();
         void vng4_demosaic();
@@ -215,6 +217,7 @@ class RawImageSource : public ImageSource {
         void dcb_demosaic(int iterations, bool dcb_enhance);
         void ahd_demosaic(int winx, int winy, int winw, int winh);
         void border_interpolate(int border, float (*image)[4], int start = 0, int end = 0);
+        void border_interpolate2(int border);
         void dcb_initTileLimits(int &colMin, int &rowMin, int &colMax, int &rowMax, int x0, int y0, int border);
         void fill_raw( float (*cache )[4], int x0, int y0, float** rawData);
         void fill_border( float (*cache )[4], int border, int x0, int y0);
@@ -121,6 +121,9 @@ namespace rtengine {
         /** This member function is called when an error occurs during the operation.
           * @param descr is the error message */
           virtual void error (Glib::ustring descr) {}
+        /** This member function is called when processImage enters its next processing step, to allow profiling.
+          * @param name is the name of the step, NULL when the last step is done */
+          virtual void setProgressStage (const char* name) {}
     };
     
     class ImageSource;
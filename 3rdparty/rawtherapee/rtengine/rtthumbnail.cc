@@ -242,7 +242,7 @@ Thumbnail* Thumbnail::loadQuickFromRaw (const Glib::ustring& fname, RawMetaDataL
 Thumbnail* Thumbnail::loadFromRaw (const Glib::ustring& fname, RawMetaDataLocation& rml, int &w, int &h, int fixwh, bool rotate)
 {
 	RawImage *ri= new RawImage (fname);
-	int r = ri->loadRaw(1,0);
+	int r = ri->loadRaw(1,0,false); // the preview below works on the four channel image
 	if( r ){
 		delete ri;
 		return NULL;
@@ -551,6 +551,7 @@ IImage8* Thumbnail::quickProcessImage (const procparams::ProcParams& params, int
         rwidth = thumbImg->width * rheight / thumbImg->height;   
 	Image16* tmp = thumbImg->resize (rwidth, rheight, interp);
 	Imagefloat* baseImg =  tmp->tofloat();
+	delete tmp;
 
     if (params.coarse.rotate) {
         Imagefloat* tmp = baseImg->rotate (params.coarse.rotate);
@@ -571,7 +572,6 @@ IImage8* Thumbnail::quickProcessImage (const procparams::ProcParams& params, int
     }
 	Image8* img8 = baseImg->to8();
 	delete baseImg;
-	//delete tmp;
 	return img8;
 }
 
@@ -45,6 +45,15 @@ namespace rtengine {
 			Glib::ustring   srgb10;					// default name of SRGB space profile
 			
 			bool		    gamutICC;           // 
+
+            int             tileSize;               ///< Edge length of the tiles processImage works on for large images, 0 processes the full frame at once
+            bool            mmapFiles;              ///< Map RAW files into memory instead of reading them into a buffer (where supported)
+            bool            simdDemosaic;           ///< Use the SSE2/AVX2 demosaic kernels if the CPU supports them
+            bool            simdDemosaicNoAVX2;     ///< Use the SSE2 demosaic kernels even if the CPU has AVX2, for comparing the two
+            bool            fastDownscale;          ///< Bin the raw data instead of demosaicing it if processImage resizes to half the size or less
+            int             iccTransformCache;      ///< Number of compiled ICC transforms kept for later images (see ICCStore::getTransform), 0 disables the cache
+            int             epdSolver;              ///< Solver of the tone mapping blur: 0 incomplete Cholesky, 1 multigrid (see EdgePreservingDecomposition)
+            bool            epdDownscale;           ///< Solve the tone mapping blur at the output size if processImage resizes to half the size or less
 			
         /** Creates a new instance of Settings.
           * @return a pointer to the new Settings instance. */
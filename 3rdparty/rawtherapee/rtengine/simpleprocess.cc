@@ -26,6 +26,7 @@
 #include <glibmm.h>
 #include "options.h"
 #include <iostream>
+#include <cstring>
 #include "rawimagesource.h"
 #include "ppversion.h"
 #undef THREAD_PRIORITY_NORMAL
@@ -37,6 +38,55 @@
 namespace rtengine {
 extern const Settings* settings;
 
+// Overlap needed around a tile so that the enabled stages produce the same
+// result in the tile as on the full frame: the stages run one after the
+// other, so their kernel radii add up. Returns -1 if a stage needs the whole
+// image (global statistics, geometric transforms, large pyramids).
+static int tileHalo (const procparams::ProcParams& params, ImProcFunctions& ipf) {
+
+    if (ipf.needsTransform() || params.sh.enabled || params.edgePreservingDecompositionUI.enabled
+            || params.defringe.enabled || params.dirpyrDenoise.enabled || params.dirpyrequalizer.enabled)
+        return -1;
+
+    int halo = 0;
+    if (params.impulseDenoise.enabled)
+        halo += (int)ceil(3.0 * std::max(2.0, params.impulseDenoise.thresh/20.0 - 1.0)) + 2;
+    if (params.sharpenEdge.enabled)
+        halo += 2 * params.sharpenEdge.passes + 2;
+    if (params.sharpenMicro.enabled)
+        halo += 3;
+    if (params.sharpening.enabled) {
+        if (params.sharpening.method=="rld")
+            halo += params.sharpening.deconviter * (int)ceil(3.0 * params.sharpening.deconvradius) + 1;
+        else
+            halo += (int)ceil(3.0 * std::max(params.sharpening.radius, params.sharpening.edgesonly ? params.sharpening.edges_radius : 0.0)) + 2;
+    }
+    return halo;
+}
+
+// Scale of the resize step for a reference frame of refw x refh pixels. A frame
+// that has been reduced by skip already needs skip times the requested scale.
+static double resizeScale (const procparams::ProcParams& params, int refw, int refh, int skip) {
+
+    switch(params.resize.dataspec) {
+    case (1):
+        // Width
+        return (double)params.resize.width/(double)refw;
+    case (2):
+        // Height
+        return (double)params.resize.height/(double)refh;
+    case (3):
+        // FitBox
+        if ((double)refw/(double)refh > (double)params.resize.width/(double)params.resize.height)
+            return (double)params.resize.width/(double)refw;
+        else
+            return (double)params.resize.height/(double)refh;
+    default:
+        // Scale
+        return params.resize.scale * skip;
+    }
+}
+
 IImage16* processImage (ProcessingJob* pjob, int& errorCode, ProgressListener* pl, bool tunnelMetaData) {
 
     errorCode = 0;
@@ -94,11 +144,38 @@ IImage16* processImage (ProcessingJob* pjob, int& errorCode, ProgressListener* p
 
     ImProcFunctions ipf (&params, true);
 
-    PreviewProps pp (0, 0, fw, fh, 1);
+    // Output at half the size or less does not need the full resolution: the
+    // raw data is binned instead of demosaiced (the superpixels are read with
+    // getImage's skip), and everything after it works on the reduced frame.
+    int skip = 1;
+    if (settings->fastDownscale && params.resize.enabled && !ipf.needsTransform()) {
+        double scale;
+        if (params.crop.enabled && params.resize.appliesTo == "Cropped area")
+            scale = resizeScale (params, params.crop.w, params.crop.h, 1);
+        else
+            scale = resizeScale (params, fw, fh, 1);
+        if (scale > 0.0 && scale <= 0.5)
+            skip = (int)(1.0 / scale + 1e-5);
+    }
+
+    PreviewProps pp (0, 0, fw, fh, skip);
+    if (pl) pl->setProgressStage ("preprocess");
     imgsrc->preprocess( params.raw);
 	if (pl) pl->setProgress (0.20);
-    imgsrc->demosaic( params.raw);
+    if (pl) pl->setProgressStage ("demosaic");
+    if (skip > 1 && imgsrc->demosaicSuperpixel ()) {
+        imgsrc->getSize (tr, pp, fw, fh);
+        if (settings->verbose)
+            printf ("Processing at 1/%d size: %dx%d\n", skip, fw, fh);
+    }
+    else {
+        skip = pp.skip = 1;
+        imgsrc->demosaic( params.raw);
+    }
+    // the radii of sharpening, impulse denoise etc. are in full size pixels
+    ipf.setScale (skip);
     if (pl) pl->setProgress (0.30);
+    if (pl) pl->setProgressStage ("hl recovery");
     imgsrc->HLRecovery_Global( params.hlrecovery );
     if (pl) pl->setProgress (0.40);
 	// set the color temperature
@@ -107,32 +184,74 @@ IImage16* processImage (ProcessingJob* pjob, int& errorCode, ProgressListener* p
         currWB = imgsrc->getWB ();
     else if (params.wb.method=="Auto")
         currWB = imgsrc->getAutoWB ();
-    Imagefloat* baseImg = new Imagefloat (fw, fh);
-    imgsrc->getImage (currWB, tr, baseImg, pp, params.hlrecovery, params.icm, params.raw);
-    if (pl) pl->setProgress (0.45);
 
-
-    // perform first analysis
+    // Large images run the post-demosaic chain on overlapping tiles: the full
+    // frame Imagefloat and LabImage are never allocated, peak memory depends
+    // on the tile size instead of the image size. The histograms needed for
+    // the curves are collected in bands beforehand.
+    int tileSize = settings->tileSize;
+    int halo = tileSize > 0 ? tileHalo (params, ipf) : -1;
+    bool tiled = halo >= 0 && (fw > tileSize || fh > tileSize);
+    // rows of a histogram band, about the pixels of one tile
+    int bandRows = tiled ? std::max(1, tileSize * tileSize / fw) : 0;
+    if (tiled && settings->verbose)
+        printf ("Processing in tiles of %dx%d pixels, overlap %d\n", tileSize, tileSize, halo);
+
+    Imagefloat* baseImg = NULL;
+    SHMap* shmap = NULL;
     LUTu hist16 (65536);
-    ipf.firstAnalysis (baseImg, &params, hist16, imgsrc->getGamma());
 
-    // perform transform (excepted resizing)
-    if (ipf.needsTransform()) {
-        Imagefloat* trImg = new Imagefloat (fw, fh);
-        ipf.transform (baseImg, trImg, 0, 0, 0, 0, fw, fh);
-        delete baseImg;
-        baseImg = trImg;
+    if (tiled) {
+        if (pl) pl->setProgressStage ("first analysis");
+        // histogram of the whole image for the tone curve
+        LUTu bandHist (65536);
+        Imagefloat* band = NULL;
+        hist16.clear();
+        for (int y=0; y<fh; y+=bandRows) {
+            int bh = std::min(bandRows, fh-y);
+            if (!band || band->height!=bh) {
+                delete band;
+                band = new Imagefloat (fw, bh);
+            }
+            imgsrc->getImage (currWB, tr, band, PreviewProps (0, y*skip, fw*skip, bh*skip, skip), params.hlrecovery, params.icm, params.raw);
+            ipf.firstAnalysis (band, &params, bandHist, imgsrc->getGamma());
+            for (int i=0; i<65536; i++)
+                hist16[i] += bandHist[i];
+        }
+        delete band;
+        if (pl) pl->setProgress (0.45);
     }
+    else {
+        if (pl) pl->setProgressStage ("get image");
+        baseImg = new Imagefloat (fw, fh);
+        imgsrc->getImage (currWB, tr, baseImg, pp, params.hlrecovery, params.icm, params.raw);
+        if (pl) pl->setProgress (0.45);
+
+
+        if (pl) pl->setProgressStage ("first analysis");
+        // perform first analysis
+        ipf.firstAnalysis (baseImg, &params, hist16, imgsrc->getGamma());
+
+        // perform transform (excepted resizing)
+        if (ipf.needsTransform()) {
+            if (pl) pl->setProgressStage ("transform");
+            Imagefloat* trImg = new Imagefloat (fw, fh);
+            ipf.transform (baseImg, trImg, 0, 0, 0, 0, fw, fh);
+            delete baseImg;
+            baseImg = trImg;
+        }
 
-    // update blurmap
-    SHMap* shmap = NULL;
-    if (params.sh.enabled) {
-        shmap = new SHMap (fw, fh, true);
-        double radius = sqrt (double(fw*fw+fh*fh)) / 2.0;
-		double shradius = params.sh.radius;
-		if (!params.sh.hq) shradius *= radius / 1800.0;
-		shmap->update (baseImg, shradius, ipf.lumimul, params.sh.hq, 1);
+        // update blurmap
+        if (params.sh.enabled) {
+            if (pl) pl->setProgressStage ("shadows/highlights");
+            shmap = new SHMap (fw, fh, true);
+            double radius = sqrt (double(fw*fw+fh*fh)) / 2.0;
+            double shradius = params.sh.radius;
+            if (!params.sh.hq) shradius *= radius / 1800.0;
+            shmap->update (baseImg, shradius, ipf.lumimul, params.sh.hq, 1);
+        }
     }
+    if (pl) pl->setProgressStage ("curves");
     // RGB processing
 //!!!// auto exposure!!!
     double expcomp = params.toneCurve.expcomp;
@@ -170,87 +289,197 @@ IImage16* processImage (ProcessingJob* pjob, int& errorCode, ProgressListener* p
 	CurveFactory::RGBCurve (params.rgbCurves.gcurve, gCurve, 1);
 	CurveFactory::RGBCurve (params.rgbCurves.bcurve, bCurve, 1);
 
-	LabImage* labView = new LabImage (fw,fh);
+    // crop and convert to rgb16, the crop is given in full size pixels
+    int cx = 0, cy = 0, cw = fw, ch = fh;
+    if (params.crop.enabled) {
+        cx = params.crop.x / skip;
+        cy = params.crop.y / skip;
+        cw = std::min(params.crop.w / skip, fw-cx);
+        ch = std::min(params.crop.h / skip, fh-cy);
+    }
 
-    ipf.rgbProc (baseImg, labView, curve1, curve2, curve, shmap, params.toneCurve.saturation, rCurve, gCurve, bCurve);
+    LabImage* labView = NULL;
+    Image16* readyImg = NULL;
+    // select gamma output between BT709, sRGB, linear, low, high, 2.2 , 1.8
+    bool customGamma = params.icm.gamma != "default" || params.icm.freegamma;
+    double ga0,ga1,ga2,ga3,ga4,ga5,ga6;
 
-    // Freeing baseImg because not used anymore
-    delete baseImg;
-    baseImg = NULL;
+    if (!tiled) {
+        labView = new LabImage (fw,fh);
 
-    if (shmap)
-    delete shmap;
-    shmap = NULL;
+        if (pl) pl->setProgressStage ("rgbProc");
+        // the luminance histogram comes from the same pass
+        hist16.clear();
+        ipf.rgbProc (baseImg, labView, curve1, curve2, curve, shmap, params.toneCurve.saturation, rCurve, gCurve, bCurve, &hist16);
 
-    if (pl) 
-        pl->setProgress (0.5);
+        // Freeing baseImg because not used anymore
+        delete baseImg;
+        baseImg = NULL;
 
+        if (shmap)
+        delete shmap;
+        shmap = NULL;
 
-    // luminance histogram update
-    hist16.clear();
-    for (int i=0; i<fh; i++)
-        for (int j=0; j<fw; j++)
-            hist16[CLIP((int)((labView->L[i][j])))]++;
+        if (pl)
+            pl->setProgress (0.5);
 
-    // luminance processing
+        // luminance processing
 
-	ipf.EPDToneMap(labView);
+        if (pl) pl->setProgressStage ("tone mapping");
+        // the resize still to come, the tone mapping can solve its blur at the output size
+        double epdScale = 1.0;
+        if (params.resize.enabled) {
+            if (params.crop.enabled && params.resize.appliesTo == "Cropped area")
+                epdScale = resizeScale (params, cw, ch, skip);
+            else
+                epdScale = resizeScale (params, fw, fh, skip);
+        }
+        ipf.EPDToneMap(labView, 0, skip, epdScale);
+
+        if (pl) pl->setProgressStage ("lab curves");
+        CurveFactory::complexLCurve (params.labCurve.brightness, params.labCurve.contrast, params.labCurve.lcurve, hist16, hist16, curve, dummy, 1);
+
+        CurveFactory::complexsgnCurve (params.labCurve.saturation, params.labCurve.enable_saturationlimiter, params.labCurve.saturationlimit,
+                                       params.labCurve.acurve, params.labCurve.bcurve, curve1, curve2, satcurve, 1);
+        ipf.labCurves (labView, curve, curve1, curve2, satcurve);
+
+        if (pl) pl->setProgressStage ("denoise");
+        ipf.impulsedenoise (labView);
+        ipf.defringe (labView);
+        ipf.dirpyrdenoise (labView);
+        if (pl) pl->setProgressStage ("sharpen");
+        if (params.sharpenEdge.enabled) {
+             ipf.MLsharpen(labView);
+        }
+        if (params.sharpenMicro.enabled) {
+            ipf.MLmicrocontrast (labView);
+        }
+        if (params.sharpening.enabled) {
+            float** buffer = new float*[fh];
+            for (int i=0; i<fh; i++)
+                buffer[i] = new float[fw];
 
-	CurveFactory::complexLCurve (params.labCurve.brightness, params.labCurve.contrast, params.labCurve.lcurve, hist16, hist16, curve, dummy, 1);
+            ipf.sharpening (labView, (float**)buffer);
 
-	CurveFactory::complexsgnCurve (params.labCurve.saturation, params.labCurve.enable_saturationlimiter, params.labCurve.saturationlimit,
-								   params.labCurve.acurve, params.labCurve.bcurve, curve1, curve2, satcurve, 1);
-	ipf.luminanceCurve (labView, labView, curve);
-	ipf.chrominanceCurve (labView, labView, curve1, curve2, satcurve);
-	ipf.vibrance(labView);
+            for (int i=0; i<fh; i++)
+                delete [] buffer[i];
+            delete [] buffer; buffer=NULL;
+        }
 
-	ipf.impulsedenoise (labView);
-	ipf.defringe (labView);
-	ipf.dirpyrdenoise (labView);
-	if (params.sharpenEdge.enabled) {
-		 ipf.MLsharpen(labView);
-	}
-	if (params.sharpenMicro.enabled) {
-		ipf.MLmicrocontrast (labView);
-	}
-    if (params.sharpening.enabled) {
-        float** buffer = new float*[fh];
-        for (int i=0; i<fh; i++)
-            buffer[i] = new float[fw];
+        if (pl) pl->setProgressStage ("equalizer");
+        // directional pyramid equalizer
+        ipf.dirpyrequalizer (labView);//TODO: this is the luminance tonecurve, not the RGB one
+    }
+    else {
+        if (pl) pl->setProgressStage ("lab histogram");
+        // the histogram for the contrast of the L curve needs a pass of its own
+        hist16.clear();
+        if (params.labCurve.contrast != 0) {
+            Imagefloat* band = NULL;
+            LabImage* labBand = NULL;
+            for (int y=0; y<fh; y+=bandRows) {
+                int bh = std::min(bandRows, fh-y);
+                if (!band || band->height!=bh) {
+                    delete band;
+                    delete labBand;
+                    band = new Imagefloat (fw, bh);
+                    labBand = new LabImage (fw, bh);
+                }
+                imgsrc->getImage (currWB, tr, band, PreviewProps (0, y*skip, fw*skip, bh*skip, skip), params.hlrecovery, params.icm, params.raw);
+                ipf.rgbProc (band, labBand, curve1, curve2, curve, NULL, params.toneCurve.saturation, rCurve, gCurve, bCurve, &hist16);
+            }
+            delete band;
+            delete labBand;
+        }
+        if (pl) pl->setProgress (0.5);
+
+        // every tile needs the RGB and the Lab curves, they get their own tables
+        LUTf labLCurve (65536,0);
+        LUTf labACurve (65536,0);
+        LUTf labBCurve (65536,0);
+        CurveFactory::complexLCurve (params.labCurve.brightness, params.labCurve.contrast, params.labCurve.lcurve, hist16, hist16, labLCurve, dummy, 1);
+        CurveFactory::complexsgnCurve (params.labCurve.saturation, params.labCurve.enable_saturationlimiter, params.labCurve.saturationlimit,
+                                       params.labCurve.acurve, params.labCurve.bcurve, labACurve, labBCurve, satcurve, 1);
+
+        if (pl) pl->setProgressStage ("tiles");
+        // All windows have the same size, those at the right and bottom border
+        // are shifted inwards. The tile buffers are allocated once.
+        int winW = std::min(fw, tileSize + 2*halo);
+        int winH = std::min(fh, tileSize + 2*halo);
+        Imagefloat* tileImg = new Imagefloat (winW, winH);
+        LabImage* tileLab = new LabImage (winW, winH);
+        float** buffer = NULL;
+        if (params.sharpening.enabled) {
+            buffer = new float*[winH];
+            for (int i=0; i<winH; i++)
+                buffer[i] = new float[winW];
+        }
 
-        ipf.sharpening (labView, (float**)buffer);
+        readyImg = new Image16 (cw, ch);
+
+        // only the tiles of the crop are processed
+        int tilesX = (cw + tileSize - 1) / tileSize;
+        int tilesY = (ch + tileSize - 1) / tileSize;
+        for (int ty=0; ty<tilesY; ty++) {
+            for (int tx=0; tx<tilesX; tx++) {
+                // the core of the tile and the window it is computed in
+                int x0 = cx + tx*tileSize;
+                int y0 = cy + ty*tileSize;
+                int x1 = std::min(cx+cw, x0+tileSize);
+                int y1 = std::min(cy+ch, y0+tileSize);
+                int wx = std::max(0, std::min(x0-halo, fw-winW));
+                int wy = std::max(0, std::min(y0-halo, fh-winH));
+
+                imgsrc->getImage (currWB, tr, tileImg, PreviewProps (wx*skip, wy*skip, winW*skip, winH*skip, skip), params.hlrecovery, params.icm, params.raw);
+                ipf.rgbProc (tileImg, tileLab, curve1, curve2, curve, NULL, params.toneCurve.saturation, rCurve, gCurve, bCurve);
+
+                ipf.labCurves (tileLab, labLCurve, labACurve, labBCurve, satcurve);
+
+                ipf.impulsedenoise (tileLab);
+                if (params.sharpenEdge.enabled)
+                    ipf.MLsharpen(tileLab);
+                if (params.sharpenMicro.enabled)
+                    ipf.MLmicrocontrast (tileLab);
+                if (params.sharpening.enabled)
+                    ipf.sharpening (tileLab, buffer);
+
+                Image16* part;
+                if (customGamma)
+                    part = ipf.lab2rgb16b (tileLab, x0-wx, y0-wy, x1-x0, y1-y0, params.icm.output, params.icm.working, params.icm.gamma, params.icm.freegamma, params.icm.gampos, params.icm.slpos, ga0,ga1,ga2,ga3,ga4,ga5,ga6 );
+                else
+                    part = ipf.lab2rgb16 (tileLab, x0-wx, y0-wy, x1-x0, y1-y0, params.icm.output);
+
+                for (int i=0; i<y1-y0; i++) {
+                    memcpy (readyImg->r[y0-cy+i] + (x0-cx), part->r[i], (x1-x0)*sizeof(unsigned short));
+                    memcpy (readyImg->g[y0-cy+i] + (x0-cx), part->g[i], (x1-x0)*sizeof(unsigned short));
+                    memcpy (readyImg->b[y0-cy+i] + (x0-cx), part->b[i], (x1-x0)*sizeof(unsigned short));
+                }
+                delete part;
+            }
+            if (pl) pl->setProgress (0.5 + 0.1 * (ty+1) / tilesY);
+        }
 
-        for (int i=0; i<fh; i++)
-            delete [] buffer[i];
-        delete [] buffer; buffer=NULL;
+        if (buffer) {
+            for (int i=0; i<winH; i++)
+                delete [] buffer[i];
+            delete [] buffer;
+        }
+        delete tileLab;
+        delete tileImg;
     }
 
-	// directional pyramid equalizer
-    ipf.dirpyrequalizer (labView);//TODO: this is the luminance tonecurve, not the RGB one
-
 
     if (pl) pl->setProgress (0.60);
 
-    // crop and convert to rgb16
-    int cx = 0, cy = 0, cw = labView->W, ch = labView->H;
-    if (params.crop.enabled) {
-        cx = params.crop.x;
-        cy = params.crop.y;
-        cw = params.crop.w;
-        ch = params.crop.h;
-    }
-
-    Image16* readyImg = NULL;
+    if (pl) pl->setProgressStage ("lab2rgb");
     cmsHPROFILE jprof = NULL;
-    bool customGamma = false;
     bool useLCMS;
 
-    if(params.icm.gamma != "default" || params.icm.freegamma) { // if select gamma output between BT709, sRGB, linear, low, high, 2.2 , 1.8
+    if(customGamma) { // if select gamma output between BT709, sRGB, linear, low, high, 2.2 , 1.8
         cmsMLU *DescriptionMLU, *CopyrightMLU, *DmndMLU, *DmddMLU;// for modification TAG
 
         cmsToneCurve* GammaTRC[3];
         cmsFloat64Number Parameters[7];
-        double ga0,ga1,ga2,ga3,ga4,ga5,ga6;
        // wchar_t string[80] ;
         int ns;//numero of stri[]
         if      (params.icm.working=="ProPhoto")   ns=0;
@@ -262,8 +491,9 @@ IImage16* processImage (ProcessingJob* pjob, int& errorCode, ProgressListener* p
         else if (params.icm.working=="BruceRGB")   ns=6;
 
 
-        readyImg = ipf.lab2rgb16b (labView, cx, cy, cw, ch, params.icm.output, params.icm.working, params.icm.gamma, params.icm.freegamma, params.icm.gampos, params.icm.slpos, ga0,ga1,ga2,ga3,ga4,ga5,ga6 );
-        customGamma = true;
+        // tiles are converted right away
+        if (!tiled)
+            readyImg = ipf.lab2rgb16b (labView, cx, cy, cw, ch, params.icm.output, params.icm.working, params.icm.gamma, params.icm.freegamma, params.icm.gampos, params.icm.slpos, ga0,ga1,ga2,ga3,ga4,ga5,ga6 );
 
         //or selected Free gamma
         useLCMS=false;
@@ -406,7 +636,8 @@ IImage16* processImage (ProcessingJob* pjob, int& errorCode, ProgressListener* p
     else {
         // if Default gamma mode: we use the profile selected in the "Output profile" combobox;
         // gamma come from the selected profile, otherwise it comes from "Free gamma" tool
-        readyImg = ipf.lab2rgb16 (labView, cx, cy, cw, ch, params.icm.output);
+        if (!tiled)
+            readyImg = ipf.lab2rgb16 (labView, cx, cy, cw, ch, params.icm.output);
         if (settings->verbose) printf("Output profile: \"%s\"\n", params.icm.output.c_str());
     }
 
@@ -432,27 +663,7 @@ IImage16* processImage (ProcessingJob* pjob, int& errorCode, ProgressListener* p
             refh = fh;
         }
 
-        switch(params.resize.dataspec) {
-        case (1):
-            // Width
-            tmpScale = (double)params.resize.width/(double)refw;
-            break;
-        case (2):
-            // Height
-            tmpScale = (double)params.resize.height/(double)refh;
-            break;
-        case (3):
-            // FitBox
-            if ((double)refw/(double)refh > (double)params.resize.width/(double)params.resize.height)
-                tmpScale = (double)params.resize.width/(double)refw;
-            else
-                tmpScale = (double)params.resize.height/(double)refh;
-        break;
-        default:
-            // Scale
-            tmpScale = params.resize.scale;
-            break;
-        }
+        tmpScale = resizeScale (params, refw, refh, skip);
 
         // resize image
         if (fabs(tmpScale-1.0)>1e-5) {
@@ -467,6 +678,7 @@ IImage16* processImage (ProcessingJob* pjob, int& errorCode, ProgressListener* p
             }
             imw = (int)( (double)imw * tmpScale + 0.5 );
             imh = (int)( (double)imh * tmpScale + 0.5 );
+            if (pl) pl->setProgressStage ("resize");
             Image16* tempImage = new Image16 (imw, imh);
             ipf.resize (readyImg, tempImage, tmpScale);
             delete readyImg;
@@ -475,6 +687,7 @@ IImage16* processImage (ProcessingJob* pjob, int& errorCode, ProgressListener* p
     }
 
 
+    if (pl) pl->setProgressStage ("output profile");
     if (tunnelMetaData)
         readyImg->setMetadata (ii->getMetaData()->getExifData ());
     else
@@ -519,6 +732,7 @@ IImage16* processImage (ProcessingJob* pjob, int& errorCode, ProgressListener* p
     delete job;
     if (pl)
         pl->setProgress (0.75);
+    if (pl) pl->setProgressStage (NULL);
 
     return readyImg;
 }
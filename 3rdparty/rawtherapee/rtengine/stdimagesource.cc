@@ -331,14 +331,12 @@ void StdImageSource::colorSpaceConversion (Imagefloat* im, ColorManagementParams
 	}
 	
 	if (cmp.input!="(none)") {
-		lcmsMutex->lock ();
-		cmsHTRANSFORM hTransform = cmsCreateTransform (in, (FLOAT_SH(1)|COLORSPACE_SH(PT_RGB)|CHANNELS_SH(3)|BYTES_SH(4)|PLANAR_SH(1)), out, (FLOAT_SH(1)|COLORSPACE_SH(PT_RGB)|CHANNELS_SH(3)|BYTES_SH(4)|PLANAR_SH(1)), settings->colorimetricIntent, 
+		cmsHTRANSFORM hTransform = iccStore->getTransform (in, (FLOAT_SH(1)|COLORSPACE_SH(PT_RGB)|CHANNELS_SH(3)|BYTES_SH(4)|PLANAR_SH(1)), out, (FLOAT_SH(1)|COLORSPACE_SH(PT_RGB)|CHANNELS_SH(3)|BYTES_SH(4)|PLANAR_SH(1)), settings->colorimetricIntent, 
             settings->LCMSSafeMode ? cmsFLAGS_NOOPTIMIZE : cmsFLAGS_NOOPTIMIZE | cmsFLAGS_NOCACHE);
-		lcmsMutex->unlock ();
 		
         im->ExecCMSTransform(hTransform, settings->LCMSSafeMode);
 		
-        cmsDeleteTransform(hTransform);
+        iccStore->releaseTransform (hTransform);
 	}
 }
 	
@@ -362,14 +360,12 @@ void StdImageSource::colorSpaceConversion16 (Image16* im, ColorManagementParams
     }
 
     if (cmp.input!="(none)") {
-        lcmsMutex->lock ();
-        cmsHTRANSFORM hTransform = cmsCreateTransform (in, TYPE_RGB_16_PLANAR, out, TYPE_RGB_16_PLANAR, settings->colorimetricIntent, 
+        cmsHTRANSFORM hTransform = iccStore->getTransform (in, TYPE_RGB_16_PLANAR, out, TYPE_RGB_16_PLANAR, settings->colorimetricIntent, 
             settings->LCMSSafeMode ? 0 : cmsFLAGS_NOCACHE);
-        lcmsMutex->unlock ();
         
         im->ExecCMSTransform(hTransform, settings->LCMSSafeMode);
         
-        cmsDeleteTransform(hTransform);
+        iccStore->releaseTransform (hTransform);
     }
 }
 
@@ -0,0 +1,404 @@
+/*
+ *  Benchmark.cpp
+ *
+ *
+ *  This file is part of openPablo.
+ *
+ *  Copyright (c) 2012- Aydin Demircioglu (aydin@openpablo.org)
+ *
+ *  openPablo is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  openPablo is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with openPablo.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "Benchmark.hpp"
+
+#include "Trace.hpp"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <exception>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+
+#include <boost/foreach.hpp>
+#include <boost/property_tree/json_parser.hpp>
+
+
+/*
+ * @mainpage Benchmark
+ *
+ * Description in html
+ * @author Aydin Demircioglu
+  */
+
+
+/*
+ * @file Benchmark.cpp
+ *
+ * @brief Timing harness for pipelines and kernels.
+ *
+ */
+
+
+
+namespace openPablo
+{
+
+    namespace
+    {
+        // sets the peak RSS of the process back to the current RSS,
+        // linux only (clear_refs, since 4.0).
+        bool resetPeakRSS ()
+        {
+            FILE *clearRefs = fopen ("/proc/self/clear_refs", "w");
+            if (clearRefs == NULL)
+            {
+                return false;
+            }
+
+            bool success = (fputs ("5", clearRefs) >= 0);
+            success = (fclose (clearRefs) == 0) && success;
+            return success;
+        }
+
+
+        int64_t peakRSS ()
+        {
+            FILE *status = fopen ("/proc/self/status", "r");
+            if (status != NULL)
+            {
+                char line[256];
+                long long kilobytes = -1;
+                while (fgets (line, sizeof (line), status) != NULL)
+                {
+                    if (sscanf (line, "VmHWM: %lld kB", &kilobytes) == 1)
+                    {
+                        break;
+                    }
+                }
+                fclose (status);
+
+                if (kilobytes >= 0)
+                {
+                    return (int64_t) kilobytes * 1024;
+                }
+            }
+
+            return Trace::sample().peakRSS;
+        }
+
+
+        std::string jsonEscape (const std::string &text)
+        {
+            std::string result;
+            for (size_t i = 0; i < text.size(); i++)
+            {
+                if ((text[i] == '"') || (text[i] == '\\'))
+                {
+                    result += '\\';
+                }
+                result += text[i];
+            }
+            return result;
+        }
+    }
+
+
+
+    /*
+     * @class BenchmarkCase
+     *
+     * @brief One measured piece of work
+     *
+     */
+
+
+    BenchmarkCase::BenchmarkCase (QString _name, double _megapixels)
+        : caseName (_name),
+          caseMegapixels (_megapixels)
+    {
+        //
+    }
+
+
+
+    BenchmarkCase::~BenchmarkCase()
+    {
+        //
+    }
+
+
+
+    QString BenchmarkCase::name () const
+    {
+        return caseName;
+    }
+
+
+
+    double BenchmarkCase::megapixels () const
+    {
+        return caseMegapixels;
+    }
+
+
+
+    /*
+     * @class Benchmark
+     *
+     * @brief Runs cases with warmup and repetitions
+     *
+     */
+
+
+    Benchmark::Benchmark (int _warmup, int _repetitions)
+        : warmup (std::max (_warmup, 0)),
+          repetitions (std::max (_repetitions, 1)),
+          perCasePeak (true)
+    {
+        //
+    }
+
+
+
+    void Benchmark::setFilter (QStringList _patterns)
+    {
+        patterns = _patterns;
+    }
+
+
+
+    bool Benchmark::selected (QString name) const
+    {
+        if (patterns.isEmpty() == true)
+        {
+            return true;
+        }
+
+        foreach (QString pattern, patterns)
+        {
+            if (name.contains (pattern) == true)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+
+
+    void Benchmark::run (BenchmarkCase *benchmarkCase)
+    {
+        if (selected (benchmarkCase -> name()) == false)
+        {
+            delete benchmarkCase;
+            return;
+        }
+
+        BenchmarkResult result;
+        result.name = benchmarkCase -> name();
+        result.megapixels = benchmarkCase -> megapixels();
+        result.repetitions = 0;
+        result.min = result.median = result.mean = result.max = 0.0;
+        result.megapixelsPerSecond = 0.0;
+        result.failed = false;
+
+        std::cout << result.name.toStdString() << " ..." << std::flush;
+
+        // the prepared input is part of the footprint of the case
+        if (resetPeakRSS() == false)
+        {
+            perCasePeak = false;
+        }
+
+        std::vector<double> seconds;
+        try
+        {
+            benchmarkCase -> prepare();
+
+            for (int i = 0; i < warmup + repetitions; i++)
+            {
+                benchmarkCase -> setUp();
+
+                Trace::Sample begin = Trace::sample();
+                benchmarkCase -> run();
+                Trace::Sample end = Trace::sample();
+
+                if (i >= warmup)
+                {
+                    seconds.push_back ((end.wall - begin.wall) / 1000000.0);
+                }
+            }
+
+            benchmarkCase -> cleanup();
+        }
+        catch (std::exception &error_)
+        {
+            result.failed = true;
+            result.error = QString::fromStdString (error_.what());
+        }
+        catch (...)
+        {
+            result.failed = true;
+            result.error = "unknown error";
+        }
+
+        result.peakRSS = peakRSS();
+        delete benchmarkCase;
+
+        if ((result.failed == false) && (seconds.empty() == false))
+        {
+            result.repetitions = seconds.size();
+
+            double sum = 0.0;
+            for (size_t i = 0; i < seconds.size(); i++)
+            {
+                sum += seconds[i];
+            }
+            result.mean = sum / seconds.size();
+
+            std::sort (seconds.begin(), seconds.end());
+            size_t middle = seconds.size() / 2;
+            result.median = (seconds.size() % 2 == 1) ? seconds[middle] : 0.5 * (seconds[middle - 1] + seconds[middle]);
+            result.min = seconds.front();
+            result.max = seconds.back();
+
+            if (result.median > 0.0)
+            {
+                result.megapixelsPerSecond = result.megapixels / result.median;
+            }
+
+            std::cout.setf (std::ios::fixed);
+            std::cout.precision (1);
+            std::cout << " median " << result.median * 1000.0 << " ms"
+                      << " min " << result.min * 1000.0 << " ms"
+                      << " " << result.megapixelsPerSecond << " MP/s"
+                      << " peakrss " << result.peakRSS / (1024 * 1024) << " MB" << std::endl;
+        }
+        else
+        {
+            std::cout << " failed: " << result.error.toStdString() << std::endl;
+        }
+
+        resultList.push_back (result);
+    }
+
+
+
+    const std::vector<BenchmarkResult>& Benchmark::results () const
+    {
+        return resultList;
+    }
+
+
+
+    bool Benchmark::peakIsPerCase () const
+    {
+        return perCasePeak;
+    }
+
+
+
+    bool Benchmark::writeJSON (QString fileName, const boost::property_tree::ptree &config) const
+    {
+        FILE *jsonFile = fopen (fileName.toStdString().c_str(), "w");
+        if (jsonFile == NULL)
+        {
+            return false;
+        }
+
+        // the config has string values only, numbers in the results stay numbers
+        std::ostringstream configJSON;
+        boost::property_tree::write_json (configJSON, config, false);
+        std::string configText = configJSON.str();
+        while ((configText.empty() == false) && (configText[configText.size() - 1] == '\n'))
+        {
+            configText.erase (configText.size() - 1);
+        }
+
+        fprintf (jsonFile, "{\n\"config\": %s,\n\"peak_rss_per_case\": %s,\n\"results\": [",
+                 configText.c_str(), perCasePeak ? "true" : "false");
+
+        for (size_t i = 0; i < resultList.size(); i++)
+        {
+            const BenchmarkResult &result = resultList[i];
+            fprintf (jsonFile, "%s\n{\"name\":\"%s\",\"megapixels\":%.4f,\"repetitions\":%d,"
+                     "\"min_s\":%.6f,\"median_s\":%.6f,\"mean_s\":%.6f,\"max_s\":%.6f,"
+                     "\"mp_per_s\":%.3f,\"peak_rss_bytes\":%lld,\"failed\":%s,\"error\":\"%s\"}",
+                     (i == 0) ? "" : ",", jsonEscape (result.name.toStdString()).c_str(), result.megapixels,
+                     result.repetitions, result.min, result.median, result.mean, result.max,
+                     result.megapixelsPerSecond, (long long) result.peakRSS, result.failed ? "true" : "false",
+                     jsonEscape (result.error.toStdString()).c_str());
+        }
+
+        fputs ("\n]\n}\n", jsonFile);
+        return (fclose (jsonFile) == 0);
+    }
+
+
+
+    int Benchmark::compare (QString baselineFileName, double tolerance) const
+    {
+        using boost::property_tree::ptree;
+        ptree baseline;
+        read_json (baselineFileName.toStdString(), baseline);
+
+        std::map<std::string, double> baselineMedian;
+        BOOST_FOREACH (const ptree::value_type& child, baseline.get_child ("results"))
+        {
+            if (child.second.get<bool> ("failed", false) == false)
+            {
+                baselineMedian[child.second.get<std::string> ("name")] = child.second.get<double> ("median_s");
+            }
+        }
+
+        int regressions = 0;
+        std::cout.setf (std::ios::fixed);
+        std::cout.precision (1);
+        for (size_t i = 0; i < resultList.size(); i++)
+        {
+            const BenchmarkResult &result = resultList[i];
+            std::map<std::string, double>::const_iterator it = baselineMedian.find (result.name.toStdString());
+            if ((it == baselineMedian.end()) || (it -> second <= 0.0))
+            {
+                continue;
+            }
+
+            if (result.failed == true)
+            {
+                std::cout << "regression " << result.name.toStdString() << " failed: " << result.error.toStdString() << std::endl;
+                regressions++;
+                continue;
+            }
+
+            double change = result.median / it -> second - 1.0;
+            if (change > tolerance)
+            {
+                std::cout << "regression " << result.name.toStdString() << " " << it -> second * 1000.0 << " ms -> "
+                          << result.median * 1000.0 << " ms (+" << change * 100.0 << "%)" << std::endl;
+                regressions++;
+            }
+            else if (change < -tolerance)
+            {
+                std::cout << "improvement " << result.name.toStdString() << " " << it -> second * 1000.0 << " ms -> "
+                          << result.median * 1000.0 << " ms (" << change * 100.0 << "%)" << std::endl;
+            }
+        }
+
+        return regressions;
+    }
+
+}
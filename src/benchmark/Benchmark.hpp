@@ -0,0 +1,171 @@
+/*
+ *  Benchmark.hpp
+ *
+ *
+ *  This file is part of openPablo.
+ *
+ *  Copyright (c) 2012- Aydin Demircioglu (aydin@openpablo.org)
+ *
+ *  openPablo is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  openPablo is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with openPablo.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef OPENPABLO_BENCHMARK_H_
+#define OPENPABLO_BENCHMARK_H_
+
+/*
+ * @mainpage Benchmark
+ *
+ * Description in html
+ * @author Aydin Demircioglu
+  */
+
+
+/*
+ * @file Benchmark.hpp
+ *
+ * @brief Timing harness for pipelines and kernels.
+ *
+ */
+
+
+#include <QString>
+#include <QStringList>
+#include <stdint.h>
+#include <vector>
+
+#include <boost/property_tree/ptree.hpp>
+
+
+namespace openPablo
+{
+
+    /*
+     * @class BenchmarkCase
+     *
+     * @brief One measured piece of work
+     *
+     * prepare() and cleanup() run once around all repetitions, setUp()
+     * before every single one. None of them is timed, only run() is.
+     * Errors are reported by throwing.
+     *
+     */
+    class BenchmarkCase
+    {
+        public:
+            BenchmarkCase (QString _name, double _megapixels);
+
+            virtual ~BenchmarkCase();
+
+            virtual void prepare () {}
+
+            virtual void setUp () {}
+
+            virtual void run () = 0;
+
+            virtual void cleanup () {}
+
+            QString name () const;
+
+            // pixels processed by one run, for the throughput
+            double megapixels () const;
+
+        protected:
+            QString caseName;
+
+            double caseMegapixels;
+    };
+
+
+
+    struct BenchmarkResult
+    {
+        QString name;
+        double megapixels;
+        int repetitions;
+
+        // seconds
+        double min;
+        double median;
+        double mean;
+        double max;
+
+        double megapixelsPerSecond;     // from the median
+
+        int64_t peakRSS;                // bytes, see Benchmark::peakIsPerCase
+
+        bool failed;
+        QString error;
+    };
+
+
+
+    /*
+     * @class Benchmark
+     *
+     * @brief Runs cases with warmup and repetitions
+     *
+     * Every case is warmed up, then timed for a number of repetitions. The
+     * median time gives the throughput in megapixels per second. The peak
+     * RSS is reset before each case where the kernel allows it, so it
+     * belongs to the case and not to everything that ran before.
+     *
+     * The results are written as JSON and can be compared against the
+     * JSON of an earlier run, cases are matched by name.
+     *
+     */
+    class Benchmark
+    {
+        public:
+            Benchmark (int _warmup, int _repetitions);
+
+            // only cases whose name contains one of the patterns are run,
+            // no patterns means all cases.
+            void setFilter (QStringList _patterns);
+
+            bool selected (QString name) const;
+
+            // runs the case if it is selected and deletes it.
+            void run (BenchmarkCase *benchmarkCase);
+
+            const std::vector<BenchmarkResult>& results () const;
+
+            // true if the peak RSS of each result only covers its case,
+            // false if it is the peak of the process so far.
+            bool peakIsPerCase () const;
+
+            // config describes the run (machine, sizes, seed) and is written
+            // as the "config" object next to the results.
+            bool writeJSON (QString fileName, const boost::property_tree::ptree &config) const;
+
+            // prints every case that is slower than the baseline by more
+            // than the tolerance (0.1 = 10%), returns their number.
+            int compare (QString baselineFileName, double tolerance) const;
+
+        private:
+            int warmup;
+
+            int repetitions;
+
+            QStringList patterns;
+
+            bool perCasePeak;
+
+            std::vector<BenchmarkResult> resultList;
+    };
+
+}
+
+
+#endif // OPENPABLO_BENCHMARK_H_
@@ -0,0 +1,1045 @@
+/*
+ *  BenchmarkCases.cpp
+ *
+ *
+ *  This file is part of openPablo.
+ *
+ *  Copyright (c) 2012- Aydin Demircioglu (aydin@openpablo.org)
+ *
+ *  openPablo is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  openPablo is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with openPablo.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "BenchmarkCases.hpp"
+
+#include "TicketJob.hpp"
+#include "ProcessorFactory.hpp"
+
+#include "improcfun.h"
+#include "rawimagesource.h"
+#include "rawimage.h"
+#include "settings.h"
+#include "alignedbuffer.h"
+#include "gauss.h"
+#include "curves.h"
+#include "imagefloat.h"
+
+#include <string.h>
+#include <algorithm>
+#include <stdexcept>
+#include <sstream>
+#include <cmath>
+#include <limits>
+#include <QFileInfo>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+
+/*
+ * @mainpage BenchmarkCases
+ *
+ * Description in html
+ * @author Aydin Demircioglu
+  */
+
+
+/*
+ * @file BenchmarkCases.cpp
+ *
+ * @brief The ticket pipelines and the rtengine kernels as benchmark cases.
+ *
+ */
+
+
+
+namespace openPablo
+{
+
+    // preprocess, demosaic and the whole image out of the source, the way
+    // processImage gets it. The caller deletes the image
+    static rtengine::Imagefloat *developRaw (rtengine::RawImageSource *source, const rtengine::procparams::RAWParams &raw)
+    {
+        rtengine::procparams::ProcParams defaults;
+        int width, height;
+
+        source -> preprocess (raw);
+        source -> demosaic (raw);
+        source -> getFullSize (width, height);
+
+        rtengine::Imagefloat *image = new rtengine::Imagefloat (width, height);
+        source -> getImage (source -> getWB(), TR_NONE, image, rtengine::PreviewProps (0, 0, width, height, 1),
+                            defaults.hlrecovery, defaults.icm, raw);
+        return image;
+    }
+
+
+
+    // throws if more than share of the samples of image differ from the reference by
+    // more than tolerance, what names the comparison in the message
+    template<typename T>
+    static void comparePlanes (T **referencePlanes[3], T **imagePlanes[3], int width, int height, double tolerance, double share, std::string what)
+    {
+        double maxDifference = 0.0;
+        size_t outside = 0;
+        for (int c = 0; c < 3; c++)
+        {
+            for (int y = 0; y < height; y++)
+            {
+                for (int x = 0; x < width; x++)
+                {
+                    double difference = fabs ((double) referencePlanes[c][y][x] - (double) imagePlanes[c][y][x]);
+                    // NaN counts as outside
+                    if ((difference <= tolerance) == false)
+                    {
+                        outside++;
+                    }
+                    maxDifference = std::max (maxDifference, difference);
+                }
+            }
+        }
+
+        if (outside > share * 3.0 * width * height)
+        {
+            std::ostringstream message;
+            message << what << ": " << outside << " of " << 3 * width * height << " samples differ by more than "
+                    << tolerance << ", up to " << maxDifference;
+            throw std::runtime_error (message.str());
+        }
+    }
+
+
+
+    static void compareImages (rtengine::Imagefloat *reference, rtengine::Imagefloat *image, double tolerance, double share, std::string what)
+    {
+        if ((image -> getWidth() != reference -> getWidth()) || (image -> getHeight() != reference -> getHeight()))
+        {
+            throw std::runtime_error (what + ": the sizes differ");
+        }
+
+        float **referencePlanes[3] = { reference -> r, reference -> g, reference -> b };
+        float **imagePlanes[3] = { image -> r, image -> g, image -> b };
+        comparePlanes (referencePlanes, imagePlanes, reference -> getWidth(), reference -> getHeight(), tolerance, share, what);
+    }
+
+
+
+    static void compareImages (rtengine::IImage16 *reference, rtengine::IImage16 *image, double tolerance, double share, std::string what)
+    {
+        if ((image -> getWidth() != reference -> getWidth()) || (image -> getHeight() != reference -> getHeight()))
+        {
+            throw std::runtime_error (what + ": the sizes differ");
+        }
+
+        unsigned short **referencePlanes[3] = { reference -> getRPlane(), reference -> getGPlane(), reference -> getBPlane() };
+        unsigned short **imagePlanes[3] = { image -> getRPlane(), image -> getGPlane(), image -> getBPlane() };
+        comparePlanes (referencePlanes, imagePlanes, reference -> getWidth(), reference -> getHeight(), tolerance, share, what);
+    }
+
+
+
+    /*
+     * @class PipelineCase
+     *
+     * @brief Runs a ticket from start to end, like openpablo <ticket>
+     *
+     */
+
+
+    PipelineCase::PipelineCase (QString _name, double _megapixels, QString _ticketFileName)
+        : BenchmarkCase (_name, _megapixels),
+          ticketFileName (_ticketFileName)
+    {
+        //
+    }
+
+
+
+    void PipelineCase::run ()
+    {
+        TicketJob job (ticketFileName);
+        job.run();
+
+        if (job.succeeded() == false)
+        {
+            throw std::runtime_error (job.errorMessage().toStdString());
+        }
+    }
+
+
+
+    /*
+     * @class DemosaicCase
+     *
+     * @brief One demosaic method of the RawTherapee engine on a Bayer file
+     *
+     */
+
+
+    DemosaicCase::DemosaicCase (QString _name, QString _rawFileName, double _megapixels, std::string _method, bool _simd, bool _check)
+        : BenchmarkCase (_name, _megapixels),
+          rawFileName (_rawFileName),
+          simd (_simd),
+          check (_check),
+          previousSIMD (false),
+          previousNoAVX2 (false),
+          source (NULL)
+    {
+        rtengine::procparams::ProcParams defaults;
+        raw = defaults.raw;
+        raw.dmethod = _method;
+    }
+
+
+
+    DemosaicCase::~DemosaicCase ()
+    {
+        cleanup();
+    }
+
+
+
+    void DemosaicCase::prepare ()
+    {
+        rtengine::Settings *settings = ProcessorFactory::engineSettings();
+        if (settings == NULL)
+        {
+            throw std::runtime_error ("The engine is not initialized");
+        }
+        previousSIMD = settings -> simdDemosaic;
+        previousNoAVX2 = settings -> simdDemosaicNoAVX2;
+
+        source = new rtengine::RawImageSource ();
+        if (source -> load (rawFileName.toStdString()) != 0)
+        {
+            throw std::runtime_error ("Cannot load " + rawFileName.toStdString());
+        }
+
+        if (check == true)
+        {
+            // the kernels use float constants where the scalar code has doubles, and the
+            // decisions between directions can flip on such differences. More than one
+            // in a thousand samples off by more than 1 (of 65535) is an error
+            settings -> simdDemosaic = false;
+            rtengine::Imagefloat *scalar = developRaw (source, raw);
+            settings -> simdDemosaic = true;
+            const char *kernels[2] = { "SSE2", "AVX2" };
+            for (int k = 0; k < 2; k++)
+            {
+                settings -> simdDemosaicNoAVX2 = (k == 0);
+                rtengine::Imagefloat *vectorized = developRaw (source, raw);
+                try
+                {
+                    compareImages (scalar, vectorized, 1.0, 0.001, raw.dmethod + " with the " + kernels[k] + " kernels and the scalar code");
+                }
+                catch (...)
+                {
+                    delete scalar;
+                    delete vectorized;
+                    throw;
+                }
+                delete vectorized;
+            }
+            delete scalar;
+            settings -> simdDemosaicNoAVX2 = previousNoAVX2;
+        }
+
+        settings -> simdDemosaic = simd;
+    }
+
+
+
+    void DemosaicCase::setUp ()
+    {
+        source -> preprocess (raw);
+    }
+
+
+
+    void DemosaicCase::run ()
+    {
+        source -> demosaic (raw);
+    }
+
+
+
+    void DemosaicCase::cleanup ()
+    {
+        delete source;
+        source = NULL;
+
+        rtengine::Settings *settings = ProcessorFactory::engineSettings();
+        if (settings != NULL)
+        {
+            settings -> simdDemosaic = previousSIMD;
+            settings -> simdDemosaicNoAVX2 = previousNoAVX2;
+        }
+    }
+
+
+
+    /*
+     * @class RawLoadCase
+     *
+     * @brief Opens and decodes a raw file through the IMFILE layer
+     *
+     */
+
+
+    RawLoadCase::RawLoadCase (QString _name, QString _rawFileName, double _megapixels, bool _mmap)
+        : BenchmarkCase (_name, _megapixels),
+          rawFileName (_rawFileName),
+          mmap (_mmap),
+          previousMMap (false),
+          image (NULL)
+    {
+        //
+    }
+
+
+
+    RawLoadCase::~RawLoadCase ()
+    {
+        cleanup();
+    }
+
+
+
+    void RawLoadCase::prepare ()
+    {
+        rtengine::Settings *settings = ProcessorFactory::engineSettings();
+        if (settings == NULL)
+        {
+            throw std::runtime_error ("The engine is not initialized");
+        }
+        previousMMap = settings -> mmapFiles;
+        settings -> mmapFiles = mmap;
+    }
+
+
+
+    void RawLoadCase::run ()
+    {
+        delete image;
+        image = new rtengine::RawImage (rawFileName.toStdString());
+        if (image -> loadRaw (true, true) != 0)
+        {
+            throw std::runtime_error ("Cannot load " + rawFileName.toStdString());
+        }
+    }
+
+
+
+    void RawLoadCase::cleanup ()
+    {
+        delete image;
+        image = NULL;
+
+        rtengine::Settings *settings = ProcessorFactory::engineSettings();
+        if (settings != NULL)
+        {
+            settings -> mmapFiles = previousMMap;
+        }
+    }
+
+
+
+    /*
+     * @class CACase
+     *
+     * @brief Automatic CA correction of the raw data
+     *
+     */
+
+
+    CACase::CACase (QString _name, QString _rawFileName, double _megapixels)
+        : BenchmarkCase (_name, _megapixels),
+          rawFileName (_rawFileName),
+          source (NULL)
+    {
+        rtengine::procparams::ProcParams defaults;
+        raw = defaults.raw;
+        raw.ca_autocorrect = true;
+        raw.dmethod = "fast";
+    }
+
+
+
+    CACase::~CACase ()
+    {
+        cleanup();
+    }
+
+
+
+    void CACase::prepare ()
+    {
+        source = new rtengine::RawImageSource ();
+        if (source -> load (rawFileName.toStdString()) != 0)
+        {
+            throw std::runtime_error ("Cannot load " + rawFileName.toStdString());
+        }
+
+#ifdef _OPENMP
+        int threads = omp_get_max_threads();
+        omp_set_num_threads (1);
+        rtengine::Imagefloat *serial = developRaw (source, raw);
+        omp_set_num_threads (threads);
+        rtengine::Imagefloat *parallel = developRaw (source, raw);
+
+        try
+        {
+            compareImages (serial, parallel, 0.0, 0.0, "CA correction with one and with all threads");
+        }
+        catch (...)
+        {
+            delete serial;
+            delete parallel;
+            throw;
+        }
+        delete serial;
+        delete parallel;
+#endif
+    }
+
+
+
+    void CACase::run ()
+    {
+        source -> preprocess (raw);
+    }
+
+
+
+    void CACase::cleanup ()
+    {
+        delete source;
+        source = NULL;
+    }
+
+
+
+    /*
+     * @class TileCase
+     *
+     * @brief processImage of a RAW in tiles
+     *
+     */
+
+
+    TileCase::TileCase (QString _name, QString _rawFileName, double _megapixels, int _tileSize)
+        : BenchmarkCase (_name, _megapixels),
+          rawFileName (_rawFileName),
+          tileSize (_tileSize),
+          previousTileSize (0),
+          image (NULL)
+    {
+        // the stages whose blurs the tiles cut, tileHalo in simpleprocess.cc
+        params.sharpening.enabled = true;
+        params.sharpening.method = "usm";
+        params.sharpening.radius = 1.0;
+        params.sharpening.amount = 200;
+        params.impulseDenoise.enabled = true;
+        params.impulseDenoise.thresh = 50;
+    }
+
+
+
+    TileCase::~TileCase ()
+    {
+        cleanup();
+    }
+
+
+
+    rtengine::IImage16 *TileCase::develop ()
+    {
+        int errorCode = 0;
+        rtengine::ProcessingJob *job = rtengine::ProcessingJob::create (image, params);
+        rtengine::IImage16 *result = rtengine::processImage (job, errorCode);
+        if (result == NULL)
+        {
+            throw std::runtime_error ("Cannot develop " + rawFileName.toStdString());
+        }
+        return result;
+    }
+
+
+
+    void TileCase::prepare ()
+    {
+        rtengine::Settings *settings = ProcessorFactory::engineSettings();
+        if (settings == NULL)
+        {
+            throw std::runtime_error ("The engine is not initialized");
+        }
+        previousTileSize = settings -> tileSize;
+
+        int errorCode = 0;
+        image = rtengine::InitialImage::load (rawFileName.toStdString(), true, &errorCode);
+        if (image == NULL)
+        {
+            throw std::runtime_error ("Cannot load " + rawFileName.toStdString());
+        }
+
+        // the tiles cut the recursive gaussians of the sharpening and the impulse
+        // denoise at their halo, so the results are close but not the same. No sample
+        // may be off by more than one step of an 8 bit rendition (256 of 65535), and
+        // at most one in a thousand by more than 16
+        settings -> tileSize = 0;
+        rtengine::IImage16 *full = develop();
+        settings -> tileSize = tileSize;
+        rtengine::IImage16 *tiled = NULL;
+        try
+        {
+            tiled = develop();
+            compareImages (full, tiled, 256.0, 0.0, "Tiled and full frame processImage");
+            compareImages (full, tiled, 16.0, 0.001, "Tiled and full frame processImage");
+        }
+        catch (...)
+        {
+            full -> free();
+            if (tiled != NULL)
+            {
+                tiled -> free();
+            }
+            throw;
+        }
+        full -> free();
+        tiled -> free();
+    }
+
+
+
+    void TileCase::run ()
+    {
+        develop() -> free();
+    }
+
+
+
+    void TileCase::cleanup ()
+    {
+        if (image != NULL)
+        {
+            image -> decreaseRef();
+            image = NULL;
+        }
+
+        rtengine::Settings *settings = ProcessorFactory::engineSettings();
+        if (settings != NULL)
+        {
+            settings -> tileSize = previousTileSize;
+        }
+    }
+
+
+
+    /*
+     * @class ResizeCase
+     *
+     * @brief ImProcFunctions::resize on a 16 bit image
+     *
+     */
+
+
+    ResizeCase::ResizeCase (QString _name, SyntheticInputs &_inputs, int _width, int _height, std::string _method, double _scale)
+        : BenchmarkCase (_name, (double) _width * _height / 1000000.0),
+          inputs (_inputs),
+          width (_width),
+          height (_height),
+          scale (_scale),
+          source (NULL),
+          target (NULL)
+    {
+        params.resize.enabled = true;
+        params.resize.method = _method;
+        params.resize.scale = _scale;
+    }
+
+
+
+    ResizeCase::~ResizeCase ()
+    {
+        cleanup();
+    }
+
+
+
+    void ResizeCase::prepare ()
+    {
+        std::vector<uint16_t> pixels = inputs.render (width, height);
+
+        source = new rtengine::Image16 (width, height);
+        for (int y = 0; y < height; y++)
+        {
+            const uint16_t *row = &pixels[(size_t) y * width * 3];
+            for (int x = 0; x < width; x++)
+            {
+                source -> r[y][x] = row[3 * x];
+                source -> g[y][x] = row[3 * x + 1];
+                source -> b[y][x] = row[3 * x + 2];
+            }
+        }
+
+        target = new rtengine::Image16 (std::max ((int) (width * scale + 0.5), 1), std::max ((int) (height * scale + 0.5), 1));
+    }
+
+
+
+    void ResizeCase::run ()
+    {
+        rtengine::ImProcFunctions ipf (&params, true);
+        ipf.resize (source, target, scale);
+    }
+
+
+
+    void ResizeCase::cleanup ()
+    {
+        delete source;
+        source = NULL;
+        delete target;
+        target = NULL;
+    }
+
+
+
+    /*
+     * @class LUTCase
+     *
+     * @brief Batch lookups of a tone curve sized LUTf
+     *
+     */
+
+
+    // the same bits, or NaN on both sides. A NaN index gives NaN, only its
+    // bits are left to the arithmetic
+    static bool sameValue (float a, float b)
+    {
+        uint32_t bitsA, bitsB;
+        memcpy (&bitsA, &a, sizeof (bitsA));
+        memcpy (&bitsB, &b, sizeof (bitsB));
+        return (bitsA == bitsB) || (((bitsA & 0x7fffffff) > 0x7f800000) && ((bitsB & 0x7fffffff) > 0x7f800000));
+    }
+
+
+
+    static void throwLookup (const char *what, int flags, int size, float index, float expected, float value)
+    {
+        std::ostringstream message;
+        message << "LUT " << what << " (flags " << flags << ", size " << size << ") at " << index
+                << " gives " << value << " instead of " << expected;
+        throw std::runtime_error (message.str());
+    }
+
+
+
+    LUTCase::LUTCase (QString _name, int _width, int _height)
+        : BenchmarkCase (_name, (double) _width * _height / 1000000.0),
+          width (_width),
+          height (_height),
+          curve (65536, 0)
+    {
+        //
+    }
+
+
+
+    void LUTCase::prepare ()
+    {
+        const int flags[4] = { 0, LUT_CLIP_BELOW, LUT_CLIP_ABOVE, LUT_CLIP_BELOW | LUT_CLIP_ABOVE };
+        const int sizes[3] = { 2, 17, 65536 };
+
+        for (int f = 0; f < 4; f++)
+        {
+            for (int s = 0; s < 3; s++)
+            {
+                const int size = sizes[s];
+                LUTf lut (size, flags[f]);
+                for (int i = 0; i < size; i++)
+                {
+                    lut[i] = 1000.0f * sin (0.37f * i) + i;
+                }
+
+                // inside, on the entries, just outside and far outside of the table, NaN
+                std::vector<float> indices;
+                for (int k = 0; k < 4099; k++)
+                {
+                    float t = (float) k / 4098;
+                    indices.push_back (-0.25f * size + 1.5f * size * t);
+                    indices.push_back ((float) (k % size));
+                }
+                indices.push_back (-1e10f);
+                indices.push_back (-0.5f);
+                indices.push_back (size - 1.5f);
+                indices.push_back (size - 1.0f);
+                indices.push_back (size - 0.5f);
+                indices.push_back (3e9f);
+                indices.push_back (std::numeric_limits<float>::quiet_NaN());
+
+                std::vector<float> batch (indices.size());
+                lut.interpolate (&indices[0], &batch[0], indices.size());
+                for (size_t k = 0; k < indices.size(); k++)
+                {
+                    if (sameValue (lut[indices[k]], batch[k]) == false)
+                    {
+                        throwLookup ("interpolate", flags[f], size, indices[k], lut[indices[k]], batch[k]);
+                    }
+                }
+
+#ifdef __SSE2__
+                // integer indices clip on both sides whatever the flags
+                for (int k = -size - 3; k < 2 * size + 3; k += 4)
+                {
+                    float lanes[4];
+                    STVFU (lanes[0], lut[_mm_setr_epi32 (k, k + 1, k + 2, k + 3)]);
+                    for (int l = 0; l < 4; l++)
+                    {
+                        if (sameValue (lut[k + l], lanes[l]) == false)
+                        {
+                            throwLookup ("vint", flags[f], size, k + l, lut[k + l], lanes[l]);
+                        }
+                    }
+                }
+#endif
+            }
+        }
+
+        // falling, so a difference of two entries is negative
+        for (int s = 0; s < 2; s++)
+        {
+            const int size = (s == 0) ? 1000 : 65536;
+            LUTus compact (size);
+            for (int i = 0; i < size; i++)
+            {
+                compact[i] = 65535 - (i * 37) % 65536;
+            }
+
+            std::vector<unsigned short> indices (65536);
+            std::vector<unsigned short> batch (65536);
+            for (int k = 0; k < 65536; k++)
+            {
+                indices[k] = (unsigned short) (k * 40503);
+            }
+            compact.lookup (&indices[0], &batch[0], indices.size());
+            for (size_t k = 0; k < indices.size(); k++)
+            {
+                if (batch[k] != compact[(int) indices[k]])
+                {
+                    throwLookup ("lookup", 0, size, indices[k], compact[(int) indices[k]], batch[k]);
+                }
+            }
+
+            float value = compact[0.5f];
+            float expected = (unsigned short) (compact[0] + (compact[1] - compact[0]) * 0.5f);
+            if (value != expected)
+            {
+                throwLookup ("LUTus", 0, size, 0.5f, expected, value);
+            }
+        }
+
+        // a gamma like tone curve, looked up at every pixel
+        for (int i = 0; i < 65536; i++)
+        {
+            curve[i] = 65535.0 * pow (i / 65535.0, 0.45);
+        }
+        index.resize ((size_t) width * height);
+        values.resize ((size_t) width * height);
+        for (size_t k = 0; k < index.size(); k++)
+        {
+            index[k] = (float) ((k * 2654435761u) % 6553600) / 100.0f;
+        }
+    }
+
+
+
+    void LUTCase::run ()
+    {
+        curve.interpolate (&index[0], &values[0], index.size());
+    }
+
+
+
+    void LUTCase::cleanup ()
+    {
+        std::vector<float>().swap (index);
+        std::vector<float>().swap (values);
+    }
+
+
+
+    /*
+     * @class LabCase
+     *
+     * @brief Base of the kernels that work on a Lab image
+     *
+     */
+
+
+    LabCase::LabCase (QString _name, SyntheticInputs &_inputs, int _width, int _height)
+        : BenchmarkCase (_name, (double) _width * _height / 1000000.0),
+          inputs (_inputs),
+          width (_width),
+          height (_height),
+          original (NULL),
+          lab (NULL)
+    {
+        //
+    }
+
+
+
+    LabCase::~LabCase ()
+    {
+        cleanup();
+    }
+
+
+
+    void LabCase::prepare ()
+    {
+        std::vector<uint16_t> pixels = inputs.render (width, height);
+
+        // a rough Lab is good enough, the kernels only need plausible ranges:
+        // L 0..32768, a and b about +-100 scaled by 327.68
+        original = new rtengine::LabImage (width, height);
+        for (int y = 0; y < height; y++)
+        {
+            const uint16_t *row = &pixels[(size_t) y * width * 3];
+            for (int x = 0; x < width; x++)
+            {
+                float r = row[3 * x] / 65535.0f;
+                float g = row[3 * x + 1] / 65535.0f;
+                float b = row[3 * x + 2] / 65535.0f;
+                original -> L[y][x] = 32768.0f * (0.299f * r + 0.587f * g + 0.114f * b);
+                original -> a[y][x] = 327.68f * 80.0f * (r - g);
+                original -> b[y][x] = 327.68f * 80.0f * (0.5f * (r + g) - b);
+            }
+        }
+
+        lab = new rtengine::LabImage (width, height);
+    }
+
+
+
+    void LabCase::setUp ()
+    {
+        // the three planes are one block
+        memcpy (lab -> L[0], original -> L[0], (size_t) width * height * 3 * sizeof (float));
+    }
+
+
+
+    void LabCase::cleanup ()
+    {
+        delete original;
+        original = NULL;
+        delete lab;
+        lab = NULL;
+    }
+
+
+
+    GaussCase::GaussCase (QString _name, SyntheticInputs &_inputs, int _width, int _height, double _sigma)
+        : LabCase (_name, _inputs, _width, _height),
+          sigma (_sigma)
+    {
+        //
+    }
+
+
+
+    void GaussCase::run ()
+    {
+        // same call pattern as the sharpening, the blur functions share
+        // their rows between the threads of the enclosing region
+#ifdef _OPENMP
+        #pragma omp parallel
+#endif
+        {
+            AlignedBuffer<double> buffer (std::max (width, height));
+            gaussHorizontal<float> (lab -> L, lab -> L, &buffer, width, height, sigma, true);
+            gaussVertical<float> (lab -> L, lab -> L, &buffer, width, height, sigma, true);
+        }
+    }
+
+
+
+    DenoiseCase::DenoiseCase (QString _name, SyntheticInputs &_inputs, int _width, int _height)
+        : LabCase (_name, _inputs, _width, _height),
+          denoised (NULL)
+    {
+        params.dirpyrDenoise.enabled = true;
+    }
+
+
+
+    DenoiseCase::~DenoiseCase ()
+    {
+        delete denoised;
+    }
+
+
+
+    void DenoiseCase::prepare ()
+    {
+        LabCase::prepare();
+        denoised = new rtengine::LabImage (width, height);
+    }
+
+
+
+    void DenoiseCase::run ()
+    {
+        rtengine::ImProcFunctions ipf (&params, true);
+        ipf.dirpyrLab_denoise (lab, denoised, params.dirpyrDenoise);
+    }
+
+
+
+    void DenoiseCase::cleanup ()
+    {
+        LabCase::cleanup();
+        delete denoised;
+        denoised = NULL;
+    }
+
+
+
+    LabCurvesCase::LabCurvesCase (QString _name, SyntheticInputs &_inputs, int _width, int _height, bool _vibrance)
+        : LabCase (_name, _inputs, _width, _height),
+          curve (65536, 0),
+          acurve (65536, 0),
+          bcurve (65536, 0),
+          satcurve (65536, 0)
+    {
+        params.labCurve.contrast = 20;
+        params.labCurve.saturation = 20;
+        params.vibrance.enabled = _vibrance;
+        params.vibrance.pastels = 30;
+        params.vibrance.saturated = 30;
+    }
+
+
+
+    void LabCurvesCase::prepare ()
+    {
+        LabCase::prepare();
+
+        LUTu histogram (65536);
+        histogram.clear();
+        LUTu dummy;
+        rtengine::CurveFactory::complexLCurve (params.labCurve.brightness, params.labCurve.contrast, params.labCurve.lcurve,
+                                               histogram, histogram, curve, dummy, 1);
+        rtengine::CurveFactory::complexsgnCurve (params.labCurve.saturation, params.labCurve.enable_saturationlimiter, params.labCurve.saturationlimit,
+                                                 params.labCurve.acurve, params.labCurve.bcurve, acurve, bcurve, satcurve, 1);
+    }
+
+
+
+    void LabCurvesCase::run ()
+    {
+        rtengine::ImProcFunctions ipf (&params, true);
+        ipf.labCurves (lab, curve, acurve, bcurve, satcurve);
+    }
+
+
+
+    EPDCase::EPDCase (QString _name, SyntheticInputs &_inputs, int _width, int _height, int _solver, double _outputScale)
+        : LabCase (_name, _inputs, _width, _height),
+          solver (_solver),
+          outputScale (_outputScale),
+          previousSolver (0),
+          previousDownscale (false)
+    {
+        params.edgePreservingDecompositionUI.enabled = true;
+    }
+
+
+
+    EPDCase::~EPDCase ()
+    {
+        cleanup();
+    }
+
+
+
+    void EPDCase::prepare ()
+    {
+        rtengine::Settings *settings = ProcessorFactory::engineSettings();
+        if (settings == NULL)
+        {
+            throw std::runtime_error ("The engine is not initialized");
+        }
+        previousSolver = settings -> epdSolver;
+        previousDownscale = settings -> epdDownscale;
+        settings -> epdSolver = solver;
+        settings -> epdDownscale = true;
+
+        LabCase::prepare();
+    }
+
+
+
+    void EPDCase::run ()
+    {
+        rtengine::ImProcFunctions ipf (&params, true);
+        ipf.EPDToneMap (lab, 0, 1, outputScale);
+    }
+
+
+
+    void EPDCase::cleanup ()
+    {
+        LabCase::cleanup();
+
+        rtengine::Settings *settings = ProcessorFactory::engineSettings();
+        if (settings != NULL)
+        {
+            settings -> epdSolver = previousSolver;
+            settings -> epdDownscale = previousDownscale;
+        }
+    }
+
+
+
+    ICCCase::ICCCase (QString _name, SyntheticInputs &_inputs, int _width, int _height, QString _profileFileName)
+        : LabCase (_name, _inputs, _width, _height),
+          profileFileName (_profileFileName)
+    {
+        //
+    }
+
+
+
+    void ICCCase::prepare ()
+    {
+        if (QFileInfo (profileFileName).exists() == false)
+        {
+            throw std::runtime_error ("Cannot find profile " + profileFileName.toStdString());
+        }
+        LabCase::prepare();
+    }
+
+
+
+    void ICCCase::run ()
+    {
+        rtengine::ImProcFunctions ipf (&params, true);
+        rtengine::Image16 *image = ipf.lab2rgb16 (lab, 0, 0, width, height, "file:" + profileFileName.toStdString());
+        delete image;
+    }
+
+}
@@ -0,0 +1,463 @@
+/*
+ *  BenchmarkCases.hpp
+ *
+ *
+ *  This file is part of openPablo.
+ *
+ *  Copyright (c) 2012- Aydin Demircioglu (aydin@openpablo.org)
+ *
+ *  openPablo is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  openPablo is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with openPablo.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef OPENPABLO_BENCHMARKCASES_H_
+#define OPENPABLO_BENCHMARKCASES_H_
+
+/*
+ * @mainpage BenchmarkCases
+ *
+ * Description in html
+ * @author Aydin Demircioglu
+  */
+
+
+/*
+ * @file BenchmarkCases.hpp
+ *
+ * @brief The ticket pipelines and the rtengine kernels as benchmark cases.
+ *
+ */
+
+
+#include "Benchmark.hpp"
+#include "SyntheticInputs.hpp"
+
+#include <QString>
+#include <string>
+#include <vector>
+
+#include "rtengine.h"
+#include "procparams.h"
+#include "LUT.h"
+
+
+namespace rtengine
+{
+    class Image16;
+    class LabImage;
+    class RawImageSource;
+    class RawImage;
+}
+
+
+namespace openPablo
+{
+
+    /*
+     * @class PipelineCase
+     *
+     * @brief Runs a ticket from start to end, like openpablo <ticket>
+     *
+     */
+    class PipelineCase: public BenchmarkCase
+    {
+        public:
+            PipelineCase (QString _name, double _megapixels, QString _ticketFileName);
+
+            virtual void run ();
+
+        private:
+            QString ticketFileName;
+    };
+
+
+
+    /*
+     * @class DemosaicCase
+     *
+     * @brief One demosaic method of the RawTherapee engine on a Bayer file
+     *
+     * The raw file is loaded once, the raw data is preprocessed again
+     * before every repetition since some methods work in place. simd
+     * switches the SSE2/AVX2 kernels of the engine on or off for the run.
+     * With check, prepare() first develops the file with the scalar code,
+     * the SSE2 and the AVX2 kernels and fails if they differ by more than
+     * float rounding (see DemosaicCase::prepare).
+     *
+     */
+    class DemosaicCase: public BenchmarkCase
+    {
+        public:
+            DemosaicCase (QString _name, QString _rawFileName, double _megapixels, std::string _method, bool _simd, bool _check = false);
+
+            virtual ~DemosaicCase ();
+
+            virtual void prepare ();
+
+            virtual void setUp ();
+
+            virtual void run ();
+
+            virtual void cleanup ();
+
+        private:
+            QString rawFileName;
+
+            bool simd;
+
+            bool check;
+
+            bool previousSIMD;
+
+            bool previousNoAVX2;
+
+            rtengine::procparams::RAWParams raw;
+
+            rtengine::RawImageSource *source;
+    };
+
+
+
+    /*
+     * @class RawLoadCase
+     *
+     * @brief Opens and decodes a raw file through the IMFILE layer
+     *
+     * Either maps the file or reads it into a buffer, the engine setting is
+     * switched for the timed runs and restored afterwards. The page cache
+     * is warm after the warmup, so this compares the copy against the
+     * mapping and not the disk.
+     *
+     */
+    class RawLoadCase: public BenchmarkCase
+    {
+        public:
+            RawLoadCase (QString _name, QString _rawFileName, double _megapixels, bool _mmap);
+
+            virtual ~RawLoadCase ();
+
+            virtual void prepare ();
+
+            virtual void run ();
+
+            virtual void cleanup ();
+
+        private:
+            QString rawFileName;
+
+            bool mmap;
+
+            bool previousMMap;
+
+            rtengine::RawImage *image;
+    };
+
+
+
+    /*
+     * @class CACase
+     *
+     * @brief Automatic CA correction of the raw data
+     *
+     * Times preprocess with ca_autocorrect, CA_correct_RT is most of it.
+     * prepare() develops the file once with a single thread and once with
+     * all of them and fails if the results are not the same, the tiles of
+     * the correction run in parallel.
+     *
+     */
+    class CACase: public BenchmarkCase
+    {
+        public:
+            CACase (QString _name, QString _rawFileName, double _megapixels);
+
+            virtual ~CACase ();
+
+            virtual void prepare ();
+
+            virtual void run ();
+
+            virtual void cleanup ();
+
+        private:
+            QString rawFileName;
+
+            rtengine::procparams::RAWParams raw;
+
+            rtengine::RawImageSource *source;
+    };
+
+
+
+    /*
+     * @class TileCase
+     *
+     * @brief processImage of a RAW in tiles of tileSize pixels
+     *
+     * Sharpening and impulse denoise are on, their halos decide the overlap of
+     * the tiles. prepare() develops the file once on the full frame and once in
+     * tiles and fails if they differ by more than the tolerance stated there.
+     *
+     */
+    class TileCase: public BenchmarkCase
+    {
+        public:
+            TileCase (QString _name, QString _rawFileName, double _megapixels, int _tileSize);
+
+            virtual ~TileCase ();
+
+            virtual void prepare ();
+
+            virtual void run ();
+
+            virtual void cleanup ();
+
+        private:
+            rtengine::IImage16 *develop ();
+
+            QString rawFileName;
+
+            int tileSize;
+
+            int previousTileSize;
+
+            rtengine::procparams::ProcParams params;
+
+            rtengine::InitialImage *image;
+    };
+
+
+
+    /*
+     * @class ResizeCase
+     *
+     * @brief ImProcFunctions::resize on a 16 bit image
+     *
+     */
+    class ResizeCase: public BenchmarkCase
+    {
+        public:
+            ResizeCase (QString _name, SyntheticInputs &_inputs, int _width, int _height, std::string _method, double _scale);
+
+            virtual ~ResizeCase ();
+
+            virtual void prepare ();
+
+            virtual void run ();
+
+            virtual void cleanup ();
+
+        private:
+            SyntheticInputs &inputs;
+
+            int width;
+
+            int height;
+
+            double scale;
+
+            rtengine::procparams::ProcParams params;
+
+            rtengine::Image16 *source;
+
+            rtengine::Image16 *target;
+    };
+
+
+
+    /*
+     * @class LUTCase
+     *
+     * @brief Batch lookups of a tone curve sized LUTf
+     *
+     * Times LUT::interpolate with one float index per pixel. prepare() first
+     * compares the four lane and row lookups with the scalar operator[] for
+     * every clip mode, over indices inside the table, clipped, extrapolated
+     * and NaN, and the 16 bit lookup of a LUTus with its int operator[]. It
+     * fails on the first difference.
+     *
+     */
+    class LUTCase: public BenchmarkCase
+    {
+        public:
+            LUTCase (QString _name, int _width, int _height);
+
+            virtual void prepare ();
+
+            virtual void run ();
+
+            virtual void cleanup ();
+
+        private:
+            int width;
+
+            int height;
+
+            LUTf curve;
+
+            std::vector<float> index;
+
+            std::vector<float> values;
+    };
+
+
+
+    /*
+     * @class LabCase
+     *
+     * @brief Base of the kernels that work on a Lab image
+     *
+     * The Lab image is rendered once, kernels that work in place get a
+     * fresh copy before every repetition.
+     *
+     */
+    class LabCase: public BenchmarkCase
+    {
+        public:
+            LabCase (QString _name, SyntheticInputs &_inputs, int _width, int _height);
+
+            virtual ~LabCase ();
+
+            virtual void prepare ();
+
+            virtual void setUp ();
+
+            virtual void cleanup ();
+
+        protected:
+            SyntheticInputs &inputs;
+
+            int width;
+
+            int height;
+
+            rtengine::procparams::ProcParams params;
+
+            rtengine::LabImage *original;
+
+            rtengine::LabImage *lab;
+    };
+
+
+
+    // separable gaussian blur of the L channel
+    class GaussCase: public LabCase
+    {
+        public:
+            GaussCase (QString _name, SyntheticInputs &_inputs, int _width, int _height, double _sigma);
+
+            virtual void run ();
+
+        private:
+            double sigma;
+    };
+
+
+
+    // directional pyramid denoise
+    class DenoiseCase: public LabCase
+    {
+        public:
+            DenoiseCase (QString _name, SyntheticInputs &_inputs, int _width, int _height);
+
+            virtual ~DenoiseCase ();
+
+            virtual void prepare ();
+
+            virtual void run ();
+
+            virtual void cleanup ();
+
+        private:
+            rtengine::LabImage *denoised;
+    };
+
+
+
+    // luminance and chrominance curves, with vibrance in the same pass
+    // when vibrance is set (see ImProcFunctions::labCurves)
+    class LabCurvesCase: public LabCase
+    {
+        public:
+            LabCurvesCase (QString _name, SyntheticInputs &_inputs, int _width, int _height, bool _vibrance);
+
+            virtual void prepare ();
+
+            virtual void run ();
+
+        private:
+            LUTf curve;
+
+            LUTf acurve;
+
+            LUTf bcurve;
+
+            LUTf satcurve;
+    };
+
+
+
+    /*
+     * @class EPDCase
+     *
+     * @brief Edge preserving decomposition tone mapping
+     *
+     * solver picks the engine's solver of the blur for the run (see
+     * Settings::epdSolver). An outputScale below 1 stands for a resize
+     * after the tone mapping, at 0.5 and below the blur is solved at the
+     * output size.
+     *
+     */
+    class EPDCase: public LabCase
+    {
+        public:
+            EPDCase (QString _name, SyntheticInputs &_inputs, int _width, int _height, int _solver, double _outputScale);
+
+            virtual ~EPDCase ();
+
+            virtual void prepare ();
+
+            virtual void run ();
+
+            virtual void cleanup ();
+
+        private:
+            int solver;
+
+            double outputScale;
+
+            int previousSolver;
+
+            bool previousDownscale;
+    };
+
+
+
+    // Lab to output profile through the ICC store, as at the end of processImage
+    class ICCCase: public LabCase
+    {
+        public:
+            ICCCase (QString _name, SyntheticInputs &_inputs, int _width, int _height, QString _profileFileName);
+
+            virtual void prepare ();
+
+            virtual void run ();
+
+        private:
+            QString profileFileName;
+    };
+
+}
+
+
+#endif // OPENPABLO_BENCHMARKCASES_H_
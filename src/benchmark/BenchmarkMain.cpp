@@ -0,0 +1,443 @@
+/*
+ *  BenchmarkMain.cpp
+ *
+ *
+ *  This file is part of openPablo.
+ *
+ *  Copyright (c) 2012- Aydin Demircioglu (aydin@openpablo.org)
+ *
+ *  openPablo is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  openPablo is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with openPablo.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "Benchmark.hpp"
+#include "BenchmarkCases.hpp"
+#include "SyntheticInputs.hpp"
+
+#include "ProcessorFactory.hpp"
+
+#include <QDateTime>
+#include <QDir>
+#include <QString>
+#include <QStringList>
+#include <QThread>
+
+#include <string>
+#include <algorithm>
+#include <iostream>
+#include <exception>
+#include <unistd.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "logog.hpp"
+#include <boost/property_tree/ptree.hpp>
+
+
+using namespace std;
+using namespace openPablo;
+using namespace logog;
+
+
+/*
+ * @file BenchmarkMain.cpp
+ *
+ * @brief Reproducible benchmark of the pipelines and the rtengine kernels.
+ *
+ * All inputs are synthetic and generated from a seed, so two runs on
+ * different machines or different revisions measure the same work. The
+ * JSON output of one run can be given as baseline to a later one.
+ *
+ */
+
+
+namespace
+{
+    struct Size
+    {
+        int width;
+        int height;
+
+        QString name () const
+        {
+            return QString ("%1x%2").arg (width).arg (height);
+        }
+
+        double megapixels () const
+        {
+            return (double) width * height / 1000000.0;
+        }
+    };
+
+
+    Size makeSize (int width, int height)
+    {
+        Size size;
+        size.width = width;
+        size.height = height;
+        return size;
+    }
+}
+
+
+
+void printUsage ()
+{
+    cout << "usage: openpablo-benchmark [options]\n";
+    cout << "       --work DIR          synthetic inputs and outputs (default /tmp/openpablo-benchmark)\n";
+    cout << "       --data DIR          openPablo data directory with the ICC profiles (default data)\n";
+    cout << "       --seed N            seed of the synthetic inputs (default 1)\n";
+    cout << "       --warmup N          untimed runs per case (default 1)\n";
+    cout << "       --repetitions N     timed runs per case (default 5)\n";
+    cout << "       --quick             small inputs only\n";
+    cout << "       --filter TEXT       only cases whose name contains TEXT, can be repeated\n";
+    cout << "       --json FILE         write the results as JSON\n";
+    cout << "       --compare FILE      compare against the JSON of an earlier run\n";
+    cout << "       --tolerance X       allowed slowdown for --compare (default 0.1 = 10%)\n";
+    cout << "       --list              print the case names and exit\n";
+}
+
+
+
+int main ( int argc, char **argv )
+{
+    LOGOG_INITIALIZE();
+
+    int retValue = 0;
+    try
+    {
+        Cout out;
+
+        // --- arguments interpretation
+
+        QString workDir = QDir::temp().filePath ("openpablo-benchmark");
+        QString dataDir = "data";
+        uint32_t seed = 1;
+        int warmup = 1;
+        int repetitions = 5;
+        bool quick = false;
+        bool listOnly = false;
+        double tolerance = 0.1;
+        QString jsonFile;
+        QString baselineFile;
+        QStringList filters;
+
+        for (int i = 1; i < argc; i++)
+        {
+            QString arg (argv[i]);
+
+            if ((arg == "--work") && (i+1 < argc))
+            {
+                workDir = argv[++i];
+            }
+            else if ((arg == "--data") && (i+1 < argc))
+            {
+                dataDir = argv[++i];
+            }
+            else if ((arg == "--seed") && (i+1 < argc))
+            {
+                seed = QString (argv[++i]).toUInt();
+            }
+            else if ((arg == "--warmup") && (i+1 < argc))
+            {
+                warmup = QString (argv[++i]).toInt();
+            }
+            else if ((arg == "--repetitions") && (i+1 < argc))
+            {
+                repetitions = QString (argv[++i]).toInt();
+            }
+            else if (arg == "--quick")
+            {
+                quick = true;
+            }
+            else if ((arg == "--filter") && (i+1 < argc))
+            {
+                filters << argv[++i];
+            }
+            else if ((arg == "--json") && (i+1 < argc))
+            {
+                jsonFile = argv[++i];
+            }
+            else if ((arg == "--compare") && (i+1 < argc))
+            {
+                baselineFile = argv[++i];
+            }
+            else if ((arg == "--tolerance") && (i+1 < argc))
+            {
+                tolerance = QString (argv[++i]).toDouble();
+            }
+            else if (arg == "--list")
+            {
+                listOnly = true;
+            }
+            else
+            {
+                printUsage();
+                return (-1);
+            }
+        }
+
+
+        // --- sizes
+
+        // pipelines run over all sizes, the single file types and the
+        // kernels on the medium one
+        std::vector<Size> sizes;
+        sizes.push_back (makeSize (1200, 800));
+        if (quick == false)
+        {
+            sizes.push_back (makeSize (4000, 3000));
+            sizes.push_back (makeSize (6000, 4000));
+        }
+        Size medium = quick ? sizes[0] : sizes[1];
+
+        // the PDF holds four images of a quarter of the medium size
+        Size pdfImage = makeSize (medium.width / 2, medium.height / 2);
+        const int pdfImages = 4;
+
+        QString iccPath = QDir (dataDir).filePath ("iccprofiles");
+        QString iccProfile = "NKsRGB.icm";
+
+
+        // --- case names, the inputs are only generated for selected cases
+
+        Benchmark benchmark (warmup, repetitions);
+        benchmark.setFilter (filters);
+
+        const char *formats[] = { "JPEG", "TIFF", "PNG" };
+        QStringList pipelineNames;
+        for (size_t i = 0; i < sizes.size(); i++)
+        {
+            for (int f = 0; f < 3; f++)
+            {
+                pipelineNames << "pipeline/" + QString (formats[f]).toLower() + "/" + sizes[i].name();
+            }
+        }
+        QString rawPipeline = "pipeline/raw/" + medium.name();
+        QString psdPipeline = "pipeline/psd/" + medium.name();
+        QString pdfPipeline = QString ("pipeline/pdf/%1-images/%2").arg (pdfImages).arg (pdfImage.name());
+
+        QStringList demosaicNames;
+        for (int m = 0; m < rtengine::procparams::RAWParams::numMethods; m++)
+        {
+            demosaicNames << QString ("kernel/demosaic/%1/%2").arg (rtengine::procparams::RAWParams::methodstring[m]).arg (medium.name());
+        }
+        // the methods with SSE2/AVX2 kernels once more on the scalar code
+        const rtengine::procparams::RAWParams::eMethod vectorized[] = { rtengine::procparams::RAWParams::amaze,
+                                                                        rtengine::procparams::RAWParams::dcb,
+                                                                        rtengine::procparams::RAWParams::fast };
+        QStringList scalarDemosaicNames;
+        for (int v = 0; v < 3; v++)
+        {
+            scalarDemosaicNames << QString ("kernel/demosaic/%1-scalar/%2").arg (rtengine::procparams::RAWParams::methodstring[vectorized[v]]).arg (medium.name());
+        }
+        QString rawLoadMMapName = "kernel/rawload/mmap/" + medium.name();
+        QString rawLoadReadName = "kernel/rawload/read/" + medium.name();
+        QString caName = "kernel/ca/" + medium.name();
+        QString tileName = "kernel/tiles/512/" + medium.name();
+        QString lanczosName = "kernel/resize/lanczos-0.25/" + medium.name();
+        QString bicubicName = "kernel/resize/bicubic-0.25/" + medium.name();
+        QString gaussSmallName = "kernel/gauss/sigma2/" + medium.name();
+        QString gaussLargeName = "kernel/gauss/sigma30/" + medium.name();
+        QString denoiseName = "kernel/dirpyrdenoise/" + medium.name();
+        QString labCurvesName = "kernel/labcurves/curves/" + medium.name();
+        QString vibranceName = "kernel/labcurves/vibrance/" + medium.name();
+        QString epdName = "kernel/epd/cholesky/" + medium.name();
+        QString epdMultigridName = "kernel/epd/multigrid/" + medium.name();
+        QString epdReducedName = "kernel/epd/multigrid-0.25/" + medium.name();
+        QString iccName = "kernel/icc/lab2rgb16/" + medium.name();
+        QString lutName = "kernel/lut/interpolate/" + medium.name();
+
+        if (listOnly == true)
+        {
+            QStringList all;
+            all << pipelineNames << rawPipeline << psdPipeline << pdfPipeline << demosaicNames << scalarDemosaicNames << rawLoadMMapName << rawLoadReadName << caName << tileName
+                << lanczosName << bicubicName << gaussSmallName << gaussLargeName << denoiseName << labCurvesName << vibranceName << epdName << epdMultigridName << epdReducedName << iccName << lutName;
+            foreach (QString name, all)
+            {
+                if (benchmark.selected (name) == true)
+                {
+                    cout << name.toStdString() << "\n";
+                }
+            }
+            return 0;
+        }
+
+        ProcessorFactory::initialize();
+        SyntheticInputs inputs (workDir, seed);
+
+
+        // --- ticket pipelines
+
+        for (size_t i = 0; i < sizes.size(); i++)
+        {
+            for (int f = 0; f < 3; f++)
+            {
+                QString name = pipelineNames[i * 3 + f];
+                if (benchmark.selected (name) == true)
+                {
+                    QString input = inputs.image (sizes[i].width, sizes[i].height, formats[f]);
+                    QString ticket = inputs.ticket (QString (name).replace ('/', '-'), input, iccPath, iccProfile);
+                    benchmark.run (new PipelineCase (name, sizes[i].megapixels(), ticket));
+                }
+            }
+        }
+
+        if (benchmark.selected (rawPipeline) == true)
+        {
+            QString input = inputs.dng (medium.width, medium.height);
+            QString ticket = inputs.ticket (QString (rawPipeline).replace ('/', '-'), input, iccPath, iccProfile);
+            benchmark.run (new PipelineCase (rawPipeline, medium.megapixels(), ticket));
+        }
+
+        if (benchmark.selected (psdPipeline) == true)
+        {
+            QString input = inputs.psd (medium.width, medium.height, 3);
+            QString ticket = inputs.ticket (QString (psdPipeline).replace ('/', '-'), input, iccPath, iccProfile);
+            benchmark.run (new PipelineCase (psdPipeline, medium.megapixels(), ticket));
+        }
+
+        if (benchmark.selected (pdfPipeline) == true)
+        {
+            QString input = inputs.pdf (pdfImage.width, pdfImage.height, pdfImages);
+            QString ticket = inputs.ticket (QString (pdfPipeline).replace ('/', '-'), input, iccPath, iccProfile);
+            benchmark.run (new PipelineCase (pdfPipeline, pdfImages * pdfImage.megapixels(), ticket));
+        }
+
+
+        // --- rtengine kernels
+
+        for (int m = 0; m < rtengine::procparams::RAWParams::numMethods; m++)
+        {
+            if (benchmark.selected (demosaicNames[m]) == true)
+            {
+                // the methods with kernels are checked against the scalar code first
+                bool check = std::find (vectorized, vectorized + 3, m) != vectorized + 3;
+                QString input = inputs.dng (medium.width, medium.height);
+                benchmark.run (new DemosaicCase (demosaicNames[m], input, medium.megapixels(), rtengine::procparams::RAWParams::methodstring[m], true, check));
+            }
+        }
+
+        for (int v = 0; v < 3; v++)
+        {
+            if (benchmark.selected (scalarDemosaicNames[v]) == true)
+            {
+                QString input = inputs.dng (medium.width, medium.height);
+                benchmark.run (new DemosaicCase (scalarDemosaicNames[v], input, medium.megapixels(), rtengine::procparams::RAWParams::methodstring[vectorized[v]], false));
+            }
+        }
+
+        if (benchmark.selected (rawLoadMMapName) == true || benchmark.selected (rawLoadReadName) == true)
+        {
+            QString input = inputs.dng (medium.width, medium.height);
+            if (benchmark.selected (rawLoadMMapName) == true)
+            {
+                benchmark.run (new RawLoadCase (rawLoadMMapName, input, medium.megapixels(), true));
+            }
+            if (benchmark.selected (rawLoadReadName) == true)
+            {
+                benchmark.run (new RawLoadCase (rawLoadReadName, input, medium.megapixels(), false));
+            }
+        }
+
+        if (benchmark.selected (caName) == true)
+        {
+            QString input = inputs.dng (medium.width, medium.height);
+            benchmark.run (new CACase (caName, input, medium.megapixels()));
+        }
+
+        if (benchmark.selected (tileName) == true)
+        {
+            QString input = inputs.dng (medium.width, medium.height);
+            benchmark.run (new TileCase (tileName, input, medium.megapixels(), 512));
+        }
+
+        benchmark.run (new ResizeCase (lanczosName, inputs, medium.width, medium.height, "Lanczos", 0.25));
+        benchmark.run (new ResizeCase (bicubicName, inputs, medium.width, medium.height, "Bicubic", 0.25));
+        benchmark.run (new GaussCase (gaussSmallName, inputs, medium.width, medium.height, 2.0));
+        benchmark.run (new GaussCase (gaussLargeName, inputs, medium.width, medium.height, 30.0));
+        benchmark.run (new DenoiseCase (denoiseName, inputs, medium.width, medium.height));
+        benchmark.run (new LabCurvesCase (labCurvesName, inputs, medium.width, medium.height, false));
+        benchmark.run (new LabCurvesCase (vibranceName, inputs, medium.width, medium.height, true));
+        benchmark.run (new EPDCase (epdName, inputs, medium.width, medium.height, 0, 1.0));
+        benchmark.run (new EPDCase (epdMultigridName, inputs, medium.width, medium.height, 1, 1.0));
+        benchmark.run (new EPDCase (epdReducedName, inputs, medium.width, medium.height, 1, 0.25));
+        benchmark.run (new ICCCase (iccName, inputs, medium.width, medium.height, QDir (iccPath).filePath (iccProfile)));
+        benchmark.run (new LUTCase (lutName, medium.width, medium.height));
+
+
+        // --- report
+
+        if (benchmark.peakIsPerCase() == false)
+        {
+            cout << "note: peak RSS could not be reset, it is the peak of the process so far\n";
+        }
+
+        if (jsonFile.isEmpty() == false)
+        {
+            using boost::property_tree::ptree;
+            ptree config;
+            config.put ("date", QDateTime::currentDateTime().toUTC().toString (Qt::ISODate).toStdString());
+            char host[256] = "";
+            gethostname (host, sizeof (host) - 1);
+            config.put ("host", host);
+            config.put ("threads", QThread::idealThreadCount());
+#ifdef _OPENMP
+            config.put ("openmp_threads", omp_get_max_threads());
+#endif
+#ifdef __VERSION__
+            config.put ("compiler", __VERSION__);
+#endif
+            config.put ("seed", seed);
+            config.put ("warmup", warmup);
+            config.put ("repetitions", repetitions);
+            config.put ("quick", quick);
+
+            if (benchmark.writeJSON (jsonFile, config) == false)
+            {
+                ERR("Cannot write the JSON results!");
+                retValue = 1;
+            }
+        }
+
+        for (size_t i = 0; i < benchmark.results().size(); i++)
+        {
+            if (benchmark.results()[i].failed == true)
+            {
+                retValue = 1;
+            }
+        }
+
+        if (baselineFile.isEmpty() == false)
+        {
+            int regressions = benchmark.compare (baselineFile, tolerance);
+            cout << regressions << " regressions against " << baselineFile.toStdString() << "\n";
+            if (regressions > 0)
+            {
+                retValue = 2;
+            }
+        }
+    }
+    catch( std::exception &error_ )
+    {
+        cout << "Caught exception: " << error_.what() << endl;
+        retValue = 1;
+    }
+
+    LOGOG_SHUTDOWN();
+
+    return retValue;
+}
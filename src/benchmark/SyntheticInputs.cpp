@@ -0,0 +1,593 @@
+/*
+ *  SyntheticInputs.cpp
+ *
+ *
+ *  This file is part of openPablo.
+ *
+ *  Copyright (c) 2012- Aydin Demircioglu (aydin@openpablo.org)
+ *
+ *  openPablo is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  openPablo is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with openPablo.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "SyntheticInputs.hpp"
+
+#include <math.h>
+#include <stdio.h>
+#include <algorithm>
+#include <list>
+#include <stdexcept>
+#include <string>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+
+#include <Magick++.h>
+#include <podofo/podofo.h>
+
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/json_parser.hpp>
+
+
+using namespace PoDoFo;
+
+
+/*
+ * @mainpage SyntheticInputs
+ *
+ * Description in html
+ * @author Aydin Demircioglu
+  */
+
+
+/*
+ * @file SyntheticInputs.cpp
+ *
+ * @brief Deterministic input files for the benchmark.
+ *
+ */
+
+
+
+namespace openPablo
+{
+
+    namespace
+    {
+        // stateless integer hash, the noise does not depend on the order of rendering
+        uint32_t hash (uint32_t x, uint32_t y, uint32_t c, uint32_t seed)
+        {
+            uint32_t h = seed ^ (x * 0x9E3779B1u) ^ (y * 0x85EBCA77u) ^ (c * 0xC2B2AE3Du);
+            h ^= h >> 16;
+            h *= 0x7FEB352Du;
+            h ^= h >> 15;
+            h *= 0x846CA68Bu;
+            h ^= h >> 16;
+            return h;
+        }
+
+
+        /*
+         * @class DNGWriter
+         *
+         * @brief Minimal little endian TIFF/DNG writer, one IFD, one strip
+         *
+         */
+        class DNGWriter
+        {
+            public:
+                enum Type
+                {
+                    Byte = 1,
+                    Ascii = 2,
+                    Short = 3,
+                    Long = 4,
+                    Rational = 5,
+                    SRational = 10
+                };
+
+                // entries have to be added in ascending tag order
+                void add (uint16_t tag, uint16_t type, uint32_t count, const std::vector<unsigned char> &data)
+                {
+                    Entry entry;
+                    entry.tag = tag;
+                    entry.type = type;
+                    entry.count = count;
+                    entry.data = data;
+                    entries.push_back (entry);
+                }
+
+                void addShort (uint16_t tag, uint16_t value)
+                {
+                    std::vector<unsigned char> data;
+                    put16 (data, value);
+                    add (tag, Short, 1, data);
+                }
+
+                void addLong (uint16_t tag, uint32_t value)
+                {
+                    std::vector<unsigned char> data;
+                    put32 (data, value);
+                    add (tag, Long, 1, data);
+                }
+
+                void addAscii (uint16_t tag, const std::string &text)
+                {
+                    std::vector<unsigned char> data (text.begin(), text.end());
+                    data.push_back (0);
+                    add (tag, Ascii, data.size(), data);
+                }
+
+                // numerators over a common denominator
+                void addRationals (uint16_t tag, uint16_t type, const double *values, uint32_t count)
+                {
+                    std::vector<unsigned char> data;
+                    for (uint32_t i = 0; i < count; i++)
+                    {
+                        put32 (data, (uint32_t) (int32_t) floor (values[i] * 10000.0 + 0.5));
+                        put32 (data, 10000);
+                    }
+                    add (tag, type, count, data);
+                }
+
+                void setLong (uint16_t tag, uint32_t value)
+                {
+                    for (size_t i = 0; i < entries.size(); i++)
+                    {
+                        if (entries[i].tag == tag)
+                        {
+                            entries[i].data.clear();
+                            put32 (entries[i].data, value);
+                        }
+                    }
+                }
+
+                // size of the header, IFD and all out of line values
+                uint32_t headerSize () const
+                {
+                    uint32_t size = 8 + 2 + 12 * entries.size() + 4;
+                    for (size_t i = 0; i < entries.size(); i++)
+                    {
+                        if (entries[i].data.size() > 4)
+                        {
+                            size += (entries[i].data.size() + 1) & ~1u;
+                        }
+                    }
+                    return size;
+                }
+
+                std::vector<unsigned char> header () const
+                {
+                    std::vector<unsigned char> ifd;
+                    std::vector<unsigned char> values;
+                    uint32_t valueOffset = 8 + 2 + 12 * entries.size() + 4;
+
+                    ifd.push_back ('I');
+                    ifd.push_back ('I');
+                    put16 (ifd, 42);
+                    put32 (ifd, 8);
+                    put16 (ifd, entries.size());
+
+                    for (size_t i = 0; i < entries.size(); i++)
+                    {
+                        const Entry &entry = entries[i];
+                        put16 (ifd, entry.tag);
+                        put16 (ifd, entry.type);
+                        put32 (ifd, entry.count);
+                        if (entry.data.size() <= 4)
+                        {
+                            std::vector<unsigned char> inlined = entry.data;
+                            inlined.resize (4, 0);
+                            ifd.insert (ifd.end(), inlined.begin(), inlined.end());
+                        }
+                        else
+                        {
+                            put32 (ifd, valueOffset + values.size());
+                            values.insert (values.end(), entry.data.begin(), entry.data.end());
+                            if (values.size() % 2 == 1)
+                            {
+                                values.push_back (0);
+                            }
+                        }
+                    }
+
+                    // no next IFD
+                    put32 (ifd, 0);
+                    ifd.insert (ifd.end(), values.begin(), values.end());
+                    return ifd;
+                }
+
+                static void put16 (std::vector<unsigned char> &data, uint16_t value)
+                {
+                    data.push_back (value & 0xFF);
+                    data.push_back (value >> 8);
+                }
+
+                static void put32 (std::vector<unsigned char> &data, uint32_t value)
+                {
+                    for (int i = 0; i < 4; i++)
+                    {
+                        data.push_back ((value >> (8 * i)) & 0xFF);
+                    }
+                }
+
+            private:
+                struct Entry
+                {
+                    uint16_t tag;
+                    uint16_t type;
+                    uint32_t count;
+                    std::vector<unsigned char> data;
+                };
+
+                std::vector<Entry> entries;
+        };
+    }
+
+
+
+    /*
+     * @class SyntheticInputs
+     *
+     * @brief Writes reproducible test images
+     *
+     */
+
+
+    SyntheticInputs::SyntheticInputs (QString _directory, uint32_t _seed)
+        : path (_directory),
+          seed (_seed)
+    {
+        if (QDir().mkpath (path) == false)
+        {
+            throw std::runtime_error ("Cannot create directory " + path.toStdString());
+        }
+    }
+
+
+
+    QString SyntheticInputs::directory () const
+    {
+        return path;
+    }
+
+
+
+    double SyntheticInputs::value (int x, int y, int c, int width, int height) const
+    {
+        double fx = (double) x / width;
+        double fy = (double) y / height;
+
+        // color ramps
+        double ramp;
+        switch (c)
+        {
+            case 0:
+                ramp = fx;
+                break;
+            case 1:
+                ramp = fy;
+                break;
+            default:
+                ramp = 1.0 - 0.5 * (fx + fy);
+                break;
+        }
+
+        // zone plate, the frequency rises towards the borders
+        double dx = x - 0.5 * width;
+        double dy = y - 0.5 * height;
+        double zone = 0.5 + 0.5 * cos (M_PI * (dx * dx + dy * dy) / (8.0 * width));
+
+        double noise = hash (x, y, c, seed) / 4294967296.0;
+
+        return 0.05 + 0.6 * ramp + 0.25 * zone + 0.1 * noise;
+    }
+
+
+
+    QString SyntheticInputs::fileName (QString kind, int width, int height, QString extension) const
+    {
+        return QDir (path).filePath (QString ("%1-%2x%3-seed%4.%5").arg (kind).arg (width).arg (height).arg (seed).arg (extension));
+    }
+
+
+
+    std::vector<uint16_t> SyntheticInputs::render (int width, int height) const
+    {
+        std::vector<uint16_t> pixels ((size_t) width * height * 3);
+
+        #pragma omp parallel for
+        for (int y = 0; y < height; y++)
+        {
+            uint16_t *row = &pixels[(size_t) y * width * 3];
+            for (int x = 0; x < width; x++)
+            {
+                for (int c = 0; c < 3; c++)
+                {
+                    double v = value (x, y, c, width, height);
+                    row[3 * x + c] = (uint16_t) (std::min (std::max (v, 0.0), 1.0) * 65535.0 + 0.5);
+                }
+            }
+        }
+
+        return pixels;
+    }
+
+
+
+    QString SyntheticInputs::image (int width, int height, QString format)
+    {
+        QString extension = format.toLower();
+        if (extension == "jpeg")
+        {
+            extension = "jpg";
+        }
+
+        QString imageFileName = fileName ("image", width, height, extension);
+        if (QFile::exists (imageFileName) == true)
+        {
+            return imageFileName;
+        }
+
+        std::vector<uint16_t> pixels = render (width, height);
+        Magick::Image rendered (width, height, "RGB", Magick::ShortPixel, &pixels[0]);
+        rendered.magick (format.toStdString());
+        if (format == "JPEG")
+        {
+            rendered.quality (90);
+        }
+        else
+        {
+            // 8 bit is what the pipelines usually get
+            rendered.depth (8);
+        }
+        rendered.write (imageFileName.toStdString());
+
+        return imageFileName;
+    }
+
+
+
+    QString SyntheticInputs::psd (int width, int height, int layers)
+    {
+        QString psdFileName = fileName (QString ("layers%1").arg (layers), width, height, "psd");
+        if (QFile::exists (psdFileName) == true)
+        {
+            return psdFileName;
+        }
+
+        std::vector<uint16_t> pixels = render (width, height);
+        Magick::Image composite (width, height, "RGB", Magick::ShortPixel, &pixels[0]);
+        composite.depth (8);
+        composite.magick ("PSD");
+
+        std::list<Magick::Image> images;
+        images.push_back (composite);
+        for (int i = 0; i < layers; i++)
+        {
+            // every layer gets a different hue, same pixels otherwise
+            Magick::Image layer = composite;
+            layer.modulate (100.0, 100.0, 100.0 + 40.0 * i);
+            images.push_back (layer);
+        }
+
+        Magick::writeImages (images.begin(), images.end(), psdFileName.toStdString(), true);
+
+        return psdFileName;
+    }
+
+
+
+    QString SyntheticInputs::dng (int width, int height)
+    {
+        QString dngFileName = fileName ("bayer", width, height, "dng");
+        if (QFile::exists (dngFileName) == true)
+        {
+            return dngFileName;
+        }
+
+        // 14 bit sensor in 16 bit samples, camera space is linear sRGB
+        const uint32_t black = 512;
+        const uint32_t white = 16383;
+        const double asShotNeutral[3] = { 0.5, 1.0, 0.7 };
+        const double colorMatrix[9] = {  3.2406, -1.5372, -0.4986,
+                                        -0.9689,  1.8758,  0.0415,
+                                         0.0557, -0.2040,  1.0570 };
+
+        uint32_t stripBytes = (uint32_t) width * height * 2;
+
+        DNGWriter writer;
+        writer.addLong (254, 0);                        // NewSubFileType
+        writer.addLong (256, width);
+        writer.addLong (257, height);
+        writer.addShort (258, 16);                      // BitsPerSample
+        writer.addShort (259, 1);                       // no compression
+        writer.addShort (262, 32803);                   // CFA
+        writer.addAscii (271, "openPablo");
+        writer.addAscii (272, "Synthetic");
+        writer.addLong (273, 0);                        // StripOffsets, set below
+        writer.addShort (274, 1);                       // Orientation
+        writer.addShort (277, 1);                       // SamplesPerPixel
+        writer.addLong (278, height);                   // RowsPerStrip
+        writer.addLong (279, stripBytes);
+        writer.addShort (284, 1);                       // PlanarConfiguration
+
+        std::vector<unsigned char> repeatDim;
+        DNGWriter::put16 (repeatDim, 2);
+        DNGWriter::put16 (repeatDim, 2);
+        writer.add (33421, DNGWriter::Short, 2, repeatDim);
+
+        // RGGB
+        std::vector<unsigned char> cfaPattern;
+        cfaPattern.push_back (0);
+        cfaPattern.push_back (1);
+        cfaPattern.push_back (1);
+        cfaPattern.push_back (2);
+        writer.add (33422, DNGWriter::Byte, 4, cfaPattern);
+
+        std::vector<unsigned char> dngVersion;
+        dngVersion.push_back (1);
+        dngVersion.push_back (1);
+        dngVersion.push_back (0);
+        dngVersion.push_back (0);
+        writer.add (50706, DNGWriter::Byte, 4, dngVersion);
+
+        writer.addAscii (50708, "openPablo Synthetic");
+        writer.addLong (50714, black);
+        writer.addLong (50717, white);
+        writer.addRationals (50721, DNGWriter::SRational, colorMatrix, 9);
+        writer.addRationals (50728, DNGWriter::Rational, asShotNeutral, 3);
+        writer.addShort (50778, 21);                    // CalibrationIlluminant1, D65
+
+        // the strip follows the header
+        writer.setLong (273, writer.headerSize());
+        std::vector<unsigned char> header = writer.header();
+
+        FILE *dngFile = fopen (dngFileName.toStdString().c_str(), "wb");
+        if (dngFile == NULL)
+        {
+            throw std::runtime_error ("Cannot write " + dngFileName.toStdString());
+        }
+
+        bool success = (fwrite (&header[0], 1, header.size(), dngFile) == header.size());
+
+        std::vector<unsigned char> row ((size_t) width * 2);
+        for (int y = 0; (y < height) && (success == true); y++)
+        {
+            for (int x = 0; x < width; x++)
+            {
+                int c = ((y & 1) == 0) ? (x & 1) : 1 + (x & 1);
+                double v = std::min (std::max (value (x, y, c, width, height), 0.0), 1.0) * asShotNeutral[c];
+                uint16_t sample = (uint16_t) (black + v * (white - black) + 0.5);
+                row[2 * x] = sample & 0xFF;
+                row[2 * x + 1] = sample >> 8;
+            }
+            success = (fwrite (&row[0], 1, row.size(), dngFile) == row.size());
+        }
+
+        success = (fclose (dngFile) == 0) && success;
+        if (success == false)
+        {
+            QFile::remove (dngFileName);
+            throw std::runtime_error ("Cannot write " + dngFileName.toStdString());
+        }
+
+        return dngFileName;
+    }
+
+
+
+    QString SyntheticInputs::pdf (int width, int height, int images)
+    {
+        QString pdfFileName = fileName (QString ("images%1").arg (images), width, height, "pdf");
+        if (QFile::exists (pdfFileName) == true)
+        {
+            return pdfFileName;
+        }
+
+        QString jpegFileName = image (width, height, "JPEG");
+
+        std::vector<uint16_t> pixels = render (width, height);
+        std::vector<char> rgb (pixels.size());
+        for (size_t i = 0; i < pixels.size(); i++)
+        {
+            rgb[i] = (char) (pixels[i] >> 8);
+        }
+
+        try
+        {
+            PdfMemDocument document;
+            PdfPainter painter;
+
+            for (int i = 0; i < images; i++)
+            {
+                PdfImage pdfImage (&document);
+                if (i % 2 == 0)
+                {
+                    // DCTDecode, the JPEG goes in as it is
+                    pdfImage.LoadFromJpeg (jpegFileName.toStdString().c_str());
+                }
+                else
+                {
+                    // FlateDecode
+                    pdfImage.SetImageColorSpace (ePdfColorSpace_DeviceRGB);
+                    PdfMemoryInputStream stream (&rgb[0], rgb.size());
+                    pdfImage.SetImageData (width, height, 8, &stream);
+                }
+
+                PdfPage *page = document.CreatePage (PdfPage::CreateStandardPageSize (ePdfPageSize_A4));
+                PdfRect pageSize = page -> GetPageSize();
+                double scale = std::min (pageSize.GetWidth() / width, pageSize.GetHeight() / height);
+
+                painter.SetPage (page);
+                painter.DrawImage (0.0, 0.0, &pdfImage, scale, scale);
+                painter.FinishPage();
+            }
+
+            document.Write (pdfFileName.toStdString().c_str());
+        }
+        catch (const PdfError &error_)
+        {
+            QFile::remove (pdfFileName);
+            throw std::runtime_error ("Cannot write " + pdfFileName.toStdString() + ": " + PdfError::ErrorMessage (error_.GetError()));
+        }
+
+        return pdfFileName;
+    }
+
+
+
+    QString SyntheticInputs::ticket (QString name, QString inputFile, QString iccPath, QString iccProfile)
+    {
+        using boost::property_tree::ptree;
+
+        QDir outputDir (QDir (path).filePath ("output"));
+        QDir().mkpath (outputDir.path());
+
+        ptree pt;
+        pt.put ("Input.InputFile", QFileInfo (inputFile).fileName().toStdString());
+        pt.put ("Input.InputPath", QFileInfo (inputFile).absolutePath().toStdString());
+        pt.put ("Processors.PSD.ProcessLayers", "No");
+        pt.put ("Processors.PSD.Layers", "");
+
+        // a print, a web and a thumbnail rendition
+        const char *ids[] = { "Print", "Web", "Thumbnail" };
+        const int sizes[] = { 2048, 800, 200 };
+        const char *formats[] = { "JPEG", "JPEG", "PNG" };
+
+        ptree outputs;
+        for (int i = 0; i < 3; i++)
+        {
+            ptree sink;
+            sink.put ("id", ids[i]);
+            sink.put ("Width", sizes[i]);
+            sink.put ("Height", sizes[i]);
+            sink.put ("OutputPath", outputDir.absolutePath().toStdString());
+            sink.put ("FileHandling.OutputFormat", formats[i]);
+            if (QString (formats[i]) == "JPEG")
+            {
+                sink.put ("FileHandling.Compression", 85);
+            }
+            sink.put ("ICC.Path", iccPath.toStdString());
+            sink.put ("ICC.Output", iccProfile.toStdString());
+            outputs.push_back (std::make_pair ("", sink));
+        }
+        pt.add_child ("Output", outputs);
+
+        QString ticketFileName = QDir (path).filePath (name + ".json");
+        write_json (ticketFileName.toStdString(), pt);
+
+        return ticketFileName;
+    }
+
+}
@@ -0,0 +1,105 @@
+/*
+ *  SyntheticInputs.hpp
+ *
+ *
+ *  This file is part of openPablo.
+ *
+ *  Copyright (c) 2012- Aydin Demircioglu (aydin@openpablo.org)
+ *
+ *  openPablo is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  openPablo is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with openPablo.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef OPENPABLO_SYNTHETICINPUTS_H_
+#define OPENPABLO_SYNTHETICINPUTS_H_
+
+/*
+ * @mainpage SyntheticInputs
+ *
+ * Description in html
+ * @author Aydin Demircioglu
+  */
+
+
+/*
+ * @file SyntheticInputs.hpp
+ *
+ * @brief Deterministic input files for the benchmark.
+ *
+ */
+
+
+#include <QString>
+#include <stdint.h>
+#include <vector>
+
+
+namespace openPablo
+{
+
+    /*
+     * @class SyntheticInputs
+     *
+     * @brief Writes reproducible test images
+     *
+     * All images are rendered from the same pattern: smooth color ramps,
+     * a zone plate for fine detail (stresses demosaicing and resampling)
+     * and hashed noise (keeps the encoders honest). Every pixel only
+     * depends on its position and the seed, so the same seed gives the
+     * same files on every machine. Files are named after their size and
+     * seed and are only written if they do not exist yet.
+     *
+     */
+    class SyntheticInputs
+    {
+        public:
+            SyntheticInputs (QString _directory, uint32_t _seed);
+
+            QString directory () const;
+
+            // interleaved RGB, 16 bit
+            std::vector<uint16_t> render (int width, int height) const;
+
+            // format is JPEG, TIFF or PNG.
+            QString image (int width, int height, QString format);
+
+            // layered PSD, the first image is the composite.
+            QString psd (int width, int height, int layers);
+
+            // uncompressed 16 bit RGGB DNG with a plausible camera matrix,
+            // readable by LibRaw and the RawTherapee engine.
+            QString dng (int width, int height);
+
+            // one image per page, alternating DCT (JPEG) and Flate.
+            QString pdf (int width, int height, int images);
+
+            // ticket with a typical set of output sinks, the outputs go
+            // to a subdirectory of the input directory.
+            QString ticket (QString name, QString inputFile, QString iccPath, QString iccProfile);
+
+        private:
+            // 0..1
+            double value (int x, int y, int c, int width, int height) const;
+
+            QString fileName (QString kind, int width, int height, QString extension) const;
+
+            QString path;
+
+            uint32_t seed;
+    };
+
+}
+
+
+#endif // OPENPABLO_SYNTHETICINPUTS_H_
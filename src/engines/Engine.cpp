@@ -67,6 +67,13 @@ namespace openPablo
 
 
 
+    bool Engine::renderSinks (const Magick::Blob &, std::vector<Magick::Blob> &)
+    {
+        return false;
+    }
+
+
+
     Engine::~Engine()
     {
         //
@@ -42,6 +42,7 @@
 
 #include <QString>
 #include <stdint.h>
+#include <vector>
 
 #include <boost/property_tree/ptree.hpp>
 #include <boost/property_tree/string_path.hpp>
@@ -75,6 +76,12 @@ namespace openPablo
 
             virtual Magick::Image getMagickImage () = 0;
 
+            // engines that decode and encode on their own render all output sinks of
+            // the ticket here, in the order of the ticket. an empty blob means the input
+            // is the file. false leaves decoding, resizing and encoding to the processor
+            // and the engine to setMagickImage/start, which is the default.
+            virtual bool renderSinks (const Magick::Blob &encodedImage, std::vector<Magick::Blob> &renditions);
+
 //	  void getLogs ();
 
 
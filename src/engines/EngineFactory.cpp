@@ -38,12 +38,14 @@
 
 
 #include <string.h>
+#include <stdexcept>
 #include <QString>
 
 #include "EngineFactory.hpp"
 
 #include "MagickEngine.hpp"
 #include "BauhausEngine.hpp"
+#include "NativeEngine.hpp"
 
 
 
@@ -79,8 +81,15 @@ namespace openPablo
             return bauhausEngine;
         }
 
-        // throw an error.
+        // native engine, JPEG without ImageMagick
+        if (engineName.contains("Native", Qt::CaseInsensitive))
+        {
+            NativeEngine *nativeEngine = new NativeEngine();
+            return nativeEngine;
+        }
 
+        // the name comes from the ticket
+        throw std::runtime_error ("Unknown engine " + engineName.toStdString());
     }
 
 }
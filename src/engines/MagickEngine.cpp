@@ -21,6 +21,7 @@
  */
 
 #include "MagickEngine.hpp"
+#include "Trace.hpp"
 
 #include <Magick++.h>
 #include <magick/MagickCore.h>
@@ -100,10 +101,22 @@ namespace openPablo
         */
         // create next optimized layer
         magickImage.renderingIntent(Magick::PerceptualIntent);
-        magickImage.unsharpmask(40, 5.0, 1.0, 0);
-        magickImage.normalize();
-        magickImage.gamma(2.8);
-        magickImage.equalize();
+        {
+            TraceSpan span ("unsharpmask", "engine");
+            magickImage.unsharpmask(40, 5.0, 1.0, 0);
+        }
+        {
+            TraceSpan span ("normalize", "engine");
+            magickImage.normalize();
+        }
+        {
+            TraceSpan span ("gamma", "engine");
+            magickImage.gamma(2.8);
+        }
+        {
+            TraceSpan span ("equalize", "engine");
+            magickImage.equalize();
+        }
 
     }
 
@@ -0,0 +1,518 @@
+/*
+ *  NativeEngine.cpp
+ *
+ *
+ *  This file is part of openPablo.
+ *
+ *  Copyright (c) 2012- Aydin Demircioglu (aydin@openpablo.org)
+ *
+ *  openPablo is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  openPablo is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with openPablo.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "NativeEngine.hpp"
+#include "Trace.hpp"
+
+#include "iccstore.h"
+#include "colorlut.h"
+
+#include <Magick++.h>
+#include <boost/foreach.hpp>
+#include <boost/property_tree/ptree.hpp>
+#include <algorithm>
+#include <csetjmp>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <QByteArray>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+
+#include <jpeglib.h>
+#include "iccjpeg.h"
+
+
+/*
+ * @mainpage NativeEngine
+ *
+ * Description in html
+ * @author Aydin Demircioglu
+  */
+
+
+/*
+ * @file NativeEngine.cpp
+ *
+ * @brief JPEG to JPEG renditions without ImageMagick.
+ *
+ */
+
+
+
+namespace openPablo
+{
+
+    /*
+     * @class NativeEngine
+     *
+     * @brief Renders the sinks of a JPEG ticket with libjpeg and own kernels
+     *
+     */
+
+
+    // libjpeg must not return from error_exit, it jumps back to decode/encode
+    struct JPEGErrorManager
+    {
+        jpeg_error_mgr pub;
+        jmp_buf jump;
+    };
+
+
+
+    static void jpegErrorExit (j_common_ptr cinfo)
+    {
+        char message[JMSG_LENGTH_MAX];
+        (*cinfo -> err -> format_message) (cinfo, message);
+        std::cout << "libjpeg: " << message << "\n";
+
+        longjmp (((JPEGErrorManager *) cinfo -> err) -> jump, 1);
+    }
+
+
+
+    // bigger boxes first
+    static bool largerBox (const std::pair<int64_t, size_t> &a, const std::pair<int64_t, size_t> &b)
+    {
+        return (a.first > b.first);
+    }
+
+
+
+    NativeEngine::NativeEngine()
+        : originalWidth (0),
+          originalHeight (0),
+          densityUnit (0),
+          xDensity (1),
+          yDensity (1),
+          encodedData (NULL),
+          encodedLength (0)
+    {
+        //
+    }
+
+
+
+    NativeEngine::~NativeEngine()
+    {
+        free (encodedData);
+    }
+
+
+
+    void NativeEngine::start ()
+    {
+        fallback.start();
+    }
+
+
+
+    void NativeEngine::setMagickImage (Magick::Image _magickImage)
+    {
+        fallback.setMagickImage (_magickImage);
+    }
+
+
+
+    Magick::Image NativeEngine::getMagickImage ()
+    {
+        return fallback.getMagickImage();
+    }
+
+
+
+    bool NativeEngine::renderSinks (const Magick::Blob &encodedImage, std::vector<Magick::Blob> &renditions)
+    {
+        using boost::property_tree::ptree;
+
+        // --- everything that needs ImageMagick is found before decoding
+
+        std::vector<NativeSink> sinks;
+        try
+        {
+            BOOST_FOREACH(const ptree::value_type& child, pt.get_child("Output"))
+            {
+                NativeSink sink;
+                sink.settings = child.second;
+                sink.boxWidth = child.second.get<int>("Width");
+                sink.boxHeight = child.second.get<int>("Height");
+                // the ICC conversion is only done through the LUT, so only sinks
+                // that opt in to it (ICC.LUTGrid) can be rendered here
+                sink.lutGrid = child.second.get<int>("ICC.LUTGrid", 0);
+                sink.lut = NULL;
+
+                if ((child.second.get<std::string>("FileHandling.OutputFormat") != "JPEG") || (sink.lutGrid < 2))
+                {
+                    return false;
+                }
+
+                QDir profileDir (QString::fromStdString (child.second.get<std::string>("ICC.Path")));
+                QString profileFullName = profileDir.filePath (QString::fromStdString (child.second.get<std::string>("ICC.Output")));
+                sink.iccName = "file:" + profileFullName.toStdString();
+                if (rtengine::iccStore->getProfile (sink.iccName) == NULL)
+                {
+                    return false;
+                }
+
+                sinks.push_back (sink);
+            }
+        }
+        catch (const std::exception& ex)
+        {
+            std::cout << "native engine cannot read the sinks - " << ex.what() << "\n";
+            return false;
+        }
+
+        if (sinks.empty() == true)
+        {
+            return false;
+        }
+
+        QByteArray fileData;
+        const unsigned char *data = (const unsigned char *) encodedImage.data();
+        size_t length = encodedImage.length();
+        if (length == 0)
+        {
+            QFile file (filename);
+            if (file.open (QIODevice::ReadOnly) == false)
+            {
+                return false;
+            }
+            fileData = file.readAll();
+            data = (const unsigned char *) fileData.constData();
+            length = fileData.size();
+        }
+
+        // JPEG starts with SOI
+        if ((length < 4) || (data[0] != 0xFF) || (data[1] != 0xD8))
+        {
+            return false;
+        }
+
+        {
+            TraceSpan decodeSpan ("decode", "decode");
+            if (decode (data, length, sinks) == false)
+            {
+                return false;
+            }
+        }
+
+        // --- the LUTs, from the embedded profile or sRGB like a browser would assume
+
+        cmsHPROFILE embedded = NULL;
+        if (inputProfile.empty() == false)
+        {
+            embedded = cmsOpenProfileFromMem (&inputProfile[0], inputProfile.size());
+        }
+        cmsHPROFILE source = (embedded != NULL) ? embedded : rtengine::iccStore->getsRGBProfile();
+
+        bool complete = true;
+        for (size_t i = 0; i < sinks.size(); i++)
+        {
+            // the intent of the MagickEngine
+            sinks[i].lut = rtengine::iccStore->getLUT (source, rtengine::iccStore->getProfile (sinks[i].iccName),
+                           INTENT_PERCEPTUAL, 0, sinks[i].lutGrid);
+            if (sinks[i].lut == NULL)
+            {
+                complete = false;
+            }
+        }
+
+        if (embedded != NULL)
+        {
+            cmsCloseProfile (embedded);
+        }
+
+        if (complete == true)
+        {
+            complete = render (sinks, renditions);
+        }
+
+        for (size_t i = 0; i < sinks.size(); i++)
+        {
+            rtengine::iccStore->releaseLUT (sinks[i].lut);
+        }
+
+        return complete;
+    }
+
+
+
+    bool NativeEngine::decode (const unsigned char *data, size_t length, const std::vector<NativeSink> &sinks)
+    {
+        jpeg_decompress_struct cinfo;
+        JPEGErrorManager jerr;
+        cinfo.err = jpeg_std_error (&jerr.pub);
+        jerr.pub.error_exit = jpegErrorExit;
+
+        if (setjmp (jerr.jump))
+        {
+            jpeg_destroy_decompress (&cinfo);
+            return false;
+        }
+
+        jpeg_create_decompress (&cinfo);
+        jpeg_mem_src (&cinfo, (unsigned char *) data, length);
+        setup_read_icc_profile (&cinfo);
+        jpeg_save_markers (&cinfo, JPEG_APP0 + 1, 0xFFFF);
+        jpeg_read_header (&cinfo, TRUE);
+
+        // grayscale and CMYK are left to ImageMagick
+        if ((cinfo.num_components != 3) || ((cinfo.jpeg_color_space != JCS_YCbCr) && (cinfo.jpeg_color_space != JCS_RGB)))
+        {
+            jpeg_destroy_decompress (&cinfo);
+            return false;
+        }
+
+        originalWidth = cinfo.image_width;
+        originalHeight = cinfo.image_height;
+
+        JOCTET *profileData = NULL;
+        unsigned int profileLength = 0;
+        inputProfile.clear();
+        if (read_icc_profile (&cinfo, &profileData, &profileLength))
+        {
+            inputProfile.assign (profileData, profileData + profileLength);
+            free (profileData);
+        }
+
+        markers.clear();
+        for (jpeg_saved_marker_ptr marker = cinfo.marker_list; marker != NULL; marker = marker -> next)
+        {
+            if (marker -> marker == JPEG_APP0 + 1)
+            {
+                markers.push_back (std::string ((const char *) marker -> data, marker -> data_length));
+            }
+        }
+
+        densityUnit = cinfo.saw_JFIF_marker ? cinfo.density_unit : 0;
+        xDensity = cinfo.saw_JFIF_marker ? cinfo.X_density : 1;
+        yDensity = cinfo.saw_JFIF_marker ? cinfo.Y_density : 1;
+
+        // the largest rendition, sized like the processor does it
+        int targetWidth = 1;
+        int targetHeight = 1;
+        for (size_t i = 0; i < sinks.size(); i++)
+        {
+            double scale = std::min ((double) sinks[i].boxWidth / originalWidth, (double) sinks[i].boxHeight / originalHeight);
+            targetWidth = std::max (targetWidth, (int) (originalWidth * scale + 0.5));
+            targetHeight = std::max (targetHeight, (int) (originalHeight * scale + 0.5));
+        }
+
+        // the smallest n/8 that still covers it, the IDCT does the first part of the reduction
+        cinfo.out_color_space = JCS_RGB;
+        cinfo.scale_denom = 8;
+        for (cinfo.scale_num = 1; cinfo.scale_num < 8; cinfo.scale_num++)
+        {
+            jpeg_calc_output_dimensions (&cinfo);
+            if (((int) cinfo.output_width >= targetWidth) && ((int) cinfo.output_height >= targetHeight))
+            {
+                break;
+            }
+        }
+
+        jpeg_start_decompress (&cinfo);
+
+        decoded.allocate (cinfo.output_width, cinfo.output_height);
+        scanline.resize ((size_t) cinfo.output_width * 3);
+        while (cinfo.output_scanline < cinfo.output_height)
+        {
+            JSAMPROW row = &scanline[0];
+            jpeg_read_scanlines (&cinfo, &row, 1);
+            NativeKernels::importRow (&scanline[0], decoded, cinfo.output_scanline - 1);
+        }
+
+        jpeg_finish_decompress (&cinfo);
+        jpeg_destroy_decompress (&cinfo);
+
+        qDebug() << "Decoded" << originalWidth << "x" << originalHeight << "at" << decoded.width() << "x" << decoded.height();
+        return true;
+    }
+
+
+
+    bool NativeEngine::render (std::vector<NativeSink> &sinks, std::vector<Magick::Blob> &renditions)
+    {
+        // the same pyramid as the processor: bigger renditions first, each one from the
+        // smallest larger one that is still big enough
+        double derivationFactor = pt.get<double>("Processors.Image.DerivationFactor", 2.0);
+
+        std::vector<std::pair<int64_t, size_t> > order;
+        for (size_t i = 0; i < sinks.size(); i++)
+        {
+            order.push_back (std::make_pair ((int64_t) sinks[i].boxWidth * sinks[i].boxHeight, i));
+        }
+        std::stable_sort (order.begin(), order.end(), largerBox);
+
+        for (size_t n = 0; n < order.size(); n++)
+        {
+            NativeSink &sink = sinks[order[n].second];
+
+            double scale = std::min ((double) sink.boxWidth / originalWidth, (double) sink.boxHeight / originalHeight);
+            int targetWidth = std::max ((int) (originalWidth * scale + 0.5), 1);
+            int targetHeight = std::max ((int) (originalHeight * scale + 0.5), 1);
+
+            const PlanarImage *sourceImage = &decoded;
+            bool sameSize = false;
+            for (size_t m = 0; m < n; m++)
+            {
+                const NativeSink &larger = sinks[order[m].second];
+                if ((larger.boxWidth == sink.boxWidth) && (larger.boxHeight == sink.boxHeight))
+                {
+                    sink.image = larger.image;
+                    sameSize = true;
+                    break;
+                }
+
+                if ((larger.image.width() >= derivationFactor * targetWidth) &&
+                        (larger.image.height() >= derivationFactor * targetHeight) &&
+                        (larger.image.width() < sourceImage -> width()))
+                {
+                    sourceImage = &larger.image;
+                }
+            }
+
+            if (sameSize == true)
+            {
+                continue;
+            }
+
+            TraceSpan resizeSpan ("resize", "sink");
+            sink.image.allocate (targetWidth, targetHeight);
+            NativeKernels::resize (*sourceImage, sink.image);
+        }
+
+        // output sharpening of the renditions, the pyramid stays unsharpened
+        double sharpenSigma = pt.get<double>("Engines.Native.SharpenSigma", 0.6);
+        double sharpenAmount = pt.get<double>("Engines.Native.SharpenAmount", 0.5);
+
+        renditions.clear();
+        for (size_t i = 0; i < sinks.size(); i++)
+        {
+            PlanarImage image = sinks[i].image;
+            {
+                TraceSpan sharpenSpan ("sharpen", "sink");
+                NativeKernels::sharpen (image, sharpenSigma, sharpenAmount);
+            }
+
+            TraceSpan iccSpan ("icc", "sink");
+            int channels = sinks[i].lut -> getChannels();
+            std::vector<unsigned char> pixels ((size_t) image.width() * image.height() * channels);
+            std::vector<float*> r = image.rows (0);
+            std::vector<float*> g = image.rows (1);
+            std::vector<float*> b = image.rows (2);
+            sinks[i].lut -> apply (&r[0], &g[0], &b[0], &pixels[0], image.width(), image.height());
+
+            // CMYK JPEGs are stored inverted, with the Adobe marker, as ImageMagick
+            // and Photoshop write them
+            if (channels == 4)
+            {
+                for (size_t p = 0; p < pixels.size(); p++)
+                {
+                    pixels[p] = 255 - pixels[p];
+                }
+            }
+            iccSpan.finish();
+
+            TraceSpan encodeSpan ("encode", "sink");
+            rtengine::ProfileContent outputProfile = rtengine::iccStore->getContent (sinks[i].iccName);
+            Magick::Blob rendition;
+            if (encode (&pixels[0], image.width(), image.height(), channels,
+                        sinks[i].settings.get<int>("FileHandling.Compression", 92),
+                        outputProfile.data, outputProfile.length, rendition) == false)
+            {
+                return false;
+            }
+            renditions.push_back (rendition);
+        }
+
+        return true;
+    }
+
+
+
+    bool NativeEngine::encode (const unsigned char *pixels, int width, int height, int channels, int quality,
+                               const char *iccProfile, int iccLength, Magick::Blob &rendition)
+    {
+        jpeg_compress_struct cinfo;
+        JPEGErrorManager jerr;
+        cinfo.err = jpeg_std_error (&jerr.pub);
+        jerr.pub.error_exit = jpegErrorExit;
+
+        free (encodedData);
+        encodedData = NULL;
+        encodedLength = 0;
+
+        if (setjmp (jerr.jump))
+        {
+            jpeg_destroy_compress (&cinfo);
+            return false;
+        }
+
+        jpeg_create_compress (&cinfo);
+        jpeg_mem_dest (&cinfo, &encodedData, &encodedLength);
+
+        cinfo.image_width = width;
+        cinfo.image_height = height;
+        cinfo.input_components = channels;
+        cinfo.in_color_space = (channels == 4) ? JCS_CMYK : JCS_RGB;
+        jpeg_set_defaults (&cinfo);
+        jpeg_set_quality (&cinfo, quality, TRUE);
+        cinfo.optimize_coding = TRUE;
+        cinfo.density_unit = densityUnit;
+        cinfo.X_density = xDensity;
+        cinfo.Y_density = yDensity;
+
+        // no chroma subsampling at high qualities, like ImageMagick
+        if (quality >= 90)
+        {
+            cinfo.comp_info[0].h_samp_factor = 1;
+            cinfo.comp_info[0].v_samp_factor = 1;
+        }
+
+        jpeg_start_compress (&cinfo, TRUE);
+
+        for (size_t i = 0; i < markers.size(); i++)
+        {
+            jpeg_write_marker (&cinfo, JPEG_APP0 + 1, (const JOCTET *) markers[i].data(), markers[i].size());
+        }
+        if (iccLength > 0)
+        {
+            write_icc_profile (&cinfo, (const JOCTET *) iccProfile, iccLength);
+        }
+
+        while (cinfo.next_scanline < cinfo.image_height)
+        {
+            JSAMPROW row = (JSAMPROW) (pixels + (size_t) cinfo.next_scanline * width * channels);
+            jpeg_write_scanlines (&cinfo, &row, 1);
+        }
+
+        jpeg_finish_compress (&cinfo);
+        jpeg_destroy_compress (&cinfo);
+
+        rendition = Magick::Blob (encodedData, encodedLength);
+        return true;
+    }
+
+}
@@ -0,0 +1,151 @@
+/*
+ *  NativeEngine.hpp
+ *
+ *
+ *  This file is part of openPablo.
+ *
+ *  Copyright (c) 2012- Aydin Demircioglu (aydin@openpablo.org)
+ *
+ *  openPablo is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  openPablo is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with openPablo.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef OPENPABLO_NATIVEENGINE_H_
+#define OPENPABLO_NATIVEENGINE_H_
+
+/*
+ * @mainpage NativeEngine
+ *
+ * Description in html
+ * @author Aydin Demircioglu
+  */
+
+
+/*
+ * @file NativeEngine.hpp
+ *
+ * @brief JPEG to JPEG renditions without ImageMagick.
+ *
+ */
+
+
+#include <QString>
+#include <string>
+#include <vector>
+
+#include <Magick++.h>
+
+#include "Engine.hpp"
+#include "MagickEngine.hpp"
+#include "NativeKernels.hpp"
+
+
+namespace rtengine
+{
+    class ColorLUT;
+}
+
+
+namespace openPablo
+{
+
+    /*
+     * @class NativeEngine
+     *
+     * @brief Renders the sinks of a JPEG ticket with libjpeg and own kernels
+     *
+     * The input is decoded by libjpeg, scaled down in the DCT domain as far as
+     * the largest sink allows. Resizing, sharpening and the ICC conversion
+     * (through the 3D LUTs of the rtengine ICCStore) work on planar float, the
+     * renditions are encoded by libjpeg again. Inputs other than RGB JPEG,
+     * sinks other than JPEG and sinks without ICC.LUTGrid go through the
+     * MagickEngine.
+     *
+     */
+    class NativeEngine: public Engine
+    {
+        public:
+            /*
+             *
+             */
+
+            NativeEngine();
+
+            virtual ~NativeEngine();
+
+            // the MagickEngine, for the images the processor decoded itself
+            virtual void start ();
+
+            virtual void setMagickImage (Magick::Image _magickImage);
+
+            virtual Magick::Image getMagickImage ();
+
+            virtual bool renderSinks (const Magick::Blob &encodedImage, std::vector<Magick::Blob> &renditions);
+
+
+        private:
+
+            struct NativeSink
+            {
+                boost::property_tree::ptree settings;
+                int boxWidth;
+                int boxHeight;
+                std::string iccName;
+                int lutGrid;
+                const rtengine::ColorLUT *lut;
+                PlanarImage image;
+            };
+
+            // decodes at the smallest DCT scale that still covers the boxes of the sinks,
+            // false if the input is no RGB JPEG or libjpeg fails
+            bool decode (const unsigned char *data, size_t length, const std::vector<NativeSink> &sinks);
+
+            // resize, sharpen, ICC and encoding of all sinks, the LUTs are set
+            bool render (std::vector<NativeSink> &sinks, std::vector<Magick::Blob> &renditions);
+
+            bool encode (const unsigned char *pixels, int width, int height, int channels, int quality,
+                         const char *iccProfile, int iccLength, Magick::Blob &rendition);
+
+            MagickEngine fallback;
+
+            PlanarImage decoded;
+
+            int originalWidth;
+
+            int originalHeight;
+
+            // the libjpeg error handler jumps back, everything libjpeg
+            // fills lives here and not on the stack
+            std::vector<unsigned char> scanline;
+
+            std::vector<unsigned char> inputProfile;
+
+            // APP1 segments of the input (EXIF, XMP), kept in the renditions like ImageMagick does
+            std::vector<std::string> markers;
+
+            int densityUnit;
+
+            int xDensity;
+
+            int yDensity;
+
+            unsigned char *encodedData;
+
+            unsigned long encodedLength;
+    };
+
+}
+
+
+#endif // OPENPABLO_NATIVEENGINE_H_
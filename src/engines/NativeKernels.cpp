@@ -0,0 +1,269 @@
+/*
+ *  NativeKernels.cpp
+ *
+ *
+ *  This file is part of openPablo.
+ *
+ *  Copyright (c) 2012- Aydin Demircioglu (aydin@openpablo.org)
+ *
+ *  openPablo is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  openPablo is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with openPablo.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "NativeKernels.hpp"
+
+#include "improcfun.h"
+
+#include <math.h>
+#include <algorithm>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+
+/*
+ * @mainpage NativeKernels
+ *
+ * Description in html
+ * @author Aydin Demircioglu
+  */
+
+
+/*
+ * @file NativeKernels.cpp
+ *
+ * @brief Planar float image and the pixel kernels of the native engine.
+ *
+ */
+
+
+
+namespace openPablo
+{
+
+    /*
+     * @class PlanarImage
+     *
+     * @brief RGB as three float planes
+     *
+     */
+
+
+    PlanarImage::PlanarImage()
+        : w (0),
+          h (0)
+    {
+        //
+    }
+
+
+
+    PlanarImage::PlanarImage (int _width, int _height)
+        : w (0),
+          h (0)
+    {
+        allocate (_width, _height);
+    }
+
+
+
+    void PlanarImage::allocate (int _width, int _height)
+    {
+        w = _width;
+        h = _height;
+        data.resize ((size_t) w * h * 3);
+    }
+
+
+
+    std::vector<float*> PlanarImage::rows (int c)
+    {
+        std::vector<float*> result (h);
+        for (int y = 0; y < h; y++)
+        {
+            result[y] = plane (c) + (size_t) y * w;
+        }
+        return result;
+    }
+
+
+
+    std::vector<const float*> PlanarImage::rows (int c) const
+    {
+        std::vector<const float*> result (h);
+        for (int y = 0; y < h; y++)
+        {
+            result[y] = plane (c) + (size_t) y * w;
+        }
+        return result;
+    }
+
+
+
+    void NativeKernels::importRow (const uint8_t *rgb, PlanarImage &image, int y)
+    {
+        const int width = image.width();
+        float *r = image.plane (0) + (size_t) y * width;
+        float *g = image.plane (1) + (size_t) y * width;
+        float *b = image.plane (2) + (size_t) y * width;
+
+        // 257 maps 255 to 65535
+        for (int x = 0; x < width; x++)
+        {
+            r[x] = rgb[3 * x] * 257.0f;
+            g[x] = rgb[3 * x + 1] * 257.0f;
+            b[x] = rgb[3 * x + 2] * 257.0f;
+        }
+    }
+
+
+
+    void NativeKernels::resize (const PlanarImage &source, PlanarImage &target)
+    {
+        // the separable Lanczos filter of the RawTherapee engine, so both engines
+        // resample the same way
+        std::vector<const float*> sourceRows[3];
+        std::vector<float*> targetRows[3];
+        const float **sourcePlanes[3];
+        float **targetPlanes[3];
+        for (int c = 0; c < 3; c++)
+        {
+            sourceRows[c] = source.rows (c);
+            targetRows[c] = target.rows (c);
+            sourcePlanes[c] = &sourceRows[c][0];
+            targetPlanes[c] = &targetRows[c][0];
+        }
+
+        float scale = (float) target.width() / source.width();
+        rtengine::ImProcFunctions::resizePlanes (sourcePlanes, source.width(), source.height(),
+                targetPlanes, target.width(), target.height(), scale, true);
+    }
+
+
+
+    // --- sharpening
+
+    static inline int clampIndex (int i, int size)
+    {
+        return std::max (0, std::min (i, size - 1));
+    }
+
+
+
+    void NativeKernels::sharpen (PlanarImage &image, double sigma, double amount)
+    {
+        if ((sigma <= 0.0) || (amount == 0.0))
+        {
+            return;
+        }
+
+        const int width = image.width();
+        const int height = image.height();
+        const int radius = std::max (1, (int) ceil (3.0 * sigma));
+        const int taps = 2 * radius + 1;
+
+        std::vector<float> kernel (taps);
+        double sum = 0.0;
+        for (int k = 0; k < taps; k++)
+        {
+            sum += kernel[k] = (float) exp (- (double) (k - radius) * (k - radius) / (2.0 * sigma * sigma));
+        }
+        for (int k = 0; k < taps; k++)
+        {
+            kernel[k] = (float) (kernel[k] / sum);
+        }
+
+        const float strength = (float) amount;
+        std::vector<float> blurred ((size_t) width * height);
+
+        for (int c = 0; c < 3; c++)
+        {
+            float *p = image.plane (c);
+
+            // horizontal blur, the edge pixels are repeated
+            #pragma omp parallel for
+            for (int y = 0; y < height; y++)
+            {
+                const float *s = p + (size_t) y * width;
+                float *d = &blurred[(size_t) y * width];
+
+                int x = 0;
+#ifdef __SSE2__
+                for (; (x < radius) && (x < width); x++)
+                {
+                    float acc = 0.0f;
+                    for (int k = 0; k < taps; k++)
+                    {
+                        acc += kernel[k] * s[clampIndex (x + k - radius, width)];
+                    }
+                    d[x] = acc;
+                }
+                for (; x + 3 < width - radius; x += 4)
+                {
+                    __m128 acc = _mm_setzero_ps();
+                    for (int k = 0; k < taps; k++)
+                    {
+                        acc = _mm_add_ps (acc, _mm_mul_ps (_mm_set1_ps (kernel[k]), _mm_loadu_ps (s + x + k - radius)));
+                    }
+                    _mm_storeu_ps (d + x, acc);
+                }
+#endif
+                for (; x < width; x++)
+                {
+                    float acc = 0.0f;
+                    for (int k = 0; k < taps; k++)
+                    {
+                        acc += kernel[k] * s[clampIndex (x + k - radius, width)];
+                    }
+                    d[x] = acc;
+                }
+            }
+
+            // vertical blur and the mask in one pass, row y of the plane is only
+            // read for its own output
+            #pragma omp parallel for
+            for (int y = 0; y < height; y++)
+            {
+                float *d = p + (size_t) y * width;
+
+                int x = 0;
+#ifdef __SSE2__
+                const __m128 strengthv = _mm_set1_ps (strength);
+                for (; x + 3 < width; x += 4)
+                {
+                    __m128 acc = _mm_setzero_ps();
+                    for (int k = 0; k < taps; k++)
+                    {
+                        const float *s = &blurred[(size_t) clampIndex (y + k - radius, height) * width];
+                        acc = _mm_add_ps (acc, _mm_mul_ps (_mm_set1_ps (kernel[k]), _mm_loadu_ps (s + x)));
+                    }
+                    __m128 value = _mm_loadu_ps (d + x);
+                    _mm_storeu_ps (d + x, _mm_add_ps (value, _mm_mul_ps (strengthv, _mm_sub_ps (value, acc))));
+                }
+#endif
+                for (; x < width; x++)
+                {
+                    float acc = 0.0f;
+                    for (int k = 0; k < taps; k++)
+                    {
+                        acc += kernel[k] * blurred[(size_t) clampIndex (y + k - radius, height) * width + x];
+                    }
+                    d[x] = d[x] + strength * (d[x] - acc);
+                }
+            }
+        }
+    }
+
+}
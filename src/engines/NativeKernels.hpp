@@ -0,0 +1,130 @@
+/*
+ *  NativeKernels.hpp
+ *
+ *
+ *  This file is part of openPablo.
+ *
+ *  Copyright (c) 2012- Aydin Demircioglu (aydin@openpablo.org)
+ *
+ *  openPablo is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  openPablo is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with openPablo.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef OPENPABLO_NATIVEKERNELS_H_
+#define OPENPABLO_NATIVEKERNELS_H_
+
+/*
+ * @mainpage NativeKernels
+ *
+ * Description in html
+ * @author Aydin Demircioglu
+  */
+
+
+/*
+ * @file NativeKernels.hpp
+ *
+ * @brief Planar float image and the pixel kernels of the native engine.
+ *
+ */
+
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+
+namespace openPablo
+{
+
+    /*
+     * @class PlanarImage
+     *
+     * @brief RGB as three float planes
+     *
+     * The values are in the 0..65535 range of the rtengine Imagefloat, so the
+     * planes go into the ICC LUTs as they are. The rows of a plane follow each
+     * other without padding.
+     *
+     */
+    class PlanarImage
+    {
+        public:
+            PlanarImage();
+
+            PlanarImage (int _width, int _height);
+
+            // the content is undefined afterwards
+            void allocate (int _width, int _height);
+
+            int width () const
+            {
+                return w;
+            }
+
+            int height () const
+            {
+                return h;
+            }
+
+            float *plane (int c)
+            {
+                return &data[(size_t) c * w * h];
+            }
+
+            const float *plane (int c) const
+            {
+                return &data[(size_t) c * w * h];
+            }
+
+            // row pointers of a plane, the form the rtengine functions take
+            std::vector<float*> rows (int c);
+
+            std::vector<const float*> rows (int c) const;
+
+        private:
+            int w;
+
+            int h;
+
+            std::vector<float> data;
+    };
+
+
+
+    /*
+     * @brief Kernels of the native engine
+     *
+     * sharpen uses SSE2 where the compiler offers it, the scalar code gives
+     * the same results. resize and sharpen run OpenMP over the rows.
+     *
+     */
+    namespace NativeKernels
+    {
+        // one interleaved 8 bit RGB row into row y of the planes
+        void importRow (const uint8_t *rgb, PlanarImage &image, int y);
+
+        // Lanczos resampling to the size of target, through the resize of the
+        // RawTherapee engine (ImProcFunctions::resizePlanes)
+        void resize (const PlanarImage &source, PlanarImage &target);
+
+        // unsharp mask with a gaussian of sigma pixels, in place:
+        // value + amount * (value - blurred)
+        void sharpen (PlanarImage &image, double sigma, double amount);
+    }
+
+}
+
+
+#endif // OPENPABLO_NATIVEKERNELS_H_
@@ -31,6 +31,9 @@
 
 #include "Processor.hpp"
 #include "ProcessorFactory.hpp"
+#include "TicketJob.hpp"
+#include "JobQueue.hpp"
+#include "Trace.hpp"
 
 
 #include <QDir>
@@ -38,6 +41,7 @@
 #include <QDataStream>
 #include <QTextStream>
 #include <QDebug>
+#include <QStringList>
 
 
 //#include "rtengine.h"
@@ -50,6 +54,7 @@
 #include <string.h>
 #include <time.h>
 #include <exception>
+#include <signal.h>
 
 
 //#include "lensfun.h"
@@ -102,17 +107,18 @@ void customMessageHandler(QtMsgType type, const char *msg)
 }
 
 
-void testFile(QString _filename)
+void printUsage ()
 {
-    QFile imageFile( _filename);
-    if (!( imageFile.exists() && imageFile.open( QIODevice::ReadOnly)))
-    {
-        // it could not be opened
-        qDebug() << "Either file" << _filename << "does not exist or could not be opened.\n";
-        throw;
-    }
+    cout << "usage: openpablo <ticket>\n";
+    cout << "       openpablo --batch [--jobs N] <ticket|directory> ...\n";
+    cout << "       openpablo --daemon [--jobs N] [--poll MS] <spooldirectory>\n";
+    cout << "       --trace FILE writes the timing of all stages as Chrome trace to FILE\n";
+}
+
 
-    imageFile.close();
+void stopHandler (int)
+{
+    JobQueue::stop();
 }
 
 
@@ -138,48 +144,109 @@ int main ( int argc, char **argv )
 
         // TODO: crashreporter-lib..
 
-        // TODO: arguments interpretation
-        // for now: just test for 1 argument with the ticket.
-
         // FIXME: version number
 
         INFO("openPablo v0.1");
 
-        if (argc != 2)
-        {
-            ERR("You must only specify one ticket!");
-            return (-1);
-        }
-
-
-        using boost::property_tree::ptree;
-        ptree pt;
+        // --- arguments interpretation
 
-        // Load the settings file into the property tree. If reading fails
-        // (cannot open file, parse error), an exception is thrown.
-
-        // FIXME: try json first then xml or info parser.
-        // TODO: info parser should be #1 way of specifiying tickets.
-        read_json(argv[1] , pt);
-//	    write_info ("/tmp/data/settings.info", pt);
+        bool batchMode = false;
+        bool daemonMode = false;
+        int maxJobs = 0;
+        int pollInterval = 1000;
+        QString traceFile;
+        QStringList tickets;
 
+        for (int i = 1; i < argc; i++)
+        {
+            QString arg (argv[i]);
+
+            if (arg == "--batch")
+            {
+                batchMode = true;
+            }
+            else if (arg == "--daemon")
+            {
+                daemonMode = true;
+            }
+            else if ((arg == "--jobs") && (i+1 < argc))
+            {
+                maxJobs = QString (argv[++i]).toInt();
+            }
+            else if ((arg == "--poll") && (i+1 < argc))
+            {
+                pollInterval = QString (argv[++i]).toInt();
+            }
+            else if ((arg == "--trace") && (i+1 < argc))
+            {
+                traceFile = argv[++i];
+            }
+            else
+            {
+                tickets << arg;
+            }
+        }
 
-        // --- read the input file
+        if ((tickets.size() == 0) || (batchMode && daemonMode))
+        {
+            printUsage();
+            return (-1);
+        }
 
-        QDir inputDir (QString::fromStdString(pt.get<std::string>("Input.InputPath")));
-        QString imageFullName = inputDir.filePath(QString::fromStdString(pt.get<std::string>("Input.InputFile")));
+        if ((traceFile.isEmpty() == false) && (Trace::open (traceFile) == false))
+        {
+            ERR("Cannot open trace file!");
+            return (-1);
+        }
 
-        // FIXME: check if file exists
-        testFile(imageFullName);
 
-        // depending on file type different things should happen. job of the processor.
-        Processor *processor = ProcessorFactory::createInstance (imageFullName);
+        if (daemonMode)
+        {
+            if (tickets.size() != 1)
+            {
+                ERR("You must specify exactly one spool directory!");
+                return (-1);
+            }
 
-        processor -> setSettings (pt);
-        processor -> start ();
+            signal (SIGINT, stopHandler);
+            signal (SIGTERM, stopHandler);
 
-        // destruct processor again
-        delete processor;
+            JobQueue queue (maxJobs);
+            queue.watchSpool (tickets[0], pollInterval);
+        }
+        else if (batchMode)
+        {
+            JobQueue queue (maxJobs);
+            foreach (QString ticket, tickets)
+            {
+                queue.addTicket (ticket);
+            }
+
+            if (queue.waitForDone() > 0)
+            {
+                retValue = 1;
+            }
+        }
+        else
+        {
+            if (tickets.size() != 1)
+            {
+                ERR("You must only specify one ticket!");
+                return (-1);
+            }
+
+            ProcessorFactory::initialize();
+
+            // depending on file type different things should happen. job of the processor.
+            TicketJob job (tickets[0]);
+            job.run();
+
+            if (job.succeeded() == false)
+            {
+                cout << "Caught exception: " << job.errorMessage().toStdString() << endl;
+                retValue = 1;
+            }
+        }
     }
     catch( std::exception &error_ )
     {
@@ -187,6 +254,8 @@ int main ( int argc, char **argv )
         retValue = 1;
     }
 
+    Trace::close();
+
     LOGOG_SHUTDOWN();
 
     return retValue;
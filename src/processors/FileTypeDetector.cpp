@@ -0,0 +1,318 @@
+/*
+ *  FileTypeDetector.cpp
+ *
+ *
+ *  This file is part of openPablo.
+ *
+ *  Copyright (c) 2012- Aydin Demircioglu (aydin@openpablo.org)
+ *
+ *  openPablo is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  openPablo is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with openPablo.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "FileTypeDetector.hpp"
+
+#include <stdio.h>
+#include <string.h>
+#include <QDebug>
+#include <QMutexLocker>
+
+#include "libraw/libraw.h"
+
+
+/*
+ * @mainpage FileTypeDetector
+ *
+ * Description in html
+ * @author Aydin Demircioglu
+  */
+
+
+/*
+ * @file FileTypeDetector.cpp
+ *
+ * @brief Cheap file type detection for the ProcessorFactory.
+ *
+ */
+
+
+
+namespace openPablo
+{
+
+    /*
+     * @class FileTypeDetector
+     *
+     * @brief Detects the type of an input file
+     *
+     */
+
+
+    FileTypeDetector::FileTypeDetector ()
+    {
+        magicCookie = magic_open (MAGIC_MIME);
+
+        if (magicCookie == NULL)
+        {
+            qDebug() << "unable to initialize magic library";
+            return;
+        }
+
+        if (magic_load (magicCookie, NULL) != 0)
+        {
+            qDebug() << "cannot load magic database" << magic_error (magicCookie);
+            magic_close (magicCookie);
+            magicCookie = NULL;
+        }
+    }
+
+
+
+    FileTypeDetector::~FileTypeDetector ()
+    {
+        if (magicCookie != NULL)
+        {
+            magic_close (magicCookie);
+        }
+    }
+
+
+
+    FileTypeDetector& FileTypeDetector::instance ()
+    {
+        // the magic database is loaded once, on first use
+        static QMutex instanceMutex;
+        QMutexLocker locker (&instanceMutex);
+
+        static FileTypeDetector detector;
+        return detector;
+    }
+
+
+
+    FileTypeDetector::FileType FileTypeDetector::checkSignature (const unsigned char *header, size_t length)
+    {
+        if ((length >= 3) && (header[0] == 0xFF) && (header[1] == 0xD8) && (header[2] == 0xFF))
+        {
+            return JPEG;
+        }
+
+        if ((length >= 8) && (memcmp (header, "\x89PNG\r\n\x1a\n", 8) == 0))
+        {
+            return PNG;
+        }
+
+        if ((length >= 5) && (memcmp (header, "%PDF-", 5) == 0))
+        {
+            return PDF;
+        }
+
+        if ((length >= 4) && (memcmp (header, "8BPS", 4) == 0))
+        {
+            return PSD;
+        }
+
+        if (length >= 4)
+        {
+            // RAW containers with a signature of their own
+            if ((memcmp (header, "IIRO", 4) == 0) || (memcmp (header, "IIRS", 4) == 0) ||
+                    (memcmp (header, "MMOR", 4) == 0) ||                      // Olympus ORF
+                    (memcmp (header, "IIU\0", 4) == 0) ||                     // Panasonic RW2
+                    (memcmp (header, "\0MRM", 4) == 0) ||                     // Minolta MRW
+                    (memcmp (header, "FOVb", 4) == 0))                        // Sigma X3F
+            {
+                return RAW;
+            }
+
+            if ((length >= 8) && (memcmp (header, "FUJIFILM", 8) == 0))
+            {
+                return RAW;
+            }
+
+            if ((length >= 14) && (memcmp (header + 6, "HEAPCCDR", 8) == 0))
+            {
+                return RAW;                                                     // Canon CRW
+            }
+
+            if ((memcmp (header, "II*\0", 4) == 0) || (memcmp (header, "MM\0*", 4) == 0))
+            {
+                // Canon CR2 marks itself right after the TIFF header, NEF, DNG, ARW, ...
+                // look like any other TIFF
+                if ((length >= 10) && (header[8] == 'C') && (header[9] == 'R'))
+                {
+                    return RAW;
+                }
+                return TIFF;
+            }
+        }
+
+        return Unknown;
+    }
+
+
+
+    QString FileTypeDetector::magicMimeType (QString fileName)
+    {
+        // a magic cookie must not be used by two threads at once
+        QMutexLocker locker (&magicMutex);
+
+        if (magicCookie == NULL)
+        {
+            return QString();
+        }
+
+        const char *magic_full = magic_file (magicCookie, fileName.toStdString().c_str());
+        if (magic_full == NULL)
+        {
+            qDebug() << "libmagic failed:" << magic_error (magicCookie);
+            return QString();
+        }
+
+        return QString (magic_full);
+    }
+
+
+
+    bool FileTypeDetector::isRAW (QString fileName)
+    {
+        LibRaw iProcessor;
+        bool raw = (iProcessor.open_file (fileName.toStdString().c_str()) == LIBRAW_SUCCESS);
+        iProcessor.recycle();
+        return raw;
+    }
+
+
+
+    FileTypeDetector::Result FileTypeDetector::detect (QString fileName)
+    {
+        Result result;
+        result.type = Unknown;
+        result.stage = ByNone;
+
+        // --- stage 1: signature of the header, one buffered read
+        unsigned char header[headerSize];
+        size_t length = 0;
+
+        FILE *file = fopen (fileName.toStdString().c_str(), "rb");
+        if (file != NULL)
+        {
+            length = fread (header, 1, headerSize, file);
+            fclose (file);
+        }
+
+        result.type = checkSignature (header, length);
+
+        if (result.type == TIFF)
+        {
+            // only LibRaw can tell plain TIFFs from TIFF based RAWs
+            result.stage = ByLibRaw;
+            if (isRAW (fileName))
+            {
+                result.type = RAW;
+            }
+            return result;
+        }
+
+        if (result.type != Unknown)
+        {
+            result.stage = BySignature;
+            return result;
+        }
+
+
+        // --- stage 2: libmagic
+        result.mimeType = magicMimeType (fileName);
+        result.stage = ByLibMagic;
+
+        if (result.mimeType.contains ("application/pdf", Qt::CaseInsensitive))
+        {
+            result.type = PDF;
+            return result;
+        }
+
+        if (result.mimeType.contains ("image/jpeg", Qt::CaseInsensitive))
+        {
+            result.type = JPEG;
+            return result;
+        }
+
+        if (result.mimeType.contains ("image/png", Qt::CaseInsensitive))
+        {
+            result.type = PNG;
+            return result;
+        }
+
+        if (result.mimeType.contains ("image/vnd.adobe.photoshop", Qt::CaseInsensitive))
+        {
+            result.type = PSD;
+            return result;
+        }
+
+
+        // --- stage 3: LibRaw for the RAW formats without clear signature
+        if (isRAW (fileName))
+        {
+            result.type = RAW;
+            result.stage = ByLibRaw;
+            return result;
+        }
+
+        if (result.mimeType.contains ("image/tiff", Qt::CaseInsensitive))
+        {
+            result.type = TIFF;
+        }
+
+        return result;
+    }
+
+
+
+    QString FileTypeDetector::typeName (FileType type)
+    {
+        switch (type)
+        {
+            case JPEG:
+                return "JPG";
+            case PNG:
+                return "PNG";
+            case TIFF:
+                return "TIFF";
+            case PDF:
+                return "PDF";
+            case PSD:
+                return "PSD";
+            case RAW:
+                return "RAW";
+            default:
+                return "Unknown";
+        }
+    }
+
+
+
+    QString FileTypeDetector::stageName (Stage stage)
+    {
+        switch (stage)
+        {
+            case BySignature:
+                return "signature";
+            case ByLibMagic:
+                return "libmagic";
+            case ByLibRaw:
+                return "LibRaw";
+            default:
+                return "none";
+        }
+    }
+
+}
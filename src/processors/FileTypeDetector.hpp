@@ -0,0 +1,133 @@
+/*
+ *  FileTypeDetector.hpp
+ *
+ *
+ *  This file is part of openPablo.
+ *
+ *  Copyright (c) 2012- Aydin Demircioglu (aydin@openpablo.org)
+ *
+ *  openPablo is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  openPablo is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with openPablo.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef OPENPABLO_FILETYPEDETECTOR_H_
+#define OPENPABLO_FILETYPEDETECTOR_H_
+
+/*
+ * @mainpage FileTypeDetector
+ *
+ * Description in html
+ * @author Aydin Demircioglu
+  */
+
+
+/*
+ * @file FileTypeDetector.hpp
+ *
+ * @brief Cheap file type detection for the ProcessorFactory.
+ *
+ */
+
+
+#include <QString>
+#include <QMutex>
+
+#include <stddef.h>
+#include <magic.h>
+
+
+namespace openPablo
+{
+
+    /*
+     * @class FileTypeDetector
+     *
+     * @brief Detects the type of an input file
+     *
+     * The first bytes of the file are read once and checked against the
+     * well known signatures (JPEG, PNG, PDF, PSD, TIFF and the common RAW
+     * containers). Only if that does not decide, libmagic and finally
+     * LibRaw are asked. The libmagic cookie is opened once and shared,
+     * access to it is serialized, so one detector can be used by all jobs.
+     *
+     */
+    class FileTypeDetector
+    {
+        public:
+            enum FileType
+            {
+                Unknown = 0,
+                JPEG,
+                PNG,
+                TIFF,
+                PDF,
+                PSD,
+                RAW
+            };
+
+            // which stage made the decision
+            enum Stage
+            {
+                ByNone = 0,
+                BySignature,
+                ByLibMagic,
+                ByLibRaw
+            };
+
+            struct Result
+            {
+                FileType type;
+                Stage stage;
+                QString mimeType;
+            };
+
+            // process wide detector
+            static FileTypeDetector& instance ();
+
+            Result detect (QString fileName);
+
+            static QString typeName (FileType type);
+
+            static QString stageName (Stage stage);
+
+            // number of header bytes used for the signature checks
+            static const size_t headerSize = 64;
+
+        private:
+
+            FileTypeDetector ();
+
+            ~FileTypeDetector ();
+
+            FileTypeDetector (const FileTypeDetector&);
+
+            FileTypeDetector& operator= (const FileTypeDetector&);
+
+            // returns Unknown if the signature is not conclusive. TIFF
+            // containers are reported as TIFF, they could still be RAW.
+            static FileType checkSignature (const unsigned char *header, size_t length);
+
+            QString magicMimeType (QString fileName);
+
+            static bool isRAW (QString fileName);
+
+            QMutex magicMutex;
+
+            magic_t magicCookie;
+    };
+
+}
+
+
+#endif // OPENPABLO_FILETYPEDETECTOR_H_
@@ -24,6 +24,10 @@
 
 #include "Engine.hpp"
 #include "EngineFactory.hpp"
+#include "Trace.hpp"
+
+#include "iccstore.h"
+#include "colorlut.h"
 
 #include <Magick++.h>
 #include <boost/foreach.hpp>
@@ -33,11 +37,17 @@
 #include "logog/logog.hpp"
 
 
+#include <algorithm>
 #include <list>
+#include <map>
 #include <string>
+#include <vector>
 #include <QString>
 #include <QDebug>
 #include <QDir>
+#include <QFile>
+#include <QRunnable>
+#include <QThreadPool>
 
 
 /*
@@ -74,6 +84,7 @@ namespace openPablo
 
 
     ImageProcessor::ImageProcessor()
+        : hasInputImage (false)
     {
         //
     }
@@ -89,14 +100,260 @@ namespace openPablo
 #define _INFO(x) { std::stringstream msg; msg << x; INFO(msg.str().c_str());}
 
 
+
+    /*
+     * @class SinkWriter
+     *
+     * @brief Writes the output sinks of one output file on a worker thread
+     *
+     * Sinks that end up in the same file are written one after the other,
+     * the last one wins like in a serial loop.
+     *
+     */
+    class SinkWriter: public QRunnable
+    {
+        public:
+            SinkWriter (ImageProcessor *_processor, Magick::Image _originalImage)
+                : processor (_processor),
+                  originalImage (_originalImage),
+                  traceJob (Trace::currentJob())
+            {
+                //
+            }
+
+            void add (const boost::property_tree::ptree &_sinkSettings, Magick::Image _sinkImage)
+            {
+                sinkSettings.push_back (_sinkSettings);
+                sinkImages.push_back (_sinkImage);
+            }
+
+            virtual void run ()
+            {
+                // the spans of the sink belong to the job that planned it
+                Trace::setCurrentJob (traceJob);
+                for (size_t i = 0; i < sinkSettings.size(); i++)
+                {
+                    processor -> writeSink (sinkSettings[i], sinkImages[i], originalImage);
+                }
+                Trace::setCurrentJob (NULL);
+            }
+
+        private:
+            ImageProcessor *processor;
+
+            std::vector<boost::property_tree::ptree> sinkSettings;
+
+            std::vector<Magick::Image> sinkImages;
+
+            Magick::Image originalImage;
+
+            TraceJob *traceJob;
+    };
+
+
+
+    // bigger boxes first
+    static bool largerSink (const ImageProcessor::OutputSink &a, const ImageProcessor::OutputSink &b)
+    {
+        return ((int64_t) a.width * a.height > (int64_t) b.width * b.height);
+    }
+
+
+
+    // collects (key, value) pairs from a ticket tag list. accepts
+    // [{"Key": "Value"}, ...] as well as plain and nested lists of keys.
+    static void collectTags (const boost::property_tree::ptree &tags, std::vector<std::pair<std::string, std::string> > &result)
+    {
+        using boost::property_tree::ptree;
+        BOOST_FOREACH(const ptree::value_type& tag, tags)
+        {
+            if (tag.first.empty() == false)
+            {
+                result.push_back (std::make_pair (tag.first, tag.second.data()));
+            }
+            else if (tag.second.empty() == false)
+            {
+                collectTags (tag.second, result);
+            }
+            else
+            {
+                result.push_back (std::make_pair (tag.second.data(), std::string()));
+            }
+        }
+    }
+
+
+
+    // short ticket names are taken relative to the usual group of the family
+    static std::string metadataKey (const std::string &family, const std::string &group, const std::string &name)
+    {
+        if (name.compare (0, family.size() + 1, family + ".") == 0)
+        {
+            return name;
+        }
+
+        if ((family == "Iptc") && (name == "Country"))
+        {
+            return "Iptc.Application2.CountryName";
+        }
+
+        return family + "." + group + "." + name;
+    }
+
+
+
+    template <class Data, class Key>
+    static void removeTag (Data &data, const std::string &key)
+    {
+        typename Data::iterator pos = data.findKey (Key (key));
+        while (pos != data.end())
+        {
+            data.erase (pos);
+            pos = data.findKey (Key (key));
+        }
+    }
+
+
+
+    template <class Data, class Key>
+    static void updateTags (Data &data, const boost::property_tree::ptree &settings,
+                            const std::string &family, const std::string &group)
+    {
+        std::vector<std::pair<std::string, std::string> > tags;
+
+        if (settings.get_child_optional ("RemoveTags"))
+        {
+            collectTags (settings.get_child ("RemoveTags"), tags);
+        }
+        for (size_t i = 0; i < tags.size(); i++)
+        {
+            // remove lists may hold the names as values as well
+            std::string name = tags[i].second.empty() ? tags[i].first : tags[i].second;
+            try
+            {
+                removeTag<Data, Key> (data, metadataKey (family, group, name));
+            }
+            catch (...)
+            {
+                std::cout << "Cannot find key " << name << ", cannot remove.\n";
+            }
+        }
+
+        tags.clear();
+        if (settings.get_child_optional ("AddTags"))
+        {
+            collectTags (settings.get_child ("AddTags"), tags);
+        }
+        for (size_t i = 0; i < tags.size(); i++)
+        {
+            try
+            {
+                data[metadataKey (family, group, tags[i].first)] = tags[i].second;
+            }
+            catch (...)
+            {
+                std::cout << "Cannot add key " << tags[i].first << "\n";
+            }
+        }
+    }
+
+
+
+    Blob ImageProcessor::applyMetadata (const Blob &encodedImage)
+    {
+        using boost::property_tree::ptree;
+
+        Exiv2::Image::AutoPtr image;
+        try
+        {
+            image = Exiv2::ImageFactory::open ((const Exiv2::byte*) encodedImage.data(), (long) encodedImage.length());
+            image->readMetadata();
+        }
+        catch (Exiv2::AnyError& e)
+        {
+            // format without metadata support, write it as it is
+            std::cout << "Cannot apply metadata: " << e << "\n";
+            return encodedImage;
+        }
+
+        try
+        {
+            BOOST_FOREACH(const ptree::value_type& metadataChild, pt.get_child("MetaData"))
+            {
+                std::string type = metadataChild.second.get<std::string>("Type");
+
+                if (type == "EXIF")
+                {
+                    updateTags<Exiv2::ExifData, Exiv2::ExifKey> (image->exifData(), metadataChild.second, "Exif", "Image");
+                }
+
+                if (type == "IPTC")
+                {
+                    updateTags<Exiv2::IptcData, Exiv2::IptcKey> (image->iptcData(), metadataChild.second, "Iptc", "Application2");
+                }
+
+                if (type == "XMP")
+                {
+                    updateTags<Exiv2::XmpData, Exiv2::XmpKey> (image->xmpData(), metadataChild.second, "Xmp", "dc");
+                }
+            }
+
+            // exiv2 rewrites only the metadata segments of its in-memory copy
+            image->writeMetadata();
+        }
+        catch (...)
+        {
+            // assume its some boost or exiv2 error
+            std::cout << "ERROR METADATA.\n";
+            return encodedImage;
+        }
+
+        Exiv2::BasicIo &memIo = image->io();
+        return Blob ((const char*) memIo.mmap (false), memIo.size());
+    }
+
+
+
     void ImageProcessor::start ()
     {
         // Initialize ImageMagick install location for Windows
         InitializeMagick(NULL);
 
+        // --- create engine
+
+        // get engine name and ask factory to assemble it. the native engine renders
+        // JPEG tickets from the encoded input and leaves everything else to ImageMagick
+        QString engineName = QString::fromStdString (pt.get<std::string>("Engine", "Magick"));
+        Engine *engine = EngineFactory::createEngine(engineName);
+
+        engine->setSettings(pt);
+        engine->setFilename(filename);
+
+        std::vector<Blob> renditions;
+        if ((hasInputImage == false) && (engine->renderSinks (imageBlob, renditions) == true))
+        {
+            delete engine;
+            Trace::note ("engine", "native");
+
+            // renditions are in the order of the ticket
+            using boost::property_tree::ptree;
+            size_t i = 0;
+            BOOST_FOREACH(const ptree::value_type& child, pt.get_child("Output"))
+            {
+                writeRendition (child.second, renditions[i++]);
+            }
+            return;
+        }
+
         // TODO: do it correctly.
+        TraceSpan decodeSpan ("decode", "decode");
         Magick::Image originalImage;
-        if (imageBlob.length() > 0)
+        if (hasInputImage == true)
+        {
+            // already decoded, nothing to read
+            originalImage = inputImage;
+        }
+        else if (imageBlob.length() > 0)
         {
             // read from blob
             originalImage.read(imageBlob);
@@ -112,19 +369,13 @@ namespace openPablo
             originalImage.read(filename.toStdString());
         }
 
+        decodeSpan.finish();
+
         // originalImage contains original image and must
         // not be changed (TODO: how to ensure this?)
 
 
-        // --- create engine
-
-        // get engine name and ask factory to assemble it
-        //QString engineName (pt.get<std::string>("Engine").c_str());
-        QString engineName = "Magick";
-
-        Engine *engine = EngineFactory::createEngine(engineName);
-
-        engine->setSettings(pt);
+        TraceSpan engineSpan ("engine", "engine");
         engine->setMagickImage (originalImage);
 //	 	  engine->setLogging (...);
         engine->start();
@@ -132,298 +383,391 @@ namespace openPablo
 
         // cleanup
         delete engine;
+        engineSpan.finish();
+
 
+        // --- plan the output sinks
 
+        // sinks are sorted by size, each rendition is derived from the smallest
+        // larger one that is still big enough, full resolution is only resized
+        // for the biggest sinks. the pyramid is built before any ICC conversion.
+        std::vector<OutputSink> sinks;
         try
         {
-            // for each sink
             using boost::property_tree::ptree;
             BOOST_FOREACH(const ptree::value_type& child,
                           pt.get_child("Output"))
             {
-                std::string outputid = child.second.get<std::string>("id");
-                std::cout << "Processing Output Sink " << outputid  << "\n";
-
-
-                // -- resize image
-                uint32_t width = child.second.get<int>("Width");
-                uint32_t height = child.second.get<int>("Height");
-                std::cout << "Scale to " << width << ", " << height << "\n";
-
-                std::stringstream str;
-                str << width << "x" << height;
-                std::string resizeresult;
-                str >> resizeresult;
-                Image sinkImage = processedImage;
-                sinkImage.resize(resizeresult);
-
+                OutputSink sink;
+                sink.settings = child.second;
+                sink.width = child.second.get<int>("Width");
+                sink.height = child.second.get<int>("Height");
+                sinks.push_back (sink);
+            }
+        }
+        catch (const std::exception& ex)
+        {
+            std::cout << "failed to read output sinks - " << ex.what() << endl;
+            return;
+        }
 
-                // -- apply output ICC profile
+        std::stable_sort (sinks.begin(), sinks.end(), largerSink);
 
-                // obtain icc parameters
-                QDir profileDir (QString::fromStdString(child.second.get<std::string>("ICC.Path")));
-                std::string profileName = child.second.get<std::string>("ICC.Output");
-                QString profileFullName = profileDir.filePath(QString::fromStdString(profileName));
+        // minimal size ratio between a rendition and one derived from it
+        double derivationFactor = pt.get<double>("Processors.Image.DerivationFactor", 2.0);
 
+        for (size_t i = 0; i < sinks.size(); i++)
+        {
+            // size of the rendition, the aspect ratio is kept within the box
+            double scale = std::min ((double) sinks[i].width / processedImage.columns(), (double) sinks[i].height / processedImage.rows());
+            size_t targetColumns = (size_t) (processedImage.columns() * scale + 0.5);
+            size_t targetRows = (size_t) (processedImage.rows() * scale + 0.5);
 
-                // load ICC file
-                QFile iccfile(profileFullName);
+            Image sourceImage = processedImage;
+            bool sameSize = false;
 
-                QByteArray outputProfile;
-                if(iccfile.open(QIODevice::ReadOnly))
+            // look for the smallest rendition so far that is large enough
+            for (size_t j = 0; j < i; j++)
+            {
+                if ((sinks[j].width == sinks[i].width) && (sinks[j].height == sinks[i].height))
                 {
-                    outputProfile = iccfile.readAll();
-                    iccfile.close();
+                    sourceImage = sinks[j].image;
+                    sameSize = true;
+                    break;
                 }
-                else
+
+                if ((sinks[j].image.columns() >= derivationFactor * targetColumns) &&
+                        (sinks[j].image.rows() >= derivationFactor * targetRows) &&
+                        (sinks[j].image.columns() < sourceImage.columns()))
                 {
-                    qDebug() << ("failed to load ") << profileFullName << "\n";
-                    return;
+                    sourceImage = sinks[j].image;
                 }
+            }
 
+            sinks[i].image = sourceImage;
+            if (sameSize == true)
+            {
+                continue;
+            }
 
-                sinkImage.profile("ICC", Magick::Blob(outputProfile.constData(), outputProfile.size()));
-                const Magick::Blob  targetICC (outputProfile.constData(), outputProfile.size());
-                sinkImage.profile("ICC", targetICC);
-                sinkImage.iccColorProfile(targetICC);
+            std::cout << "Scale to " << sinks[i].width << ", " << sinks[i].height << " from "
+                      << sourceImage.columns() << "x" << sourceImage.rows() << "\n";
 
-                qDebug() << "Applied ICC profile.\n";
+            TraceSpan resizeSpan ("resize", "sink");
+            std::stringstream str;
+            str << sinks[i].width << "x" << sinks[i].height;
+            std::string resizeresult;
+            str >> resizeresult;
+            sinks[i].image.resize (resizeresult);
+        }
 
-                // read output format
-                std::string outputFormat = child.second.get<std::string>("FileHandling.OutputFormat");
 
-                std::string compression;
-                // depending on format need some extra infos
-                if (outputFormat == "JPEG")
-                {
-                    compression = child.second.get<std::string>("FileHandling.Compression");
-                }
+        // --- ICC, encoding, metadata and writing are independent per output file.
+        // two sinks with the same format and path write the same file, they share a
+        // writer so it is never opened twice at the same time
 
-                // depending on format need some extra infos
-                std::string preserveOriginalLayer;
-                if (outputFormat == "PSD")
-                {
-                    preserveOriginalLayer = child.second.get<std::string>("FileHandling.PreserveOriginalLayer");
-                }
+        QThreadPool sinkPool;
+        std::map<QString, SinkWriter*> writers;
+        std::vector<SinkWriter*> writerOrder;
+        for (size_t i = 0; i < sinks.size(); i++)
+        {
+            QString target;
+            try
+            {
+                target = sinkFileName (sinks[i].settings);
+            }
+            catch (const std::exception&)
+            {
+                // incomplete sink, writeSink reports it
+                target = QString ("#%1").arg (i);
+            }
 
+            SinkWriter *&writer = writers[target];
+            if (writer == NULL)
+            {
+                writer = new SinkWriter (this, originalImage);
+                writerOrder.push_back (writer);
+            }
+            else
+            {
+                qDebug() << "Sinks share the output file" << target << ", writing them one after the other.";
+            }
+            writer -> add (sinks[i].settings, sinks[i].image);
+        }
+        for (size_t i = 0; i < writerOrder.size(); i++)
+        {
+            sinkPool.start (writerOrder[i]);
+        }
+        sinkPool.waitForDone();
+    }
 
-                // apply format specifities
 
 
+    void ImageProcessor::writeSink (const boost::property_tree::ptree &sinkSettings, Magick::Image sinkImage, Magick::Image originalImage)
+    {
+        try
+        {
+            using boost::property_tree::ptree;
 
-                // output blob that will be written to disk
-                Blob sinkBlob;
+            std::string outputid = sinkSettings.get<std::string>("id");
+            std::cout << "Processing Output Sink " << outputid  << "\n";
 
-                // determine if user wants to have second (original) layer (..)
-                if (preserveOriginalLayer == "True")
-                {
-                    // TODO: we need the original image, and we need to resize it as well
-                    // as convert it to the same ICC profile, for now just ignore.
 
-                    qDebug() << "Preserving original Layer.\n";
+            // -- apply output ICC profile
 
-                    list<Image> layers;
-                    originalImage.magick("PSD");
-                    processedImage.magick("PSD");
+            // obtain icc parameters
+            QDir profileDir (QString::fromStdString(sinkSettings.get<std::string>("ICC.Path")));
+            std::string profileName = sinkSettings.get<std::string>("ICC.Output");
+            QString profileFullName = profileDir.filePath(QString::fromStdString(profileName));
 
-                    // copy original image as layer
-                    layers.push_back (originalImage);
-                    layers.push_back (processedImage );
 
-                    Image finalPSD;
-                    std::string inputFile = filename.toStdString();
-                    writeImages( layers.begin(), layers.end(), &sinkBlob, true );
-//					writeImages( layers.begin(), layers.end(), "/tmp/sinkBlob.psd", true );
-                    std::cout << "vorher: " << layers.size();
-                }
-                else
-                {
-                    // just normal nonlayered output
-                    qDebug() << "Flat output.\n";
+            // the ICC file is read once per process, the ICCStore of rtengine keeps it
+            // for all jobs and sinks
+            TraceSpan iccSpan ("icc", "sink");
+            std::string iccName = "file:" + profileFullName.toStdString();
+            if (rtengine::iccStore->getProfile (iccName) == NULL)
+            {
+                qDebug() << ("failed to load ") << profileFullName << "\n";
+                return;
+            }
+            rtengine::ProfileContent outputProfile = rtengine::iccStore->getContent (iccName);
+
+            // CMYK print renditions are the expensive case, a sink can have them go
+            // through a 3D LUT with ICC.LUTGrid nodes per axis. The LUT is approximate,
+            // so it is opt-in: without the setting (or 0) the exact conversion of
+            // ImageMagick is used
+            const Magick::Blob targetICC (outputProfile.data, outputProfile.length);
+            int lutGrid = sinkSettings.get<int>("ICC.LUTGrid", 0);
+            if ((lutGrid < 2) || (convertWithLUT (sinkImage, iccName, lutGrid) == false))
+            {
+                sinkImage.profile("ICC", targetICC);
+            }
+            sinkImage.iccColorProfile(targetICC);
 
-                    // save it in the correct output format, but in memory
-//?                    processedimage.magick( outputFormat );
-                    processedImage.write( &sinkBlob, outputFormat );
-                }
+            iccSpan.finish();
+            qDebug() << "Applied ICC profile.\n";
 
+            // read output format
+            std::string outputFormat = sinkSettings.get<std::string>("FileHandling.OutputFormat");
 
-                // try to apply as much metadata as possible
-                Exiv2::Image::AutoPtr image = Exiv2::ImageFactory::open((const uint8_t*) sinkBlob.data(), (long) sinkBlob.length());
+            std::string compression;
+            // depending on format need some extra infos
+            if (outputFormat == "JPEG")
+            {
+                compression = sinkSettings.get<std::string>("FileHandling.Compression");
+            }
 
-                image->readMetadata();
-                Exiv2::ExifData &exifData = image->exifData();
+            // depending on format need some extra infos
+            std::string preserveOriginalLayer;
+            if (outputFormat == "PSD")
+            {
+                preserveOriginalLayer = sinkSettings.get<std::string>("FileHandling.PreserveOriginalLayer");
+            }
 
-                if (exifData.empty())
-                {
-                    // create new exif data or is exif in format not possible?
-                }
 
+            // apply format specifities
 
 
-                // -- apply Metadata
 
-                try
-                {
-                    BOOST_FOREACH(const ptree::value_type& metadataChild, pt.get_child("MetaData"))
-                    {
-                        std::cout << "Found Exif Data in Settings.";
-//                  	// check type
-                        if (metadataChild.second.get<std::string>("Type") == "EXIF")
-                        {
-                            std::cout << "Removing tags now:\n";
-//
-                            // get all removetags
-                            BOOST_FOREACH(const ptree::value_type& exifChild, metadataChild.second.get_child("RemoveTags"))
-                            {
-                                // exifChild
-                                std::string updateStr= exifChild.second.get<std::string>(exifChild.first);
-                                std::cout << "Removing from Exif Data:" << updateStr << "\n";
-                                try
-                                {
-                                    Exiv2::ExifKey key = Exiv2::ExifKey("Exif.Image." + exifChild.first);
-                                    std::cout << "Fin loop\n";
-                                    Exiv2::ExifData::iterator pos = exifData.findKey(key);
-                                    if (pos != exifData.end())
-                                    {
-                                        exifData.erase(pos);
-                                    }
-                                }
-                                catch (...)
-                                {
-                                    std::cout << "Cannot find key, cannot remove.\n";
-                                }
-                            }
-
-                            std::cout << "XX";
-
-                            // get all addtags
-                            BOOST_FOREACH(const ptree::value_type& exifChild, metadataChild.second.get_child("AddTags"))
-                            {
-
-                                // "Image", "Photo" are available.
-//                            	const Exiv2::GroupInfo* gp = Exiv2::ExifTags::groupList();
-//                            	for (int r=0; r < 166; r++)
-//                            	{
-//                            		std::cout << gp[r].groupName_ << "\n";
-//                            	}
-
-//                    			const Exiv2::TagInfo* tg = Exiv2::ExifTags::tagList("Image");
-//								for (int r=0; r < 566; r++)
-//								{
-//									std::cout << tg[r].typeId_ << " " << tg[r].name_ << "\n";
-//									if (tg[r].name_ == "(UnknownIfdTag)")
-//										break;
-//								}
-
-                                std::cout << "Looping over addtags:";
-                                // exifChild
-                                std::cout << "Adding tag " << exifChild.first << " with value ";
-                                std::cout << exifChild.second.data() << " to Exif Data.\n";
-
-                                try
-                                {
-                                    // need to determine type for exifdata first
-                                    exifData["Exif.Image."+exifChild.first] = exifChild.second.data();
-                                }
-                                catch (...)
-                                {
-                                    std::cout << "Cannot add key\n";
-                                }
-
-                                std::cout << "Fin loop\n";
-                            }
-
-
-                        }
-
-                        if (metadataChild.second.get<std::string>("Type") == "IPTC")
-                        {
-                            //
-                        }
-                    }
+            // output blob that will be written to disk
+            TraceSpan encodeSpan ("encode", "sink");
+            Blob sinkBlob;
 
-                }
-                catch(...)
+            // determine if user wants to have second (original) layer (..)
+            if (preserveOriginalLayer == "True")
+            {
+                // TODO: we need the original image, and we need to resize it as well
+                // as convert it to the same ICC profile, for now just ignore.
+
+                qDebug() << "Preserving original Layer.\n";
+
+                list<Image> layers;
+                originalImage.magick("PSD");
+                sinkImage.magick("PSD");
+
+                // copy original image as layer
+                layers.push_back (originalImage);
+                layers.push_back (sinkImage);
+
+                Image finalPSD;
+                std::string inputFile = filename.toStdString();
+                writeImages( layers.begin(), layers.end(), &sinkBlob, true );
+//					writeImages( layers.begin(), layers.end(), "/tmp/sinkBlob.psd", true );
+                std::cout << "vorher: " << layers.size();
+            }
+            else
+            {
+                // just normal nonlayered output
+                qDebug() << "Flat output.\n";
+
+                // save it in the correct output format, but in memory
+//?                    processedimage.magick( outputFormat );
+                if (compression.empty() == false)
                 {
-                    // assume its some boost error
-                    std::cout << "ERROR METADATA.\n";
+                    sinkImage.quality (QString::fromStdString (compression).toInt());
                 }
+                sinkImage.write( &sinkBlob, outputFormat );
+            }
 
-                std::cout << "FIN METADATA.\n";
-                /*
-                                // try to apply as much metadata as possible
-                                Exiv2::Image::AutoPtr image = Exiv2::ImageFactory::open((const uint8_t*) sinkBlob.data(), (long) sinkBlob.length());
 
-                                image->readMetadata();
-                                Exiv2::ExifData &exifData = image->exifData();
+            encodeSpan.finish();
+            writeRendition (sinkSettings, sinkBlob);
+        }
+        catch (const std::exception& ex)
+        {
+            std::cout << "failed to magick - " << ex.what() << endl;
+        }
+    }
 
-                                if (exifData.empty())
-                                {
-                                    // create new exif data or is exif in format not possible?
-                                }
 
-                                // set exif as requested by user
-                                exifData["Exif.Photo.UserComment"] = "charset=\"Unicode\" An Unicode Exif comment added with Exiv2";
-                                exifData["Exif.Image.Model"] = "Test 1";                     // AsciiValue
-                                exifData["Exif.Image.SamplesPerPixel"] = uint16_t(162);      // UShortValue
-                //                exifData["Exif.Image.XResolution"] = int32_t(-2);            // LongValue
-                //                exifData["Exif.Image.YResolution"] = Exiv2::Rational(-2, 3); // RationalValue
 
+    void ImageProcessor::writeRendition (const boost::property_tree::ptree &sinkSettings, const Magick::Blob &sinkBlob)
+    {
+        try
+        {
+            std::string outputFormat = sinkSettings.get<std::string>("FileHandling.OutputFormat");
 
-                                // apply IPTC
-                                Exiv2::IptcData &iptcData = image -> iptcData();
+            // -- apply Metadata
 
-                                iptcData["Iptc.Application2.Headline"] = "openPablo v0.1";
-                                iptcData["Iptc.Application2.Keywords"] = "Yet another keyword";
-                                iptcData["Iptc.Application2.DateCreated"] = "2004-8-3";
-                                iptcData["Iptc.Application2.Urgency"] = uint16_t(1);
-                */
+            // the metadata goes straight into the encoded stream (JPEG APPn segments,
+            // PNG chunks, TIFF IFDs), the pixels are not decoded again.
+            Blob outputBlob = sinkBlob;
+            if (pt.get_child_optional("MetaData"))
+            {
+                TraceSpan metadataSpan ("metadata", "sink");
+                outputBlob = applyMetadata (sinkBlob);
+            }
 
-                // write data back to blob
-                image->writeMetadata();
-                Exiv2::BasicIo &myMemIo = image->io();
-                Blob newBlob((const char*) myMemIo.mmap(false), myMemIo.size());
+            QString outputFullName = sinkFileName (sinkSettings);
 
-                //	update image with updated metadata
 
-                // need to read here a layered list as it could be PSD.
+            // save image, the encoded bytes are written as they are
+            qDebug() << "Format " << QString::fromStdString(outputFormat)<<"\n";
 
-                list<Image> layers;
-                readImages(&layers, newBlob);
+            TraceSpan writeSpan ("write", "sink");
+            QFile outputFile (outputFullName);
+            if (outputFile.open (QIODevice::WriteOnly) == false)
+            {
+                qDebug() << "cannot write to " << outputFullName;
+                return;
+            }
+            outputFile.write ((const char*) outputBlob.data(), outputBlob.length());
+            outputFile.close();
+
+            qDebug() << "wrote to " << outputFullName;
+        }
+        catch (const std::exception& ex)
+        {
+            std::cout << "failed to write - " << ex.what() << endl;
+        }
+    }
 
-                std::cout << layers.size();
 
-                // create filename
+
+    QString ImageProcessor::sinkFileName (const boost::property_tree::ptree &sinkSettings) const
+    {
+        std::string outputFormat = sinkSettings.get<std::string>("FileHandling.OutputFormat");
+
+        // create filename
 //                QString outputFileName = QString::fromStdString(pt.get<std::string>("RenamePattern"));
 
-                QString outputFileName = filename + "." + QString::fromStdString(outputFormat);
-                // cook up all the %x's
-                // ...
+        QString outputFileName = filename + "." + QString::fromStdString(outputFormat);
+        // cook up all the %x's
+        // ...
 
-                // fix extension, if necessary
+        // fix extension, if necessary
 
-                // create outputpath
-                QDir outputDir (QString::fromStdString(child.second.get<std::string>("OutputPath")));
-                QString outputFullName = outputDir.filePath(outputFileName);
+        // create outputpath
+        QDir outputDir (QString::fromStdString(sinkSettings.get<std::string>("OutputPath")));
+        return outputDir.filePath(outputFileName);
+    }
 
 
-                // save image
-                qDebug() << "Format " << QString::fromStdString(outputFormat)<<"\n";
 
-                // need to distinguish between layered output or not
-                // TODO: write layered output only by default.
-                writeImages( layers.begin(), layers.end(), outputFullName.toStdString(), true );
+    bool ImageProcessor::convertWithLUT (Magick::Image &image, const std::string &iccName, int grid)
+    {
+        // without a profile ImageMagick only attaches the new one, alpha and
+        // other color spaces are left to it as well
+        Magick::Blob sourceICC = image.iccColorProfile();
+        if ((sourceICC.length() == 0) || (image.matte() == true)
+                || ((image.colorSpace() != RGBColorspace) && (image.colorSpace() != sRGBColorspace)))
+        {
+            return false;
+        }
 
+        // the intent ImageMagick would use
+        int intent = INTENT_PERCEPTUAL;
+        switch (image.renderingIntent())
+        {
+            case SaturationIntent:
+                intent = INTENT_SATURATION;
+                break;
+            case AbsoluteIntent:
+                intent = INTENT_ABSOLUTE_COLORIMETRIC;
+                break;
+            case RelativeIntent:
+                intent = INTENT_RELATIVE_COLORIMETRIC;
+                break;
+            default:
+                break;
+        }
 
-//                processedImage.magick(outputFormat);
-//                processedImage.write(outputFullName.toStdString());
-                qDebug() << "wrote to " << outputFullName;
-            }
+        cmsHPROFILE in = cmsOpenProfileFromMem (sourceICC.data(), sourceICC.length());
+        cmsHPROFILE out = rtengine::iccStore->getProfile (iccName);
+        const rtengine::ColorLUT *lut = (in != NULL) ? rtengine::iccStore->getLUT (in, out, intent, 0, grid) : NULL;
+        if (in != NULL)
+        {
+            cmsCloseProfile (in);
         }
-        catch (const std::exception& ex)
+        if (lut == NULL)
         {
-            std::cout << "failed to magick - " << ex.what() << endl;
+            return false;
+        }
+
+        // through 16 bit interleaved buffers
+        size_t width = image.columns();
+        size_t height = image.rows();
+        int channels = lut -> getChannels();
+        std::vector<unsigned short> source (width * height * 3);
+        std::vector<unsigned short> converted (width * height * channels);
+        image.write (0, 0, width, height, "RGB", ShortPixel, &source[0]);
+        lut -> apply (&source[0], &converted[0], width, height);
+
+        qDebug() << "Converted with a" << grid << "^3 LUT, max error" << lut -> getMaxError();
+        rtengine::iccStore->releaseLUT (lut);
+
+        // the converted pixels go back into the same image, so that its EXIF, IPTC,
+        // XMP and 8BIM profiles and its other attributes stay with it
+        image.classType (DirectClass);
+        image.modifyImage();
+        if (channels == 4)
+        {
+            // only relabels the pixels, they are overwritten below
+            MagickCore::SetImageColorspace (image.image(), CMYKColorspace);
+        }
+
+        Magick::Pixels view (image);
+        const unsigned short *value = &converted[0];
+        for (size_t y = 0; y < height; y++)
+        {
+            PixelPacket *pixel = view.set (0, y, width, 1);
+            IndexPacket *black = (channels == 4) ? view.indexes() : NULL;
+            for (size_t x = 0; x < width; x++)
+            {
+                pixel->red = ScaleShortToQuantum (value[0]);
+                pixel->green = ScaleShortToQuantum (value[1]);
+                pixel->blue = ScaleShortToQuantum (value[2]);
+                if (black != NULL)
+                {
+                    black[x] = ScaleShortToQuantum (value[3]);
+                }
+                value += channels;
+                pixel++;
+            }
+            view.sync();
         }
+
+        return true;
     }
 
 
@@ -433,4 +777,21 @@ namespace openPablo
         // create blob
         imageBlob.updateNoCopy(data, datalength );
     }
+
+
+
+    void ImageProcessor::setMagickBlob (Magick::Blob _imageBlob)
+    {
+        // reference counted, the encoded bytes are not copied
+        imageBlob = _imageBlob;
+    }
+
+
+
+    void ImageProcessor::setMagickImage (Magick::Image _magickImage)
+    {
+        // reference counted, no pixels are copied
+        inputImage = _magickImage;
+        hasInputImage = true;
+    }
 }
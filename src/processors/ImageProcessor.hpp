@@ -76,9 +76,43 @@ namespace openPablo
 
             virtual void setBLOB (unsigned char *data, uint64_t datalength);
 
+            // start from an already decoded image, e.g. a developed RAW.
+            void setMagickImage (Magick::Image _magickImage);
+
+            // start from an encoded image in memory, e.g. a JPEG stream of a PDF.
+            void setMagickBlob (Magick::Blob _imageBlob);
+
+            // ICC, encoding, metadata and writing of one rendition. thread safe.
+            void writeSink (const boost::property_tree::ptree &sinkSettings, Magick::Image sinkImage, Magick::Image originalImage);
+
+            // metadata and writing of an encoded rendition. thread safe.
+            void writeRendition (const boost::property_tree::ptree &sinkSettings, const Magick::Blob &sinkBlob);
+
+            struct OutputSink
+            {
+                boost::property_tree::ptree settings;
+                int width;
+                int height;
+                Magick::Image image;
+            };
+
 
         private:
+            // EXIF, IPTC and XMP of the ticket, applied to the encoded image
+            Blob applyMetadata (const Blob &encodedImage);
+
+            // the file a sink is written to, throws if the sink has no format or path
+            QString sinkFileName (const boost::property_tree::ptree &sinkSettings) const;
+
+            // converts an RGB image with a profile to the named profile through a cached 3D LUT,
+            // returns false if the image or the profiles need the conversion of ImageMagick
+            static bool convertWithLUT (Magick::Image &image, const std::string &iccName, int grid);
+
             Blob imageBlob;
+
+            Magick::Image inputImage;
+
+            bool hasInputImage;
     };
 
 }
@@ -0,0 +1,286 @@
+/*
+ *  JobQueue.cpp
+ *
+ *
+ *  This file is part of openPablo.
+ *
+ *  Copyright (c) 2012- Aydin Demircioglu (aydin@openpablo.org)
+ *
+ *  openPablo is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  openPablo is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with openPablo.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "JobQueue.hpp"
+
+#include "ProcessorFactory.hpp"
+#include "TicketJob.hpp"
+
+#include <signal.h>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QDebug>
+#include <QMutexLocker>
+#include <QSet>
+#include <QWaitCondition>
+
+
+/*
+ * @mainpage JobQueue
+ *
+ * Description in html
+ * @author Aydin Demircioglu
+  */
+
+
+/*
+ * @file JobQueue.cpp
+ *
+ * @brief Batch and daemon mode: many tickets in one process.
+ *
+ */
+
+
+namespace
+{
+    volatile sig_atomic_t stopFlag = 0;
+}
+
+
+
+namespace openPablo
+{
+
+    /*
+     * @class QueuedTicketJob
+     *
+     * @brief TicketJob that reports back to its queue
+     *
+     * If the ticket was taken from a spool directory, it is moved to
+     * done/ or failed/ afterwards.
+     *
+     */
+    class QueuedTicketJob: public TicketJob
+    {
+        public:
+            QueuedTicketJob (JobQueue *_queue, QString _ticketFileName, QString _spoolDir = QString())
+                : TicketJob (_ticketFileName),
+                  queue (_queue),
+                  spoolDir (_spoolDir)
+            {
+                //
+            }
+
+        protected:
+            virtual void finished ()
+            {
+                if (spoolDir.isEmpty() == false)
+                {
+                    QDir spool (spoolDir);
+                    QString target = spool.filePath ((succeeded() ? "done/" : "failed/") + QFileInfo (ticketFileName()).fileName());
+                    QFile::remove (target);
+                    if (QFile::rename (ticketFileName(), target) == false)
+                    {
+                        qDebug() << "Cannot move ticket" << ticketFileName() << "to" << target;
+                    }
+                }
+
+                queue -> jobFinished (succeeded());
+            }
+
+        private:
+            JobQueue *queue;
+
+            QString spoolDir;
+    };
+
+
+
+    /*
+     * @class JobQueue
+     *
+     * @brief Runs tickets on a bounded pool of worker threads
+     *
+     */
+
+
+    JobQueue::JobQueue (int maxJobs)
+        : failedJobs (0),
+          doneJobs (0)
+    {
+        // initialize all the libraries once for all jobs
+        ProcessorFactory::initialize ();
+
+        if (maxJobs > 0)
+        {
+            pool.setMaxThreadCount (maxJobs);
+        }
+
+        qDebug() << "Job queue runs with" << pool.maxThreadCount() << "workers.";
+    }
+
+
+
+    JobQueue::~JobQueue()
+    {
+        pool.waitForDone();
+    }
+
+
+
+    QStringList JobQueue::ticketsInDirectory (QString directory)
+    {
+        QStringList filters;
+        filters << "*.txt" << "*.json";
+
+        QDir dir (directory);
+        QStringList tickets;
+        foreach (QString entry, dir.entryList (filters, QDir::Files | QDir::Readable, QDir::Name))
+        {
+            tickets << dir.filePath (entry);
+        }
+        return tickets;
+    }
+
+
+
+    void JobQueue::addTicket (QString ticketPath)
+    {
+        if (QFileInfo (ticketPath).isDir())
+        {
+            foreach (QString ticket, ticketsInDirectory (ticketPath))
+            {
+                addTicket (ticket);
+            }
+            return;
+        }
+
+        // the pool takes the ownership of the job
+        pool.start (new QueuedTicketJob (this, ticketPath));
+    }
+
+
+
+    int JobQueue::waitForDone ()
+    {
+        pool.waitForDone();
+
+        QMutexLocker locker (&mutex);
+        qDebug() << "Processed" << doneJobs << "tickets," << failedJobs << "failed.";
+        return failedJobs;
+    }
+
+
+
+    void JobQueue::watchSpool (QString spoolDir, int pollInterval)
+    {
+        QDir spool (spoolDir);
+        spool.mkpath ("processing");
+        spool.mkpath ("done");
+        spool.mkpath ("failed");
+
+        qDebug() << "Watching spool directory" << spool.absolutePath();
+
+        QMutex sleepMutex;
+        QWaitCondition sleeper;
+
+        // tickets that could neither be claimed nor moved to failed/
+        QSet<QString> unclaimable;
+
+        while (stopRequested() == false)
+        {
+            foreach (QString ticket, ticketsInDirectory (spool.absolutePath()))
+            {
+                // do not hoard tickets, other daemons may share the spool
+                if (pool.activeThreadCount() >= pool.maxThreadCount())
+                {
+                    break;
+                }
+
+                if (unclaimable.contains (ticket) == true)
+                {
+                    continue;
+                }
+
+                // claim the ticket. rename is atomic, if it fails and the ticket is gone
+                // someone else was faster.
+                QString claimed = spool.filePath ("processing/" + QFileInfo (ticket).fileName());
+                if (QFile::rename (ticket, claimed) == false)
+                {
+                    if (QFile::exists (ticket) == false)
+                    {
+                        continue;
+                    }
+
+                    // the ticket cannot be claimed, most likely a claim of the same name is
+                    // left over from a crash. it would be skipped on every poll, so it fails.
+                    if (QFile::exists (claimed) == true)
+                    {
+                        qDebug() << "Cannot claim ticket" << ticket << "," << claimed << "already exists.";
+                    }
+                    else
+                    {
+                        qDebug() << "Cannot claim ticket" << ticket;
+                    }
+
+                    QString failed = spool.filePath ("failed/" + QFileInfo (ticket).fileName());
+                    QFile::remove (failed);
+                    if (QFile::rename (ticket, failed) == false)
+                    {
+                        // stays where it is, but is reported only once
+                        qDebug() << "Cannot move ticket" << ticket << "to" << failed;
+                        unclaimable.insert (ticket);
+                    }
+                    jobFinished (false);
+                    continue;
+                }
+
+                pool.start (new QueuedTicketJob (this, claimed, spool.absolutePath()));
+            }
+
+            sleepMutex.lock();
+            sleeper.wait (&sleepMutex, pollInterval);
+            sleepMutex.unlock();
+        }
+
+        qDebug() << "Stopping, waiting for running jobs.";
+        waitForDone();
+    }
+
+
+
+    void JobQueue::stop ()
+    {
+        stopFlag = 1;
+    }
+
+
+
+    bool JobQueue::stopRequested ()
+    {
+        return (stopFlag != 0);
+    }
+
+
+
+    void JobQueue::jobFinished (bool success)
+    {
+        QMutexLocker locker (&mutex);
+        doneJobs++;
+        if (success == false)
+        {
+            failedJobs++;
+        }
+    }
+
+}
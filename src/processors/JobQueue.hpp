@@ -0,0 +1,110 @@
+/*
+ *  JobQueue.hpp
+ *
+ *
+ *  This file is part of openPablo.
+ *
+ *  Copyright (c) 2012- Aydin Demircioglu (aydin@openpablo.org)
+ *
+ *  openPablo is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  openPablo is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with openPablo.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef OPENPABLO_JOBQUEUE_H_
+#define OPENPABLO_JOBQUEUE_H_
+
+/*
+ * @mainpage JobQueue
+ *
+ * Description in html
+ * @author Aydin Demircioglu
+  */
+
+
+/*
+ * @file JobQueue.hpp
+ *
+ * @brief Batch and daemon mode: many tickets in one process.
+ *
+ */
+
+
+#include <QString>
+#include <QStringList>
+#include <QMutex>
+#include <QThreadPool>
+
+
+namespace openPablo
+{
+
+    /*
+     * @class JobQueue
+     *
+     * @brief Runs tickets on a bounded pool of worker threads
+     *
+     * All libraries (ImageMagick, libmagic, rtengine) are initialized once
+     * by the ProcessorFactory and then shared by all jobs of the queue.
+     * Tickets can be given directly (files or directories of tickets) or
+     * picked up from a spool directory. Tickets in the spool are claimed
+     * by moving them to spool/processing and end up in spool/done or
+     * spool/failed.
+     *
+     */
+    class JobQueue
+    {
+        public:
+            /*
+             *
+             */
+
+            JobQueue (int maxJobs = 0);
+
+            virtual ~JobQueue();
+
+            // queue a ticket, or all tickets (*.txt, *.json) of a directory.
+            void addTicket (QString ticketPath);
+
+            // wait for all queued jobs, returns the number of failed jobs.
+            int waitForDone ();
+
+            // poll the spool directory every pollInterval ms until stop() is called.
+            void watchSpool (QString spoolDir, int pollInterval = 1000);
+
+            // can be called from a signal handler.
+            static void stop ();
+
+            static bool stopRequested ();
+
+            static QStringList ticketsInDirectory (QString directory);
+
+            // called by the jobs, thread safe.
+            void jobFinished (bool success);
+
+
+        private:
+
+            QThreadPool pool;
+
+            QMutex mutex;
+
+            int failedJobs;
+
+            int doneJobs;
+    };
+
+}
+
+
+#endif // OPENPABLO_JOBQUEUE_H_
@@ -29,11 +29,27 @@
 #include "PDFProcessor.hpp"
 
 
+#include "ImageProcessor.hpp"
+#include "Trace.hpp"
+
 #include <sys/stat.h>
 #include <stdlib.h>
+#include <string.h>
 #include <cstdio>
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <stdexcept>
 #include <QString>
 #include <QDebug>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QSemaphore>
+#include <QThread>
+#include <QThreadPool>
+
+#include <Magick++.h>
 
 #include <podofo/podofo.h>
 
@@ -64,11 +80,262 @@ namespace openPablo
 {
 
     /*
-     * @class ImageProcessor
+     * @class PDFImageState
+     *
+     * @brief What the parser and the image jobs of one PDF share
+     *
+     */
+    class PDFImageState
+    {
+        public:
+            PDFImageState (int maxPending)
+                : pendingImages (maxPending),
+                  processed (0),
+                  failed (0)
+            {
+                //
+            }
+
+            void finished (bool success)
+            {
+                QMutexLocker locker (&mutex);
+                if (success == true)
+                {
+                    processed++;
+                }
+                else
+                {
+                    failed++;
+                }
+            }
+
+            // one slot per image that is extracted but not processed yet,
+            // bounds the memory no matter how large the document is.
+            QSemaphore pendingImages;
+
+            QMutex mutex;
+
+            int processed;
+
+            int failed;
+    };
+
+
+
+    /*
+     * @class PDFImageJob
      *
-     * @brief Abstract class to interface the capabilities of a processor
+     * @brief Pipes one image of the PDF through the ImageProcessor
+     *
+     * The job gets the stream bytes as they are stored in the file. JPEG
+     * and JPEG 2000 streams go to the ImageProcessor untouched, Flate
+     * streams are inflated here, on the worker thread, straight into the
+     * pixel buffer of the image.
+     *
+     */
+    class PDFImageJob: public QRunnable
+    {
+        public:
+            PDFImageJob (PDFImageState *_state, const boost::property_tree::ptree &_pt, QString _name, Magick::Blob _data)
+                : state (_state),
+                  pt (_pt),
+                  name (_name),
+                  data (_data),
+                  flate (false),
+                  width (0),
+                  height (0),
+                  bitsPerComponent (8),
+                  hasDecodeParms (false),
+                  traceJob (Trace::currentJob())
+            {
+                //
+            }
+
+            // the stream is Flate compressed raw pixels, map is I, RGB or CMYK
+            void setFlate (int _width, int _height, int _bitsPerComponent, std::string _map,
+                           const PdfDictionary *_decodeParms, Magick::Blob _iccProfile)
+            {
+                flate = true;
+                width = _width;
+                height = _height;
+                bitsPerComponent = _bitsPerComponent;
+                map = _map;
+                hasDecodeParms = (_decodeParms != NULL);
+                if (hasDecodeParms == true)
+                {
+                    decodeParms = *_decodeParms;
+                }
+                iccProfile = _iccProfile;
+            }
+
+            virtual void run ()
+            {
+                // the spans of the image belong to the job of the PDF
+                Trace::setCurrentJob (traceJob);
+
+                bool success = false;
+                try
+                {
+                    ImageProcessor imageProcessor;
+                    imageProcessor.setFilename (name);
+                    imageProcessor.setSettings (pt);
+
+                    if (flate == true)
+                    {
+                        imageProcessor.setMagickImage (inflate());
+                    }
+                    else
+                    {
+                        imageProcessor.setMagickBlob (data);
+                    }
+
+                    // release the stream bytes as early as possible
+                    data = Magick::Blob();
+
+                    imageProcessor.start();
+                    success = true;
+                }
+                catch (const PdfError &e)
+                {
+                    qDebug() << "Cannot decode" << name << ":" << PdfError::ErrorMessage (e.GetError());
+                }
+                catch (const std::exception &e)
+                {
+                    qDebug() << "Cannot process" << name << ":" << e.what();
+                }
+
+                state -> finished (success);
+                Trace::setCurrentJob (NULL);
+                state -> pendingImages.release();
+            }
+
+        private:
+            Magick::Image inflate ()
+            {
+                TraceSpan inflateSpan ("inflate", "pdf");
+
+                std::auto_ptr<PdfFilter> filter = PdfFilterFactory::Create (ePdfFilter_FlateDecode);
+                char *pixels = NULL;
+                pdf_long length = 0;
+                filter -> Decode ((const char*) data.data(), data.length(), &pixels, &length,
+                                  hasDecodeParms ? &decodeParms : NULL);
+
+                size_t expected = (size_t) width * height * map.size() * (bitsPerComponent / 8);
+                if ((size_t) length < expected)
+                {
+                    podofo_free (pixels);
+                    throw std::runtime_error ("image data is too short");
+                }
+
+                // PDF samples are big endian
+                if (bitsPerComponent == 16)
+                {
+                    unsigned char *bytes = (unsigned char *) pixels;
+                    for (size_t i = 0; i < expected; i += 2)
+                    {
+                        unsigned short sample = (bytes[i] << 8) | bytes[i + 1];
+                        memcpy (bytes + i, &sample, 2);
+                    }
+                }
+
+                Magick::Image image;
+                try
+                {
+                    image.read (width, height, map, (bitsPerComponent == 16) ? ShortPixel : CharPixel, pixels);
+                }
+                catch (...)
+                {
+                    podofo_free (pixels);
+                    throw;
+                }
+                podofo_free (pixels);
+
+                if (iccProfile.length() > 0)
+                {
+                    image.profile ("ICC", iccProfile);
+                }
+
+                return image;
+            }
+
+            PDFImageState *state;
+
+            boost::property_tree::ptree pt;
+
+            QString name;
+
+            Magick::Blob data;
+
+            bool flate;
+
+            int width;
+
+            int height;
+
+            int bitsPerComponent;
+
+            std::string map;
+
+            bool hasDecodeParms;
+
+            PdfDictionary decodeParms;
+
+            Magick::Blob iccProfile;
+
+            TraceJob *traceJob;
+    };
+
+
+
+    namespace
+    {
+        pdf_int64 numberKey (PdfObject *object, const char *key, pdf_int64 defaultValue)
+        {
+            PdfObject *value = object -> GetIndirectKey (PdfName (key));
+            if ((value == NULL) || (value -> IsNumber() == false))
+            {
+                return defaultValue;
+            }
+            return value -> GetNumber();
+        }
+
+
+        // the name of the only filter, empty for no or several filters
+        std::string filterName (PdfObject *object)
+        {
+            PdfObject *filter = object -> GetIndirectKey (PdfName::KeyFilter);
+            if ((filter != NULL) && filter -> IsArray() && (filter -> GetArray().GetSize() == 1))
+            {
+                filter = &filter -> GetArray()[0];
+            }
+
+            if ((filter != NULL) && filter -> IsName())
+            {
+                return filter -> GetName().GetName();
+            }
+            return std::string();
+        }
+
+
+        // stream bytes as stored in the file, the blob takes the buffer over
+        Magick::Blob rawStream (PdfObject *object)
+        {
+            char *buffer = NULL;
+            pdf_long length = 0;
+            object -> GetStream() -> GetCopy (&buffer, &length);
+
+            Magick::Blob blob;
+            blob.updateNoCopy (buffer, length, Magick::Blob::MallocAllocator);
+            return blob;
+        }
+    }
+
+
+
+    /*
+     * @class PDFProcessor
      *
-     * Abstract class..
+     * @brief Extracts the images of a PDF and processes each of them
      *
      */
 
@@ -90,88 +357,167 @@ namespace openPablo
 
     void PDFProcessor::start ()
     {
-        int nNum = 0;
+        // images are processed while the parser goes on, at most maxPending
+        // of them are held in memory at the same time.
+        int threads = pt.get<int>("Processors.PDF.Threads", QThread::idealThreadCount());
+        threads = std::max (threads, 1);
+        int maxPending = std::max (pt.get<int>("Processors.PDF.MaxPendingImages", 2 * threads), 1);
+
+        QThreadPool imagePool;
+        imagePool.setMaxThreadCount (threads);
+        PDFImageState state (maxPending);
+
+        int skipped = 0;
         try
         {
-            PdfObject*  pObj  = NULL;
-
-            // open document
+            // the parser only reads the cross reference table, objects
+            // are read from the file when they are accessed
             qDebug() << "Opening file: " << filename.toStdString().c_str();
+            TraceSpan openSpan ("parse pdf", "pdf");
             PdfMemDocument document( filename.toStdString().c_str() );
+            openSpan.finish();
 
-//    	    m_pszOutputDirectory = const_cast<char*>(pszOutput);
+            // ICC profiles are usually shared by many images
+            std::map<PdfReference, Magick::Blob> iccProfiles;
 
             TCIVecObjects it = document.GetObjects().begin();
 
             while( it != document.GetObjects().end() )
             {
-                if( (*it)->IsDictionary() )
+                PdfObject *object = *it;
+                ++it;
+
+                if (object -> IsDictionary() == false)
                 {
-                    PdfObject* pObjType = (*it)->GetDictionary().GetKey( PdfName::KeyType );
-                    PdfObject* pObjSubType = (*it)->GetDictionary().GetKey( PdfName::KeySubtype );
-                    if( ( pObjType && pObjType->IsName() && ( pObjType->GetName().GetName() == "XObject" ) ) ||
-                            ( pObjSubType && pObjSubType->IsName() && ( pObjSubType->GetName().GetName() == "Image" ) ) )
-                    {
-                        pObj = (*it)->GetDictionary().GetKey( PdfName::KeyFilter );
-                        if( pObj && pObj->IsArray() && pObj->GetArray().GetSize() == 1 &&
-                                pObj->GetArray()[0].IsName() && (pObj->GetArray()[0].GetName().GetName() == "DCTDecode") )
-                            pObj = &pObj->GetArray()[0];
+                    continue;
+                }
 
-                        std::string filterName = pObj->GetName().GetName();
-                        bool processed = 0;
+                // asking for the stream reads it, so look at the dictionary first
+                PdfObject* pObjSubType = object -> GetDictionary().GetKey( PdfName::KeySubtype );
+                if ((pObjSubType == NULL) || (pObjSubType -> IsName() == false) || (pObjSubType -> GetName().GetName() != "Image") ||
+                        (object -> HasStream() == false))
+                {
+                    continue;
+                }
 
-                        if( pObj && pObj->IsName() && ( filterName == "DCTDecode" ) )
-                        {
-                            // The only filter is JPEG -> create a JPEG file
-                            qDebug() << "JPG found.\n";
-                            processed = true;
-                            nNum++;
-                        }
+                QString imageName = QString ("%1-image%2").arg (filename).arg (object -> Reference().ObjectNumber());
+                std::string filter = filterName (object);
+
+                // wait for a free slot before the stream is read
+                state.pendingImages.acquire();
+                PDFImageJob *job = NULL;
 
-                        if( pObj && pObj->IsName() && ( filterName == "JPXDecode" ) )
+                try
+                {
+                    TraceSpan extractSpan ("extract", "pdf");
+
+                    if ((filter == "DCTDecode") || (filter == "JPXDecode"))
+                    {
+                        // JPEG and JPEG 2000 are passed on as they are
+                        job = new PDFImageJob (&state, pt, imageName, rawStream (object));
+                    }
+                    else if (filter == "FlateDecode")
+                    {
+                        int width = numberKey (object, "Width", 0);
+                        int height = numberKey (object, "Height", 0);
+                        int bitsPerComponent = numberKey (object, "BitsPerComponent", 8);
+
+                        std::string map;
+                        Magick::Blob iccProfile;
+
+                        PdfObject *colorSpace = object -> GetIndirectKey (PdfName ("ColorSpace"));
+                        if ((colorSpace != NULL) && colorSpace -> IsName())
                         {
-                            // The only filter is JPEG -> create a JPEG file
-                            qDebug() << "JPG found.\n";
-                            processed = true;
-                            nNum++;
+                            std::string colorSpaceName = colorSpace -> GetName().GetName();
+                            if (colorSpaceName == "DeviceGray")
+                            {
+                                map = "I";
+                            }
+                            else if (colorSpaceName == "DeviceRGB")
+                            {
+                                map = "RGB";
+                            }
+                            else if (colorSpaceName == "DeviceCMYK")
+                            {
+                                map = "CMYK";
+                            }
                         }
-
-                        if( pObj && pObj->IsName() && ( filterName == "FlateDecode" ) )
+                        else if ((colorSpace != NULL) && colorSpace -> IsArray() && (colorSpace -> GetArray().GetSize() == 2) &&
+                                 colorSpace -> GetArray()[0].IsName() && (colorSpace -> GetArray()[0].GetName().GetName() == "ICCBased") &&
+                                 colorSpace -> GetArray()[1].IsReference())
                         {
-                            // The only filter is JPEG -> create a JPEG file
-                            qDebug() << "JPG found.\n";
-                            processed = true;
-                            nNum++;
+                            PdfReference profileReference = colorSpace -> GetArray()[1].GetReference();
+                            PdfObject *profile = document.GetObjects().GetObject (profileReference);
+                            if ((profile != NULL) && profile -> HasStream())
+                            {
+                                switch (numberKey (profile, "N", 0))
+                                {
+                                    case 1:
+                                        map = "I";
+                                        break;
+                                    case 3:
+                                        map = "RGB";
+                                        break;
+                                    case 4:
+                                        map = "CMYK";
+                                        break;
+                                }
+
+                                if (iccProfiles.count (profileReference) == 0)
+                                {
+                                    char *buffer = NULL;
+                                    pdf_long length = 0;
+                                    profile -> GetStream() -> GetFilteredCopy (&buffer, &length);
+                                    iccProfiles[profileReference].updateNoCopy (buffer, length, Magick::Blob::MallocAllocator);
+                                    document.FreeObjectMemory (profile, true);
+                                }
+                                iccProfile = iccProfiles[profileReference];
+                            }
                         }
 
-
-                        // else we found something strange, we do not care about it for now.
-                        if (processed == false)
+                        // palettes, masks and special color spaces are not handled yet
+                        if ((map.empty() == false) && (width > 0) && (height > 0) &&
+                                ((bitsPerComponent == 8) || (bitsPerComponent == 16)))
                         {
-                            qDebug() << "Unknown image type found:" << QString::fromStdString(filterName) << "\n";
-                            nNum++;
+                            PdfObject *decodeParms = object -> GetIndirectKey (PdfName ("DecodeParms"));
+                            job = new PDFImageJob (&state, pt, imageName, rawStream (object));
+                            job -> setFlate (width, height, bitsPerComponent, map,
+                                             ((decodeParms != NULL) && decodeParms -> IsDictionary()) ? &decodeParms -> GetDictionary() : NULL,
+                                             iccProfile);
                         }
-
-                        document.FreeObjectMemory( *it );
                     }
                 }
+                catch( PdfError & e )
+                {
+                    qDebug() << "Cannot read image" << imageName << ":" << PdfError::ErrorMessage (e.GetError());
+                    delete job;
+                    job = NULL;
+                }
 
-                ++it;
-            }
+                // the parsed object and its stream are not needed anymore
+                document.FreeObjectMemory (object, true);
 
+                if (job == NULL)
+                {
+                    qDebug() << "Skipping image" << imageName << "with filter" << QString::fromStdString (filter);
+                    skipped++;
+                    state.pendingImages.release();
+                    continue;
+                }
 
+                imagePool.start (job);
+            }
         }
         catch( PdfError & e )
         {
             qDebug() << "Error: An error ocurred during processing the pdf file:" << e.GetError();
             e.PrintErrorMsg();
-            return;// e.GetError();
         }
 
-        // TODO: statistics of no of images etc
-//      nNum = extractor.GetNumImagesExtracted();
+        // images already extracted are still processed
+        imagePool.waitForDone();
 
-        qDebug() << "Extracted " << nNum << " images successfully from the PDF file.\n";
+        qDebug() << "Processed" << state.processed << "images from the PDF file," << state.failed << "failed," << skipped << "skipped.\n";
     }
 
 
@@ -51,9 +51,13 @@ namespace openPablo
     /*
      * @class PDFProcessor
      *
-     * @brief Abstract class to interface the capabilities of a processor
+     * @brief Extracts the images of a PDF and processes each of them
      *
-     * Abstract class..
+     * The document is parsed on demand, objects are read from the file
+     * only when they are visited and freed afterwards. Every image is
+     * handed to an ImageProcessor on a worker thread while the parser goes
+     * on, a fixed number of pending images (Processors.PDF.MaxPendingImages)
+     * keeps the memory bounded even for very large print PDFs.
      *
      */
     class PDFProcessor: public Processor
@@ -37,59 +37,40 @@
  */
 
 #include "rtengine.h"
-#include "processingjob.h"
 
 
 #include <string.h>
+#include <stdexcept>
 #include <QString>
+#include <QMutex>
+#include <QMutexLocker>
 #include <QFile>
 #include <QDataStream>
 #include <QDebug>
 
-#include <magic.h>
-#include "libraw/libraw.h"
-#include "boost/format.hpp"
-
-
-
-
-#ifdef WIN32
-#define snprintf _snprintf
-#include <winsock2.h>
-#pragma comment(lib, "ws2_32.lib")
-#else
-#include <netinet/in.h>
-#endif
+#include <Magick++.h>
 
 
 #include "ProcessorFactory.hpp"
+#include "FileTypeDetector.hpp"
+#include "Trace.hpp"
 
 #include "ImageProcessor.hpp"
 #include "PDFProcessor.hpp"
 #include "PSDProcessor.hpp"
+#include "RAWProcessor.hpp"
 
 
-using boost::format;
-
-
-
-
-class PListener : public rtengine::ProgressListener
-{
-
-    public:
-        void setProgressStr (Glib::ustring str)
-        {
-        }
-        void setProgress (double p)
-        {
-        }
-};
 
 
 namespace openPablo
 {
 
+    namespace
+    {
+        rtengine::Settings* sharedSettings = NULL;
+    }
+
     /*
      * @class ProcessorFactory
      *
@@ -100,167 +81,91 @@ namespace openPablo
      *
      */
 
-    Processor* ProcessorFactory::createInstance (QString imageFileName)
+    void ProcessorFactory::initialize ()
     {
-        qDebug() << "Analysing file type of file " << imageFileName;
-
-
-        // determine type of image
-        // apply magic for it
-        const char *magic_full;
-        magic_t magic_cookie;
-
-        magic_cookie = magic_open(MAGIC_MIME);
-
-        if (magic_cookie == NULL)
-        {
-            qDebug() << "unable to initialize magic library";
+        static QMutex initMutex;
+        static bool initialized = false;
 
-            // FIXME: throw some error
-            ImageProcessor *imageProcessor = new ImageProcessor();
-            return imageProcessor;
-        }
-        printf("Loading default magic database\n");
-        if (magic_load(magic_cookie, NULL) != 0)
+        QMutexLocker locker (&initMutex);
+        if (initialized == true)
         {
-            qDebug() << "cannot load magic database" << magic_error(magic_cookie);
-            magic_close(magic_cookie);
-
-            // FIXME: throw some error
-            ImageProcessor *imageProcessor = new ImageProcessor();
-            return imageProcessor;
+            return;
         }
-        magic_full = magic_file(magic_cookie, imageFileName.toStdString().c_str());
-
-        // convert to qstring
-        QString mimeType(magic_full);
-        qDebug() << "Filetype: " << mimeType;
-        magic_close(magic_cookie);
-
 
-        // create processors depending on filetype
-
-
-        // --- RAW section
-        //
-        LibRaw iProcessor;
-
-        // Open the file and read the metadata
-        if (iProcessor.open_file(imageFileName.toStdString().c_str()) == LIBRAW_SUCCESS)
-        {
-            ///--------------------------------- try RawTherapee
-
-
-
-            Glib::thread_init ();
-
-            // create and fill settings
-            rtengine::Settings* s = rtengine::Settings::create ();
-            s->iccDirectory = "";
-            s->colorimetricIntent = 1;
-            s->monitorProfile = "";
-            // init rtengine
-            rtengine::init (s, ".");
-            // the settings can be modified later through the "s" pointer without calling any api function
-
-            // Create a listener object. Any class is appropriate that inherits from rtengine::ProgressListener
-            PListener pl;
-
-            // Load the image given in the first command line parameter
-            rtengine::InitialImage* ii;
-            int errorC;
-            ii = rtengine::InitialImage::load (imageFileName.toStdString().c_str(), true, &errorC, &pl);
-            if (!ii)
-                ii = rtengine::InitialImage::load (imageFileName.toStdString().c_str(), false, &errorC, &pl);
-            if (!ii)
-            {
-                std::cout << "Input file not supported." << std::endl;
-                exit(2);
-            }
-
-            // create an instance of ProcParams structure that holds the image processing settings. You find the memory map in a separate file and the non-basic types like strings and vectors can be manipulated through helper functions
-            rtengine::procparams::ProcParams params;
-            params.load ("/home/drunkeneye/testprofile.rt");
-
-            /* First, simplest scenario. Develope image and save it in a file */
-            // create a processing job with the loaded image and the current processing parameters
-            rtengine::ProcessingJob* job = rtengine::ProcessingJob::create (ii, params);
-            // process image. The error is given back in errorcode.
-            rtengine::IImage16* res = rtengine::processImage (job, errorC, &pl);
-            // save image to disk
-            res->saveToFile ("/tmp/RT.jpg");
-            // through "res" you can access width/height and pixel data, too
+        // Initialize ImageMagick install location for Windows
+        InitializeMagick (NULL);
+
+        Glib::thread_init ();
+
+        // create and fill settings
+        rtengine::Settings* s = rtengine::Settings::create ();
+        s->iccDirectory = "";
+        s->colorimetricIntent = 1;
+        s->monitorProfile = "";
+        // processing large images in tiles saves memory when many jobs share the
+        // box. it is opt-in, the tiles cut the blurs of sharpening and impulse
+        // denoise at their halo (see the kernel/tiles benchmark for the difference)
+        s->tileSize = 0;
+        // map raw files instead of copying them, the pages are shared with
+        // the page cache and only the parts the decoder touches are read
+        s->mmapFiles = true;
+        // demosaic with the SSE2/AVX2 kernels where the CPU has them
+        s->simdDemosaic = true;
+        // developing renditions at half the sensor size or less from the binned
+        // raw data (Settings::fastDownscale) is opt-in, it does not give the
+        // same pixels as the full size develop
+        s->fastDownscale = false;
+        // batches use the same few profiles for thousands of images, keep
+        // their compiled transforms instead of building them per image
+        s->iccTransformCache = 32;
+        // init rtengine
+        rtengine::init (s, ".");
+        // the settings can be modified later through the "s" pointer without calling any api function
+        sharedSettings = s;
+
+        initialized = true;
+    }
 
 
-            // create JPG Processor
-            ImageProcessor *imageP = new ImageProcessor();
 
-            // FIXME: still set filename for now for ooutput reasons.
-            imageP ->setFilename(imageFileName);
-//			imageProcessor -> setBLOB (ppmBuffer, ppmBufferSize);
+    rtengine::Settings* ProcessorFactory::engineSettings ()
+    {
+        return sharedSettings;
+    }
 
 
 
-            iProcessor.recycle();
+    Processor* ProcessorFactory::createInstance (QString imageFileName)
+    {
+        qDebug() << "Analysing file type of file " << imageFileName;
 
 
-            return imageP;
-///---------------------------------
+        // determine type of image, cheap signatures first, then libmagic and LibRaw
+        TraceSpan detectSpan ("detect type", "ticket");
+        FileTypeDetector::Result fileType = FileTypeDetector::instance().detect (imageFileName);
+        detectSpan.finish();
+        qDebug() << "Filetype: " << FileTypeDetector::typeName (fileType.type) << fileType.mimeType
+                 << "(decided by" << FileTypeDetector::stageName (fileType.stage) << ")";
 
 
+        // create processors depending on filetype
 
 
-            // could be a RAW
+        // --- RAW section
+        //
+        if (fileType.type == FileTypeDetector::RAW)
+        {
             qDebug() << "  Determined file type RAW.";
 
-            // unpack and develop with dcraw
-            int errorCode;
-            iProcessor.unpack();
-            iProcessor.dcraw_process();
-            libraw_processed_image_t *developedImage = iProcessor.dcraw_make_mem_image(&errorCode);
-
-            // convert developed libraw image to something magic can handle-- e.g. ppm.
-            std::string header;
-            int maxValue = (1 << developedImage ->bits)-1;
-            header = boost::str (boost::format ("P6\n%d %d\n%d\n") % developedImage ->width % developedImage -> height % maxValue);
-            unsigned char *ppmBuffer = new unsigned char [developedImage -> data_size + header.size()];
-            memcpy (ppmBuffer, header.data(), header.size());
-            /*
-             NOTE:
-             data in img->data is not converted to network byte order.
-             So, we should swap values on some architectures for dcraw compatibility
-             (unfortunately, xv cannot display 16-bit PPMs with network byte order data
-            */
-#define SWAP(a,b) { a ^= b; a ^= (b ^= a); }
-            if (developedImage->bits == 16 && htons(0x55aa) != 0x55aa)
-                for(unsigned i=0; i< developedImage->data_size; i+=2)
-                    SWAP(developedImage->data[i],developedImage->data[i+1]);
-#undef SWAP
-
-
-            // copy image data
-            memcpy (ppmBuffer+header.size(), developedImage->data, developedImage->data_size);
-            uint64_t ppmBufferSize = developedImage->data_size + header.size();
-
-
-            // create JPG Processor
-            ImageProcessor *imageProcessor = new ImageProcessor();
-
-            // FIXME: still set filename for now for ooutput reasons.
-            imageProcessor->setFilename(imageFileName);
-            imageProcessor -> setBLOB (ppmBuffer, ppmBufferSize);
-
-
-            // Finally, let us free the image processor for work with the next image
-            LibRaw::dcraw_clear_mem(developedImage);
-            iProcessor.recycle();
-
-            return imageProcessor;
+            // develops in memory and hands over to the ImageProcessor
+            RAWProcessor *rawProcessor = new RAWProcessor();
+            rawProcessor->setFilename(imageFileName);
+            return rawProcessor;
         }
 
 
         // create processor
-        if (mimeType.contains("application/pdf", Qt::CaseInsensitive))
+        if (fileType.type == FileTypeDetector::PDF)
         {
             qDebug() << "  Determined file type PDF.";
 
@@ -270,7 +175,8 @@ namespace openPablo
             return pdfProcessor;
         }
 
-        if (mimeType.contains("image/jpeg", Qt::CaseInsensitive))
+        if ((fileType.type == FileTypeDetector::JPEG) || (fileType.type == FileTypeDetector::PNG) ||
+                (fileType.type == FileTypeDetector::TIFF))
         {
             qDebug() << "  Determined file type JPG.";
 
@@ -280,7 +186,7 @@ namespace openPablo
             return imageProcessor;
         }
 
-        if (mimeType.contains("image/vnd.adobe.photoshop", Qt::CaseInsensitive))
+        if (fileType.type == FileTypeDetector::PSD)
         {
             qDebug() << "  Determined file type PSD.";
 
@@ -47,6 +47,12 @@
 #include "Processor.hpp"
 
 
+namespace rtengine
+{
+    class Settings;
+}
+
+
 using namespace openPablo;
 
 
@@ -70,6 +76,12 @@ namespace openPablo
              */
             static Processor* createInstance (QString imageFileName);
 
+            // one time initialization of all libraries, safe to call more than once.
+            static void initialize ();
+
+            // the engine settings created by initialize, NULL before.
+            static rtengine::Settings* engineSettings ();
+
     };
 
 }
@@ -22,13 +22,24 @@
 
 #include "RAWProcessor.hpp"
 
-#include "Engine.hpp"
-#include "EngineFactory.hpp"
+#include "ImageProcessor.hpp"
+#include "ProcessorFactory.hpp"
+#include "Trace.hpp"
 
+#include "rtengine.h"
+#include "processingjob.h"
+#include "imagesource.h"
+#include "rtthumbnail.h"
+#include "rawimage.h"
+#include "libraw/libraw.h"
 
 #include <Magick++.h>
 #include <magick/MagickCore.h>
+#include <boost/foreach.hpp>
+#include <algorithm>
+#include <cmath>
 #include <list>
+#include <stdexcept>
 #include <string>
 #include <QString>
 #include <QDebug>
@@ -55,6 +66,37 @@ using namespace std;
 
 
 
+class PListener : public rtengine::ProgressListener
+{
+
+    public:
+        PListener ()
+            : stage (NULL)
+        {
+        }
+        ~PListener ()
+        {
+            delete stage;
+        }
+        void setProgressStr (Glib::ustring str)
+        {
+        }
+        void setProgress (double p)
+        {
+        }
+        // every processing step of rtengine becomes a trace span
+        void setProgressStage (const char* name)
+        {
+            delete stage;
+            stage = (name != NULL) ? new openPablo::TraceSpan (name, "rtengine") : NULL;
+        }
+
+    private:
+        openPablo::TraceSpan *stage;
+};
+
+
+
 namespace openPablo
 {
 
@@ -85,13 +127,393 @@ namespace openPablo
 
     void RAWProcessor::start ()
     {
+        // rtengine and ImageMagick are initialized once per process
+        ProcessorFactory::initialize ();
 
+        TraceSpan developSpan ("develop", "decode");
+        Magick::Image developedImage;
+        if (developThumbnail (developedImage) == false)
+        {
+            // the job log and the trace report tell which path developed the RAW
+            if (developWithRawTherapee (developedImage) == true)
+            {
+                qDebug() << "Developed" << filename << "at full size with rtengine.";
+                Trace::note ("raw", "rtengine");
+            }
+            else
+            {
+                qDebug() << "rtengine cannot develop" << filename << ", falling back to LibRaw.";
+                developWithLibRaw (developedImage);
+                qDebug() << "Developed" << filename << "at full size with LibRaw.";
+                Trace::note ("raw", "libraw");
+            }
+        }
+        developSpan.finish();
+
+        // hand over the developed image, in memory
+        ImageProcessor *imageProcessor = new ImageProcessor();
+
+        // FIXME: still set filename for now for output reasons.
+        imageProcessor->setFilename (filename);
+        imageProcessor->setSettings (pt);
+        imageProcessor->setMagickImage (developedImage);
+        imageProcessor->start ();
+
+        // destruct processor again
+        delete imageProcessor;
     }
 
 
 
-    void RAWProcessor::setBLOB (unsigned char *data, uint64_t datalength)
+    bool RAWProcessor::developThumbnail (Magick::Image &developedImage)
     {
+        int thumbnailSize = pt.get<int>("Processors.RAW.ThumbnailSize", 1024);
+        int sinkEdge = largestSinkEdge();
+        if ((sinkEdge <= 0) || (sinkEdge > thumbnailSize) || (pt.get<bool>("Processors.RAW.FullSize", false) == true))
+        {
+            return false;
+        }
+
+        // the header alone has the sizes of the sensor and of the embedded preview
+        TraceSpan thumbnailSpan ("thumbnail", "decode");
+        rtengine::RawImage header (filename.toStdString());
+        if ((header.loadRaw (false, true) != 0) || (header.get_FujiWidth() != 0))
+        {
+            return false;
+        }
+
+        rtengine::procparams::ProcParams params;
+        loadProfile (params);
+
+        // pixels the largest sink needs, in the orientation of the sensor
+        int fullWidth = header.get_width();
+        int fullHeight = header.get_height();
+        bool turned = ((header.get_rotateDegree() + params.coarse.rotate) % 180) == 90;
+        double scale = turned ? sinkScale (fullHeight, fullWidth) : sinkScale (fullWidth, fullHeight);
+        if ((scale <= 0.0) || (scale > 1.0))
+        {
+            return false;
+        }
+        int neededWidth = (int) ceil (fullWidth * scale);
+        int neededHeight = (int) ceil (fullHeight * scale);
+
+        // the embedded preview is the rendering of the camera, it can stand in for the
+        // default develop only. it must be large enough and show the whole frame
+        int previewWidth = header.get_thumbWidth();
+        int previewHeight = header.get_thumbHeight();
+        bool previewFits = header.is_supportedThumb()
+                           && (pt.get<std::string>("Processors.RAW.Profile", "").empty() == true)
+                           && (previewWidth >= neededWidth) && (previewHeight >= neededHeight)
+                           && (fabs ((double) previewWidth * fullHeight - (double) previewHeight * fullWidth) <= 0.02 * previewHeight * fullWidth);
+
+        rtengine::RawMetaDataLocation rml;
+        rtengine::Thumbnail *thumbnail = NULL;
+        int width = 0;
+        int height = 0;
+        if (previewFits == true)
+        {
+            // at its own size, loadQuickFromRaw then only decodes and rotates
+            height = previewHeight;
+            thumbnail = rtengine::Thumbnail::loadQuickFromRaw (filename.toStdString(), rml, width, height, 1, true);
+        }
+        if (thumbnail == NULL)
+        {
+            // demosaic free develop of the decimated raw data
+            previewFits = false;
+            height = neededHeight;
+            thumbnail = rtengine::Thumbnail::loadFromRaw (filename.toStdString(), rml, width, height, 1, true);
+        }
+        if (thumbnail == NULL)
+        {
+            return false;
+        }
+
+        // keep the size of the thumbnail, the sinks resize
+        double thumbnailScale = 1.0;
+        thumbnail -> getDimensions (width, height, thumbnailScale);
+        int rheight = ((params.coarse.rotate == 90) || (params.coarse.rotate == 270)) ? width : height;
+
+        rtengine::IImage8 *res = NULL;
+        QString source;
+        if (previewFits == true)
+        {
+            res = thumbnail -> quickProcessImage (params, rheight, rtengine::TI_Bilinear, thumbnailScale);
+            source = QString ("embedded preview %1x%2").arg (previewWidth).arg (previewHeight);
+        }
+        else
+        {
+            rtengine::ImageMetaData *metaData = rtengine::ImageMetaData::fromFile (filename.toStdString(), &rml);
+            std::string camName = (metaData != NULL) ? metaData -> getCamera() : "";
+            delete metaData;
+
+            res = thumbnail -> processImage (params, rheight, rtengine::TI_Bilinear, camName, thumbnailScale);
+            source = "thumbnail";
+        }
+        delete thumbnail;
+        if (res == NULL)
+        {
+            return false;
+        }
+
+        // the renditions differ from a full develop, so the source goes into the
+        // job log even without --trace
+        qDebug() << "Developed" << filename << "for thumbnail sinks from the" << source << "at" << res -> getWidth() << "x" << res -> getHeight();
+        Trace::note ("raw", source);
+        developedImage = importImage (res);
+        res -> free();
+
+        return true;
+    }
+
+
+
+    bool RAWProcessor::developWithRawTherapee (Magick::Image &developedImage)
+    {
+        PListener pl;
+
+        // Load the image, first with rtengine's own raw loader
+        rtengine::InitialImage* ii;
+        int errorC;
+        TraceSpan loadSpan ("load raw", "decode");
+        ii = rtengine::InitialImage::load (filename.toStdString().c_str(), true, &errorC, &pl);
+        if (!ii)
+            ii = rtengine::InitialImage::load (filename.toStdString().c_str(), false, &errorC, &pl);
+        loadSpan.finish();
+        if (!ii)
+        {
+            return false;
+        }
+
+        rtengine::procparams::ProcParams params;
+        loadProfile (params);
+
+        // web renditions need a fraction of the sensor resolution. with binning
+        // switched on (Settings::fastDownscale) rtengine then develops at the reduced
+        // size without demosaicing. without it the resize would only be a second
+        // resample on top of the sinks, the sinks resize alone then
+        if ((pt.get<bool>("Processors.RAW.FullSize", false) == false)
+                && (ProcessorFactory::engineSettings() -> fastDownscale == true))
+        {
+            fitToSinks (ii, params);
+        }
+
+        // create a processing job with the loaded image and the current processing parameters,
+        // processImage takes over the job and the initial image.
+        rtengine::ProcessingJob* job = rtengine::ProcessingJob::create (ii, params);
+        rtengine::IImage16* res = rtengine::processImage (job, errorC, &pl);
+        if (res == NULL)
+        {
+            return false;
+        }
+
+        TraceSpan importSpan ("import", "decode");
+        developedImage = importImage (res);
+        res->free();
+
+        return true;
+    }
+
+
+
+    void RAWProcessor::fitToSinks (rtengine::InitialImage *ii, rtengine::procparams::ProcParams &params)
+    {
+        int fullWidth = 0;
+        int fullHeight = 0;
+        ii->getImageSource()->getFullSize (fullWidth, fullHeight);
+        if ((params.coarse.rotate == 90) || (params.coarse.rotate == 270))
+        {
+            std::swap (fullWidth, fullHeight);
+        }
+        if ((fullWidth <= 0) || (fullHeight <= 0))
+        {
+            return;
+        }
+
+        // larger renditions are developed at full size and resized by the sinks,
+        // so are sinks of unknown size
+        double scale = sinkScale (fullWidth, fullHeight);
+        if ((scale <= 0.0) || (scale > 0.5))
+        {
+            return;
+        }
+
+        params.resize.enabled = true;
+        params.resize.appliesTo = "Full image";
+        params.resize.dataspec = 0;
+        params.resize.scale = scale;
+    }
+
+
+
+    double RAWProcessor::sinkScale (int fullWidth, int fullHeight)
+    {
+        if ((fullWidth <= 0) || (fullHeight <= 0))
+        {
+            return 0.0;
+        }
+
+        // the largest rendition decides, it is fit into its box like in the ImageProcessor
+        double scale = 0.0;
+        boost::optional<boost::property_tree::ptree &> output = pt.get_child_optional ("Output");
+        if (!output)
+        {
+            return 0.0;
+        }
+        BOOST_FOREACH(const boost::property_tree::ptree::value_type& child, *output)
+        {
+            int width = child.second.get<int>("Width", 0);
+            int height = child.second.get<int>("Height", 0);
+            if ((width <= 0) || (height <= 0))
+            {
+                return 0.0;
+            }
+            scale = std::max (scale, std::min ((double) width / fullWidth, (double) height / fullHeight));
+        }
+
+        return scale;
+    }
+
 
+
+    int RAWProcessor::largestSinkEdge ()
+    {
+        int edge = 0;
+        boost::optional<boost::property_tree::ptree &> output = pt.get_child_optional ("Output");
+        if (!output)
+        {
+            return 0;
+        }
+        BOOST_FOREACH(const boost::property_tree::ptree::value_type& child, *output)
+        {
+            int width = child.second.get<int>("Width", 0);
+            int height = child.second.get<int>("Height", 0);
+            if ((width <= 0) || (height <= 0))
+            {
+                return 0;
+            }
+            edge = std::max (edge, std::max (width, height));
+        }
+
+        return edge;
+    }
+
+
+
+    void RAWProcessor::loadProfile (rtengine::procparams::ProcParams &params)
+    {
+        std::string profileName = pt.get<std::string>("Processors.RAW.Profile", "");
+        if (profileName.empty() == false)
+        {
+            params.load (profileName);
+        }
+    }
+
+
+
+    void RAWProcessor::developWithLibRaw (Magick::Image &developedImage)
+    {
+        LibRaw iProcessor;
+
+        if (iProcessor.open_file (filename.toStdString().c_str()) != LIBRAW_SUCCESS)
+        {
+            throw std::runtime_error ("Input file not supported.");
+        }
+
+        // unpack and develop with dcraw
+        TraceSpan libRawSpan ("libraw", "decode");
+        int errorCode = LIBRAW_SUCCESS;
+        iProcessor.unpack();
+        iProcessor.dcraw_process();
+        libraw_processed_image_t *libRawImage = iProcessor.dcraw_make_mem_image (&errorCode);
+
+        if (libRawImage == NULL)
+        {
+            iProcessor.recycle();
+            throw std::runtime_error ("LibRaw cannot develop the input file.");
+        }
+
+        developedImage = importImage (libRawImage);
+
+        // Finally, let us free the image processor for work with the next image
+        LibRaw::dcraw_clear_mem (libRawImage);
+        iProcessor.recycle();
+    }
+
+
+
+    Magick::Image RAWProcessor::importImage (rtengine::IImage16 *developedImage)
+    {
+        int width = developedImage->getWidth();
+        int height = developedImage->getHeight();
+        unsigned short **r = developedImage->getRPlane();
+        unsigned short **g = developedImage->getGPlane();
+        unsigned short **b = developedImage->getBPlane();
+
+        Magick::Image image (Magick::Geometry (width, height), Magick::Color ("black"));
+        image.type (TrueColorType);
+        image.depth (16);
+        image.modifyImage();
+
+        // write the planes row by row into the pixel cache
+        Magick::Pixels view (image);
+        for (int y = 0; y < height; y++)
+        {
+            PixelPacket *pixel = view.set (0, y, width, 1);
+            for (int x = 0; x < width; x++)
+            {
+                pixel->red = ScaleShortToQuantum (r[y][x]);
+                pixel->green = ScaleShortToQuantum (g[y][x]);
+                pixel->blue = ScaleShortToQuantum (b[y][x]);
+                pixel++;
+            }
+            view.sync();
+        }
+
+        // keep the output profile, the sinks convert from it
+        int profileLength = 0;
+        char *profileData = NULL;
+        developedImage->getOutputProfileData (profileLength, profileData);
+        if (profileLength > 0)
+        {
+            image.iccColorProfile (Magick::Blob (profileData, profileLength));
+        }
+
+        return image;
+    }
+
+
+
+    Magick::Image RAWProcessor::importImage (rtengine::IImage8 *developedImage)
+    {
+        // thumbnails come as interleaved 8 bit RGB, already converted for display
+        Magick::Image image;
+        image.read (developedImage->getWidth(), developedImage->getHeight(), "RGB", CharPixel, developedImage->getData());
+
+        return image;
+    }
+
+
+
+    Magick::Image RAWProcessor::importImage (const libraw_processed_image_t *developedImage)
+    {
+        if ((developedImage->type != LIBRAW_IMAGE_BITMAP) || (developedImage->colors != 3))
+        {
+            throw std::runtime_error ("LibRaw returned an unsupported image layout.");
+        }
+
+        // LibRaw delivers interleaved RGB in host byte order, ImageMagick imports that as it is
+        Magick::Image image;
+        image.read (developedImage->width, developedImage->height, "RGB",
+                    (developedImage->bits == 16) ? ShortPixel : CharPixel, developedImage->data);
+
+        return image;
+    }
+
+
+
+    void RAWProcessor::setBLOB (unsigned char *data, uint64_t datalength)
+    {
+        // create blob
+        imageBlob.updateNoCopy (data, datalength);
     }
 }
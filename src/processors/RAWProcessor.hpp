@@ -46,6 +46,9 @@
 
 #include "Processor.hpp"
 
+#include "rtengine.h"
+#include "libraw/libraw.h"
+
 
 using namespace Magick;
 
@@ -56,9 +59,13 @@ namespace openPablo
     /*
      * @class RAWProcessor
      *
-     * @brief Abstract class to interface the capabilities of a processor
+     * @brief Develops a RAW file and hands the result to the ImageProcessor
      *
-     * Abstract class..
+     * The RAW is developed by rtengine, LibRaw is the fallback. The developed
+     * pixels are imported straight into the pixel cache of a Magick::Image,
+     * there is no intermediate encode and no temporary file.
+     * Thumbnail sized sinks are served from the embedded preview or from the
+     * decimated thumbnail develop of rtengine instead.
      *
      */
     class RAWProcessor: public Processor
@@ -77,7 +84,37 @@ namespace openPablo
             virtual void setBLOB (unsigned char *data, uint64_t datalength);
 
 
+            // import developed images into a Magick::Image
+            static Magick::Image importImage (rtengine::IImage16 *developedImage);
+
+            static Magick::Image importImage (rtengine::IImage8 *developedImage);
+
+            static Magick::Image importImage (const libraw_processed_image_t *developedImage);
+
+
         private:
+
+            // develop for sinks up to Processors.RAW.ThumbnailSize, from the embedded preview
+            // or the thumbnail path of rtengine. returns false if a full develop is needed
+            bool developThumbnail (Magick::Image &developedImage);
+
+            // develop with rtengine, returns false if rtengine cannot load the file
+            bool developWithRawTherapee (Magick::Image &developedImage);
+
+            // resize in rtengine to the largest output sink, if that is half the size or less
+            void fitToSinks (rtengine::InitialImage *ii, rtengine::procparams::ProcParams &params);
+
+            // the scale that fits the largest output sink, 0 if a sink has no size
+            double sinkScale (int fullWidth, int fullHeight);
+
+            // the longer edge of the largest output sink box, 0 if a sink has no size
+            int largestSinkEdge ();
+
+            // processing parameters, defaults unless the ticket names a RawTherapee profile
+            void loadProfile (rtengine::procparams::ProcParams &params);
+
+            void developWithLibRaw (Magick::Image &developedImage);
+
             Blob imageBlob;
     };
 
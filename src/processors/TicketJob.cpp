@@ -0,0 +1,184 @@
+/*
+ *  TicketJob.cpp
+ *
+ *
+ *  This file is part of openPablo.
+ *
+ *  Copyright (c) 2012- Aydin Demircioglu (aydin@openpablo.org)
+ *
+ *  openPablo is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  openPablo is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with openPablo.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "TicketJob.hpp"
+
+#include "Processor.hpp"
+#include "ProcessorFactory.hpp"
+#include "Trace.hpp"
+
+#include <stdexcept>
+#include <string>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QDebug>
+
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/json_parser.hpp>
+
+
+/*
+ * @mainpage TicketJob
+ *
+ * Description in html
+ * @author Aydin Demircioglu
+  */
+
+
+/*
+ * @file TicketJob.cpp
+ *
+ * @brief One ticket, parsed and pushed through the matching processor.
+ *
+ */
+
+
+
+namespace openPablo
+{
+
+    /*
+     * @class TicketJob
+     *
+     * @brief Runs a single ticket from start to end
+     *
+     */
+
+
+    TicketJob::TicketJob (QString _ticketFileName)
+        : ticket (_ticketFileName),
+          success (false)
+    {
+        //
+    }
+
+
+
+    TicketJob::~TicketJob()
+    {
+        //
+    }
+
+
+
+    QString TicketJob::ticketFileName () const
+    {
+        return ticket;
+    }
+
+
+
+    bool TicketJob::succeeded () const
+    {
+        return success;
+    }
+
+
+
+    QString TicketJob::errorMessage () const
+    {
+        return error;
+    }
+
+
+
+    void TicketJob::finished ()
+    {
+        //
+    }
+
+
+
+    void TicketJob::run ()
+    {
+        success = false;
+        error.clear();
+
+        Trace::beginJob (QFileInfo (ticket).fileName());
+
+        try
+        {
+            using boost::property_tree::ptree;
+            ptree pt;
+
+            // Load the ticket into the property tree. If reading fails
+            // (cannot open file, parse error), an exception is thrown.
+
+            // FIXME: try json first then xml or info parser.
+            TraceSpan parseSpan ("parse ticket", "ticket");
+            read_json (ticket.toStdString(), pt);
+            parseSpan.finish();
+
+
+            // --- read the input file
+
+            QDir inputDir (QString::fromStdString(pt.get<std::string>("Input.InputPath")));
+            QString imageFullName = inputDir.filePath(QString::fromStdString(pt.get<std::string>("Input.InputFile")));
+
+            QFile imageFile (imageFullName);
+            if (!( imageFile.exists() && imageFile.open( QIODevice::ReadOnly)))
+            {
+                throw std::runtime_error ("Either file " + imageFullName.toStdString() + " does not exist or could not be opened.");
+            }
+            imageFile.close();
+
+            // depending on file type different things should happen. job of the processor.
+            Processor *processor = ProcessorFactory::createInstance (imageFullName);
+
+            try
+            {
+                TraceSpan processSpan ("process", "ticket");
+                processor -> setSettings (pt);
+                processor -> start ();
+            }
+            catch (...)
+            {
+                delete processor;
+                throw;
+            }
+
+            // destruct processor again
+            delete processor;
+
+            success = true;
+        }
+        catch (std::exception &error_)
+        {
+            error = QString::fromStdString (error_.what());
+        }
+        catch (...)
+        {
+            error = "unknown error";
+        }
+
+        if (success == false)
+        {
+            qDebug() << "Ticket" << ticket << "failed:" << error;
+        }
+
+        Trace::endJob (success);
+
+        finished ();
+    }
+
+}
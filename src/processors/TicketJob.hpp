@@ -0,0 +1,99 @@
+/*
+ *  TicketJob.hpp
+ *
+ *
+ *  This file is part of openPablo.
+ *
+ *  Copyright (c) 2012- Aydin Demircioglu (aydin@openpablo.org)
+ *
+ *  openPablo is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  openPablo is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with openPablo.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef OPENPABLO_TICKETJOB_H_
+#define OPENPABLO_TICKETJOB_H_
+
+/*
+ * @mainpage TicketJob
+ *
+ * Description in html
+ * @author Aydin Demircioglu
+  */
+
+
+/*
+ * @file TicketJob.hpp
+ *
+ * @brief One ticket, parsed and pushed through the matching processor.
+ *
+ */
+
+
+#include <QString>
+#include <QRunnable>
+
+
+namespace openPablo
+{
+
+    /*
+     * @class TicketJob
+     *
+     * @brief Runs a single ticket from start to end
+     *
+     * Reads the ticket, asks the ProcessorFactory for the right processor
+     * and starts it. The job never throws, errors are reported via
+     * succeeded() and errorMessage(), so it can run on a worker thread
+     * of the JobQueue as well as directly from main.
+     *
+     */
+    class TicketJob: public QRunnable
+    {
+        public:
+            /*
+             *
+             */
+
+            TicketJob (QString _ticketFileName);
+
+            virtual ~TicketJob();
+
+            virtual void run ();
+
+            QString ticketFileName () const;
+
+            bool succeeded () const;
+
+            QString errorMessage () const;
+
+
+        protected:
+
+            // called once the job is done, success or not.
+            virtual void finished ();
+
+
+        private:
+
+            QString ticket;
+
+            bool success;
+
+            QString error;
+    };
+
+}
+
+
+#endif // OPENPABLO_TICKETJOB_H_
@@ -0,0 +1,389 @@
+/*
+ *  Trace.cpp
+ *
+ *
+ *  This file is part of openPablo.
+ *
+ *  Copyright (c) 2012- Aydin Demircioglu (aydin@openpablo.org)
+ *
+ *  openPablo is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  openPablo is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with openPablo.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "Trace.hpp"
+
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <QHash>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QStringList>
+
+
+/*
+ * @mainpage Trace
+ *
+ * Description in html
+ * @author Aydin Demircioglu
+  */
+
+
+/*
+ * @file Trace.cpp
+ *
+ * @brief Timing and memory of the pipeline stages.
+ *
+ */
+
+
+
+namespace openPablo
+{
+
+    /*
+     * @class TraceJob
+     *
+     * @brief Per job totals for the summary line
+     *
+     */
+    class TraceJob
+    {
+        public:
+            QString name;
+
+            Trace::Sample begin;
+
+            // stages in order of their first appearance
+            QStringList stages;
+
+            QHash<QString, int64_t> stageTime;
+
+            // notes in order of their first appearance
+            QStringList noteKeys;
+
+            QHash<QString, QString> notes;
+    };
+
+
+
+    namespace
+    {
+        QMutex traceMutex;
+
+        FILE *traceFile = NULL;
+
+        bool firstEvent = true;
+
+        volatile bool traceEnabled = false;
+
+        int nextThreadId = 1;
+
+        __thread int threadId = 0;
+
+        __thread TraceJob *threadJob = NULL;
+
+
+        int64_t clockMicroseconds (clockid_t clock)
+        {
+            struct timespec ts;
+            clock_gettime (clock, &ts);
+            return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+        }
+
+
+        std::string jsonEscape (const std::string &text)
+        {
+            std::string result;
+            for (size_t i = 0; i < text.size(); i++)
+            {
+                if ((text[i] == '"') || (text[i] == '\\'))
+                {
+                    result += '\\';
+                }
+                result += text[i];
+            }
+            return result;
+        }
+
+
+        // caller holds traceMutex
+        void writeEvent (const std::string &name, const char *category, const Trace::Sample &begin,
+                         const Trace::Sample &end, const std::string &jobName, const std::string &extra)
+        {
+            if (threadId == 0)
+            {
+                threadId = nextThreadId++;
+            }
+
+            fprintf (traceFile, "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,"
+                     "\"ts\":%lld,\"dur\":%lld,\"args\":{\"job\":\"%s\",\"thread_cpu_us\":%lld,\"process_heap_delta_bytes\":%lld,\"peak_rss_bytes\":%lld%s}}",
+                     firstEvent ? "[\n" : ",\n", jsonEscape (name).c_str(), category, (int) getpid(), threadId,
+                     (long long) begin.wall, (long long) (end.wall - begin.wall), jsonEscape (jobName).c_str(),
+                     (long long) (end.cpu - begin.cpu), (long long) (end.heap - begin.heap), (long long) end.peakRSS,
+                     extra.c_str());
+            firstEvent = false;
+        }
+    }
+
+
+
+    /*
+     * @class Trace
+     *
+     * @brief Collects timed spans of the processing stages
+     *
+     */
+
+
+    bool Trace::open (QString traceFileName)
+    {
+        QMutexLocker locker (&traceMutex);
+
+        if (traceFile != NULL)
+        {
+            return false;
+        }
+
+        traceFile = fopen (traceFileName.toStdString().c_str(), "w");
+        if (traceFile == NULL)
+        {
+            return false;
+        }
+
+        firstEvent = true;
+        traceEnabled = true;
+        return true;
+    }
+
+
+
+    void Trace::close ()
+    {
+        QMutexLocker locker (&traceMutex);
+
+        if (traceFile == NULL)
+        {
+            return;
+        }
+
+        traceEnabled = false;
+        fputs (firstEvent ? "[\n]\n" : "\n]\n", traceFile);
+        fclose (traceFile);
+        traceFile = NULL;
+    }
+
+
+
+    bool Trace::enabled ()
+    {
+        return traceEnabled;
+    }
+
+
+
+    void Trace::beginJob (QString name)
+    {
+        if (enabled() == false)
+        {
+            return;
+        }
+
+        TraceJob *job = new TraceJob;
+        job -> name = name;
+        job -> begin = sample();
+        threadJob = job;
+    }
+
+
+
+    void Trace::endJob (bool success)
+    {
+        TraceJob *job = threadJob;
+        threadJob = NULL;
+
+        if (job == NULL)
+        {
+            return;
+        }
+
+        Sample end = sample();
+
+        // one line per job, stage times in ms
+        std::ostringstream summary;
+        summary.setf (std::ios::fixed);
+        summary.precision (1);
+        summary << "trace " << job -> name.toStdString() << " " << (success ? "ok" : "failed")
+                << " wall " << (end.wall - job -> begin.wall) / 1000.0 << " ms"
+                << " threadcpu " << (end.cpu - job -> begin.cpu) / 1000.0 << " ms"
+                << " peakrss " << end.peakRSS / (1024 * 1024) << " MB";
+
+        std::ostringstream args;
+        {
+            QMutexLocker locker (&traceMutex);
+            foreach (QString stage, job -> stages)
+            {
+                summary << " " << stage.toStdString() << "=" << job -> stageTime[stage] / 1000.0;
+                args << ",\"" << jsonEscape (stage.toStdString()) << "_us\":" << job -> stageTime[stage];
+            }
+            foreach (QString key, job -> noteKeys)
+            {
+                summary << " " << key.toStdString() << "=" << job -> notes[key].toStdString();
+                args << ",\"" << jsonEscape (key.toStdString()) << "\":\"" << jsonEscape (job -> notes[key].toStdString()) << "\"";
+            }
+
+            if (traceFile != NULL)
+            {
+                writeEvent (job -> name.toStdString(), "job", job -> begin, end, job -> name.toStdString(), args.str());
+                fflush (traceFile);
+            }
+        }
+
+        std::cout << summary.str() << std::endl;
+        delete job;
+    }
+
+
+
+    TraceJob* Trace::currentJob ()
+    {
+        return threadJob;
+    }
+
+
+
+    void Trace::setCurrentJob (TraceJob *job)
+    {
+        threadJob = job;
+    }
+
+
+
+    Trace::Sample Trace::sample ()
+    {
+        Sample s;
+        s.wall = clockMicroseconds (CLOCK_MONOTONIC);
+        // the process clock would charge a span with the work of every other
+        // job on the pool
+        s.cpu = clockMicroseconds (CLOCK_THREAD_CPUTIME_ID);
+
+        s.heap = 0;
+#if defined(__GLIBC__) && ((__GLIBC__ > 2) || ((__GLIBC__ == 2) && (__GLIBC_MINOR__ >= 33)))
+        struct mallinfo2 info = mallinfo2();
+        s.heap = (int64_t) info.uordblks + (int64_t) info.hblkhd;
+#elif defined(__GLIBC__)
+        // the counters are ints, read them unsigned to get up to 4 GB
+        struct mallinfo info = mallinfo();
+        s.heap = (int64_t) (unsigned int) info.uordblks + (int64_t) (unsigned int) info.hblkhd;
+#endif
+
+        struct rusage usage;
+        getrusage (RUSAGE_SELF, &usage);
+        s.peakRSS = (int64_t) usage.ru_maxrss * 1024;
+
+        return s;
+    }
+
+
+
+    void Trace::record (const char *name, const char *category, const Sample &begin, const Sample &end)
+    {
+        QMutexLocker locker (&traceMutex);
+
+        if (traceFile == NULL)
+        {
+            return;
+        }
+
+        TraceJob *job = threadJob;
+        if (job != NULL)
+        {
+            QString stage (name);
+            if (job -> stageTime.contains (stage) == false)
+            {
+                job -> stages << stage;
+                job -> stageTime[stage] = 0;
+            }
+            job -> stageTime[stage] += end.wall - begin.wall;
+        }
+
+        writeEvent (name, category, begin, end, (job != NULL) ? job -> name.toStdString() : std::string(), std::string());
+    }
+
+
+
+    void Trace::note (const char *key, QString value)
+    {
+        TraceJob *job = threadJob;
+        if (job == NULL)
+        {
+            return;
+        }
+
+        QMutexLocker locker (&traceMutex);
+        QString noteKey (key);
+        if (job -> notes.contains (noteKey) == false)
+        {
+            job -> noteKeys << noteKey;
+        }
+        job -> notes[noteKey] = value;
+    }
+
+
+
+    /*
+     * @class TraceSpan
+     *
+     * @brief Times the scope it lives in
+     *
+     */
+
+
+    TraceSpan::TraceSpan (const char *_name, const char *_category)
+        : name (_name),
+          category (_category),
+          active (Trace::enabled())
+    {
+        if (active == true)
+        {
+            begin = Trace::sample();
+        }
+    }
+
+
+
+    TraceSpan::~TraceSpan ()
+    {
+        finish();
+    }
+
+
+
+    void TraceSpan::finish ()
+    {
+        if (active == true)
+        {
+            active = false;
+            Trace::record (name, category, begin, Trace::sample());
+        }
+    }
+
+}
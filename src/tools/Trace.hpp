@@ -0,0 +1,144 @@
+/*
+ *  Trace.hpp
+ *
+ *
+ *  This file is part of openPablo.
+ *
+ *  Copyright (c) 2012- Aydin Demircioglu (aydin@openpablo.org)
+ *
+ *  openPablo is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  openPablo is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with openPablo.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef OPENPABLO_TRACE_H_
+#define OPENPABLO_TRACE_H_
+
+/*
+ * @mainpage Trace
+ *
+ * Description in html
+ * @author Aydin Demircioglu
+  */
+
+
+/*
+ * @file Trace.hpp
+ *
+ * @brief Timing and memory of the pipeline stages.
+ *
+ */
+
+
+#include <QString>
+#include <stdint.h>
+
+
+namespace openPablo
+{
+
+    class TraceJob;
+
+
+    /*
+     * @class Trace
+     *
+     * @brief Collects timed spans of the processing stages
+     *
+     * A span records wall time, CPU time of its thread, the change of the
+     * allocated heap and the peak RSS. The heap and the RSS are figures of the
+     * whole process, other jobs running at the same time show up in them, the
+     * heap change is written as process_heap_delta_bytes for that reason.
+     * OpenMP workers a span starts are not in its CPU time, they are in the
+     * wall time only. Finished spans are appended to the
+     * trace file as Chrome trace events (JSON array format, chrome://tracing),
+     * one per line, so the file can be read while a daemon is running.
+     * Spans belong to the job of their thread, every job prints one summary
+     * line with the time spent in each stage and its notes when it ends.
+     *
+     * Tracing is off until a trace file is opened, spans then cost nothing
+     * but a flag test.
+     *
+     */
+    class Trace
+    {
+        public:
+            struct Sample
+            {
+                int64_t wall;           // us, monotonic
+                int64_t cpu;            // us, calling thread only
+                int64_t heap;           // bytes in use by malloc, whole process
+                int64_t peakRSS;        // bytes
+            };
+
+            static bool open (QString traceFileName);
+
+            static void close ();
+
+            static bool enabled ();
+
+            // spans of the calling thread are accounted to this job until endJob.
+            static void beginJob (QString name);
+
+            static void endJob (bool success);
+
+            // worker threads take over the job of the thread that started them.
+            static TraceJob* currentJob ();
+
+            static void setCurrentJob (TraceJob *job);
+
+            static Sample sample ();
+
+            static void record (const char *name, const char *category, const Sample &begin, const Sample &end);
+
+            // adds key=value to the summary of the current job, e.g. which path a
+            // processor took. a later note with the same key replaces the value.
+            static void note (const char *key, QString value);
+    };
+
+
+
+    /*
+     * @class TraceSpan
+     *
+     * @brief Times the scope it lives in
+     *
+     */
+    class TraceSpan
+    {
+        public:
+            TraceSpan (const char *_name, const char *_category = "pipeline");
+
+            ~TraceSpan ();
+
+            // ends the span before the end of the scope.
+            void finish ();
+
+        private:
+            TraceSpan (const TraceSpan&);
+
+            TraceSpan& operator= (const TraceSpan&);
+
+            const char *name;
+
+            const char *category;
+
+            bool active;
+
+            Trace::Sample begin;
+    };
+
+}
+
+
+#endif // OPENPABLO_TRACE_H_